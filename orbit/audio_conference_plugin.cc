@@ -169,13 +169,22 @@ namespace {
       }
       uint64_t bitrate = janus_rtcp_get_remb(buf, len);
       if(bitrate > 0) {
-        /* FIXME We got a REMB from this listener, should we do something about it? */
+        // The estimate of this viewer, which selects the simulcast layer
+        // it receives.
         VLOG(3) << "Got REMB packet... bitrate=" << bitrate;
-        //((AudioConferenceRoom*)room_)->SendRembPacketToViewer();
+        auto audio_room = room_.lock();
+        if (audio_room.get() != NULL) {
+          ((AudioConferenceRoom*)audio_room.get())->OnReceiverEstimate(
+              stream_id(), bitrate);
+        }
       }
     }
   }
 
+  bool AudioConferencePlugin::SupportsSimulcast() {
+    return FLAGS_video_forward_element_new;
+  }
+
   void AudioConferencePlugin::OnTransportStateChange(TransportState state) {
     auto audio_room = room_.lock();
     if (audio_room && audio_room.get() != NULL) {
@@ -396,6 +405,10 @@ namespace {
       if(video_forward_element_){
         video_forward_element_->OnIncomingPacket(stream_id, packet);
       }
+      // Only the lowest simulcast layer goes to the live stream.
+      if (packet.simulcast_layer > 0) {
+        return;
+      }
     }
 
    // HACK(chengxu): We forward the incoming RTP packet directly to live_stream_processor
@@ -438,6 +451,13 @@ namespace {
     }
   }
 
+  void AudioConferenceRoom::OnReceiverEstimate(int stream_id,
+                                               uint64_t bitrate_bps) {
+    if (video_forward_element_) {
+      video_forward_element_->OnReceiverEstimate(stream_id, bitrate_bps);
+    }
+  }
+
   void AudioConferenceRoom::OnAudioMixed(const char* outBuffer, int size){
     if(use_webcast_ && live_stream_processor_ && live_stream_processor_->IsStarted()){
       //live_stream_processor_->RelayRawAudioPacket(outBuffer, size);
@@ -44,6 +44,9 @@ namespace orbit {
      * Event for ice connection state change.
      */
     void OnTransportStateChange(TransportState state) override;
+    // The upper simulcast layers are selected per viewer by
+    // VideoForwardElementNew.
+    bool SupportsSimulcast() override;
     // Overrides the functions in IAudioMixerRtpPacketListener
     void OnAudioMixed(const std::shared_ptr<MediaOutputPacket> packet) override;
 
@@ -85,6 +88,8 @@ namespace orbit {
     void SetupRecordStream();
     void AddParticipant(TransportPlugin* plugin) override;
     void OnPacketLoss(int stream_id, int percent);
+    // The REMB of the viewer.
+    void OnReceiverEstimate(int stream_id, uint64_t bitrate_bps);
     void OnAudioMixed(const char* outBuffer, int size) override;
     void OnAudioMixed(const std::shared_ptr<MediaOutputPacket> packet) override;
     bool RemoveParticipant(TransportPlugin* plugin) override;
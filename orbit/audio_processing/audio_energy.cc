@@ -9,6 +9,13 @@
  */
 
 #include "audio_energy.h"
+#include "audio_mix.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define AUDIO_ENERGY_X86 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
 
 namespace orbit {
 /* for Energy Computing */
@@ -74,18 +81,232 @@ opus_int16 WebRtcSpl_GetScalingSquare(opus_int16 *in_vector, int in_vector_lengt
     }
 }
 
-opus_int32  WebRtcSpl_Energy(opus_int16 *_buffer, int _length, int *scale_factor) {
-    opus_int32 energy = 0;
-    *scale_factor = WebRtcSpl_GetScalingSquare(_buffer, _length, _length);
+namespace {
 
-    opus_int16 *p = _buffer;
-    int i;
-    for (i = 0; i < _length; i++) {
-        energy += (*p * *p) >> (*scale_factor);
-        p++;
+// The first pass over the frame: the max |sample| as WebRtcSpl_GetScalingSquare
+// computes it (i.e. -32768 wraps and is ignored), the saturated peak, and the
+// zero crossings.
+struct FramePeaks {
+  opus_int16 smax;
+  opus_int16 peak;
+  int zero_crossings;
+};
+
+void PeaksScalar(const opus_int16* in, int length, int start, FramePeaks* peaks) {
+  for (int i = start; i < length; ++i) {
+    opus_int16 x = in[i];
+    opus_int16 sabs = (x > 0 ? x : -x);
+    peaks->smax = (sabs > peaks->smax ? sabs : peaks->smax);
+    opus_int16 abs_sat = (x == -32768 ? 32767 : sabs);
+    peaks->peak = (abs_sat > peaks->peak ? abs_sat : peaks->peak);
+    if (i > 0 && (in[i] ^ in[i - 1]) < 0) {
+      peaks->zero_crossings++;
+    }
+  }
+}
+
+// The second pass: sum((x * x) >> scale_factor), like WebRtcSpl_Energy.
+opus_int32 EnergyScalar(const opus_int16* in, int length, int start,
+                        int scale_factor) {
+  opus_int32 energy = 0;
+  for (int i = start; i < length; ++i) {
+    energy += (in[i] * in[i]) >> scale_factor;
+  }
+  return energy;
+}
+
+#ifdef AUDIO_ENERGY_X86
+// The zero crossings are counted in int16 lanes, flush them before overflow.
+#define ZERO_CROSSING_FLUSH 4096
+
+inline int HorizontalMax16(__m128i v) {
+  v = _mm_max_epi16(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+  v = _mm_max_epi16(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+  v = _mm_max_epi16(v, _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1)));
+  return static_cast<opus_int16>(_mm_cvtsi128_si32(v));
+}
+
+inline int HorizontalSum32(__m128i v) {
+  v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+  v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(v);
+}
+
+void PeaksSse2(const opus_int16* in, int length, FramePeaks* peaks) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ones = _mm_set1_epi16(1);
+  __m128i smax = _mm_set1_epi16(-1);
+  __m128i peak = zero;
+  __m128i crossings32 = zero;
+  int i = 0;
+  // The first vector starts at 1, so in[i - 1] is always valid.
+  if (length > 0) {
+    PeaksScalar(in, 1, 0, peaks);
+    i = 1;
+  }
+  while (i + 8 <= length) {
+    __m128i crossings16 = zero;
+    for (int n = 0; n < ZERO_CROSSING_FLUSH && i + 8 <= length; ++n, i += 8) {
+      __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+      __m128i prev = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i - 1));
+      // 0 - x wraps for -32768, exactly as the scalar code does.
+      smax = _mm_max_epi16(smax, _mm_max_epi16(x, _mm_sub_epi16(zero, x)));
+      peak = _mm_max_epi16(peak, _mm_max_epi16(x, _mm_subs_epi16(zero, x)));
+      // -1 in the lanes where the sign changes.
+      crossings16 = _mm_sub_epi16(
+          crossings16, _mm_srai_epi16(_mm_xor_si128(x, prev), 15));
+    }
+    crossings32 = _mm_add_epi32(crossings32, _mm_madd_epi16(crossings16, ones));
+  }
+  int vmax = HorizontalMax16(smax);
+  peaks->smax = vmax > peaks->smax ? vmax : peaks->smax;
+  int vpeak = HorizontalMax16(peak);
+  peaks->peak = vpeak > peaks->peak ? vpeak : peaks->peak;
+  peaks->zero_crossings += HorizontalSum32(crossings32);
+  PeaksScalar(in, length, i, peaks);
+}
+
+opus_int32 EnergySse2(const opus_int16* in, int length, int scale_factor) {
+  const __m128i shift = _mm_cvtsi32_si128(scale_factor);
+  __m128i sum = _mm_setzero_si128();
+  int i = 0;
+  for (; i + 8 <= length; i += 8) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    // The int32 squares, from the low and high halves of the products.
+    __m128i lo = _mm_mullo_epi16(x, x);
+    __m128i hi = _mm_mulhi_epi16(x, x);
+    __m128i sq0 = _mm_srl_epi32(_mm_unpacklo_epi16(lo, hi), shift);
+    __m128i sq1 = _mm_srl_epi32(_mm_unpackhi_epi16(lo, hi), shift);
+    sum = _mm_add_epi32(sum, _mm_add_epi32(sq0, sq1));
+  }
+  return HorizontalSum32(sum) + EnergyScalar(in, length, i, scale_factor);
+}
+
+__attribute__((target("avx2")))
+void PeaksAvx2(const opus_int16* in, int length, FramePeaks* peaks) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i ones = _mm256_set1_epi16(1);
+  __m256i smax = _mm256_set1_epi16(-1);
+  __m256i peak = zero;
+  __m256i crossings32 = zero;
+  int i = 0;
+  if (length > 0) {
+    PeaksScalar(in, 1, 0, peaks);
+    i = 1;
+  }
+  while (i + 16 <= length) {
+    __m256i crossings16 = zero;
+    for (int n = 0; n < ZERO_CROSSING_FLUSH && i + 16 <= length; ++n, i += 16) {
+      __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+      __m256i prev = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i - 1));
+      smax = _mm256_max_epi16(smax, _mm256_max_epi16(x, _mm256_sub_epi16(zero, x)));
+      peak = _mm256_max_epi16(peak, _mm256_abs_epi16(_mm256_max_epi16(x, _mm256_set1_epi16(-32767))));
+      crossings16 = _mm256_sub_epi16(
+          crossings16, _mm256_srai_epi16(_mm256_xor_si256(x, prev), 15));
     }
-    return energy;
+    crossings32 = _mm256_add_epi32(crossings32, _mm256_madd_epi16(crossings16, ones));
+  }
+  __m128i smax128 = _mm_max_epi16(_mm256_castsi256_si128(smax),
+                                  _mm256_extracti128_si256(smax, 1));
+  __m128i peak128 = _mm_max_epi16(_mm256_castsi256_si128(peak),
+                                  _mm256_extracti128_si256(peak, 1));
+  __m128i crossings128 = _mm_add_epi32(_mm256_castsi256_si128(crossings32),
+                                       _mm256_extracti128_si256(crossings32, 1));
+  int vmax = HorizontalMax16(smax128);
+  peaks->smax = vmax > peaks->smax ? vmax : peaks->smax;
+  int vpeak = HorizontalMax16(peak128);
+  peaks->peak = vpeak > peaks->peak ? vpeak : peaks->peak;
+  peaks->zero_crossings += HorizontalSum32(crossings128);
+  PeaksScalar(in, length, i, peaks);
+}
+
+__attribute__((target("avx2")))
+opus_int32 EnergyAvx2(const opus_int16* in, int length, int scale_factor) {
+  const __m128i shift = _mm_cvtsi32_si128(scale_factor);
+  __m256i sum = _mm256_setzero_si256();
+  int i = 0;
+  for (; i + 16 <= length; i += 16) {
+    __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+    __m256i lo = _mm256_mullo_epi16(x, x);
+    __m256i hi = _mm256_mulhi_epi16(x, x);
+    __m256i sq0 = _mm256_srl_epi32(_mm256_unpacklo_epi16(lo, hi), shift);
+    __m256i sq1 = _mm256_srl_epi32(_mm256_unpackhi_epi16(lo, hi), shift);
+    sum = _mm256_add_epi32(sum, _mm256_add_epi32(sq0, sq1));
+  }
+  __m128i sum128 = _mm_add_epi32(_mm256_castsi256_si128(sum),
+                                 _mm256_extracti128_si256(sum, 1));
+  return HorizontalSum32(sum128) + EnergyScalar(in, length, i, scale_factor);
+}
+#endif  // AUDIO_ENERGY_X86
+
+typedef void (*PeaksFunc)(const opus_int16*, int, FramePeaks*);
+typedef opus_int32 (*EnergyFunc)(const opus_int16*, int, int);
+
+void PeaksScalarAll(const opus_int16* in, int length, FramePeaks* peaks) {
+  PeaksScalar(in, length, 0, peaks);
+}
+
+opus_int32 EnergyScalarAll(const opus_int16* in, int length, int scale_factor) {
+  return EnergyScalar(in, length, 0, scale_factor);
+}
+
+struct EnergyKernel {
+  PeaksFunc peaks;
+  EnergyFunc energy;
+};
+
+// Follows the audio mix kernel, so one switch selects the SIMD level of the
+// whole audio path (and the tests cover each level).
+const EnergyKernel& GetEnergyKernel() {
+  static const EnergyKernel kScalar = {PeaksScalarAll, EnergyScalarAll};
+#ifdef AUDIO_ENERGY_X86
+  static const EnergyKernel kSse2 = {PeaksSse2, EnergySse2};
+  static const EnergyKernel kAvx2 = {PeaksAvx2, EnergyAvx2};
+  switch (GetAudioMixKernel()) {
+    case AUDIO_MIX_KERNEL_AVX2:
+      return kAvx2;
+    case AUDIO_MIX_KERNEL_SSE2:
+      return kSse2;
+    default:
+      break;
+  }
+#endif
+  return kScalar;
 }
 
+// Same as the tail of WebRtcSpl_GetScalingSquare().
+int ScalingSquare(opus_int16 smax, int times) {
+  opus_int16 nbits = WebRtcSpl_GetSizeInBits((opus_uint32)times);
+  opus_int16 t = WebRtcSpl_NormW32(WEBRTC_SPL_MUL(smax, smax));
+  if (smax == 0) {
+    return 0; // Since norm(0) returns 0
+  } else {
+    return (t > nbits) ? 0 : nbits - t;
+  }
+}
+
+}  // annoymous namespace
+
+void AnalyzeAudioFrame(const opus_int16* buffer, int length,
+                       AudioFrameFeatures* features) {
+  const EnergyKernel& kernel = GetEnergyKernel();
+  FramePeaks peaks;
+  peaks.smax = -1;
+  peaks.peak = 0;
+  peaks.zero_crossings = 0;
+  kernel.peaks(buffer, length, &peaks);
+  features->scale_factor = ScalingSquare(peaks.smax, length);
+  features->energy = kernel.energy(buffer, length, features->scale_factor);
+  features->peak = peaks.peak;
+  features->zero_crossings = peaks.zero_crossings;
+  features->length = length;
+}
+
+opus_int32  WebRtcSpl_Energy(opus_int16 *_buffer, int _length, int *scale_factor) {
+    AudioFrameFeatures features;
+    AnalyzeAudioFrame(_buffer, _length, &features);
+    *scale_factor = features.scale_factor;
+    return features.energy;
+}
 
 }  // namespace orbit
@@ -23,6 +23,21 @@ opus_int16 WebRtcSpl_GetScalingSquare(opus_int16 *in_vector,
                                       int times);
 opus_int32  WebRtcSpl_Energy(opus_int16 *_buffer, int _length, int *scale_factor);
 
+// The features of one decoded audio frame.
+struct AudioFrameFeatures {
+  opus_int32 energy = 0;    // Bit exact with WebRtcSpl_Energy().
+  int scale_factor = 0;     // The scale_factor of WebRtcSpl_Energy().
+  opus_int16 peak = 0;      // The max absolute sample value.
+  int zero_crossings = 0;   // The number of sign changes, a VAD feature.
+  int length = 0;           // The number of samples analyzed.
+};
+
+// Computes the features of the frame with the SIMD kernel selected by
+// GetAudioMixKernel() (SSE2 or AVX2) or the scalar fallback. Meant to be
+// called right after decoding, while the frame is still in the cache.
+void AnalyzeAudioFrame(const opus_int16* buffer, int length,
+                       AudioFrameFeatures* features);
+
 }  // namespace orbit
 
 #endif  // AUDIO_ENERGY_H__
@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2016 Orangelab Inc. All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * audio_energy_test.cc
+ * ---------------------------------------------------------------------------
+ * Compares AnalyzeAudioFrame() and WebRtcSpl_Energy() of each kernel with
+ * the scalar WebRtcSpl_Energy loop.
+ * ---------------------------------------------------------------------------
+ */
+
+#include "audio_energy.h"
+#include "audio_mix.h"
+
+#include <stdlib.h>
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace orbit {
+namespace {
+
+typedef std::vector<opus_int16> Pcm;
+
+// WebRtcSpl_Energy before the kernels.
+opus_int32 ReferenceEnergy(Pcm& pcm, int* scale_factor) {
+  opus_int32 energy = 0;
+  *scale_factor = WebRtcSpl_GetScalingSquare(pcm.data(), pcm.size(), pcm.size());
+  for (size_t i = 0; i < pcm.size(); i++) {
+    energy += (pcm[i] * pcm[i]) >> *scale_factor;
+  }
+  return energy;
+}
+
+void ReferenceFeatures(Pcm& pcm, AudioFrameFeatures* features) {
+  features->energy = ReferenceEnergy(pcm, &features->scale_factor);
+  features->peak = 0;
+  features->zero_crossings = 0;
+  for (size_t i = 0; i < pcm.size(); i++) {
+    int sabs = pcm[i] < 0 ? -pcm[i] : pcm[i];
+    sabs = sabs > 32767 ? 32767 : sabs;
+    if (sabs > features->peak) {
+      features->peak = sabs;
+    }
+    if (i > 0 && ((pcm[i] < 0) != (pcm[i - 1] < 0))) {
+      features->zero_crossings++;
+    }
+  }
+  features->length = pcm.size();
+}
+
+Pcm MakePcm(int samples, int amplitude, unsigned int seed) {
+  srand(seed);
+  Pcm pcm(samples);
+  for (int i = 0; i < samples; ++i) {
+    pcm[i] = static_cast<opus_int16>(rand() % (2 * amplitude + 1) - amplitude);
+  }
+  return pcm;
+}
+
+class AudioEnergyTest : public ::testing::TestWithParam<AudioMixKernel> {
+ protected:
+  void SetUp() override {
+    default_kernel_ = GetAudioMixKernel();
+    if (!SetAudioMixKernel(GetParam())) {
+      supported_ = false;
+    }
+  }
+  void TearDown() override {
+    SetAudioMixKernel(default_kernel_);
+  }
+
+  void ExpectSameAsReference(Pcm pcm) {
+    AudioFrameFeatures expected, actual;
+    ReferenceFeatures(pcm, &expected);
+    AnalyzeAudioFrame(pcm.data(), pcm.size(), &actual);
+    EXPECT_EQ(expected.energy, actual.energy) << "length " << pcm.size();
+    EXPECT_EQ(expected.scale_factor, actual.scale_factor);
+    EXPECT_EQ(expected.peak, actual.peak);
+    EXPECT_EQ(expected.zero_crossings, actual.zero_crossings);
+    EXPECT_EQ(expected.length, actual.length);
+
+    int scale_factor = -1;
+    EXPECT_EQ(expected.energy,
+              WebRtcSpl_Energy(pcm.data(), pcm.size(), &scale_factor));
+    EXPECT_EQ(expected.scale_factor, scale_factor);
+  }
+
+  AudioMixKernel default_kernel_;
+  bool supported_ = true;
+};
+
+TEST_P(AudioEnergyTest, BitExactWithReference) {
+  if (!supported_) {
+    return;
+  }
+  // 10ms at 8k, 16k, 48k, 20ms at 48k and stereo.
+  for (int samples : {80, 160, 480, 960, 1920}) {
+    for (int amplitude : {0, 1, 100, 3000, 32767}) {
+      ExpectSameAsReference(MakePcm(samples, amplitude, samples + amplitude));
+    }
+  }
+}
+
+TEST_P(AudioEnergyTest, HandlesTailSamples) {
+  if (!supported_) {
+    return;
+  }
+  for (int samples : {0, 1, 2, 7, 8, 9, 15, 16, 17, 33, 479}) {
+    ExpectSameAsReference(MakePcm(samples, 20000, samples));
+  }
+}
+
+TEST_P(AudioEnergyTest, HandlesExtremeSamples) {
+  if (!supported_) {
+    return;
+  }
+  // -32768 has no int16 absolute value, the scaling ignores it.
+  ExpectSameAsReference(Pcm(480, -32768));
+  ExpectSameAsReference(Pcm(480, 32767));
+  Pcm alternating(480);
+  for (size_t i = 0; i < alternating.size(); ++i) {
+    alternating[i] = (i % 2) ? 32767 : -32768;
+  }
+  ExpectSameAsReference(alternating);
+  Pcm spike(480, 0);
+  spike[477] = -32768;
+  ExpectSameAsReference(spike);
+}
+
+TEST_P(AudioEnergyTest, CountsZeroCrossingsOfLongFrames) {
+  if (!supported_) {
+    return;
+  }
+  // Long enough to flush the int16 counters of the kernels several times.
+  Pcm pcm(200000);
+  for (size_t i = 0; i < pcm.size(); ++i) {
+    pcm[i] = (i % 2) ? 1 : -1;
+  }
+  ExpectSameAsReference(pcm);
+}
+
+INSTANTIATE_TEST_CASE_P(Kernels, AudioEnergyTest,
+                        ::testing::Values(AUDIO_MIX_KERNEL_SCALAR,
+                                          AUDIO_MIX_KERNEL_SSE2,
+                                          AUDIO_MIX_KERNEL_AVX2));
+
+}  // annoymous namespace
+}  // namespace orbit
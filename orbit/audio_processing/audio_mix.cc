@@ -0,0 +1,222 @@
+/*
+ * Copyright (C) 2016 Orangelab Inc. All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * audio_mix.cc
+ * ---------------------------------------------------------------------------
+ * Implements the scalar, SSE2 and AVX2 mix-minus kernels.
+ * ---------------------------------------------------------------------------
+ */
+
+#include "audio_mix.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define AUDIO_MIX_X86 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+
+#include "glog/logging.h"
+
+namespace orbit {
+namespace {
+
+// Branchless, so the compiler can still auto-vectorize the scalar loops.
+inline opus_int16 SaturateInt16(opus_int32 value) {
+  return static_cast<opus_int16>(std::min(std::max(value, -32768), 32767));
+}
+
+void AccumulateScalar(const opus_int16* in, opus_int32* sum, int samples) {
+  for (int i = 0; i < samples; ++i) {
+    sum[i] += in[i];
+  }
+}
+
+void MinusScalar(const opus_int32* sum, const opus_int16* self,
+                 opus_int16* out, int samples) {
+  if (self) {
+    for (int i = 0; i < samples; ++i) {
+      out[i] = SaturateInt16(sum[i] - self[i]);
+    }
+  } else {
+    for (int i = 0; i < samples; ++i) {
+      out[i] = SaturateInt16(sum[i]);
+    }
+  }
+}
+
+#ifdef AUDIO_MIX_X86
+// SSE2 is always available on x86_64, 8 samples per iteration.
+void AccumulateSse2(const opus_int16* in, opus_int32* sum, int samples) {
+  int i = 0;
+  for (; i + 8 <= samples; i += 8) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    // Sign extend to int32: put each sample in the high half and shift back.
+    __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+    __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+    __m128i* s = reinterpret_cast<__m128i*>(sum + i);
+    _mm_storeu_si128(s, _mm_add_epi32(_mm_loadu_si128(s), lo));
+    _mm_storeu_si128(s + 1, _mm_add_epi32(_mm_loadu_si128(s + 1), hi));
+  }
+  AccumulateScalar(in + i, sum + i, samples - i);
+}
+
+void MinusSse2(const opus_int32* sum, const opus_int16* self,
+               opus_int16* out, int samples) {
+  int i = 0;
+  for (; i + 8 <= samples; i += 8) {
+    const __m128i* s = reinterpret_cast<const __m128i*>(sum + i);
+    __m128i s0 = _mm_loadu_si128(s);
+    __m128i s1 = _mm_loadu_si128(s + 1);
+    if (self) {
+      __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(self + i));
+      s0 = _mm_sub_epi32(s0, _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16));
+      s1 = _mm_sub_epi32(s1, _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16));
+    }
+    // packs saturates the int32 to int16.
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i),
+                     _mm_packs_epi32(s0, s1));
+  }
+  MinusScalar(sum + i, self ? self + i : NULL, out + i, samples - i);
+}
+
+// Compiled for AVX2 regardless of -march, only called when the CPU has it.
+__attribute__((target("avx2")))
+void AccumulateAvx2(const opus_int16* in, opus_int32* sum, int samples) {
+  int i = 0;
+  for (; i + 16 <= samples; i += 16) {
+    __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+    __m256i lo = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(x));
+    __m256i hi = _mm256_cvtepi16_epi32(_mm256_extracti128_si256(x, 1));
+    __m256i* s = reinterpret_cast<__m256i*>(sum + i);
+    _mm256_storeu_si256(s, _mm256_add_epi32(_mm256_loadu_si256(s), lo));
+    _mm256_storeu_si256(s + 1, _mm256_add_epi32(_mm256_loadu_si256(s + 1), hi));
+  }
+  AccumulateScalar(in + i, sum + i, samples - i);
+}
+
+__attribute__((target("avx2")))
+void MinusAvx2(const opus_int32* sum, const opus_int16* self,
+               opus_int16* out, int samples) {
+  int i = 0;
+  for (; i + 16 <= samples; i += 16) {
+    const __m256i* s = reinterpret_cast<const __m256i*>(sum + i);
+    __m256i s0 = _mm256_loadu_si256(s);
+    __m256i s1 = _mm256_loadu_si256(s + 1);
+    if (self) {
+      __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(self + i));
+      s0 = _mm256_sub_epi32(s0, _mm256_cvtepi16_epi32(_mm256_castsi256_si128(x)));
+      s1 = _mm256_sub_epi32(s1, _mm256_cvtepi16_epi32(_mm256_extracti128_si256(x, 1)));
+    }
+    // packs works within the 128-bit lanes: [s0 lo, s1 lo, s0 hi, s1 hi],
+    // put the 64-bit quarters back in order.
+    __m256i packed = _mm256_packs_epi32(s0, s1);
+    packed = _mm256_permute4x64_epi64(packed, 0xD8);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), packed);
+  }
+  MinusScalar(sum + i, self ? self + i : NULL, out + i, samples - i);
+}
+#endif  // AUDIO_MIX_X86
+
+typedef void (*AccumulateFunc)(const opus_int16*, opus_int32*, int);
+typedef void (*MinusFunc)(const opus_int32*, const opus_int16*, opus_int16*, int);
+
+struct KernelTable {
+  AudioMixKernel kernel;
+  AccumulateFunc accumulate;
+  MinusFunc minus;
+};
+
+KernelTable MakeKernelTable(AudioMixKernel kernel) {
+  KernelTable table;
+  table.kernel = kernel;
+  switch (kernel) {
+#ifdef AUDIO_MIX_X86
+    case AUDIO_MIX_KERNEL_AVX2:
+      table.accumulate = AccumulateAvx2;
+      table.minus = MinusAvx2;
+      break;
+    case AUDIO_MIX_KERNEL_SSE2:
+      table.accumulate = AccumulateSse2;
+      table.minus = MinusSse2;
+      break;
+#endif
+    default:
+      table.kernel = AUDIO_MIX_KERNEL_SCALAR;
+      table.accumulate = AccumulateScalar;
+      table.minus = MinusScalar;
+      break;
+  }
+  return table;
+}
+
+AudioMixKernel DetectBestKernel() {
+  AudioMixKernel kernel = AUDIO_MIX_KERNEL_SCALAR;
+  if (IsAudioMixKernelSupported(AUDIO_MIX_KERNEL_AVX2)) {
+    kernel = AUDIO_MIX_KERNEL_AVX2;
+  } else if (IsAudioMixKernelSupported(AUDIO_MIX_KERNEL_SSE2)) {
+    kernel = AUDIO_MIX_KERNEL_SSE2;
+  }
+  LOG(INFO) << "Audio mix kernel: " << AudioMixKernelName(kernel);
+  return kernel;
+}
+
+KernelTable* GetKernelTable() {
+  static KernelTable table = MakeKernelTable(DetectBestKernel());
+  return &table;
+}
+
+}  // annoymous namespace
+
+void AudioMixAccumulate(const opus_int16* in, opus_int32* sum, int samples) {
+  GetKernelTable()->accumulate(in, sum, samples);
+}
+
+void AudioMixMinus(const opus_int32* sum, const opus_int16* self,
+                   opus_int16* out, int samples) {
+  GetKernelTable()->minus(sum, self, out, samples);
+}
+
+AudioMixKernel GetAudioMixKernel() {
+  return GetKernelTable()->kernel;
+}
+
+bool SetAudioMixKernel(AudioMixKernel kernel) {
+  if (!IsAudioMixKernelSupported(kernel)) {
+    return false;
+  }
+  *GetKernelTable() = MakeKernelTable(kernel);
+  return true;
+}
+
+bool IsAudioMixKernelSupported(AudioMixKernel kernel) {
+  switch (kernel) {
+    case AUDIO_MIX_KERNEL_SCALAR:
+      return true;
+#ifdef AUDIO_MIX_X86
+    case AUDIO_MIX_KERNEL_SSE2:
+      return __builtin_cpu_supports("sse2");
+    case AUDIO_MIX_KERNEL_AVX2:
+      return __builtin_cpu_supports("avx2");
+#endif
+    default:
+      return false;
+  }
+}
+
+const char* AudioMixKernelName(AudioMixKernel kernel) {
+  switch (kernel) {
+    case AUDIO_MIX_KERNEL_SCALAR:
+      return "scalar";
+    case AUDIO_MIX_KERNEL_SSE2:
+      return "sse2";
+    case AUDIO_MIX_KERNEL_AVX2:
+      return "avx2";
+    default:
+      return "unknown";
+  }
+}
+
+}  // namespace orbit
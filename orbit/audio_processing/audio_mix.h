@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2016 Orangelab Inc. All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * audio_mix.h
+ * ---------------------------------------------------------------------------
+ * Defines the mix-minus kernels to mix the int16 PCM of a room.
+ * ---------------------------------------------------------------------------
+ * The full-room sum is accumulated once into an int32 buffer, then the output
+ * of each participant ("everyone but me") is derived from the sum with one
+ * subtraction per sample and saturated to int16:
+ *
+ *   opus_int32 sum[samples];
+ *   memset(sum, 0, sizeof(sum));
+ *   for (each participant p) AudioMixAccumulate(p.pcm, sum, samples);
+ *   for (each participant p) AudioMixMinus(sum, p.pcm, p.out, samples);
+ *   AudioMixMinus(sum, NULL, room_out, samples);  // The whole room.
+ *
+ * The kernels are vectorized with SSE2 or AVX2, selected at runtime by the
+ * CPU features, with a scalar fallback. All the kernels give bit-exact
+ * results.
+ */
+
+#ifndef AUDIO_MIX_H__
+#define AUDIO_MIX_H__
+
+#include <opus/opus.h>
+
+namespace orbit {
+
+enum AudioMixKernel {
+  AUDIO_MIX_KERNEL_SCALAR = 0,
+  AUDIO_MIX_KERNEL_SSE2,
+  AUDIO_MIX_KERNEL_AVX2,
+};
+
+// Adds in[0, samples) to sum[0, samples).
+void AudioMixAccumulate(const opus_int16* in, opus_int32* sum, int samples);
+
+// out[i] = saturate(sum[i] - self[i]). If self is NULL,
+// out[i] = saturate(sum[i]).
+void AudioMixMinus(const opus_int32* sum, const opus_int16* self,
+                   opus_int16* out, int samples);
+
+// Returns the kernel in use, the best one supported by the CPU by default.
+AudioMixKernel GetAudioMixKernel();
+// Forces the kernel, e.g. in the tests and benchmarks. Returns false if the
+// CPU does not support it.
+bool SetAudioMixKernel(AudioMixKernel kernel);
+bool IsAudioMixKernelSupported(AudioMixKernel kernel);
+const char* AudioMixKernelName(AudioMixKernel kernel);
+
+}  // namespace orbit
+
+#endif  // AUDIO_MIX_H__
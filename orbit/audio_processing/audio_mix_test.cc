@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2016 Orangelab Inc. All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * audio_mix_test.cc
+ * ---------------------------------------------------------------------------
+ * Compares the mix-minus kernels with the scalar mixing loop of
+ * AudioMixerElement.
+ * ---------------------------------------------------------------------------
+ */
+
+#include "audio_mix.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace orbit {
+namespace {
+
+// 10ms at 48kHz, the mixer_samples_ of AudioMixerElement.
+const int kSamples = 480;
+
+typedef std::vector<opus_int16> Pcm;
+
+std::vector<Pcm> MakeRoom(int participants, int samples, int amplitude,
+                          unsigned int seed) {
+  srand(seed);
+  std::vector<Pcm> room(participants, Pcm(samples));
+  for (Pcm& pcm : room) {
+    for (int i = 0; i < samples; ++i) {
+      pcm[i] = static_cast<opus_int16>(rand() % (2 * amplitude + 1) - amplitude);
+    }
+  }
+  return room;
+}
+
+// The mixing loop of AudioMixerElement before the kernels. The int32 sum is
+// truncated to int16, so it only matches when nothing clips.
+void LegacyMix(const std::vector<Pcm>& room, int samples,
+               std::vector<Pcm>* outs, Pcm* room_out) {
+  std::vector<opus_int32> buffer(samples, 0);
+  for (const Pcm& pcm : room) {
+    for (int i = 0; i < samples; ++i) {
+      buffer[i] += pcm[i];
+    }
+  }
+  outs->assign(room.size(), Pcm(samples));
+  for (size_t p = 0; p < room.size(); ++p) {
+    for (int i = 0; i < samples; ++i) {
+      (*outs)[p][i] = buffer[i] - room[p][i];
+    }
+  }
+  room_out->resize(samples);
+  for (int i = 0; i < samples; ++i) {
+    (*room_out)[i] = buffer[i];
+  }
+}
+
+// The saturating reference.
+void SaturatingMix(const std::vector<Pcm>& room, int samples,
+                   std::vector<Pcm>* outs, Pcm* room_out) {
+  std::vector<opus_int32> buffer(samples, 0);
+  for (const Pcm& pcm : room) {
+    for (int i = 0; i < samples; ++i) {
+      buffer[i] += pcm[i];
+    }
+  }
+  auto saturate = [](opus_int32 v) -> opus_int16 {
+    return v > 32767 ? 32767 : (v < -32768 ? -32768 : v);
+  };
+  outs->assign(room.size(), Pcm(samples));
+  for (size_t p = 0; p < room.size(); ++p) {
+    for (int i = 0; i < samples; ++i) {
+      (*outs)[p][i] = saturate(buffer[i] - room[p][i]);
+    }
+  }
+  room_out->resize(samples);
+  for (int i = 0; i < samples; ++i) {
+    (*room_out)[i] = saturate(buffer[i]);
+  }
+}
+
+void KernelMix(const std::vector<Pcm>& room, int samples,
+               std::vector<Pcm>* outs, Pcm* room_out) {
+  std::vector<opus_int32> buffer(samples, 0);
+  for (const Pcm& pcm : room) {
+    AudioMixAccumulate(pcm.data(), buffer.data(), samples);
+  }
+  outs->assign(room.size(), Pcm(samples));
+  for (size_t p = 0; p < room.size(); ++p) {
+    AudioMixMinus(buffer.data(), room[p].data(), (*outs)[p].data(), samples);
+  }
+  room_out->resize(samples);
+  AudioMixMinus(buffer.data(), NULL, room_out->data(), samples);
+}
+
+class AudioMixTest : public ::testing::TestWithParam<AudioMixKernel> {
+ protected:
+  void SetUp() override {
+    default_kernel_ = GetAudioMixKernel();
+    if (!SetAudioMixKernel(GetParam())) {
+      supported_ = false;
+    }
+  }
+  void TearDown() override {
+    SetAudioMixKernel(default_kernel_);
+  }
+
+  void ExpectSameAs(void (*reference)(const std::vector<Pcm>&, int,
+                                      std::vector<Pcm>*, Pcm*),
+                    int participants, int samples, int amplitude) {
+    std::vector<Pcm> room = MakeRoom(participants, samples, amplitude,
+                                     participants * 31 + samples);
+    std::vector<Pcm> expected, actual;
+    Pcm expected_room, actual_room;
+    reference(room, samples, &expected, &expected_room);
+    KernelMix(room, samples, &actual, &actual_room);
+    for (int p = 0; p < participants; ++p) {
+      ASSERT_EQ(0, memcmp(expected[p].data(), actual[p].data(),
+                          samples * sizeof(opus_int16)))
+          << "participant " << p << " of " << participants;
+    }
+    ASSERT_EQ(0, memcmp(expected_room.data(), actual_room.data(),
+                        samples * sizeof(opus_int16)));
+  }
+
+  AudioMixKernel default_kernel_;
+  bool supported_ = true;
+};
+
+TEST_P(AudioMixTest, BitExactWithLegacyMix) {
+  if (!supported_) {
+    return;
+  }
+  for (int participants : {10, 50, 200}) {
+    // Keep the sum in the int16 range, where the legacy loop doesn't wrap.
+    int amplitude = 32767 / participants;
+    ExpectSameAs(LegacyMix, participants, kSamples, amplitude);
+  }
+}
+
+TEST_P(AudioMixTest, SaturatesLoudRooms) {
+  if (!supported_) {
+    return;
+  }
+  for (int participants : {10, 50, 200}) {
+    ExpectSameAs(SaturatingMix, participants, kSamples, 32767);
+  }
+}
+
+TEST_P(AudioMixTest, HandlesTailSamples) {
+  if (!supported_) {
+    return;
+  }
+  for (int samples : {1, 7, 15, 17, 479}) {
+    ExpectSameAs(SaturatingMix, 10, samples, 20000);
+  }
+}
+
+INSTANTIATE_TEST_CASE_P(Kernels, AudioMixTest,
+                        ::testing::Values(AUDIO_MIX_KERNEL_SCALAR,
+                                          AUDIO_MIX_KERNEL_SSE2,
+                                          AUDIO_MIX_KERNEL_AVX2));
+
+}  // annoymous namespace
+}  // namespace orbit
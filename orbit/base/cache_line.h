@@ -0,0 +1,24 @@
+/*
+ * Copyright 2016 (C) Orangelab Inc. All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * cache_line.h
+ * ---------------------------------------------------------------------------
+ * The cache line size, to keep the fields written by different threads from
+ * sharing a line (false sharing).
+ * ---------------------------------------------------------------------------
+ * Don't use alignas(CACHE_LINE_SIZE) for the objects created with new: before
+ * C++17, new ignores the alignment over alignof(max_align_t) (g++ warns with
+ * -Waligned-new). Put CACHE_LINE_SIZE bytes of padding between the hot fields
+ * instead, two addresses at least a line apart are never on the same line,
+ * wherever the object is.
+ *
+ * Example usage:
+ *   std::atomic<size_t> head_;
+ *   char head_padding_[CACHE_LINE_SIZE];
+ *   std::atomic<size_t> tail_;
+ */
+
+#pragma once
+
+#define CACHE_LINE_SIZE 64
@@ -0,0 +1,80 @@
+/*
+ * Copyright 2016 (C) Orangelab Inc. All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ * --------------------------------------------------------------------------
+ * event_notifier.cc
+ *  -- implements the eventfd based notifier.
+ * --------------------------------------------------------------------------
+ */
+
+#include "event_notifier.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "glog/logging.h"
+
+namespace orbit {
+
+EventNotifier::EventNotifier() {
+  event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (event_fd_ < 0) {
+    LOG(FATAL) << "eventfd() failed, errno=" << errno;
+  }
+}
+
+EventNotifier::~EventNotifier() {
+  if (event_fd_ >= 0) {
+    close(event_fd_);
+    event_fd_ = -1;
+  }
+}
+
+void EventNotifier::Notify() {
+  // Pairs with the fence in PrepareWait(): either the consumer sees the
+  // newly queued work when it re-checks, or we see waiting_ == true here.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (waiting_.load(std::memory_order_relaxed)) {
+    ForceNotify();
+  }
+}
+
+void EventNotifier::ForceNotify() {
+  uint64_t one = 1;
+  ssize_t ret = write(event_fd_, &one, sizeof(one));
+  if (ret != sizeof(one) && errno != EAGAIN) {
+    LOG(ERROR) << "EventNotifier write failed, errno=" << errno;
+  }
+}
+
+void EventNotifier::PrepareWait() {
+  waiting_.store(true, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+void EventNotifier::CancelWait() {
+  waiting_.store(false, std::memory_order_relaxed);
+}
+
+bool EventNotifier::Wait(int timeout_ms) {
+  struct pollfd pfd;
+  pfd.fd = event_fd_;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  int ret = poll(&pfd, 1, timeout_ms);
+  waiting_.store(false, std::memory_order_relaxed);
+  if (ret <= 0) {
+    return false;
+  }
+  // Reset the counter, so the next Wait() blocks again.
+  uint64_t value;
+  if (read(event_fd_, &value, sizeof(value)) != sizeof(value)) {
+    return false;
+  }
+  return true;
+}
+
+}  // namespace orbit
@@ -0,0 +1,63 @@
+/*
+ * Copyright 2016 (C) Orangelab Inc. All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * event_notifier.h
+ * ---------------------------------------------------------------------------
+ * An eventfd based notifier to wake up a consumer thread when some work has
+ * been queued, instead of letting the consumer poll with usleep().
+ * ---------------------------------------------------------------------------
+ * The producer side is cheap: Notify() only issues the write() syscall when
+ * the consumer has announced that it is about to sleep.
+ *
+ * Consumer loop:
+ *   while (running) {
+ *     notifier.PrepareWait();
+ *     if (HasWork()) {
+ *       notifier.CancelWait();
+ *     } else {
+ *       notifier.Wait(timeout_ms);
+ *     }
+ *     DoWork();
+ *   }
+ *
+ * Producer:
+ *   queue.TryPush(item);
+ *   notifier.Notify();
+ */
+
+#pragma once
+
+#include <atomic>
+
+namespace orbit {
+
+class EventNotifier final {
+ public:
+  EventNotifier();
+  ~EventNotifier();
+
+  EventNotifier(const EventNotifier&) = delete;
+  EventNotifier& operator=(const EventNotifier&) = delete;
+
+  // Wakes up the consumer if it is waiting (or about to wait).
+  void Notify();
+  // Wakes up the consumer unconditionally. Used for state changes (stop,
+  // transport ready etc.) that are not visible through the work queues.
+  void ForceNotify();
+
+  // Announces that the consumer is going to sleep. The consumer must check
+  // its queues once more after this call and before Wait().
+  void PrepareWait();
+  // The consumer found some work after PrepareWait(), don't sleep.
+  void CancelWait();
+  // Blocks until Notify()/ForceNotify() is called or timeout_ms elapsed.
+  // Returns true if woken up by a notification.
+  bool Wait(int timeout_ms);
+
+ private:
+  int event_fd_ = -1;
+  std::atomic<bool> waiting_{false};
+};
+
+}  // namespace orbit
@@ -0,0 +1,131 @@
+/*
+ * Copyright 2016 (C) Orangelab Inc. All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * mpsc_ring.h
+ * ---------------------------------------------------------------------------
+ * A bounded, lock-free, multi-producer single-consumer ring buffer.
+ * ---------------------------------------------------------------------------
+ * The implementation follows Dmitry Vyukov's bounded MPMC queue: every cell
+ * carries a sequence number, producers claim a slot with a CAS on the
+ * enqueue position and publish it by bumping the cell sequence. Since there
+ * is only one consumer, the dequeue side needs no CAS at all.
+ *
+ * Example usage:
+ *   MpscRing<RtpSendPacket> ring(1024);
+ *   // Any thread:
+ *   if (!ring.TryPush(packet)) { ... the ring is full, drop or retry ... }
+ *   // The single consumer thread:
+ *   RtpSendPacket p;
+ *   while (ring.TryPop(&p)) { ... }
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "stream_service/orbit/base/cache_line.h"
+
+#include <atomic>
+#include <memory>
+#include <utility>
+
+namespace orbit {
+
+template <typename T>
+class MpscRing final {
+ public:
+  // The capacity is rounded up to the next power of two.
+  explicit MpscRing(size_t capacity) {
+    size_t size = 2;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    mask_ = size - 1;
+    cells_.reset(new Cell[size]);
+    for (size_t i = 0; i < size; ++i) {
+      cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    enqueue_pos_.store(0, std::memory_order_relaxed);
+    dequeue_pos_.store(0, std::memory_order_relaxed);
+  }
+
+  MpscRing(const MpscRing&) = delete;
+  MpscRing& operator=(const MpscRing&) = delete;
+
+  size_t Capacity() const {
+    return mask_ + 1;
+  }
+
+  // Pushes a copy of value into the ring. Never blocks. Returns false if the
+  // ring is full. Safe to call from any number of threads.
+  bool TryPush(const T& value) {
+    Cell* cell;
+    size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    for (;;) {
+      cell = &cells_[pos & mask_];
+      size_t seq = cell->sequence.load(std::memory_order_acquire);
+      intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+      if (dif == 0) {
+        if (enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (dif < 0) {
+        // The consumer has not released this cell yet: the ring is full.
+        return false;
+      } else {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    cell->value = value;
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Pops the oldest element. Returns false if the ring is empty.
+  // Must only be called from the single consumer thread.
+  bool TryPop(T* value) {
+    size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+    Cell* cell = &cells_[pos & mask_];
+    size_t seq = cell->sequence.load(std::memory_order_acquire);
+    if (static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1) < 0) {
+      return false;
+    }
+    *value = std::move(cell->value);
+    cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+    dequeue_pos_.store(pos + 1, std::memory_order_relaxed);
+    return true;
+  }
+
+  // The approximate number of elements in the ring. Exact only when there
+  // are no concurrent producers or consumer.
+  size_t SizeApprox() const {
+    size_t enqueue = enqueue_pos_.load(std::memory_order_relaxed);
+    size_t dequeue = dequeue_pos_.load(std::memory_order_relaxed);
+    return enqueue > dequeue ? enqueue - dequeue : 0;
+  }
+
+  bool EmptyApprox() const {
+    return SizeApprox() == 0;
+  }
+
+ private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    T value;
+  };
+
+  size_t mask_;
+  std::unique_ptr<Cell[]> cells_;
+  // Keep the producer and consumer positions on separate cache lines, apart
+  // from the read-only fields above.
+  char padding0_[CACHE_LINE_SIZE];
+  std::atomic<size_t> enqueue_pos_;
+  char padding1_[CACHE_LINE_SIZE];
+  std::atomic<size_t> dequeue_pos_;
+  char padding2_[CACHE_LINE_SIZE];
+};
+
+}  // namespace orbit
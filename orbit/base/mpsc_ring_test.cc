@@ -0,0 +1,97 @@
+/*
+ * Copyright 2016 (C) Orangelab Inc. All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * mpsc_ring_test.cc
+ * ---------------------------------------------------------------------------
+ * Unit tests for the MpscRing.
+ * ---------------------------------------------------------------------------
+ */
+
+#include "gtest/gtest.h"
+
+#include "mpsc_ring.h"
+
+#include <thread>
+#include <vector>
+
+namespace orbit {
+namespace {
+
+TEST(MpscRingTest, CapacityIsRoundedUp) {
+  MpscRing<int> ring(100);
+  EXPECT_EQ(128u, ring.Capacity());
+  EXPECT_TRUE(ring.EmptyApprox());
+}
+
+TEST(MpscRingTest, PushPopInOrder) {
+  MpscRing<int> ring(8);
+  for (int i = 0; i < 8; ++i) {
+    EXPECT_TRUE(ring.TryPush(i));
+  }
+  // The ring is full now.
+  EXPECT_FALSE(ring.TryPush(100));
+  EXPECT_EQ(8u, ring.SizeApprox());
+
+  int value = -1;
+  for (int i = 0; i < 8; ++i) {
+    EXPECT_TRUE(ring.TryPop(&value));
+    EXPECT_EQ(i, value);
+  }
+  EXPECT_FALSE(ring.TryPop(&value));
+  EXPECT_TRUE(ring.EmptyApprox());
+}
+
+TEST(MpscRingTest, WrapAround) {
+  MpscRing<int> ring(4);
+  int value = -1;
+  for (int i = 0; i < 1000; ++i) {
+    EXPECT_TRUE(ring.TryPush(i));
+    EXPECT_TRUE(ring.TryPush(i + 1));
+    EXPECT_TRUE(ring.TryPop(&value));
+    EXPECT_EQ(i, value);
+    EXPECT_TRUE(ring.TryPop(&value));
+    EXPECT_EQ(i + 1, value);
+  }
+}
+
+TEST(MpscRingTest, MultipleProducers) {
+  const int kProducers = 4;
+  const int kItemsPerProducer = 100000;
+  MpscRing<int> ring(1024);
+
+  std::vector<std::thread> producers;
+  for (int p = 0; p < kProducers; ++p) {
+    producers.push_back(std::thread([&ring, p, kItemsPerProducer]() {
+      for (int i = 0; i < kItemsPerProducer; ++i) {
+        int item = p * kItemsPerProducer + i;
+        while (!ring.TryPush(item)) {
+          std::this_thread::yield();
+        }
+      }
+    }));
+  }
+
+  // Each producer's items must come out in the order they were pushed.
+  std::vector<int> last_seen(kProducers, -1);
+  int received = 0;
+  int value;
+  while (received < kProducers * kItemsPerProducer) {
+    if (!ring.TryPop(&value)) {
+      std::this_thread::yield();
+      continue;
+    }
+    int producer = value / kItemsPerProducer;
+    int index = value % kItemsPerProducer;
+    EXPECT_GT(index, last_seen[producer]);
+    last_seen[producer] = index;
+    received++;
+  }
+  for (auto& t : producers) {
+    t.join();
+  }
+  EXPECT_TRUE(ring.EmptyApprox());
+}
+
+}  // namespace
+}  // namespace orbit
@@ -0,0 +1,112 @@
+/*
+ * Copyright 2016 (C) Orangelab Inc. All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * spsc_ring.h
+ * ---------------------------------------------------------------------------
+ * A bounded, lock-free, single-producer single-consumer ring buffer.
+ * ---------------------------------------------------------------------------
+ * The producer only writes the tail and the consumer only writes the head,
+ * so neither side needs a CAS. Each side caches the other's position and
+ * only reloads it when the ring looks full (or empty), which keeps the
+ * shared cache lines from bouncing on every push/pop.
+ *
+ * Example usage:
+ *   SpscRing<PacketBufferPtr> ring(256);
+ *   // The single producer thread:
+ *   if (!ring.TryPush(buffer)) { ... the ring is full, drop it ... }
+ *   // The single consumer thread:
+ *   PacketBufferPtr buffer;
+ *   while (ring.TryPop(&buffer)) { ... }
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#include "stream_service/orbit/base/cache_line.h"
+
+#include <atomic>
+#include <memory>
+#include <utility>
+
+namespace orbit {
+
+template <typename T>
+class SpscRing final {
+ public:
+  // The capacity is rounded up to the next power of two.
+  explicit SpscRing(size_t capacity) {
+    size_t size = 2;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    mask_ = size - 1;
+    cells_.reset(new T[size]);
+  }
+
+  SpscRing(const SpscRing&) = delete;
+  SpscRing& operator=(const SpscRing&) = delete;
+
+  size_t Capacity() const {
+    return mask_ + 1;
+  }
+
+  // Pushes a copy of value. Never blocks, returns false if the ring is full.
+  // Must only be called from the single producer thread.
+  bool TryPush(const T& value) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - cached_head_ > mask_) {
+      cached_head_ = head_.load(std::memory_order_acquire);
+      if (tail - cached_head_ > mask_) {
+        return false;
+      }
+    }
+    cells_[tail & mask_] = value;
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Pops the oldest element. Returns false if the ring is empty.
+  // Must only be called from the single consumer thread.
+  bool TryPop(T* value) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head == cached_tail_) {
+      cached_tail_ = tail_.load(std::memory_order_acquire);
+      if (head == cached_tail_) {
+        return false;
+      }
+    }
+    *value = std::move(cells_[head & mask_]);
+    // Don't keep a reference to the element in the ring.
+    cells_[head & mask_] = T();
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // The approximate number of elements in the ring, from any thread.
+  size_t SizeApprox() const {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    size_t head = head_.load(std::memory_order_relaxed);
+    return tail > head ? tail - head : 0;
+  }
+
+  bool EmptyApprox() const {
+    return SizeApprox() == 0;
+  }
+
+ private:
+  size_t mask_;
+  std::unique_ptr<T[]> cells_;
+  char padding0_[CACHE_LINE_SIZE];
+  // The consumer side: its position and its copy of the tail.
+  std::atomic<size_t> head_{0};
+  size_t cached_tail_ = 0;
+  char padding1_[CACHE_LINE_SIZE];
+  // The producer side: its position and its copy of the head.
+  std::atomic<size_t> tail_{0};
+  size_t cached_head_ = 0;
+  char padding2_[CACHE_LINE_SIZE];
+};
+
+}  // namespace orbit
@@ -0,0 +1,76 @@
+/*
+ * Copyright 2016 (C) Orangelab Inc. All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * spsc_ring_test.cc
+ * ---------------------------------------------------------------------------
+ * Unit tests for the SpscRing.
+ * ---------------------------------------------------------------------------
+ */
+
+#include "gtest/gtest.h"
+
+#include "spsc_ring.h"
+
+#include <memory>
+#include <thread>
+
+namespace orbit {
+namespace {
+
+TEST(SpscRingTest, PushPopInOrder) {
+  SpscRing<int> ring(6);
+  EXPECT_EQ(8u, ring.Capacity());
+  for (int i = 0; i < 8; ++i) {
+    EXPECT_TRUE(ring.TryPush(i));
+  }
+  // The ring is full now.
+  EXPECT_FALSE(ring.TryPush(100));
+  EXPECT_EQ(8u, ring.SizeApprox());
+
+  int value = -1;
+  for (int i = 0; i < 8; ++i) {
+    EXPECT_TRUE(ring.TryPop(&value));
+    EXPECT_EQ(i, value);
+  }
+  EXPECT_FALSE(ring.TryPop(&value));
+  EXPECT_TRUE(ring.EmptyApprox());
+}
+
+TEST(SpscRingTest, ReleasesPoppedElements) {
+  SpscRing<std::shared_ptr<int>> ring(4);
+  std::shared_ptr<int> item = std::make_shared<int>(1);
+  EXPECT_TRUE(ring.TryPush(item));
+  EXPECT_EQ(2, item.use_count());
+  std::shared_ptr<int> popped;
+  EXPECT_TRUE(ring.TryPop(&popped));
+  popped.reset();
+  EXPECT_EQ(1, item.use_count());
+}
+
+TEST(SpscRingTest, ProducerAndConsumerThreads) {
+  const int kItems = 100000;
+  SpscRing<int> ring(64);
+  std::thread producer([&ring]() {
+    for (int i = 0; i < kItems; ++i) {
+      while (!ring.TryPush(i)) {
+        std::this_thread::yield();
+      }
+    }
+  });
+  int expected = 0;
+  int value = -1;
+  while (expected < kItems) {
+    if (ring.TryPop(&value)) {
+      ASSERT_EQ(expected, value);
+      expected++;
+    } else {
+      std::this_thread::yield();
+    }
+  }
+  producer.join();
+  EXPECT_TRUE(ring.EmptyApprox());
+}
+
+}  // anonymous namespace
+}  // namespace orbit
@@ -330,12 +330,16 @@ namespace orbit {
     LOG(INFO)<<"ClassRoom destroy";
     running_ = false;
     if (rtp_capture_ != NULL) {
+      std::string file_path = rtp_capture_->GetFilePath();
+      std::string folder_path = rtp_capture_->GetFolderPath();
+      // Deleting the capture joins its writer and flushes the file, the
+      // replay must only read it after that.
+      delete rtp_capture_;
+      rtp_capture_ = NULL;
       if(FLAGS_auto_replay_pb_file) {
         ReplayExector* exector = Singleton<ReplayExector>::GetInstance();
-        exector->AddTask(rtp_capture_->GetFilePath(), rtp_capture_->GetFolderPath());
+        exector->AddTask(file_path, folder_path);
       }
-      delete rtp_capture_;
-      rtp_capture_ = NULL;
     }
     if(time_recorder_ != NULL) {
       delete time_recorder_;
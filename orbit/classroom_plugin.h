@@ -91,6 +91,11 @@ namespace orbit {
     }
     virtual void SetExtendedVideoSsrcs(
         std::vector<unsigned int> extended_video_ssrcs) override;
+    // The ClassRoom relays the streams as they are, only the lowest
+    // simulcast layer.
+    bool SupportsSimulcast() override {
+      return false;
+    }
 
     // Link the plugin to the incoming stream's ssrc and stream_id
     void LinkToSsrc(unsigned int other_ssrc, int other_stream_id);
@@ -174,8 +174,12 @@ void PacketReplayDriver::StartReplay(int session_id, string replay_file) {
     ++i;
   } while(packet != NULL);
 
+  RemoveParticipants(session_id);
+}
+
+void PacketReplayDriver::RemoveParticipants(int session_id) {
   for (auto iter : delegate_pool_) {
-    delegate = iter.second;
+    ReplayTransportDelegate* delegate = iter.second;
     int stream_id = delegate->stream_id();
     orbit::SessionInfoManager* session_info = 
       Singleton<orbit::SessionInfoManager>::GetInstance();
@@ -196,26 +200,31 @@ void PacketReplayDriver::PrepareReplay(int session_id, string replay_file) {
     i++;
     packet = replay->Next();
     if (packet != NULL) {
-      char* buf = const_cast<char*>(packet->data().c_str());
-      RtcpHeader* chead = (RtcpHeader*)(buf);
-      if (!chead->isRtcp()) {
-        RtpHeader *head = reinterpret_cast<RtpHeader*> (buf);
-        uint32_t recvSSRC = head->getSSRC();
-        int transport_id = packet->transport_id();
-        SdpInfo remote_sdp = sdp_infos_[transport_id];
-        if (packet->type() == AUDIO) {
-          remote_sdp.setAudioSsrc(recvSSRC);
-        } else if (packet->type() == VIDEO) {
-          remote_sdp.setVideoSsrc(recvSSRC);
-        } else if (packet->type() == VIDEO_RTX) {
-          remote_sdp.setVideoRtxSsrc(recvSSRC);
-        }
-        sdp_infos_[transport_id] = remote_sdp;
-      }
+      PreparePacket(packet->transport_id(), packet->type(),
+                    packet->data().c_str());
     }
   } while(packet != NULL);
 }
 
+void PacketReplayDriver::PreparePacket(int transport_id, int media_type,
+                                       const char* data) {
+  char* buf = const_cast<char*>(data);
+  RtcpHeader* chead = (RtcpHeader*)(buf);
+  if (!chead->isRtcp()) {
+    RtpHeader *head = reinterpret_cast<RtpHeader*> (buf);
+    uint32_t recvSSRC = head->getSSRC();
+    SdpInfo remote_sdp = sdp_infos_[transport_id];
+    if (media_type == AUDIO) {
+      remote_sdp.setAudioSsrc(recvSSRC);
+    } else if (media_type == VIDEO) {
+      remote_sdp.setVideoSsrc(recvSSRC);
+    } else if (media_type == VIDEO_RTX) {
+      remote_sdp.setVideoRtxSsrc(recvSSRC);
+    }
+    sdp_infos_[transport_id] = remote_sdp;
+  }
+}
+
 int PacketReplayDriver::RunReplayPipeline() {
   int session_id = rand();
 
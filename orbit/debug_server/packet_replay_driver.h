@@ -37,6 +37,18 @@ namespace orbit {
 
     void StartReplay(int session_id, std::string replay_file);
     void PrepareReplay(int session_id, std::string replay_file);
+    // Learns the SSRC of the stream (a StoredMediaType) from a captured
+    // packet, for the SDP of its transport.
+    void PreparePacket(int transport_id, int media_type, const char* data);
+    // Removes the plugins of all the delegates from the room.
+    void RemoveParticipants(int session_id);
+
+    void set_plugin_name(const std::string& plugin_name) {
+      plugin_name_ = plugin_name;
+    }
+    int num_delegates() const {
+      return delegate_pool_.size();
+    }
 
     int RunMain(int run_times);
   private:
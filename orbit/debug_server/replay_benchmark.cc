@@ -0,0 +1,450 @@
+/*
+ * Copyright 2016 (C) Orange Labs Inc. All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * replay_benchmark.cc
+ * ---------------------------------------------------------------------------
+ * Implements the replay benchmark harness.
+ * ---------------------------------------------------------------------------
+ */
+
+#include "replay_benchmark.h"
+
+#include "packet_replay_driver.h"
+#include "replay_transport_delegate.h"
+#include "rtp_capture.h"
+
+#include "stream_service/orbit/base/session_info.h"
+#include "stream_service/orbit/base/singleton.h"
+#include "stream_service/orbit/base/strutil.h"
+#include "stream_service/orbit/http_server/latency_histogram.h"
+#include "stream_service/orbit/packet_trace.h"
+#include "stream_service/orbit/rtp/rtp_headers.h"
+
+#include "glog/logging.h"
+
+#include <arpa/inet.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <thread>
+
+namespace orbit {
+
+namespace {
+
+int64_t NowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+double CpuSeconds() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+         (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+// Salts the SSRC at offset of the size bytes of data, if it fits.
+void SaltSsrc(char* data, int size, int offset, uint32_t salt) {
+  if (offset < 0 || offset + 4 > size) {
+    return;
+  }
+  uint32_t ssrc;
+  memcpy(&ssrc, data + offset, 4);
+  ssrc = htonl(ntohl(ssrc) ^ salt);
+  memcpy(data + offset, &ssrc, 4);
+}
+
+// Salts the SSRCs of one RTCP packet of a compound.
+void SaltRtcpSsrcs(char* data, int size, uint32_t salt) {
+  int count = data[0] & 0x1f;
+  uint8_t type = data[1];
+  switch (type) {
+  case RTCP_Sender_PT:
+  case RTCP_Receiver_PT: {
+    SaltSsrc(data, size, 4, salt);
+    // The report blocks follow the sender info of a SR.
+    int offset = (type == RTCP_Sender_PT ? 28 : 8);
+    for (int i = 0; i < count; ++i) {
+      SaltSsrc(data, size, offset + i * 24, salt);
+    }
+  }
+  break;
+  case RTCP_SDES_PT: {
+    // The chunks: a SSRC, the items and a null item padded to 32 bits.
+    int offset = 4;
+    for (int i = 0; i < count && offset + 4 <= size; ++i) {
+      SaltSsrc(data, size, offset, salt);
+      offset += 4;
+      while (offset < size && data[offset] != 0) {
+        if (offset + 1 >= size) {
+          return;
+        }
+        offset += 2 + (uint8_t)data[offset + 1];
+      }
+      offset = (offset + 4) & ~3;
+    }
+  }
+  break;
+  case RTCP_BYE: {
+    for (int i = 0; i < count; ++i) {
+      SaltSsrc(data, size, 4 + i * 4, salt);
+    }
+  }
+  break;
+  case RTCP_RTP_Feedback_PT:
+  case RTCP_PS_Feedback_PT: {
+    // The sender and the media source.
+    SaltSsrc(data, size, 4, salt);
+    SaltSsrc(data, size, 8, salt);
+    if (type == RTCP_PS_Feedback_PT && count == RTCP_FIR_FMT) {
+      // The FCI entries of a FIR start with the SSRC.
+      for (int offset = 12; offset + 8 <= size; offset += 8) {
+        SaltSsrc(data, size, offset, salt);
+      }
+    } else if (type == RTCP_PS_Feedback_PT && count == RTCP_AFB &&
+               size >= 20 && memcmp(data + 12, "REMB", 4) == 0) {
+      int num_ssrcs = (uint8_t)data[16];
+      for (int i = 0; i < num_ssrcs; ++i) {
+        SaltSsrc(data, size, 20 + i * 4, salt);
+      }
+    }
+  }
+  break;
+  default:
+    // APP, XR: the sender.
+    SaltSsrc(data, size, 4, salt);
+  break;
+  }
+}
+
+// Returns the value at the percentile (0 - 100) of the bucket counts of a
+// LatencyHistogram, as the upper bound of its bucket.
+int64_t BucketPercentile(const std::vector<long long>& counts, long long total,
+                         double percentile) {
+  long long rank = (long long)(total * percentile / 100);
+  if (rank >= total) {
+    rank = total - 1;
+  }
+  long long seen = 0;
+  for (size_t bucket = 0; bucket < counts.size(); ++bucket) {
+    seen += counts[bucket];
+    if (seen > rank) {
+      return LatencyHistogram::BucketUpperBound(bucket) - 1;
+    }
+  }
+  return 0;
+}
+
+}  // anonymous namespace
+
+ReplayBenchmark::ReplayBenchmark(const Options& options)
+  : options_(options) {
+  if (options_.rooms < 1) {
+    options_.rooms = 1;
+  }
+  if (options_.threads < 1) {
+    options_.threads = 1;
+  }
+  if (options_.threads > options_.rooms) {
+    options_.threads = options_.rooms;
+  }
+}
+
+ReplayBenchmark::~ReplayBenchmark() {
+  TearDownRooms();
+}
+
+bool ReplayBenchmark::Load() {
+  timeline_.clear();
+  // (file, captured transport_id) -> transport_id of the timeline, the
+  // captured ids of different files may collide.
+  std::map<std::pair<int, int>, int> transports;
+  for (size_t i = 0; i < options_.files.size(); ++i) {
+    RtpReplay replay;
+    replay.Init(options_.files[i]);
+    std::shared_ptr<StoredPacket> stored;
+    while ((stored = replay.Next()) != NULL) {
+      if (stored->data().size() < sizeof(RtpHeader)) {
+        continue;
+      }
+      auto key = std::make_pair((int)i, stored->transport_id());
+      auto it = transports.find(key);
+      if (it == transports.end()) {
+        it = transports.insert(std::make_pair(key, (int)transports.size())).first;
+      }
+      Packet packet;
+      packet.ts = stored->ts();
+      packet.transport_id = it->second;
+      packet.media_type = stored->type();
+      packet.data = stored->data();
+      timeline_.push_back(std::move(packet));
+    }
+  }
+  num_transports_ = transports.size();
+  // The packets of each file are in the order of capture, keep it.
+  std::stable_sort(timeline_.begin(), timeline_.end(),
+                   [](const Packet& a, const Packet& b) {
+                     return a.ts < b.ts;
+                   });
+  LOG(INFO) << "Loaded " << timeline_.size() << " packets of "
+            << num_transports_ << " transports from "
+            << options_.files.size() << " files.";
+  return !timeline_.empty();
+}
+
+void ReplayBenchmark::RewriteSsrcs(const Packet& packet, uint32_t salt,
+                                   char* buf) {
+  int len = packet.data.size();
+  memcpy(buf, packet.data.data(), len);
+  if (salt == 0) {
+    return;
+  }
+  RtcpHeader* chead = reinterpret_cast<RtcpHeader*>(buf);
+  if (!chead->isRtcp()) {
+    RtpHeader* head = reinterpret_cast<RtpHeader*>(buf);
+    head->setSSRC(head->getSSRC() ^ salt);
+    for (int i = 0; i < (int)head->cc; ++i) {
+      SaltSsrc(buf, len, RtpHeader::MIN_SIZE + i * 4, salt);
+    }
+    return;
+  }
+  int offset = 0;
+  while (offset + 8 <= len) {
+    chead = reinterpret_cast<RtcpHeader*>(buf + offset);
+    int size = std::min((chead->getLength() + 1) * 4, len - offset);
+    SaltRtcpSsrcs(buf + offset, size, salt);
+    offset += size;
+  }
+}
+
+void ReplayBenchmark::SetupRooms() {
+  SessionInfoManager* session_info =
+    Singleton<SessionInfoManager>::GetInstance();
+  char buf[sizeof(((dataPacket*)0)->data)];
+  for (int i = 0; i < options_.rooms; ++i) {
+    Room* room = new Room();
+    room->session_id = rand();
+    // Room 0 keeps the captured SSRCs.
+    room->ssrc_salt = (uint32_t)i * 0x9E3779B1u;
+    room->driver.reset(new PacketReplayDriver());
+    room->driver->set_plugin_name(options_.plugin_name);
+    session_info->AddSession(room->session_id);
+    PacketTracer::GetInstance()->AddRoom(room->session_id);
+    room->driver->SetupRoom(room->session_id);
+
+    for (const Packet& packet : timeline_) {
+      if (packet.data.size() > sizeof(buf)) {
+        continue;
+      }
+      RewriteSsrcs(packet, room->ssrc_salt, buf);
+      room->driver->PreparePacket(packet.transport_id, packet.media_type, buf);
+    }
+    room->delegates.resize(num_transports_);
+    for (int t = 0; t < num_transports_; ++t) {
+      room->delegates[t] =
+        room->driver->GetTransportDelegate(room->session_id, t);
+    }
+    rooms_.push_back(room);
+  }
+}
+
+void ReplayBenchmark::TearDownRooms() {
+  SessionInfoManager* session_info =
+    Singleton<SessionInfoManager>::GetInstance();
+  for (Room* room : rooms_) {
+    room->driver->RemoveParticipants(room->session_id);
+    session_info->RemoveSession(room->session_id);
+    PacketTracer::GetInstance()->RemoveRoom(room->session_id);
+    room->driver->CleanRoom();
+    delete room;
+  }
+  rooms_.clear();
+}
+
+void ReplayBenchmark::ReplayRooms(int thread, int64_t start_ns,
+                                  std::vector<int32_t>* ingress_us,
+                                  std::vector<int32_t>* lag_us) {
+  std::vector<Room*> rooms;
+  for (size_t i = thread; i < rooms_.size(); i += options_.threads) {
+    rooms.push_back(rooms_[i]);
+  }
+  char buf[sizeof(((dataPacket*)0)->data)];
+  int64_t first_ts = timeline_.front().ts;
+  for (const Packet& packet : timeline_) {
+    if (packet.data.size() > sizeof(buf)) {
+      continue;
+    }
+    if (options_.speed > 0) {
+      // The virtual clock of the timeline.
+      int64_t target_ns = start_ns +
+        (int64_t)((packet.ts - first_ts) * 1e6 / options_.speed);
+      int64_t now = NowNs();
+      if (target_ns > now) {
+        std::this_thread::sleep_for(std::chrono::nanoseconds(target_ns - now));
+        now = NowNs();
+      }
+      lag_us->push_back((now - target_ns) / 1000);
+    }
+    for (Room* room : rooms) {
+      RewriteSsrcs(packet, room->ssrc_salt, buf);
+      // Traced as if received now, from the delegate on.
+      PacketTraceContext trace = PacketTracer::Sample();
+      trace.room = room->session_id;
+      PacketTraceScope trace_scope(&trace);
+      int64_t begin = NowNs();
+      room->delegates[packet.transport_id]->onTransportData(
+          buf, packet.data.size(), NULL);
+      ingress_us->push_back((NowNs() - begin) / 1000);
+    }
+  }
+}
+
+ReplayBenchmark::Percentiles
+ReplayBenchmark::ComputePercentiles(std::vector<int32_t>* samples) {
+  Percentiles result;
+  if (samples->empty()) {
+    return result;
+  }
+  std::sort(samples->begin(), samples->end());
+  size_t size = samples->size();
+  result.p50 = (*samples)[size / 2];
+  result.p90 = (*samples)[size * 90 / 100];
+  result.p99 = (*samples)[size * 99 / 100];
+  result.max = samples->back();
+  return result;
+}
+
+void ReplayBenchmark::CollectStages(Result* result) {
+  PacketTracer* tracer = PacketTracer::GetInstance();
+  result->stage_us.assign(TRACE_STAGE_COUNT, Percentiles());
+  result->stage_samples.assign(TRACE_STAGE_COUNT, 0);
+  for (int stage = 0; stage < TRACE_STAGE_COUNT; ++stage) {
+    std::vector<long long> counts(LatencyHistogram::kNumBuckets, 0);
+    for (Room* room : rooms_) {
+      tracer->AddStageBuckets(room->session_id, (PacketTraceStage)stage,
+                              &counts[0]);
+    }
+    long long total = 0;
+    int last = 0;
+    for (int bucket = 0; bucket < LatencyHistogram::kNumBuckets; ++bucket) {
+      total += counts[bucket];
+      if (counts[bucket] > 0) {
+        last = bucket;
+      }
+    }
+    if (total == 0) {
+      continue;
+    }
+    result->stage_samples[stage] = total;
+    Percentiles* percentiles = &result->stage_us[stage];
+    percentiles->p50 = BucketPercentile(counts, total, 50);
+    percentiles->p90 = BucketPercentile(counts, total, 90);
+    percentiles->p99 = BucketPercentile(counts, total, 99);
+    percentiles->max = LatencyHistogram::BucketUpperBound(last) - 1;
+  }
+}
+
+ReplayBenchmark::Result ReplayBenchmark::Run() {
+  Result result;
+  if (timeline_.empty()) {
+    LOG(ERROR) << "Nothing to replay.";
+    return result;
+  }
+  PacketTracer* tracer = PacketTracer::GetInstance();
+  int trace_sample = tracer->sample_rate();
+  tracer->set_sample_rate(options_.trace_sample);
+  SetupRooms();
+  for (Room* room : rooms_) {
+    result.participants += room->driver->num_delegates();
+  }
+
+  std::vector<std::vector<int32_t> > ingress(options_.threads);
+  std::vector<std::vector<int32_t> > lag(options_.threads);
+  int64_t allocations = options_.allocation_counter ?
+    options_.allocation_counter() : 0;
+  double cpu = CpuSeconds();
+  int64_t start_ns = NowNs();
+  std::vector<std::thread> threads;
+  for (int i = 0; i < options_.threads; ++i) {
+    ingress[i].reserve(timeline_.size() * options_.rooms / options_.threads + 1);
+    threads.emplace_back([this, i, start_ns, &ingress, &lag]() {
+        ReplayRooms(i, start_ns, &ingress[i], &lag[i]);
+      });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  result.wall_seconds = (NowNs() - start_ns) / 1e9;
+  double cpu_seconds = CpuSeconds() - cpu;
+  if (options_.allocation_counter) {
+    allocations = options_.allocation_counter() - allocations;
+  }
+
+  std::vector<int32_t> all_ingress;
+  std::vector<int32_t> all_lag;
+  for (int i = 0; i < options_.threads; ++i) {
+    all_ingress.insert(all_ingress.end(), ingress[i].begin(), ingress[i].end());
+    all_lag.insert(all_lag.end(), lag[i].begin(), lag[i].end());
+  }
+  result.packets = all_ingress.size();
+  result.media_seconds = (timeline_.back().ts - timeline_.front().ts) / 1000.0;
+  if (result.wall_seconds > 0) {
+    result.packets_per_second = result.packets / result.wall_seconds;
+    result.cpu_percent = cpu_seconds * 100 / result.wall_seconds;
+  }
+  result.ingress_us = ComputePercentiles(&all_ingress);
+  result.lag_us = ComputePercentiles(&all_lag);
+  if (options_.allocation_counter && result.packets > 0) {
+    result.allocations_per_packet = (double)allocations / result.packets;
+  }
+  if (result.participants > 0 && result.media_seconds > 0) {
+    result.cpu_ms_per_participant =
+      cpu_seconds * 1000 / result.participants / result.media_seconds;
+  }
+
+  // Waits for the queued packets to be traced through the last stages.
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  CollectStages(&result);
+  TearDownRooms();
+  tracer->set_sample_rate(trace_sample);
+  return result;
+}
+
+std::string ReplayBenchmark::FormatResult(const Options& options,
+                                          const Result& result) {
+  std::string stages;
+  for (size_t stage = 0; stage < result.stage_us.size(); ++stage) {
+    if (result.stage_samples[stage] == 0) {
+      continue;
+    }
+    const Percentiles& stage_us = result.stage_us[stage];
+    StringAppendF(&stages, " %s_us(n/p50/p90/p99/max)<=%lld/%lld/%lld/%lld/%lld",
+                  PacketTracer::StageName(stage),
+                  (long long)result.stage_samples[stage],
+                  (long long)stage_us.p50, (long long)stage_us.p90,
+                  (long long)stage_us.p99, (long long)stage_us.max);
+  }
+  return StringPrintf(
+      "plugin=%s rooms=%d threads=%d speed=%g participants=%d "
+      "packets=%lld wall=%.2fs media=%.2fs pps=%.0f "
+      "ingress_us(p50/p90/p99/max)=%lld/%lld/%lld/%lld "
+      "lag_us(p50/p90/p99/max)=%lld/%lld/%lld/%lld "
+      "allocs_per_packet=%.2f cpu=%.1f%% "
+      "cpu_ms_per_participant_per_media_sec=%.3f%s",
+      options.plugin_name.c_str(), options.rooms, options.threads,
+      options.speed, result.participants, (long long)result.packets,
+      result.wall_seconds, result.media_seconds, result.packets_per_second,
+      (long long)result.ingress_us.p50, (long long)result.ingress_us.p90,
+      (long long)result.ingress_us.p99, (long long)result.ingress_us.max,
+      (long long)result.lag_us.p50, (long long)result.lag_us.p90,
+      (long long)result.lag_us.p99, (long long)result.lag_us.max,
+      result.allocations_per_packet, result.cpu_percent,
+      result.cpu_ms_per_participant, stages.c_str());
+}
+
+}  // namespace orbit
@@ -0,0 +1,157 @@
+/*
+ * Copyright 2016 (C) Orange Labs Inc. All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * replay_benchmark.h
+ * ---------------------------------------------------------------------------
+ * Defines a benchmark harness which replays the captured packets into K
+ * synthetic rooms through PacketReplayDriver, and reports the throughput,
+ * the latency percentiles of the ingress call and of each stage of the
+ * pipeline, the allocations per packet and the CPU per participant.
+ * ---------------------------------------------------------------------------
+ * The capture files (recordio or binary capture logs) are loaded once and
+ * merged into one timeline ordered by (ts, file, record), so every run
+ * replays the same packets in the same order. A virtual clock follows the
+ * ts of the timeline: at --replay_speed=1 the packets are delivered in real
+ * time, at N the timeline runs N times faster, and at 0 the packets are
+ * delivered as fast as the pipeline takes them. The virtual clock only
+ * paces the delivery: the pipeline itself (the arrival times, the RTCP and
+ * the mixer timers) still runs on the wall clock, so at a speed other than
+ * 1 its timers fire at other points of the media than in a real session.
+ *
+ * The ingress latency is the time of the synchronous onTransportData()
+ * call, which includes the plugin only without --async_plugin_delivery.
+ * The replayed packets are also traced through the stages of the pipeline
+ * (see packet_trace.h), and the per-stage latencies of all the rooms are
+ * reported, e.g. the plugin_queue and the sender_queue waits which the
+ * ingress latency doesn't see.
+ *
+ * Each room gets its own PacketReplayDriver, and every stream of the
+ * captures is cloned into every room with its SSRCs rewritten, so the
+ * rooms don't see each other's streams.
+ *
+ * Example usage:
+ *   ReplayBenchmark::Options options;
+ *   options.files = {"./record8.pb", "./record9.pb"};
+ *   options.rooms = 10;
+ *   ReplayBenchmark benchmark(options);
+ *   benchmark.Load();
+ *   ReplayBenchmark::Result result = benchmark.Run();
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace orbit {
+
+class PacketReplayDriver;
+class ReplayTransportDelegate;
+
+class ReplayBenchmark {
+ public:
+  struct Options {
+    std::vector<std::string> files;
+    std::string plugin_name = "video_mixer";
+    int rooms = 1;
+    // The number of threads replaying the rooms, each room is replayed by
+    // one thread.
+    int threads = 1;
+    // 1 is real time, 0 is unthrottled.
+    double speed = 1.0;
+    // Traces one of every trace_sample packets through the stages, 0
+    // doesn't.
+    int trace_sample = 1;
+    // Returns the number of the allocations made so far by the process, if
+    // the binary counts them.
+    std::function<int64_t()> allocation_counter;
+  };
+
+  struct Percentiles {
+    int64_t p50 = 0;
+    int64_t p90 = 0;
+    int64_t p99 = 0;
+    int64_t max = 0;
+  };
+
+  struct Result {
+    int64_t packets = 0;
+    int participants = 0;
+    double wall_seconds = 0;
+    double media_seconds = 0;         // The length of the replayed timeline.
+    double packets_per_second = 0;
+    // The time of the onTransportData() call.
+    Percentiles ingress_us;
+    // The latencies of the traced packets per PacketTraceStage, with the
+    // resolution of LatencyHistogram. The stages never reached are empty.
+    std::vector<Percentiles> stage_us;
+    std::vector<int64_t> stage_samples;
+    // How late the packets are delivered w.r.t. the virtual clock.
+    Percentiles lag_us;
+    double allocations_per_packet = -1;  // -1 if not counted.
+    double cpu_percent = 0;              // Of one core.
+    // The CPU time spent per participant per second of media.
+    double cpu_ms_per_participant = 0;
+  };
+
+  explicit ReplayBenchmark(const Options& options);
+  ~ReplayBenchmark();
+
+  // Loads the capture files into the timeline. Returns false if nothing
+  // could be read.
+  bool Load();
+  // Sets up the rooms, replays the timeline into them and tears them down.
+  Result Run();
+
+  // The options in effect, with the threads capped to the rooms.
+  const Options& options() const {
+    return options_;
+  }
+
+  static std::string FormatResult(const Options& options,
+                                  const Result& result);
+
+ private:
+  struct Packet {
+    int64_t ts;                       // in ms
+    int transport_id;                 // 0..num_transports_-1
+    int media_type;                   // StoredMediaType
+    std::string data;
+  };
+
+  struct Room {
+    int session_id = 0;
+    std::unique_ptr<PacketReplayDriver> driver;
+    uint32_t ssrc_salt = 0;
+    // Indexed by the transport_id of the timeline.
+    std::vector<ReplayTransportDelegate*> delegates;
+  };
+
+  // Copies the packet to buf with the SSRCs of the stream rewritten for
+  // the room: the SSRC and the CSRCs of RTP, and every SSRC carried by the
+  // RTCP compound (senders, report blocks, SDES chunks, BYE, feedback).
+  static void RewriteSsrcs(const Packet& packet, uint32_t salt, char* buf);
+  // Sums the stage histograms of the rooms into the result.
+  void CollectStages(Result* result);
+
+  void SetupRooms();
+  void TearDownRooms();
+  // Replays the timeline into the rooms index % threads == thread.
+  void ReplayRooms(int thread, int64_t start_ns,
+                   std::vector<int32_t>* ingress_us,
+                   std::vector<int32_t>* lag_us);
+
+  static Percentiles ComputePercentiles(std::vector<int32_t>* samples);
+
+  Options options_;
+  std::vector<Packet> timeline_;
+  int num_transports_ = 0;
+  std::vector<Room*> rooms_;
+};
+
+}  // namespace orbit
@@ -0,0 +1,142 @@
+/*
+ * Copyright 2016 All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * replay_benchmark_main.cc
+ * ---------------------------------------------------------------------------
+ * Replays the captured packets into K synthetic rooms and reports the
+ * packets/sec, the ingress call and pacing lag percentiles, the per-stage
+ * latencies, the allocations (malloc) per packet and the CPU per
+ * participant (see replay_benchmark.h). Runs offline, without any browser.
+ * ---------------------------------------------------------------------------
+ * Usage command line:
+ *   bazel-bin/stream_service/orbit/debug_server/replay_benchmark_main \
+ *      --logtostderr --replay_files="./record8.pb;./record9.pb" \
+ *      --test_plugin=video_dispatcher --rooms=1,10,50 --replay_speed=0
+ */
+
+// For Gflags and Glog
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "stream_service/orbit/server/gst_util.h"
+#include "stream_service/orbit/base/strutil.h"
+#include "replay_benchmark.h"
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include <atomic>
+
+DEFINE_bool(only_public_ip, false, "use public ip only on candidate.");
+DEFINE_string(packet_capture_directory, "", "Specify the directory to store the capture file. e.g. /tmp/");
+DEFINE_string(packet_capture_filename, "", "If any filename is specified, "
+              "the rtp packet capture will be enabled and stored into the file."
+              " e.g. video_rtp.pb");
+DEFINE_string(test_plugin, "video_mixer", "Specifies the plugin and room. "
+              "e.g. video_mixer, video_dispatcher or audio_conference ");
+DEFINE_string(rooms, "1", "The numbers of the synthetic rooms to test, each "
+              "replays all the streams of --replay_files.");
+DEFINE_int32(replay_threads, 1, "The threads replaying the rooms.");
+DEFINE_double(replay_speed, 1.0, "The speed of the virtual clock: 1 is real "
+              "time, N is N times faster, 0 is unthrottled.");
+DEFINE_int32(stage_trace_sample, 1, "Traces one of every N replayed packets "
+             "through the stages of the pipeline, 0 doesn't report the "
+             "per-stage latencies.");
+DEFINE_int32(seed, 1, "The seed of rand(), for the same session and stream "
+             "ids on every run.");
+DECLARE_string(replay_files);
+
+using namespace std;
+
+namespace {
+
+std::atomic<int64_t> allocations(0);
+
+int64_t CountAllocations() {
+  return allocations.load(std::memory_order_relaxed);
+}
+
+}  // anonymous namespace
+
+// Counts the allocations of the whole process, for the allocations per
+// packet. The malloc family is replaced (glibc only), so operator new,
+// g_malloc() and the GStreamer elements are all counted. GSlice allocates
+// its chunks with posix_memalign(), the slices carved from a chunk are not
+// counted, run with G_SLICE=always-malloc to count them too.
+extern "C" {
+
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* p, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+
+void* malloc(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  return __libc_calloc(count, size);
+}
+
+void* realloc(void* p, size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  return __libc_realloc(p, size);
+}
+
+void* memalign(size_t alignment, size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void** p, size_t alignment, size_t size) {
+  if (alignment % sizeof(void*) != 0 ||
+      (alignment & (alignment - 1)) != 0) {
+    return EINVAL;
+  }
+  void* result = memalign(alignment, size);
+  if (result == NULL) {
+    return ENOMEM;
+  }
+  *p = result;
+  return 0;
+}
+
+}  // extern "C"
+
+int main(int argc, char** argv) {
+  google::InstallFailureSignalHandler();
+  google::ParseCommandLineFlags(&argc, &argv, false);
+  google::InitGoogleLogging(argv[0]);
+
+  olive::InitGstreamer(argc,argv);
+  srand(FLAGS_seed);
+
+  orbit::ReplayBenchmark::Options options;
+  orbit::SplitStringUsing(FLAGS_replay_files, ";", &options.files);
+  options.plugin_name = FLAGS_test_plugin;
+  options.threads = FLAGS_replay_threads;
+  options.speed = FLAGS_replay_speed;
+  options.trace_sample = FLAGS_stage_trace_sample;
+  options.allocation_counter = CountAllocations;
+
+  vector<string> rooms;
+  orbit::SplitStringUsing(FLAGS_rooms, ",", &rooms);
+  for (const string& count : rooms) {
+    options.rooms = atoi(count.c_str());
+    if (options.rooms <= 0) {
+      continue;
+    }
+    orbit::ReplayBenchmark benchmark(options);
+    if (!benchmark.Load()) {
+      LOG(ERROR) << "No packets in --replay_files=" << FLAGS_replay_files;
+      return 1;
+    }
+    orbit::ReplayBenchmark::Result result = benchmark.Run();
+    LOG(INFO) << orbit::ReplayBenchmark::FormatResult(benchmark.options(),
+                                                      result);
+  }
+  return 0;
+}
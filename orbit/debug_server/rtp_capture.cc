@@ -9,12 +9,17 @@
  */
 
 #include "rtp_capture.h"
+#include "gflags/gflags.h"
 #include "glog/logging.h"
 
 #include "stream_service/orbit/rtp/rtp_headers.h"
 #include "stream_service/orbit/base/timeutil.h"
 #include "stream_service/orbit/debug_server/stored_rtp.pb.h"
 
+DEFINE_bool(rtp_capture_binary, false, "Capture the packets into a binary "
+            "log written by a background thread, instead of the recordio "
+            "file. Convert it with rtp_capture_convert_main.");
+
 namespace orbit {
   RtpCapture::RtpCapture() {
   }
@@ -23,6 +28,14 @@ namespace orbit {
   }
 
   void RtpCapture::SetExportFile(const string& export_file){
+    if (FLAGS_rtp_capture_binary) {
+      log_writer_.reset(new RtpCaptureLogWriter());
+      if (!log_writer_->Open(export_file)) {
+        LOG(FATAL) << "Cannot open " << export_file;
+      }
+      file_path_ = export_file;
+      return;
+    }
     if (!file::Open(export_file, "wb", &file_, file::Defaults()).ok()) {
       LOG(FATAL) << "Cannot open " << export_file;
     }
@@ -35,10 +48,19 @@ namespace orbit {
   }
 
   void RtpCapture::Destroy() {
-    writer_->Close();
+    if (log_writer_ != NULL) {
+      log_writer_->Close();
+    }
+    if (writer_ != NULL) {
+      writer_->Close();
+    }
   }
 
   void RtpCapture::CapturePacket(int transport_id, const dataPacket& packet) {
+    if (log_writer_ != NULL) {
+      CaptureToLog(transport_id, packet);
+      return;
+    }
     std::lock_guard<std::mutex> lock(mutex_);
     StoredPacket packet_proto;
     if (packet.type == AUDIO_PACKET) {
@@ -71,7 +93,34 @@ namespace orbit {
     writer_->WriteProtocolMessage(packet_proto);
   }
 
+  void RtpCapture::CaptureToLog(int transport_id, const dataPacket& packet) {
+    RtpCaptureRecordHeader header;
+    memset(&header, 0, sizeof(header));
+    if (packet.type == AUDIO_PACKET) {
+      header.media_type = AUDIO;
+    } else if (packet.type == VIDEO_PACKET) {
+      header.media_type = VIDEO;
+    } else if (packet.type == VIDEO_RTX_PACKET) {
+      header.media_type = VIDEO_RTX;
+    }
+    RtcpHeader* chead = (RtcpHeader*)(&(packet.data[0]));
+    header.packet_type = chead->isRtcp() ? RTCP_PACKET : RTP_PACKET;
+    header.length = packet.length;
+    header.transport_id = transport_id;
+    header.rtp_timestamp = packet.rtp_timestamp;
+    header.ts = getTimeMS();
+    header.remote_ntp_time_ms = packet.remote_ntp_time_ms;
+    log_writer_->Append(header, packet.data);
+  }
+
   void RtpReplay::Init(const string& file) {
+    if (RtpCaptureLogReader::IsCaptureLog(file)) {
+      log_reader_.reset(new RtpCaptureLogReader());
+      if (!log_reader_->Open(file)) {
+        LOG(FATAL) << "Cannot open " << file;
+      }
+      return;
+    }
     if (!file::Open(file, "rb", &file_, file::Defaults()).ok()) {
       LOG(FATAL) << "Cannot open " << file;
     }
@@ -80,6 +129,9 @@ namespace orbit {
 
   std::shared_ptr<StoredPacket> RtpReplay::Next() {
     std::shared_ptr<StoredPacket> packet(new StoredPacket);
+    if (log_reader_ != NULL) {
+      return log_reader_->Next(packet.get()) ? packet : NULL;
+    }
     if (reader_->ReadProtocolMessage(packet.get())) {
       return packet;
     }
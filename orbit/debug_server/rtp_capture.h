@@ -12,12 +12,17 @@
 #pragma once
 
 #include "stream_service/orbit/debug_server/stored_rtp.pb.h"
+#include "stream_service/orbit/debug_server/rtp_capture_log.h"
 #include "stream_service/orbit/base/recordio.h"
 #include "stream_service/orbit/media_definitions.h"
+#include <memory>
 #include <mutex>
 
 namespace orbit {
 
+// With --rtp_capture_binary, the packets are appended to a binary capture
+// log (see rtp_capture_log.h) without blocking the caller, instead of being
+// written to the recordio file under a mutex.
 class RtpCapture {
 public:
   RtpCapture();
@@ -38,12 +43,14 @@ public:
   }
 
   bool IsReady() {
-    return file_ != NULL;
+    return file_ != NULL || log_writer_ != NULL;
   }
 private:  
   void Destroy();
+  void CaptureToLog(int transport_id, const dataPacket& packet);
 
-  RecordWriter* writer_;
+  RecordWriter* writer_ = NULL;
+  std::unique_ptr<RtpCaptureLogWriter> log_writer_;
   File* file_ = NULL;
   mutable std::mutex mutex_;
 
@@ -56,15 +63,19 @@ public:
   RtpReplay() {
   }
   ~RtpReplay() {
-    reader_->Close();
-    delete reader_;
-    delete file_;
+    if (reader_ != NULL) {
+      reader_->Close();
+      delete reader_;
+      delete file_;
+    }
   }
+  // Reads a recordio file, or a binary capture log.
   void Init(const string& file);
   std::shared_ptr<StoredPacket> Next();
 private:
-  RecordReader* reader_;
-  File* file_;
+  RecordReader* reader_ = NULL;
+  File* file_ = NULL;
+  std::unique_ptr<RtpCaptureLogReader> log_reader_;
 };
 
  
@@ -0,0 +1,40 @@
+/*
+ * Copyright 2016 (C) Orange Labs Inc. All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * rtp_capture_convert_main.cc
+ * ---------------------------------------------------------------------------
+ * Converts a binary capture log (--rtp_capture_binary) into the StoredPacket
+ * recordio file read by rtp_replay_main and the replay pipeline.
+ * ---------------------------------------------------------------------------
+ * Usage command line:
+ *   bazel-bin/stream_service/orbit/debug_server/rtp_capture_convert_main \
+ *      --logtostderr --input=./record9.rtplog --output=./record9.pb
+ */
+
+// For Gflags and Glog
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "rtp_capture_log.h"
+
+DEFINE_string(input, "", "The binary capture log to convert.");
+DEFINE_string(output, "", "The recordio file to write.");
+
+int main(int argc, char** argv) {
+  google::InstallFailureSignalHandler();
+  google::ParseCommandLineFlags(&argc, &argv, false);
+  google::InitGoogleLogging(argv[0]);
+
+  if (FLAGS_input.empty() || FLAGS_output.empty()) {
+    LOG(ERROR) << "Both --input and --output are required.";
+    return 1;
+  }
+  int64_t converted = 0;
+  if (!orbit::ConvertRtpCaptureLog(FLAGS_input, FLAGS_output, &converted)) {
+    LOG(ERROR) << "Failed to convert " << FLAGS_input;
+    return 1;
+  }
+  LOG(INFO) << "Converted " << converted << " packets into " << FLAGS_output;
+  return 0;
+}
@@ -0,0 +1,510 @@
+/*
+ * Copyright 2016 (C) Orange Labs Inc. All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * rtp_capture_log.cc
+ * ---------------------------------------------------------------------------
+ * Implements the binary packet log of RtpCapture.
+ * ---------------------------------------------------------------------------
+ */
+
+#include "rtp_capture_log.h"
+
+#include "stream_service/orbit/base/cache_line.h"
+#include "stream_service/orbit/base/file.h"
+#include "stream_service/orbit/base/recordio.h"
+#include "stream_service/orbit/base/timeutil.h"
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+
+DEFINE_int32(rtp_capture_ring_size, 1 << 20,
+             "The bytes of the capture ring of each thread which captures "
+             "packets. A full ring drops the packets.");
+DEFINE_int32(rtp_capture_write_size, 1 << 20,
+             "The bytes the capture writer collects before each write.");
+DEFINE_bool(rtp_capture_direct_io, false,
+            "Write the binary capture log with O_DIRECT, bypassing the page "
+            "cache.");
+
+// The block size (and alignment) of the writes, fine for O_DIRECT.
+#define RTP_CAPTURE_BLOCK_SIZE 4096
+// The writer drains the rings this often when they are idle.
+#define RTP_CAPTURE_DRAIN_INTERVAL 10 // in ms
+// Write the collected blocks at least this often.
+#define RTP_CAPTURE_WRITE_INTERVAL 1000 // in ms
+// The records of the different threads are at most this late in the file.
+#define RTP_CAPTURE_REORDER_WINDOW 1000 // in ms
+// The writers one thread remembers its ring of.
+#define RTP_CAPTURE_THREAD_CACHE_SIZE 8
+
+namespace orbit {
+
+const char kRtpCaptureMagic[8] = {'O', 'R', 'B', 'I', 'T', 'C', 'A', 'P'};
+const uint32_t kRtpCaptureVersion = 1;
+
+namespace {
+
+size_t RecordSize(int length) {
+  return (sizeof(RtpCaptureRecordHeader) + length + 7) & ~(size_t)7;
+}
+
+size_t RoundUp(size_t size, size_t block) {
+  return (size + block - 1) / block * block;
+}
+
+const char kZeros[8] = {0};
+
+std::atomic<uint64_t> next_writer_id(1);
+
+}  // anonymous namespace
+
+// A single-producer single-consumer ring of variable sized records. The
+// producer is the capturing thread, the consumer is the writer thread.
+class RtpCaptureLogWriter::Ring {
+ public:
+  explicit Ring(size_t capacity) {
+    size_t size = 4096;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    mask_ = size - 1;
+    buffer_.reset(new char[size]);
+  }
+
+  bool TryWrite(const RtpCaptureRecordHeader& header, const char* data) {
+    size_t size = RecordSize(header.length);
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail + size - cached_head_ > mask_ + 1) {
+      cached_head_ = head_.load(std::memory_order_acquire);
+      if (tail + size - cached_head_ > mask_ + 1) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+    }
+    size_t pos = tail;
+    CopyIn(pos, &header, sizeof(header));
+    pos += sizeof(header);
+    CopyIn(pos, data, header.length);
+    pos += header.length;
+    CopyIn(pos, kZeros, tail + size - pos);
+    tail_.store(tail + size, std::memory_order_release);
+    return true;
+  }
+
+  // Copies the whole records that fit in max bytes to dst. Returns the
+  // bytes copied and adds the records to *records.
+  size_t Read(char* dst, size_t max, int64_t* records) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    size_t tail = tail_.load(std::memory_order_acquire);
+    size_t copied = 0;
+    while (head != tail) {
+      RtpCaptureRecordHeader header;
+      CopyOut(head, &header, sizeof(header));
+      size_t size = RecordSize(header.length);
+      if (copied + size > max) {
+        break;
+      }
+      CopyOut(head, dst + copied, size);
+      head += size;
+      copied += size;
+      (*records)++;
+    }
+    head_.store(head, std::memory_order_release);
+    return copied;
+  }
+
+  size_t Capacity() const {
+    return mask_ + 1;
+  }
+
+  int64_t dropped() const {
+    return dropped_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  void CopyIn(size_t pos, const void* src, size_t len) {
+    size_t offset = pos & mask_;
+    size_t first = std::min(len, mask_ + 1 - offset);
+    memcpy(buffer_.get() + offset, src, first);
+    memcpy(buffer_.get(), (const char*)src + first, len - first);
+  }
+
+  void CopyOut(size_t pos, void* dst, size_t len) const {
+    size_t offset = pos & mask_;
+    size_t first = std::min(len, mask_ + 1 - offset);
+    memcpy(dst, buffer_.get() + offset, first);
+    memcpy((char*)dst + first, buffer_.get(), len - first);
+  }
+
+  std::unique_ptr<char[]> buffer_;
+  size_t mask_;
+
+  char padding0_[CACHE_LINE_SIZE];
+  // Written by the producer.
+  std::atomic<size_t> tail_{0};
+  size_t cached_head_ = 0;
+  std::atomic<int64_t> dropped_{0};
+  char padding1_[CACHE_LINE_SIZE];
+
+  // Written by the consumer.
+  std::atomic<size_t> head_{0};
+  char padding2_[CACHE_LINE_SIZE];
+};
+
+RtpCaptureLogWriter::RtpCaptureLogWriter()
+  : id_(next_writer_id.fetch_add(1)) {
+}
+
+RtpCaptureLogWriter::~RtpCaptureLogWriter() {
+  Close();
+  for (Ring* ring : ring_list_) {
+    delete ring;
+  }
+  free(staging_);
+}
+
+bool RtpCaptureLogWriter::Open(const std::string& path) {
+  if (fd_ >= 0) {
+    LOG(ERROR) << "The capture log " << path_ << " is already open.";
+    return false;
+  }
+  direct_io_ = FLAGS_rtp_capture_direct_io;
+  int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+  fd_ = open(path.c_str(), flags | (direct_io_ ? O_DIRECT : 0), 0644);
+  if (fd_ < 0 && direct_io_ && errno == EINVAL) {
+    LOG(WARNING) << "O_DIRECT is not supported for " << path
+                 << ", use the buffered writes.";
+    direct_io_ = false;
+    fd_ = open(path.c_str(), flags, 0644);
+  }
+  if (fd_ < 0) {
+    LOG(ERROR) << "Cannot open " << path << ", errno=" << errno;
+    return false;
+  }
+  path_ = path;
+
+  staging_size_ = std::max<size_t>(
+      RoundUp(std::max(FLAGS_rtp_capture_write_size, 0),
+              RTP_CAPTURE_BLOCK_SIZE),
+      16 * RTP_CAPTURE_BLOCK_SIZE);
+  if (posix_memalign((void**)&staging_, RTP_CAPTURE_BLOCK_SIZE,
+                     staging_size_) != 0) {
+    LOG(ERROR) << "Cannot allocate the capture staging buffer.";
+    close(fd_);
+    fd_ = -1;
+    return false;
+  }
+  RtpCaptureFileHeader header;
+  memcpy(header.magic, kRtpCaptureMagic, sizeof(header.magic));
+  header.version = kRtpCaptureVersion;
+  header.header_size = sizeof(header);
+  memcpy(staging_, &header, sizeof(header));
+  staging_used_ = sizeof(header);
+  file_size_ = 0;
+  last_write_ms_ = GetCurrentTime_MS();
+
+  running_ = true;
+  thread_.reset(new std::thread(&RtpCaptureLogWriter::WriterLoop, this));
+  return true;
+}
+
+void RtpCaptureLogWriter::Close() {
+  if (fd_ < 0) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(wait_mutex_);
+    running_ = false;
+  }
+  wait_cond_.notify_all();
+  thread_->join();
+  thread_.reset();
+
+  // Write out what is left in the rings.
+  while (DrainRings() > 0 || staging_used_ >= RTP_CAPTURE_BLOCK_SIZE) {
+    if (!WriteStaging(false)) {
+      break;
+    }
+  }
+  WriteStaging(true);
+  if (direct_io_ && ftruncate(fd_, file_size_) != 0) {
+    LOG(ERROR) << "Cannot truncate " << path_ << ", errno=" << errno;
+  }
+  close(fd_);
+  fd_ = -1;
+  LOG(INFO) << "Closed the capture log " << path_ << ", records="
+            << written_records_ << " dropped=" << dropped_records();
+}
+
+bool RtpCaptureLogWriter::Append(const RtpCaptureRecordHeader& header,
+                                 const char* data) {
+  if (!running_) {
+    return false;
+  }
+  Ring* ring = LocalRing();
+  if (RecordSize(header.length) > ring->Capacity() / 2 ||
+      !ring->TryWrite(header, data)) {
+    LOG_EVERY_N(WARNING, 1000) << "The capture ring is full, dropped "
+                               << dropped_records() << " packets so far.";
+    return false;
+  }
+  return true;
+}
+
+int64_t RtpCaptureLogWriter::dropped_records() const {
+  std::lock_guard<std::mutex> lock(rings_mutex_);
+  int64_t dropped = 0;
+  for (Ring* ring : ring_list_) {
+    dropped += ring->dropped();
+  }
+  return dropped;
+}
+
+RtpCaptureLogWriter::Ring* RtpCaptureLogWriter::LocalRing() {
+  struct CachedRing {
+    uint64_t writer_id;
+    Ring* ring;
+  };
+  // The writer ids are never reused, so the entries of the closed writers
+  // are never matched again.
+  static thread_local std::vector<CachedRing> cache;
+  for (const CachedRing& cached : cache) {
+    if (cached.writer_id == id_) {
+      return cached.ring;
+    }
+  }
+  Ring* ring;
+  {
+    std::lock_guard<std::mutex> lock(rings_mutex_);
+    auto it = rings_.find(std::this_thread::get_id());
+    if (it != rings_.end()) {
+      ring = it->second;
+    } else {
+      ring = new Ring(std::max(FLAGS_rtp_capture_ring_size, 0));
+      rings_[std::this_thread::get_id()] = ring;
+      ring_list_.push_back(ring);
+    }
+  }
+  if (cache.size() >= RTP_CAPTURE_THREAD_CACHE_SIZE) {
+    cache.erase(cache.begin());
+  }
+  cache.push_back({id_, ring});
+  return ring;
+}
+
+void RtpCaptureLogWriter::WriterLoop() {
+  while (running_) {
+    size_t drained = DrainRings();
+    long long now = GetCurrentTime_MS();
+    if (staging_used_ >= staging_size_ / 2 ||
+        (staging_used_ >= RTP_CAPTURE_BLOCK_SIZE &&
+         now - last_write_ms_ >= RTP_CAPTURE_WRITE_INTERVAL)) {
+      WriteStaging(false);
+      last_write_ms_ = now;
+    }
+    if (drained == 0) {
+      std::unique_lock<std::mutex> lock(wait_mutex_);
+      wait_cond_.wait_for(lock,
+                          std::chrono::milliseconds(RTP_CAPTURE_DRAIN_INTERVAL),
+                          [this]() { return !running_; });
+    }
+  }
+}
+
+size_t RtpCaptureLogWriter::DrainRings() {
+  std::vector<Ring*> rings;
+  {
+    std::lock_guard<std::mutex> lock(rings_mutex_);
+    rings = ring_list_;
+  }
+  size_t drained = 0;
+  int64_t records = 0;
+  for (Ring* ring : rings) {
+    size_t n = ring->Read(staging_ + staging_used_,
+                          staging_size_ - staging_used_, &records);
+    staging_used_ += n;
+    drained += n;
+  }
+  written_records_ += records;
+  return drained;
+}
+
+bool RtpCaptureLogWriter::WriteStaging(bool final) {
+  size_t length = staging_used_ / RTP_CAPTURE_BLOCK_SIZE * RTP_CAPTURE_BLOCK_SIZE;
+  if (final) {
+    length = staging_used_;
+    if (direct_io_) {
+      // The last block is padded, the file is truncated after it.
+      length = RoundUp(staging_used_, RTP_CAPTURE_BLOCK_SIZE);
+      memset(staging_ + staging_used_, 0, length - staging_used_);
+    }
+  }
+  if (length == 0) {
+    return true;
+  }
+  size_t written = 0;
+  while (written < length) {
+    ssize_t n = write(fd_, staging_ + written, length - written);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      LOG(ERROR) << "Failed to write the capture log " << path_
+                 << ", errno=" << errno << ", " << staging_used_
+                 << " bytes are lost.";
+      staging_used_ = 0;
+      return false;
+    }
+    written += n;
+  }
+  size_t data_length = std::min(length, staging_used_);
+  file_size_ += data_length;
+  staging_used_ -= data_length;
+  memmove(staging_, staging_ + data_length, staging_used_);
+  return true;
+}
+
+bool RtpCaptureLogReader::IsCaptureLog(const std::string& path) {
+  FILE* file = fopen(path.c_str(), "rb");
+  if (file == NULL) {
+    return false;
+  }
+  char magic[sizeof(kRtpCaptureMagic)];
+  bool result = (fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+                 memcmp(magic, kRtpCaptureMagic, sizeof(magic)) == 0);
+  fclose(file);
+  return result;
+}
+
+bool RtpCaptureLogReader::Open(const std::string& path) {
+  Close();
+  file_ = fopen(path.c_str(), "rb");
+  if (file_ == NULL) {
+    LOG(ERROR) << "Cannot open " << path;
+    return false;
+  }
+  RtpCaptureFileHeader header;
+  if (fread(&header, sizeof(header), 1, file_) != 1 ||
+      memcmp(header.magic, kRtpCaptureMagic, sizeof(header.magic)) != 0 ||
+      header.version != kRtpCaptureVersion ||
+      header.header_size < sizeof(header) ||
+      fseek(file_, header.header_size, SEEK_SET) != 0) {
+    LOG(ERROR) << path << " is not a capture log of version "
+               << kRtpCaptureVersion;
+    Close();
+    return false;
+  }
+  eof_ = false;
+  read_records_ = 0;
+  max_ts_ = 0;
+  return true;
+}
+
+void RtpCaptureLogReader::Close() {
+  if (file_ != NULL) {
+    fclose(file_);
+    file_ = NULL;
+  }
+  while (!pending_.empty()) {
+    pending_.pop();
+  }
+}
+
+bool RtpCaptureLogReader::ReadRecord() {
+  if (file_ == NULL) {
+    return false;
+  }
+  RtpCaptureRecordHeader header;
+  if (fread(&header, sizeof(header), 1, file_) != 1) {
+    return false;
+  }
+  size_t padding = RecordSize(header.length) - sizeof(header) - header.length;
+  std::string data(header.length, '\0');
+  char skipped[8];
+  if ((header.length > 0 &&
+       fread(&data[0], header.length, 1, file_) != 1) ||
+      (padding > 0 && fread(skipped, padding, 1, file_) != 1)) {
+    LOG(WARNING) << "The capture log ends with a truncated record.";
+    return false;
+  }
+
+  std::shared_ptr<StoredPacket> packet(new StoredPacket);
+  packet->set_packet_type((StoredPacketType)header.packet_type);
+  packet->set_type((StoredMediaType)header.media_type);
+  packet->set_packet_length(header.length);
+  packet->set_header_length(12);
+  packet->set_data(data);
+  packet->set_ts(header.ts);
+  packet->set_remote_ntp_time_ms(header.remote_ntp_time_ms);
+  packet->set_rtp_timestamp(header.rtp_timestamp);
+  packet->set_transport_id(header.transport_id);
+
+  if (header.ts > max_ts_) {
+    max_ts_ = header.ts;
+  }
+  pending_.push({header.ts, read_records_++, packet});
+  return true;
+}
+
+bool RtpCaptureLogReader::Next(StoredPacket* packet) {
+  // Read ahead until the earliest pending record can't be preceded by a
+  // record of another thread still in the file.
+  while (!eof_ && (pending_.empty() ||
+                   pending_.top().ts > max_ts_ - RTP_CAPTURE_REORDER_WINDOW)) {
+    if (!ReadRecord()) {
+      eof_ = true;
+    }
+  }
+  if (pending_.empty()) {
+    return false;
+  }
+  packet->Swap(pending_.top().packet.get());
+  pending_.pop();
+  return true;
+}
+
+bool ConvertRtpCaptureLog(const std::string& input, const std::string& output,
+                          int64_t* converted) {
+  RtpCaptureLogReader reader;
+  if (!reader.Open(input)) {
+    return false;
+  }
+  File* file = NULL;
+  if (!file::Open(output, "wb", &file, file::Defaults()).ok()) {
+    LOG(ERROR) << "Cannot open " << output;
+    return false;
+  }
+  RecordWriter writer(file);
+  StoredPacket packet;
+  int64_t count = 0;
+  bool result = true;
+  while (reader.Next(&packet)) {
+    if (!writer.WriteProtocolMessage(packet)) {
+      LOG(ERROR) << "Failed to write " << output;
+      result = false;
+      break;
+    }
+    count++;
+  }
+  if (!writer.Close()) {
+    result = false;
+  }
+  delete file;
+  if (converted != NULL) {
+    *converted = count;
+  }
+  return result;
+}
+
+}  // namespace orbit
@@ -0,0 +1,169 @@
+/*
+ * Copyright 2016 (C) Orange Labs Inc. All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * rtp_capture_log.h
+ * ---------------------------------------------------------------------------
+ * Defines a binary packet log for RtpCapture which never blocks the media
+ * threads, and the reader/converter back to the StoredPacket recordio.
+ * ---------------------------------------------------------------------------
+ * File format (all integers in host byte order):
+ *   RtpCaptureFileHeader                   16 bytes, once
+ *   { RtpCaptureRecordHeader, packet data,  padded to 8 bytes } ...
+ *
+ * Each producer thread appends its records to its own lock-free ring, and a
+ * background thread drains the rings into an aligned staging buffer and
+ * writes it out in large blocks (with O_DIRECT if --rtp_capture_direct_io).
+ * A full ring drops the packet instead of waiting for the disk.
+ *
+ * The records of different threads may be out of order by up to one drain
+ * pass, RtpCaptureLogReader puts them back in the order of their ts.
+ *
+ * Example usage:
+ *   RtpCaptureLogWriter writer;
+ *   writer.Open("/tmp/capture.rtplog");
+ *   writer.Append(header, data);        // any thread
+ *   writer.Close();
+ *   ConvertRtpCaptureLog("/tmp/capture.rtplog", "/tmp/capture.pb", NULL);
+ */
+
+#pragma once
+
+#include "stream_service/orbit/debug_server/stored_rtp.pb.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace orbit {
+
+struct RtpCaptureFileHeader {
+  char magic[8];              // kRtpCaptureMagic
+  uint32_t version;
+  uint32_t header_size;       // sizeof(RtpCaptureFileHeader)
+};
+
+struct RtpCaptureRecordHeader {
+  uint16_t length;            // The bytes of the packet data that follow.
+  uint8_t packet_type;        // StoredPacketType
+  uint8_t media_type;         // StoredMediaType
+  int32_t transport_id;
+  uint32_t rtp_timestamp;
+  uint32_t reserved;
+  int64_t ts;                 // The capture time in ms.
+  int64_t remote_ntp_time_ms;
+};
+
+static_assert(sizeof(RtpCaptureFileHeader) == 16, "packed file header");
+static_assert(sizeof(RtpCaptureRecordHeader) == 32, "packed record header");
+
+extern const char kRtpCaptureMagic[8];
+extern const uint32_t kRtpCaptureVersion;
+
+class RtpCaptureLogWriter {
+ public:
+  RtpCaptureLogWriter();
+  ~RtpCaptureLogWriter();
+
+  // Creates the file and starts the writer thread.
+  bool Open(const std::string& path);
+  // Writes everything appended so far and closes the file. No Append()
+  // may run concurrently with (or after) Close().
+  void Close();
+
+  // Copies the record into the ring of the calling thread. Never blocks,
+  // returns false (and counts the drop) if the ring is full.
+  bool Append(const RtpCaptureRecordHeader& header, const char* data);
+
+  int64_t written_records() const {
+    return written_records_;
+  }
+  int64_t dropped_records() const;
+
+ private:
+  class Ring;
+
+  Ring* LocalRing();
+  void WriterLoop();
+  // Moves the ready records of all the rings into the staging buffer.
+  // Returns the bytes moved.
+  size_t DrainRings();
+  // Writes the whole blocks of the staging buffer, or all of it (padded to
+  // a block) if final.
+  bool WriteStaging(bool final);
+
+  const uint64_t id_;         // Tells the writers apart in the thread caches.
+  int fd_ = -1;
+  bool direct_io_ = false;
+  std::string path_;
+
+  mutable std::mutex rings_mutex_;
+  std::map<std::thread::id, Ring*> rings_;
+  std::vector<Ring*> ring_list_;   // The same rings, for the writer thread.
+
+  char* staging_ = NULL;
+  size_t staging_size_ = 0;
+  size_t staging_used_ = 0;
+  int64_t file_size_ = 0;          // The logical size, without the padding.
+  long long last_write_ms_ = 0;
+
+  std::atomic<bool> running_{false};
+  std::atomic<int64_t> written_records_{0};
+  std::mutex wait_mutex_;
+  std::condition_variable wait_cond_;
+  std::unique_ptr<std::thread> thread_;
+};
+
+class RtpCaptureLogReader {
+ public:
+  RtpCaptureLogReader() {
+  }
+  ~RtpCaptureLogReader() {
+    Close();
+  }
+
+  // Whether the file starts with the binary capture log magic.
+  static bool IsCaptureLog(const std::string& path);
+
+  bool Open(const std::string& path);
+  void Close();
+  // Reads the next record in the order of ts. Returns false at the end.
+  bool Next(StoredPacket* packet);
+
+ private:
+  struct Pending {
+    int64_t ts;
+    int64_t index;                 // Keeps the file order of the same ts.
+    std::shared_ptr<StoredPacket> packet;
+    bool operator>(const Pending& other) const {
+      return ts != other.ts ? ts > other.ts : index > other.index;
+    }
+  };
+
+  // Reads one record of the file into pending_.
+  bool ReadRecord();
+
+  FILE* file_ = NULL;
+  bool eof_ = false;
+  int64_t read_records_ = 0;
+  int64_t max_ts_ = 0;
+  std::priority_queue<Pending, std::vector<Pending>,
+                      std::greater<Pending> > pending_;
+};
+
+// Converts a binary capture log into the StoredPacket recordio read by
+// RtpReplay. Sets the number of the converted packets in *converted if not
+// NULL.
+bool ConvertRtpCaptureLog(const std::string& input, const std::string& output,
+                          int64_t* converted);
+
+}  // namespace orbit
@@ -0,0 +1,112 @@
+// Copyright 2016 Orangelab Inc. All Rights Reserved.
+// Author: cheng@orangelab.com (Cheng Xu)
+//
+// Unittest for the binary capture log of RtpCapture.
+
+#include "gtest/gtest.h"
+
+#include "stream_service/orbit/base/file.h"
+#include "rtp_capture.h"
+#include "rtp_capture_log.h"
+
+#include <string.h>
+
+#include <thread>
+#include <vector>
+
+namespace orbit {
+namespace {
+
+const int kPacketsPerThread = 5000;
+
+RtpCaptureRecordHeader MakeHeader(int transport_id, int seq, int length) {
+  RtpCaptureRecordHeader header;
+  memset(&header, 0, sizeof(header));
+  header.length = length;
+  header.packet_type = RTP_PACKET;
+  header.media_type = VIDEO;
+  header.transport_id = transport_id;
+  header.rtp_timestamp = seq;
+  header.ts = 1000 + seq / 10;
+  return header;
+}
+
+// Writes kPacketsPerThread packets from each of the threads.
+void WriteLog(const string& path, int threads) {
+  RtpCaptureLogWriter writer;
+  ASSERT_TRUE(writer.Open(path));
+  std::vector<std::thread> producers;
+  for (int t = 0; t < threads; ++t) {
+    producers.emplace_back([&writer, t]() {
+        char data[1200];
+        for (int i = 0; i < kPacketsPerThread; ++i) {
+          int length = 100 + i % 1000;
+          memset(data, 'a' + t, length);
+          RtpCaptureRecordHeader header = MakeHeader(t, i, length);
+          // The rings are large enough, but don't count on the writer.
+          while (!writer.Append(header, data)) {
+            std::this_thread::yield();
+          }
+        }
+      });
+  }
+  for (std::thread& producer : producers) {
+    producer.join();
+  }
+  writer.Close();
+  EXPECT_EQ(threads * kPacketsPerThread, writer.written_records());
+}
+
+void CheckPackets(RtpReplay* replay, int threads) {
+  std::vector<int> next_seq(threads, 0);
+  int64_t last_ts = 0;
+  int count = 0;
+  std::shared_ptr<StoredPacket> packet;
+  while ((packet = replay->Next()) != NULL) {
+    int t = packet->transport_id();
+    ASSERT_TRUE(t >= 0 && t < threads);
+    // In the order of ts, and each thread in its own order.
+    EXPECT_LE(last_ts, (int64_t)packet->ts());
+    last_ts = packet->ts();
+    EXPECT_EQ(next_seq[t], packet->rtp_timestamp());
+    int length = 100 + next_seq[t] % 1000;
+    EXPECT_EQ(length, (int)packet->packet_length());
+    EXPECT_EQ(string(length, 'a' + t), packet->data());
+    EXPECT_EQ(VIDEO, packet->type());
+    next_seq[t]++;
+    count++;
+  }
+  EXPECT_EQ(threads * kPacketsPerThread, count);
+}
+
+TEST(RtpCaptureLogTest, WriteAndReplay) {
+  string path = "./test_capture.rtplog";
+  WriteLog(path, 4);
+  EXPECT_TRUE(RtpCaptureLogReader::IsCaptureLog(path));
+
+  RtpReplay replay;
+  replay.Init(path);
+  CheckPackets(&replay, 4);
+  EXPECT_TRUE(File::Delete(path));
+}
+
+TEST(RtpCaptureLogTest, ConvertToRecordio) {
+  string path = "./test_capture.rtplog";
+  string recordio = "./test_capture.pb";
+  WriteLog(path, 2);
+
+  int64_t converted = 0;
+  EXPECT_TRUE(ConvertRtpCaptureLog(path, recordio, &converted));
+  EXPECT_EQ(2 * kPacketsPerThread, converted);
+  EXPECT_FALSE(RtpCaptureLogReader::IsCaptureLog(recordio));
+
+  RtpReplay replay;
+  replay.Init(recordio);
+  CheckPackets(&replay, 2);
+  EXPECT_TRUE(File::Delete(path));
+  EXPECT_TRUE(File::Delete(recordio));
+}
+
+}  // namespace annoymous
+
+}  // namespace orbit
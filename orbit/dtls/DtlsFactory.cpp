@@ -21,7 +21,7 @@
 
 using namespace dtls;
 using namespace std;
-const char* DtlsFactory::DefaultSrtpProfile = "SRTP_AES128_CM_SHA1_80";
+const char* DtlsFactory::DefaultSrtpProfile = "SRTP_AES128_CM_SHA1_80:SRTP_AES128_CM_SHA1_32";
 
 X509 *DtlsFactory::mCert = NULL;
 EVP_PKEY *DtlsFactory::privkey = NULL;
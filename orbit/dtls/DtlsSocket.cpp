@@ -252,6 +252,12 @@ DtlsSocket::getSrtpSessionKeys()
 
    SrtpSessionKeys* keys = new SrtpSessionKeys();
 
+   // The key and salt lengths are the ones of the AES-CM profiles, the only
+   // ones offered by the DtlsFactory (RFC 5764 4.1.2).
+   SRTP_PROTECTION_PROFILE* profile = SSL_get_selected_srtp_profile(mSsl);
+   assert(profile == NULL || profile->id == SRTP_AES128_CM_SHA1_80 ||
+          profile->id == SRTP_AES128_CM_SHA1_32);
+
    unsigned char material[SRTP_MASTER_KEY_LEN << 1];
    if (!SSL_export_keying_material(
       mSsl,
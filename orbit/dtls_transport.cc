@@ -12,12 +12,19 @@
 #include <sys/prctl.h>
 #include "dtls_transport.h"
 #include "srtp_channel.h"
+#include "packet_trace.h"
+#include "nice_reactor.h"
 
 #include "dtls/DtlsFactory.h"
 #include "rtp/rtp_headers.h"
 
+#include "gflags/gflags.h"
 #include "glog/logging.h"
 
+DEFINE_int32(transport_ingress_queue_size, 1024,
+             "The max number of received packets queued for a transport "
+             "with the NiceReactor, the newer packets are dropped.");
+
 using namespace orbit;
 using namespace std;
 using namespace dtls;
@@ -121,6 +128,13 @@ DtlsTransport::DtlsTransport(MediaType med, const std::string &transport_name, b
       dtlsRtcp->setDtlsReceiver(this);
     }
   }
+  if (NiceReactor::IsEnabled()) {
+    // Keep the unprotect, the delegate and the plugins off the shared loop,
+    // a slow connection only delays its own packets.
+    ingress_queue_.reset(new PluginDeliveryQueue(
+        FLAGS_transport_ingress_queue_size,
+        std::bind(&DtlsTransport::onNiceBuffer, this, std::placeholders::_1)));
+  }
   nice_.reset(new NiceConnection(med, transport_name, this, comps, iceConfig_, username, password));
   running_ =true;
 
@@ -129,20 +143,43 @@ DtlsTransport::DtlsTransport(MediaType med, const std::string &transport_name, b
   rtcp_packet_total_ = 0;
   rtp_unprotect_fail_ = 0;
   rtcp_unprotect_fail_ = 0;
-
-  getNice_Thread_ = boost::thread(&DtlsTransport::getNiceDataLoop, this);
 }
 
 DtlsTransport::~DtlsTransport() {
   ELOG_DEBUG("DtlsTransport destructor");
   running_ = false;
   nice_->close();
-  ELOG_DEBUG("Join thread getNice");
-  getNice_Thread_.join();
+  if (ingress_queue_ != NULL) {
+    // Nothing is queued after close(), wait for the packet being processed.
+    ingress_queue_->Stop();
+  }
   ELOG_DEBUG("DTLSTransport destructor END");
 }
 
 void DtlsTransport::onNiceData(unsigned int component_id, char* data, int len, NiceConnection* nice) {
+  PacketBufferPtr buffer = PacketBuffer::Create(data, len);
+  if (buffer == NULL) {
+    return;
+  }
+  buffer->comp = component_id;
+  buffer->trace = PacketTracer::Sample();
+  if (ingress_queue_ != NULL) {
+    // Dropped and counted by the queue if the transport falls behind.
+    ingress_queue_->Push(buffer);
+    return;
+  }
+  onNiceBuffer(buffer);
+}
+
+void DtlsTransport::onNiceBuffer(const PacketBufferPtr& buffer) {
+  // The packet is processed on this thread until it is queued for the
+  // plugin or the senders.
+  PacketTraceScope trace_scope(&buffer->trace);
+  buffer->trace.room = trace_room.load(std::memory_order_relaxed);
+  PacketTracer::EndStage(TRACE_STAGE_NICE_QUEUE);
+  unsigned int component_id = buffer->comp;
+  char* data = buffer->data();
+  int len = buffer->length();
   int length = len;
   SrtpChannel *srtp = srtp_.get();
   if (DtlsTransport::isDtlsPacket(data, len)) {
@@ -161,19 +198,18 @@ void DtlsTransport::onNiceData(unsigned int component_id, char* data, int len, N
     }
     return;
   } else if (this->getTransportState() == TRANSPORT_READY) {
-    memcpy(unprotectBuf_, data, len);
-
+    // The buffer is owned by this thread only, unprotect it in place.
     if (dtlsRtcp != NULL && component_id == 2) {
       srtp = srtcp_.get();
     }
     if (srtp != NULL){
-      RtcpHeader *chead = reinterpret_cast<RtcpHeader*> (unprotectBuf_);
+      RtcpHeader *chead = reinterpret_cast<RtcpHeader*> (data);
       if (chead->isRtcp()){
         {
           boost::mutex::scoped_lock lock(stats_mutex_);
           rtcp_packet_total_++;
         }
-        if(srtp->unprotectRtcp(unprotectBuf_, &length)<0){
+        if(srtp->unprotectRtcp(data, &length)<0){
           LOG(ERROR) << "unprotectRtcp failed...length=" << length;
           boost::mutex::scoped_lock lock(stats_mutex_);
           rtcp_unprotect_fail_++;
@@ -184,7 +220,7 @@ void DtlsTransport::onNiceData(unsigned int component_id, char* data, int len, N
           boost::mutex::scoped_lock lock(stats_mutex_);
           rtp_packet_total_++;
         }
-        if(srtp->unprotectRtp(unprotectBuf_, &length)<0){
+        if(srtp->unprotectRtp(data, &length)<0){
           LOG(ERROR) << "unprotectRtp failed...length=" << length;
           boost::mutex::scoped_lock lock(stats_mutex_);
           rtp_unprotect_fail_++;
@@ -198,7 +234,9 @@ void DtlsTransport::onNiceData(unsigned int component_id, char* data, int len, N
     if (length <= 0){
       return;
     }
-    getTransportListener()->onTransportData(unprotectBuf_, length, this);
+    buffer->set_length(length);
+    PacketTracer::EndStage(TRACE_STAGE_SRTP_UNPROTECT);
+    getTransportListener()->onTransportBuffer(buffer, this);
   }
 }
 
@@ -210,48 +248,138 @@ void DtlsTransport::onCandidate(const CandidateInfo &candidate, NiceConnection *
 
 void DtlsTransport::write(char* data, int len) {
   boost::mutex::scoped_lock lock(writeMutex_);
-  if (nice_==NULL)
+  int comp = 1;
+  int length = protect(data, len, &comp);
+  if (length < 0) {
+    return;
+  }
+  this->writeOnNice(comp, protectBuf_, length);
+}
+
+void DtlsTransport::writeBatched(char* data, int len, UdpBatchSender* batch) {
+  if (batch == NULL) {
+    write(data, len);
+    return;
+  }
+  boost::mutex::scoped_lock lock(writeMutex_);
+  int comp = 1;
+  int length = protect(data, len, &comp);
+  if (length < 0) {
+    return;
+  }
+  sendProtected(comp, protectBuf_, length, batch);
+}
+
+void DtlsTransport::writeBuffers(PacketBufferPtr* buffers, int count,
+                                 UdpBatchSender* batch) {
+  if (nice_ == NULL || this->getTransportState() != TRANSPORT_READY ||
+      nice_->checkIceState() != NICE_READY) {
+    return;
+  }
+  // Only serializes the SRTP sessions. The buffers are shared with the NACK
+  // history, so they are never protected in place: each one is protected
+  // right into its datagram in the batch, the only copy of the packet.
+  boost::mutex::scoped_lock lock(writeMutex_);
+  for (int i = 0; i < count; ++i) {
+    const PacketBuffer& buffer = *buffers[i];
+    bool rtcp = reinterpret_cast<RtcpHeader*>(buffers[i]->data())->isRtcp();
+    int comp = (rtcp && !rtcp_mux_) ? 2 : 1;
+    SrtpChannel *srtp = (rtcp && dtlsRtcp != NULL) ? srtcp_.get() : srtp_.get();
+    if (srtp == NULL) {
+      continue;
+    }
+    int fd = -1;
+    struct sockaddr_storage remote;
+    socklen_t remote_len = 0;
+    char* out = NULL;
+    int out_size = UdpBatchSender::kMaxDatagramSize;
+    if (batch != NULL &&
+        nice_->getSelectedSocket(comp, &fd, &remote, &remote_len)) {
+      out = batch->Reserve(fd, reinterpret_cast<struct sockaddr*>(&remote),
+                           remote_len);
+    }
+    bool batched = (out != NULL);
+    if (!batched) {
+      // No batch, or relayed or TCP pair: protect it into protectBuf_ and
+      // send it via libnice.
+      out = protectBuf_;
+      out_size = sizeof(protectBuf_);
+    }
+    int length = rtcp ? srtp->protectRtcp(buffer, out, out_size) :
+                        srtp->protectRtp(buffer, out, out_size);
+    PacketTracer::EndStage(TRACE_STAGE_SRTP_PROTECT);
+    if (length <= 10) {
+      continue;
+    }
+    if (batched) {
+      batch->Commit(length);
+    } else {
+      this->writeOnNice(comp, out, length);
+    }
+    PacketTracer::EndStage(TRACE_STAGE_SOCKET_WRITE);
+  }
+}
+
+void DtlsTransport::sendProtected(int comp, char* data, int len,
+                                  UdpBatchSender* batch) {
+  int fd = -1;
+  struct sockaddr_storage remote;
+  socklen_t remote_len = 0;
+  if (batch != NULL &&
+      nice_->getSelectedSocket(comp, &fd, &remote, &remote_len) &&
+      batch->Add(fd, reinterpret_cast<struct sockaddr*>(&remote), remote_len,
+                 data, len)) {
     return;
+  }
+  // No batch, or relayed or TCP pair: send it via libnice.
+  this->writeOnNice(comp, data, len);
+}
+
+int DtlsTransport::protect(char* data, int len, int* comp) {
+  if (nice_==NULL)
+    return -1;
   int length = len;
   SrtpChannel *srtp = srtp_.get();
 
   VLOG(4) << "DtlsTransport::Write data_len=" << len;
-  if (this->getTransportState() == TRANSPORT_READY) {
-    memcpy(protectBuf_, data, len);
-    int comp = 1;
-    RtcpHeader *chead = reinterpret_cast<RtcpHeader*> (protectBuf_);
-    if (chead->isRtcp()) {
-      if (!rtcp_mux_) {
-        comp = 2;
-      }
-      if (dtlsRtcp != NULL) {
-        srtp = srtcp_.get();
-      }
-      if (srtp && nice_->checkIceState() == NICE_READY) {
-        if(srtp->protectRtcp(protectBuf_, &length)<0) {
-          return;
-        }
-      } else {
-        return;
-      }
+  if (this->getTransportState() != TRANSPORT_READY) {
+    return -1;
+  }
+  memcpy(protectBuf_, data, len);
+  *comp = 1;
+  RtcpHeader *chead = reinterpret_cast<RtcpHeader*> (protectBuf_);
+  if (chead->isRtcp()) {
+    if (!rtcp_mux_) {
+      *comp = 2;
     }
-    else{
-      comp = 1;
-      if (srtp && nice_->checkIceState() == NICE_READY) {
-        if(srtp->protectRtp(protectBuf_, &length)<0) {
-          return;
-        }
-      } else {
-        return;
-      }
+    if (dtlsRtcp != NULL) {
+      srtp = srtcp_.get();
     }
-    if (length <= 10) {
-      return;
+    if (srtp && nice_->checkIceState() == NICE_READY) {
+      if(srtp->protectRtcp(protectBuf_, &length)<0) {
+        return -1;
+      }
+    } else {
+      return -1;
     }
-    if (nice_->checkIceState() == NICE_READY) {
-      this->writeOnNice(comp, protectBuf_, length);
+  }
+  else{
+    *comp = 1;
+    if (srtp && nice_->checkIceState() == NICE_READY) {
+      if(srtp->protectRtp(protectBuf_, &length)<0) {
+        return -1;
+      }
+    } else {
+      return -1;
     }
   }
+  if (length <= 10) {
+    return -1;
+  }
+  if (nice_->checkIceState() != NICE_READY) {
+    return -1;
+  }
+  return length;
 }
 
 void DtlsTransport::writeDtls(DtlsSocketContext *ctx, const unsigned char* data, unsigned int len) {
@@ -281,7 +409,8 @@ void DtlsTransport::onHandshakeCompleted(DtlsSocketContext *ctx, std::string cli
   if (ctx == dtlsRtp.get()) {
     ELOG_DEBUG("%s - Setting RTP srtp params, is Server? %d", transport_name.c_str(), this->isServer_);
     srtp_.reset(new SrtpChannel());
-    if (srtp_->setRtpParams((char*) clientKey.c_str(), (char*) serverKey.c_str())) {
+    if (srtp_->setRtpParams((char*) clientKey.c_str(), (char*) serverKey.c_str(),
+                            SrtpChannel::profileFromName(srtp_profile))) {
       readyRtp = true;
     } else {
       updateTransportState(TRANSPORT_FAILED);
@@ -293,7 +422,8 @@ void DtlsTransport::onHandshakeCompleted(DtlsSocketContext *ctx, std::string cli
   if (ctx == dtlsRtcp.get()) {
     ELOG_DEBUG("%s - Setting RTCP srtp params", transport_name.c_str());
     srtcp_.reset(new SrtpChannel());
-    if (srtcp_->setRtpParams((char*) clientKey.c_str(), (char*) serverKey.c_str())) {
+    if (srtcp_->setRtpParams((char*) clientKey.c_str(), (char*) serverKey.c_str(),
+                             SrtpChannel::profileFromName(srtp_profile))) {
       readyRtcp = true;
     } else {
       updateTransportState(TRANSPORT_FAILED);
@@ -357,21 +487,6 @@ void DtlsTransport::processLocalSdp(SdpInfo *localSdp_) {
   ELOG_DEBUG( "Processed Local SDP in DTLS Transport with credentials %s, %s", username.c_str(), password.c_str());
 }
 
-void DtlsTransport::getNiceDataLoop(){
-  /* Set thread name */
-  prctl(PR_SET_NAME, (unsigned long)"getNiceDataLoop");
-
-  while(running_){
-    p_ = nice_->getPacket();
-    if (p_->length > 0) {
-        this->onNiceData(p_->comp, p_->data, p_->length, NULL);
-    }
-    if (p_->length == -1){    
-      running_=false;
-      return;
-    }
-  }
-}
 bool DtlsTransport::isDtlsPacket(const char* buf, int len) {
   int data = DtlsFactory::demuxPacket(reinterpret_cast<const unsigned char*>(buf),len);
   switch(data)
@@ -19,6 +19,7 @@
 #include <boost/scoped_ptr.hpp>
 #include "dtls/DtlsSocket.h"
 #include "nice_connection.h"
+#include "plugin_dispatcher.h"
 #include "transport.h"
 #include "logger_helper.h"
 
@@ -33,9 +34,17 @@ class DtlsTransport : dtls::DtlsReceiver, public Transport {
     void connectionStateChanged(IceState newState);
     std::string getMyFingerprint();
     static bool isDtlsPacket(const char* buf, int len);
+    // Called on the thread of the NiceConnection's context, for each
+    // received packet. With the NiceReactor, the packet is only queued for
+    // onNiceBuffer() here, so the shared loop does nothing but the I/O.
     void onNiceData(unsigned int component_id, char* data, int len, NiceConnection* nice);
+    // Unprotects the received packet in place and passes it to the listener.
+    // Runs on a PluginDispatcher worker with the NiceReactor.
+    void onNiceBuffer(const PacketBufferPtr& buffer);
     void onCandidate(const CandidateInfo &candidate, NiceConnection *conn);
     void write(char* data, int len);
+    void writeBatched(char* data, int len, UdpBatchSender* batch);
+    void writeBuffers(PacketBufferPtr* buffers, int count, UdpBatchSender* batch);
     void writeDtls(dtls::DtlsSocketContext *ctx, const unsigned char* data, unsigned int len);
     void onHandshakeCompleted(dtls::DtlsSocketContext *ctx, std::string clientKey, std::string serverKey, std::string srtp_profile);
     void updateIceState(IceState state, NiceConnection *conn);
@@ -43,16 +52,20 @@ class DtlsTransport : dtls::DtlsReceiver, public Transport {
 
   private:
     char protectBuf_[5000];
-    char unprotectBuf_[5000];
     std::shared_ptr<dtls::DtlsSocketContext> dtlsRtp, dtlsRtcp;
     boost::mutex writeMutex_,sessionMutex_;
     boost::scoped_ptr<SrtpChannel> srtp_, srtcp_;
     bool readyRtp, readyRtcp;
     bool running_, isServer_;
     boost::scoped_ptr<Resender> rtcpResender, rtpResender;
-    boost::thread getNice_Thread_;
-    void getNiceDataLoop();
-    packetPtr p_;
+    // Protects the packet into protectBuf_. Returns the protected length, or
+    // -1 if the packet should not be sent. Must hold writeMutex_.
+    int protect(char* data, int len, int* comp);
+    // Sends the protected datagram, into the batch if possible.
+    void sendProtected(int comp, char* data, int len, UdpBatchSender* batch);
+
+    // The received packets, in order, with the NiceReactor only.
+    boost::scoped_ptr<PluginDeliveryQueue> ingress_queue_;
 
     // Stats
     boost::mutex stats_mutex_;
@@ -0,0 +1,284 @@
+/*
+ * Copyright 2016 (C) Orange Labs Inc. All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * egress_scheduler.cc
+ * ---------------------------------------------------------------------------
+ * Implements the process-wide egress scheduler.
+ * ---------------------------------------------------------------------------
+ */
+#include "egress_scheduler.h"
+#include "rtp_sender.h"
+
+#include "stream_service/orbit/base/strutil.h"
+#include "stream_service/orbit/base/timeutil.h"
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include <sys/prctl.h>
+#include <unistd.h>
+#include <thread>
+
+DEFINE_int32(egress_worker_threads, 0,
+             "The number of threads to send the outgoing packets of all the "
+             "streams. Numbers <= 0 mean the number of cores.");
+DEFINE_bool(egress_batch_send, false,
+            "Gather the outgoing datagrams per socket and send them with "
+            "sendmmsg() (and UDP GSO if supported), instead of one "
+            "nice_agent_send() per packet.");
+
+// The idle workers wake up periodically to steal work and update /varz.
+#define EGRESS_WORKER_IDLE_WAIT 50 // in ms
+// The max number of packets sent for one sender before moving on to the
+// next runnable sender.
+#define EGRESS_SENDER_BUDGET 64
+// Update the per-worker queue depth on /varz every second.
+#define EGRESS_EXPORT_INTERVAL 1000 // in ms
+
+namespace orbit {
+
+EgressScheduler::EgressScheduler() {
+  int num_workers = FLAGS_egress_worker_threads;
+  if (num_workers <= 0) {
+    num_workers = std::thread::hardware_concurrency();
+  }
+  if (num_workers <= 0) {
+    num_workers = 1;
+  }
+  LOG(INFO) << "EgressScheduler starts with " << num_workers << " workers.";
+
+  running_ = true;
+  for (int i = 0; i < num_workers; ++i) {
+    Worker* worker = new Worker();
+    worker->index = i;
+    worker->runnable_senders_var.reset(
+        new ExportedVar(StringPrintf("egress_worker_%d_runnable_senders", i)));
+    worker->queued_packets_var.reset(
+        new ExportedVar(StringPrintf("egress_worker_%d_queued_packets", i)));
+    worker->senders_var.reset(
+        new ExportedVar(StringPrintf("egress_worker_%d_senders", i)));
+    if (FLAGS_egress_batch_send) {
+      worker->batch.reset(new UdpBatchSender());
+      worker->batch_syscalls_var.reset(
+          new ExportedVar(StringPrintf("egress_worker_%d_batch_syscalls", i)));
+      worker->batch_datagrams_var.reset(
+          new ExportedVar(StringPrintf("egress_worker_%d_batch_datagrams", i)));
+    }
+    workers_.push_back(worker);
+  }
+  for (Worker* worker : workers_) {
+    worker->thread.reset(
+        new boost::thread(boost::bind(&EgressScheduler::WorkerLoop, this, worker)));
+  }
+}
+
+EgressScheduler::~EgressScheduler() {
+  running_ = false;
+  for (Worker* worker : workers_) {
+    worker->notifier.ForceNotify();
+  }
+  for (Worker* worker : workers_) {
+    if (worker->thread != NULL) {
+      worker->thread->join();
+    }
+    delete worker;
+  }
+  workers_.clear();
+}
+
+void EgressScheduler::Register(RtpSender* sender) {
+  // Shard the sender onto the worker with the fewest senders.
+  Worker* home = workers_[0];
+  for (Worker* worker : workers_) {
+    if (worker->num_senders < home->num_senders) {
+      home = worker;
+    }
+  }
+  home->num_senders++;
+  sender->worker_index_ = home->index;
+  sender->closing_ = false;
+  std::lock_guard<std::mutex> lock(home->mutex);
+  home->senders.push_back(sender);
+}
+
+void EgressScheduler::Unregister(RtpSender* sender) {
+  sender->closing_ = true;
+  for (Worker* worker : workers_) {
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    for (auto it = worker->run_queue.begin(); it != worker->run_queue.end();) {
+      if (*it == sender) {
+        it = worker->run_queue.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+  // Wait for the workers which are still running the sender (if any).
+  while (sender->run_count_ > 0) {
+    usleep(100);
+  }
+  Worker* home = workers_[sender->worker_index_];
+  {
+    std::lock_guard<std::mutex> lock(home->mutex);
+    for (auto it = home->senders.begin(); it != home->senders.end(); ++it) {
+      if (*it == sender) {
+        home->senders.erase(it);
+        break;
+      }
+    }
+  }
+  home->num_senders--;
+  sender->scheduled_ = false;
+}
+
+void EgressScheduler::Schedule(RtpSender* sender) {
+  bool expected = false;
+  if (!sender->scheduled_.compare_exchange_strong(expected, true)) {
+    // Already in a run queue or being run, the worker will pick up the new
+    // packets.
+    return;
+  }
+  if (!Enqueue(sender)) {
+    sender->scheduled_ = false;
+  }
+}
+
+bool EgressScheduler::Enqueue(RtpSender* sender) {
+  Worker* home = workers_[sender->worker_index_];
+  size_t runnable = 0;
+  {
+    std::lock_guard<std::mutex> lock(home->mutex);
+    if (sender->closing_) {
+      return false;
+    }
+    home->run_queue.push_back(sender);
+    runnable = home->run_queue.size();
+  }
+  home->notifier.Notify();
+  if (runnable > 1 && workers_.size() > 1) {
+    // The home worker is busy, let an idle neighbour steal some work.
+    workers_[(home->index + 1) % workers_.size()]->notifier.Notify();
+  }
+  return true;
+}
+
+RtpSender* EgressScheduler::TakeSender(Worker* worker) {
+  {
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    if (!worker->run_queue.empty()) {
+      RtpSender* sender = worker->run_queue.front();
+      worker->run_queue.pop_front();
+      sender->run_count_++;
+      return sender;
+    }
+  }
+  if (workers_.size() <= 1) {
+    return NULL;
+  }
+  // Steal from the back of the busiest worker. Leave the last runnable
+  // sender to its home worker, which is already awake to run it.
+  Worker* victim = NULL;
+  size_t victim_size = 1;
+  for (Worker* other : workers_) {
+    if (other == worker) {
+      continue;
+    }
+    std::lock_guard<std::mutex> lock(other->mutex);
+    if (other->run_queue.size() > victim_size) {
+      victim = other;
+      victim_size = other->run_queue.size();
+    }
+  }
+  if (victim == NULL) {
+    return NULL;
+  }
+  std::lock_guard<std::mutex> lock(victim->mutex);
+  if (victim->run_queue.size() <= 1) {
+    return NULL;
+  }
+  RtpSender* sender = victim->run_queue.back();
+  victim->run_queue.pop_back();
+  sender->run_count_++;
+  return sender;
+}
+
+void EgressScheduler::WorkerLoop(Worker* worker) {
+  /* Set thread name */
+  prctl(PR_SET_NAME, (unsigned long)"EgressWorker");
+
+  while (running_) {
+    RtpSender* sender = TakeSender(worker);
+    if (sender == NULL) {
+      worker->notifier.PrepareWait();
+      sender = TakeSender(worker);
+      if (sender == NULL) {
+        worker->notifier.Wait(EGRESS_WORKER_IDLE_WAIT);
+        ExportQueueDepth(worker);
+        continue;
+      }
+      worker->notifier.CancelWait();
+    }
+
+    bool ready = sender->IsTransportReady();
+    if (ready) {
+      sender->SendPendingPackets(EGRESS_SENDER_BUDGET, worker->batch.get());
+      if (worker->batch != NULL) {
+        // Flush while the sender is still held, so its transports (and the
+        // sockets in the batch) are alive.
+        worker->batch->Flush();
+      }
+    }
+    bool requeue = ready && sender->HasPendingPackets();
+    if (!requeue) {
+      sender->scheduled_ = false;
+      // A packet may have been queued after the check above, but its
+      // Schedule() saw scheduled_ == true and returned. Re-check it.
+      if (ready && sender->HasPendingPackets()) {
+        bool expected = false;
+        requeue = sender->scheduled_.compare_exchange_strong(expected, true);
+      }
+    }
+    if (requeue) {
+      // Put it to the back of the run queue, so the other senders on this
+      // worker get their turn.
+      if (!Enqueue(sender)) {
+        sender->scheduled_ = false;
+      }
+    }
+    // NOTE: the sender may be deleted as soon as run_count_ drops to zero,
+    // don't touch it after this line.
+    sender->run_count_--;
+    ExportQueueDepth(worker);
+  }
+}
+
+void EgressScheduler::ExportQueueDepth(Worker* worker) {
+  long long now = GetCurrentTime_MS();
+  if (now - worker->last_export_ms < EGRESS_EXPORT_INTERVAL) {
+    return;
+  }
+  worker->last_export_ms = now;
+  int runnable = 0;
+  int queued_packets = 0;
+  {
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    runnable = worker->run_queue.size();
+    for (RtpSender* sender : worker->senders) {
+      queued_packets += sender->QueuedPacketsApprox();
+    }
+  }
+  worker->runnable_senders_var->Set(runnable);
+  worker->queued_packets_var->Set(queued_packets);
+  worker->senders_var->Set(worker->num_senders);
+  if (worker->batch != NULL) {
+    uint64_t syscalls = worker->batch->syscalls();
+    uint64_t datagrams = worker->batch->sent_datagrams();
+    worker->batch_syscalls_var->Set(syscalls - worker->last_batch_syscalls);
+    worker->batch_datagrams_var->Set(datagrams - worker->last_batch_datagrams);
+    worker->last_batch_syscalls = syscalls;
+    worker->last_batch_datagrams = datagrams;
+  }
+}
+
+}  // namespace orbit
@@ -0,0 +1,99 @@
+/*
+ * Copyright 2016 (C) Orange Labs Inc. All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * egress_scheduler.h
+ * ---------------------------------------------------------------------------
+ * Defines a process-wide scheduler to send the outgoing packets of all the
+ * RtpSenders with a fixed pool of worker threads.
+ * ---------------------------------------------------------------------------
+ * Each RtpSender is sharded onto a "home" worker when it is registered. When
+ * a packet is queued into an idle sender, the sender is put into its home
+ * worker's run queue. A sender is in at most one run queue and is run by at
+ * most one worker at a time, so the packets of one connection are always
+ * sent in order. An idle worker steals runnable senders from the busiest
+ * other worker, so a hot room does not saturate a single worker.
+ *
+ * The per-worker queue depth is exported on /varz as:
+ *   egress_worker_<N>_runnable_senders
+ *   egress_worker_<N>_queued_packets
+ *   egress_worker_<N>_senders
+ *
+ * With --egress_batch_send, the packets of a sender run are gathered per
+ * socket and sent with sendmmsg()/UDP GSO when the run ends, see
+ * UdpBatchSender. The syscalls and datagrams of the last second are exported
+ * as egress_worker_<N>_batch_syscalls and egress_worker_<N>_batch_datagrams.
+ */
+
+#pragma once
+
+#include <boost/thread.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "udp_batch_sender.h"
+#include "stream_service/orbit/base/event_notifier.h"
+#include "stream_service/orbit/base/singleton.h"
+#include "stream_service/orbit/http_server/exported_var.h"
+
+namespace orbit {
+
+class RtpSender;
+
+class EgressScheduler {
+ public:
+  // Assigns the sender to the worker with the fewest senders.
+  void Register(RtpSender* sender);
+  // Removes the sender from the scheduler. Blocks until no worker is running
+  // the sender anymore, after that the sender can be safely deleted.
+  void Unregister(RtpSender* sender);
+  // Makes the sender runnable. Called after a packet has been queued into
+  // the sender, or when its transport becomes ready. Cheap if the sender is
+  // already runnable.
+  void Schedule(RtpSender* sender);
+
+  int num_workers() const {
+    return workers_.size();
+  }
+
+ private:
+  struct Worker {
+    int index;
+    std::mutex mutex;                    // protects run_queue and senders.
+    std::deque<RtpSender*> run_queue;    // The runnable senders.
+    std::vector<RtpSender*> senders;     // The senders homed here.
+    EventNotifier notifier;
+    boost::scoped_ptr<boost::thread> thread;
+    std::atomic<int> num_senders{0};
+    boost::scoped_ptr<ExportedVar> runnable_senders_var;
+    boost::scoped_ptr<ExportedVar> queued_packets_var;
+    boost::scoped_ptr<ExportedVar> senders_var;
+    long long last_export_ms = 0;
+    // Only used with --egress_batch_send.
+    boost::scoped_ptr<UdpBatchSender> batch;
+    boost::scoped_ptr<ExportedVar> batch_syscalls_var;
+    boost::scoped_ptr<ExportedVar> batch_datagrams_var;
+    uint64_t last_batch_syscalls = 0;
+    uint64_t last_batch_datagrams = 0;
+  };
+
+  void WorkerLoop(Worker* worker);
+  // Pops a sender from the worker's own run queue, or steals one from the
+  // busiest other worker. Returns NULL if there is no runnable sender.
+  RtpSender* TakeSender(Worker* worker);
+  // Puts the sender back to its home worker's run queue. Returns false if
+  // the sender is being unregistered.
+  bool Enqueue(RtpSender* sender);
+  void ExportQueueDepth(Worker* worker);
+
+  std::vector<Worker*> workers_;
+  std::atomic<bool> running_{false};
+
+  DEFINE_AS_SINGLETON_WITHOUT_CONSTRUCTOR(EgressScheduler);
+};
+
+}  // namespace orbit
@@ -0,0 +1,256 @@
+/*
+ * Copyright 2016 All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * i420_compositor_benchmark.cc
+ * ---------------------------------------------------------------------------
+ *  Measures the CPU of mixing the video of one room versus the number of
+ *  tiles, with the GStreamer compositor element the mixer used before and
+ *  with the I420Compositor and each scale kernel.
+ *  Every source sends 640x480 I420 frames, scaled into 180x180 tiles of the
+ *  grid layout of VideoMixerPositionManager. The encoder is not included.
+ *   - gst: appsrc (one per tile, zero copy) -> compositor -> fakesink.
+ *   - <kernel>: UpdateFrame() of every tile, Compose() and one copy of the
+ *     canvas (what is pushed to the encoder).
+ *   - <kernel>_half_static: the same, but half of the sources don't send any
+ *     new frame (e.g. the camera is muted), their tiles are not drawn again.
+ *  The result is the CPU time per second of media, i.e. the share of a core
+ *  a mixed room takes, from getrusage (all threads).
+ * ---------------------------------------------------------------------------
+ * Usage command line:
+ *  bazel-bin/stream_service/orbit/examples/i420_compositor_benchmark \
+ *     --tile_counts=4,9,16 --frames=300 --logtostderr
+ * ---------------------------------------------------------------------------
+ *  Performance result of the I420Compositor (CPU ms per second of media at
+ *  15 fps, -O2, x86_64 VM):
+ *   tiles=4   scalar=36.0   sse2=17.7  sse2_half_static=8.7
+ *   tiles=9   scalar=81.4   sse2=39.6  sse2_half_static=22.6
+ *   tiles=16  scalar=140.5  sse2=66.6  sse2_half_static=27.5
+ *  The SSE2 row kernels halve the cost, the rest is mostly the scalar
+ *  horizontal pass of the box filter.
+ */
+#include "stream_service/orbit/video_mixer/i420_compositor.h"
+#include "stream_service/orbit/video_mixer/i420_scale.h"
+#include "stream_service/orbit/base/strutil.h"
+
+// For Gflags and Glog
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include <gstreamer-1.5/gst/gst.h>
+#include <gst/app/gstappsrc.h>
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include <string>
+#include <vector>
+
+DEFINE_string(tile_counts, "4,9,16", "The numbers of tiles (participants) to test.");
+DEFINE_int32(frames, 300, "How many frames to mix.");
+DEFINE_int32(fps, 15, "The frame rate of the sources, to report per second.");
+DEFINE_int32(source_width, 640, "The width of the source frames.");
+DEFINE_int32(source_height, 480, "The height of the source frames.");
+DEFINE_int32(tile_width, 180, "The width of a tile.");
+DEFINE_int32(tile_height, 180, "The height of a tile.");
+DEFINE_bool(gst_compositor, true, "Also run the GStreamer compositor element.");
+
+using namespace std;
+namespace orbit {
+namespace {
+  // Distinct frames per source, so the content keeps changing.
+  const int kSourceFrames = 4;
+  // The space between the tiles, as VideoMixerPositionManager.
+  const int kTileSpace = 10;
+
+  double CpuMs() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000.0 +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000.0;
+  }
+}  // namespace annoymous
+
+class I420CompositorBenchmark {
+public:
+  I420CompositorBenchmark() {
+  }
+
+  int Run() {
+    CreateSources();
+    vector<string> counts;
+    SplitStringUsing(FLAGS_tile_counts, ",", &counts);
+    I420ScaleKernel default_kernel = GetI420ScaleKernel();
+    double media_seconds = (double)FLAGS_frames / FLAGS_fps;
+    for (const string& count : counts) {
+      int tiles = atoi(count.c_str());
+      if (tiles <= 0) {
+        continue;
+      }
+      Layout(tiles);
+      if (FLAGS_gst_compositor) {
+        LOG(INFO) << "tiles=" << tiles << " gst="
+                  << RunGstCompositor() / media_seconds << " ms/s";
+      }
+      for (I420ScaleKernel kernel : {I420_SCALE_KERNEL_SCALAR,
+                                     I420_SCALE_KERNEL_SSE2}) {
+        if (!SetI420ScaleKernel(kernel)) {
+          LOG(INFO) << I420ScaleKernelName(kernel) << " is not supported, skip.";
+          continue;
+        }
+        LOG(INFO) << "tiles=" << tiles << " " << I420ScaleKernelName(kernel)
+                  << "=" << RunCompositor(false) / media_seconds << " ms/s"
+                  << " " << I420ScaleKernelName(kernel) << "_half_static="
+                  << RunCompositor(true) / media_seconds << " ms/s";
+      }
+    }
+    SetI420ScaleKernel(default_kernel);
+    return 0;
+  }
+
+private:
+  struct Position {
+    int x;
+    int y;
+  };
+
+  void CreateSources() {
+    sources_.resize(kSourceFrames);
+    for (I420Buffer& source : sources_) {
+      source.Resize(FLAGS_source_width, FLAGS_source_height);
+      uint8_t* data = source.y();
+      for (int i = 0; i < source.size(); ++i) {
+        data[i] = rand() % 256;
+      }
+    }
+  }
+
+  // The grid of VideoMixerPositionManager (without centering the last row).
+  void Layout(int tiles) {
+    int columns = (int)ceil(sqrt((double)tiles));
+    int rows = (tiles + columns - 1) / columns;
+    canvas_width_ = (FLAGS_tile_width + kTileSpace) * columns - kTileSpace;
+    canvas_height_ = (FLAGS_tile_height + kTileSpace) * rows - kTileSpace;
+    positions_.clear();
+    for (int i = 0; i < tiles; ++i) {
+      Position position;
+      position.x = (FLAGS_tile_width + kTileSpace) * (i % columns);
+      position.y = (FLAGS_tile_height + kTileSpace) * (i / columns);
+      positions_.push_back(position);
+    }
+  }
+
+  // Returns the CPU ms.
+  double RunCompositor(bool half_static) {
+    I420Compositor compositor;
+    compositor.SetCanvasSize(canvas_width_, canvas_height_);
+    for (size_t i = 0; i < positions_.size(); ++i) {
+      compositor.SetTile(i, positions_[i].x, positions_[i].y,
+                         FLAGS_tile_width, FLAGS_tile_height);
+    }
+    vector<uint8_t> output;
+    double start = CpuMs();
+    for (int n = 0; n < FLAGS_frames; ++n) {
+      for (size_t i = 0; i < positions_.size(); ++i) {
+        // The static sources still send their first frame.
+        if (half_static && i % 2 == 1 && n > 0) {
+          continue;
+        }
+        compositor.UpdateFrame(i, sources_[(n + i) % kSourceFrames].frame());
+      }
+      compositor.Compose();
+      const I420Buffer& canvas = compositor.canvas();
+      output.assign(canvas.data(), canvas.data() + canvas.size());
+    }
+    return CpuMs() - start;
+  }
+
+  // Returns the CPU ms.
+  double RunGstCompositor() {
+    GstElement* pipeline = gst_pipeline_new("compositor_benchmark");
+    GstElement* compositor = gst_element_factory_make("compositor", NULL);
+    g_object_set(G_OBJECT(compositor), "background", 1, NULL);
+    GstElement* caps_filter = gst_element_factory_make("capsfilter", NULL);
+    GstCaps* caps = gst_caps_new_simple("video/x-raw",
+        "width", G_TYPE_INT, canvas_width_,
+        "height", G_TYPE_INT, canvas_height_, NULL);
+    g_object_set(G_OBJECT(caps_filter), "caps", caps, NULL);
+    gst_caps_unref(caps);
+    GstElement* sink = gst_element_factory_make("fakesink", NULL);
+    g_object_set(G_OBJECT(sink), "sync", FALSE, NULL);
+    gst_bin_add_many(GST_BIN(pipeline), compositor, caps_filter, sink, NULL);
+    gst_element_link_many(compositor, caps_filter, sink, NULL);
+
+    caps = gst_caps_new_simple("video/x-raw",
+        "format", G_TYPE_STRING, "I420",
+        "width", G_TYPE_INT, FLAGS_source_width,
+        "height", G_TYPE_INT, FLAGS_source_height,
+        "framerate", GST_TYPE_FRACTION, FLAGS_fps, 1, NULL);
+    vector<GstElement*> srcs;
+    for (const Position& position : positions_) {
+      GstElement* src = gst_element_factory_make("appsrc", NULL);
+      g_object_set(G_OBJECT(src), "caps", caps, "format", GST_FORMAT_TIME,
+                   "block", TRUE, "max-bytes", (guint64)(4 * sources_[0].size()),
+                   NULL);
+      gst_bin_add(GST_BIN(pipeline), src);
+      GstPad* sink_pad = gst_element_get_request_pad(compositor, "sink_%u");
+      g_object_set(G_OBJECT(sink_pad), "xpos", position.x, "ypos", position.y,
+                   "width", FLAGS_tile_width, "height", FLAGS_tile_height, NULL);
+      GstPad* src_pad = gst_element_get_static_pad(src, "src");
+      gst_pad_link(src_pad, sink_pad);
+      gst_object_unref(src_pad);
+      gst_object_unref(sink_pad);
+      srcs.push_back(src);
+    }
+    gst_caps_unref(caps);
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+    double start = CpuMs();
+    for (int n = 0; n < FLAGS_frames; ++n) {
+      for (size_t i = 0; i < srcs.size(); ++i) {
+        const I420Buffer& source = sources_[(n + i) % kSourceFrames];
+        // Wraps the source frame, not copied.
+        GstBuffer* buffer = gst_buffer_new_wrapped_full(
+            GST_MEMORY_FLAG_READONLY, (gpointer)source.data(), source.size(),
+            0, source.size(), NULL, NULL);
+        GST_BUFFER_PTS(buffer) = gst_util_uint64_scale(n, GST_SECOND, FLAGS_fps);
+        GST_BUFFER_DURATION(buffer) = gst_util_uint64_scale(1, GST_SECOND, FLAGS_fps);
+        gst_app_src_push_buffer(GST_APP_SRC(srcs[i]), buffer);
+      }
+    }
+    for (GstElement* src : srcs) {
+      gst_app_src_end_of_stream(GST_APP_SRC(src));
+    }
+    GstBus* bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline));
+    GstMessage* msg = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE,
+        (GstMessageType)(GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+    if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR) {
+      LOG(ERROR) << "The compositor pipeline failed.";
+    }
+    double cpu_ms = CpuMs() - start;
+    gst_message_unref(msg);
+    gst_object_unref(bus);
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(pipeline);
+    return cpu_ms;
+  }
+
+  vector<I420Buffer> sources_;
+  vector<Position> positions_;
+  int canvas_width_ = 0;
+  int canvas_height_ = 0;
+};  // end of class.
+
+}  // namespace orbit
+
+int main(int argc, char** argv) {
+  google::InstallFailureSignalHandler();
+  google::ParseCommandLineFlags(&argc, &argv, false);
+  google::InitGoogleLogging(argv[0]);
+  gst_init(&argc, &argv);
+
+  orbit::I420CompositorBenchmark main;
+  return main.Run();
+}
@@ -0,0 +1,261 @@
+/*
+ * Copyright 2016 All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * nack_storm_benchmark.cc
+ * ---------------------------------------------------------------------------
+ *  Replays NACK storms against the RetransmitHistory of the NackProcessor,
+ *  versus the std::list<shared_ptr<RtpRetransmitPacket>> used before.
+ *  A sender pushes the sent packets, and every --nack_interval packets the
+ *  receiver NACKs --loss_percent of the recent ones (and some of them again,
+ *  as the browsers do when the retransmission is lost too).
+ *
+ *  The sender and the NACK handling run on two threads, the push latency of
+ *  the sender is reported as well: with the list the sender waits for the
+ *  whole NACK scan under the mutex.
+ * ---------------------------------------------------------------------------
+ * Usage command line:
+ *  bazel-bin/stream_service/orbit/examples/nack_storm_benchmark \
+ *     --loss_percent=10 --nack_interval=20 --logtostderr
+ * ---------------------------------------------------------------------------
+ *  Performance result (-O2, 1200 bytes packets, loss_percent=10,
+ *  nack_interval=20, 300 packets in the legacy list):
+ *   lookup ns per NACKed seq:  legacy=1013  history=50
+ *   push ns per packet:        legacy=212   history=159
+ *  The push of the history includes the copy into the PacketBuffer, which
+ *  the NackProcessor shares with the send path instead. The max push stall
+ *  is dominated by the scheduler unless the threads are pinned.
+ */
+#include "stream_service/orbit/rtp/retransmit_history.h"
+#include "stream_service/orbit/rtp/rtp_headers.h"
+#include "stream_service/orbit/base/timeutil.h"
+
+// For Gflags and Glog
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+DEFINE_int32(packet_size, 1200, "The size of each rtp packet.");
+DEFINE_int32(packets, 1000000, "How many packets to send.");
+DEFINE_int32(loss_percent, 10, "The percentage of the packets NACKed.");
+DEFINE_int32(nack_interval, 20, "A NACK is received every this many "
+             "packets sent.");
+DEFINE_int32(history_size, 300, "The packets kept by the legacy list.");
+
+using namespace std;
+namespace orbit {
+
+// The retransmit list of the NackProcessor before the RetransmitHistory.
+class LegacyRetransmitList {
+ public:
+  struct RtpRetransmitPacket {
+    uint16_t seqn;
+    unsigned char* buf = NULL;
+    int buf_size;
+    long ts;
+    int retries;
+    ~RtpRetransmitPacket() {
+      free(buf);
+    }
+  };
+  typedef std::shared_ptr<RtpRetransmitPacket> RtpRetransmitPacketPtr;
+
+  void PushPacket(const char* buf, int len, long now) {
+    const RtpHeader* rtp = reinterpret_cast<const RtpHeader*>(buf);
+    char* rbuf = reinterpret_cast<char*>(malloc(len));
+    memcpy(rbuf, buf, len);
+    auto rp = std::make_shared<RtpRetransmitPacket>();
+    rp->seqn = rtp->getSeqNumber();
+    rp->buf = (unsigned char*) rbuf;
+    rp->buf_size = len;
+    rp->retries = 0;
+    rp->ts = now;
+    std::lock_guard<std::mutex> lock(mutex_);
+    list_.push_back(rp);
+    while ((int)list_.size() > FLAGS_history_size) {
+      list_.pop_front();
+    }
+  }
+
+  // Returns true if the packet would be retransmitted.
+  bool Retransmit(uint16_t seqn, long now) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = list_.rbegin(); it != list_.rend(); ++it) {
+      RtpRetransmitPacketPtr rp = *it;
+      if (seqn == rp->seqn) {
+        if (rp->retries < 5 && (rp->retries == 0 || now - rp->ts > 30)) {
+          rp->ts = now;
+          rp->retries++;
+          // The packet was copied into a dataPacket to be relayed.
+          memcpy(relay_, rp->buf, rp->buf_size);
+          return true;
+        }
+        return false;
+      }
+    }
+    return false;
+  }
+
+ private:
+  std::list<RtpRetransmitPacketPtr> list_;
+  std::mutex mutex_;
+  char relay_[1500];
+};
+
+class NackStormBenchmark {
+public:
+  NackStormBenchmark() {
+  }
+
+  int Run() {
+    packet_.resize(std::max(FLAGS_packet_size, (int)sizeof(RtpHeader)));
+    for (size_t i = 0; i < packet_.size(); ++i) {
+      packet_[i] = rand();
+    }
+    MakeNacks();
+
+    LegacyRetransmitList legacy;
+    Result legacy_result = RunStorm(
+      [&legacy, this](uint16_t seqn, long now) {
+        legacy.PushPacket(PacketOf(seqn), packet_.size(), now);
+      },
+      [&legacy](uint16_t seqn, long now) {
+        return legacy.Retransmit(seqn, now);
+      });
+
+    RetransmitHistory history;
+    Result history_result = RunStorm(
+      [&history, this](uint16_t seqn, long now) {
+        history.Put(PacketBuffer::Create(PacketOf(seqn), packet_.size()),
+                    now);
+      },
+      [&history](uint16_t seqn, long now) {
+        PacketBufferPtr buffer;
+        return history.GetForRetransmit(seqn, now, &buffer, NULL) ==
+          RetransmitHistory::RETRANSMIT;
+      });
+
+    LOG(INFO) << "lookup ns per NACKed seq: legacy=" << legacy_result.lookup_ns
+              << " history=" << history_result.lookup_ns;
+    LOG(INFO) << "push ns per packet: legacy=" << legacy_result.push_ns
+              << " history=" << history_result.push_ns;
+    LOG(INFO) << "max push stall us: legacy=" << legacy_result.max_push_us
+              << " history=" << history_result.max_push_us;
+    LOG(INFO) << "retransmitted: legacy=" << legacy_result.retransmitted
+              << " history=" << history_result.retransmitted
+              << " of " << nacked_;
+    return 0;
+  }
+
+private:
+  struct Result {
+    double lookup_ns = 0;
+    double push_ns = 0;
+    long long max_push_us = 0;
+    long long retransmitted = 0;
+  };
+
+  // nacks_[i] is the NACK received after the packet i is sent.
+  void MakeNacks() {
+    nacks_.resize(FLAGS_packets);
+    nacked_ = 0;
+    for (int i = FLAGS_nack_interval; i < FLAGS_packets;
+         i += FLAGS_nack_interval) {
+      // The lost packets among the last 2 intervals, so half of them are
+      // NACKed again.
+      for (int j = i - 2 * FLAGS_nack_interval; j < i; ++j) {
+        if (j >= 0 && rand() % 100 < FLAGS_loss_percent) {
+          nacks_[i].push_back((uint16_t)j);
+          nacked_++;
+        }
+      }
+    }
+  }
+
+  const char* PacketOf(uint16_t seq) {
+    reinterpret_cast<RtpHeader*>(packet_.data())->setSeqNumber(seq);
+    return packet_.data();
+  }
+
+  static long long NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  // The packet i is sent at i/2 ms (about 2000 packets/s). The NACKs are
+  // handled by another thread, as the RTCP is received on the libnice
+  // thread, and the packets are sent by the plugin threads. The sender is
+  // kept at most one nack_interval ahead of the NACK handling, as it would
+  // be in real time.
+  template <typename PushFunc, typename LookupFunc>
+  Result RunStorm(PushFunc push, LookupFunc lookup) {
+    Result result;
+    std::atomic<int> sent{0};
+    std::atomic<int> handled{-1};
+    long long lookup_ns = 0;
+    long long retransmitted = 0;
+    std::thread nack_thread([&]() {
+      for (int i = 0; i < FLAGS_packets; ++i) {
+        while (sent.load(std::memory_order_acquire) <= i) {
+          std::this_thread::yield();
+        }
+        if (!nacks_[i].empty()) {
+          long long start = NowNs();
+          for (uint16_t seqn : nacks_[i]) {
+            if (lookup(seqn, i / 2)) {
+              retransmitted++;
+            }
+          }
+          lookup_ns += NowNs() - start;
+        }
+        handled.store(i, std::memory_order_release);
+      }
+    });
+
+    long long push_ns = 0;
+    for (int i = 0; i < FLAGS_packets; ++i) {
+      while (handled.load(std::memory_order_acquire) <
+             i - FLAGS_nack_interval) {
+        std::this_thread::yield();
+      }
+      long long start = NowNs();
+      push((uint16_t)i, i / 2);
+      long long ns = NowNs() - start;
+      push_ns += ns;
+      if (ns / 1000 > result.max_push_us) {
+        result.max_push_us = ns / 1000;
+      }
+      sent.store(i + 1, std::memory_order_release);
+    }
+    nack_thread.join();
+    result.push_ns = (double)push_ns / FLAGS_packets;
+    result.lookup_ns = nacked_ > 0 ? (double)lookup_ns / nacked_ : 0;
+    result.retransmitted = retransmitted;
+    return result;
+  }
+
+  vector<char> packet_;
+  vector<vector<uint16_t>> nacks_;
+  long long nacked_ = 0;
+};  // end of class.
+
+}  // namespace orbit
+
+int main(int argc, char** argv) {
+  google::InstallFailureSignalHandler();
+  google::ParseCommandLineFlags(&argc, &argv, false);
+  google::InitGoogleLogging(argv[0]);
+
+  orbit::NackStormBenchmark main;
+  return main.Run();
+}
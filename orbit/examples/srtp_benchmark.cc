@@ -0,0 +1,220 @@
+/*
+ * Copyright 2016 All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * srtp_benchmark.cc
+ * ---------------------------------------------------------------------------
+ *  Measures the SRTP protect throughput of the egress path per crypto
+ *  profile:
+ *   - copy: the copy into a per transport buffer followed by protectRtp(),
+ *     what DtlsTransport::write() does.
+ *   - clone: the pooled buffer is cloned, then protected in place, what the
+ *     egress path did for the packets shared with the NACK history.
+ *   - into_batch: the pooled buffer is protected right into the datagram of
+ *     the batch, what DtlsTransport::writeBuffers() does now.
+ * ---------------------------------------------------------------------------
+ * Each thread owns a SrtpChannel, as each transport does, and protects
+ * --packets packets of --packet_size bytes in batches of --batch_size (the
+ * batch of a sender run). The packets are created from the pool for each
+ * round in all modes, as the producers (the rooms) do, and a second
+ * reference of each one is kept in a ring of --history_size, as the
+ * RetransmitHistory does for all the media packets.
+ *
+ * The profiles are AES_CM_128_HMAC_SHA1_80 and AES_CM_128_HMAC_SHA1_32, the
+ * ones offered by the DtlsFactory.
+ *
+ * Usage command line:
+ *  bazel-bin/stream_service/orbit/examples/srtp_benchmark \
+ *     --packets=1000000 --threads=1,2,4 --logtostderr
+ */
+#include "stream_service/orbit/srtp_channel.h"
+#include "stream_service/orbit/packet_buffer.h"
+#include "stream_service/orbit/udp_batch_sender.h"
+#include "stream_service/orbit/rtp/rtp_headers.h"
+#include "stream_service/orbit/base/strutil.h"
+
+// For Gflags and Glog
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+DEFINE_int32(packet_size, 1200, "The size of each rtp packet.");
+DEFINE_int32(packets, 1000000, "How many packets each thread protects.");
+DEFINE_int32(batch_size, 16, "The packets protected per batch.");
+DEFINE_int32(history_size, 512, "The packets still referenced by the NACK "
+             "history, 0 to protect unshared buffers.");
+DEFINE_string(threads, "1,2,4", "The numbers of threads (transports) to "
+              "test.");
+
+using namespace std;
+namespace orbit {
+
+namespace {
+
+// The base64 master key and salt (30 bytes) of each side.
+const char kKey[] = "AAECAwQFBgcICQoLDA0ODxAREhMUFRYXGBkaGxwd";
+const char kPeerKey[] = "ZGVmZ2hpamtsbW5vcHFyc3R1dnd4eXp7fH1+f4CB";
+
+const char* ProfileName(SrtpChannel::Profile profile) {
+  switch (profile) {
+    case SrtpChannel::AES_CM_128_HMAC_SHA1_80:
+      return "AES_CM_128_HMAC_SHA1_80";
+    case SrtpChannel::AES_CM_128_HMAC_SHA1_32:
+      return "AES_CM_128_HMAC_SHA1_32";
+  }
+  return "UNKNOWN";
+}
+
+enum ProtectMode {
+  PROTECT_COPY,
+  PROTECT_CLONE,
+  PROTECT_INTO_BATCH,
+};
+
+const char* ModeName(ProtectMode mode) {
+  switch (mode) {
+    case PROTECT_COPY:
+      return "copy";
+    case PROTECT_CLONE:
+      return "clone";
+    case PROTECT_INTO_BATCH:
+      return "into_batch";
+  }
+  return "unknown";
+}
+
+}  // anonymous namespace
+
+class SrtpBenchmark {
+ public:
+  int Run() {
+    vector<string> threads;
+    SplitStringUsing(FLAGS_threads, ",", &threads);
+    for (SrtpChannel::Profile profile : {SrtpChannel::AES_CM_128_HMAC_SHA1_80,
+                                         SrtpChannel::AES_CM_128_HMAC_SHA1_32}) {
+      for (const string& thread_count : threads) {
+        int count = atoi(thread_count.c_str());
+        if (count <= 0) {
+          continue;
+        }
+        for (ProtectMode mode : {PROTECT_COPY, PROTECT_CLONE,
+                                 PROTECT_INTO_BATCH}) {
+          RunOnce(profile, count, mode);
+        }
+      }
+    }
+    return 0;
+  }
+
+ private:
+  // Protects the packets on one thread, returns false on any error.
+  static bool Protect(SrtpChannel::Profile profile, ProtectMode mode) {
+    string key = kKey;
+    string peer_key = kPeerKey;
+    SrtpChannel srtp;
+    if (!srtp.setRtpParams((char*)key.c_str(), (char*)peer_key.c_str(),
+                           profile)) {
+      return false;
+    }
+
+    vector<char> payload(FLAGS_packet_size, 'x');
+    RtpHeader* header = reinterpret_cast<RtpHeader*>(payload.data());
+    memset(header, 0, sizeof(RtpHeader));
+    header->setVersion(2);
+    header->setPayloadType(100);
+    header->setSSRC(55543);
+
+    char protect_buf[5000];
+    // The datagrams of the batch, as in the UdpBatchSender.
+    vector<char> datagrams(FLAGS_batch_size * UdpBatchSender::kMaxDatagramSize);
+    vector<PacketBufferPtr> buffers(FLAGS_batch_size);
+    vector<PacketBufferPtr> history(FLAGS_history_size);
+    size_t history_pos = 0;
+    uint16_t seqn = 0;
+    for (int sent = 0; sent < FLAGS_packets; sent += FLAGS_batch_size) {
+      for (PacketBufferPtr& buffer : buffers) {
+        header->setSeqNumber(seqn++);
+        buffer = PacketBuffer::Create(payload.data(), payload.size());
+        if (!history.empty()) {
+          history[history_pos++ % history.size()] = buffer;
+        }
+      }
+      for (size_t i = 0; i < buffers.size(); ++i) {
+        const PacketBufferPtr& buffer = buffers[i];
+        int length = buffer->length();
+        switch (mode) {
+          case PROTECT_COPY:
+            memcpy(protect_buf, buffer->data(), length);
+            if (srtp.protectRtp(protect_buf, &length) < 0) {
+              return false;
+            }
+            break;
+          case PROTECT_CLONE: {
+            PacketBufferPtr copy = buffer;
+            if (copy->ref_count() > 1) {
+              copy = copy->Clone();
+            }
+            if (srtp.protectRtp(copy->data(), &length) < 0) {
+              return false;
+            }
+            break;
+          }
+          case PROTECT_INTO_BATCH:
+            if (srtp.protectRtp(*buffer, &datagrams[i * UdpBatchSender::kMaxDatagramSize],
+                                UdpBatchSender::kMaxDatagramSize) < 0) {
+              return false;
+            }
+            break;
+        }
+      }
+    }
+    return true;
+  }
+
+  void RunOnce(SrtpChannel::Profile profile, int thread_count,
+               ProtectMode mode) {
+    auto start = chrono::steady_clock::now();
+    vector<thread> threads;
+    vector<char> results(thread_count, 0);
+    for (int i = 0; i < thread_count; ++i) {
+      threads.emplace_back([&results, i, profile, mode]() {
+          results[i] = Protect(profile, mode);
+        });
+    }
+    for (thread& t : threads) {
+      t.join();
+    }
+    double seconds = chrono::duration<double>(
+        chrono::steady_clock::now() - start).count();
+    for (char result : results) {
+      if (!result) {
+        LOG(ERROR) << ProfileName(profile) << " failed to protect.";
+        return;
+      }
+    }
+    double packets = (double)FLAGS_packets * thread_count;
+    LOG(INFO) << ProfileName(profile) << " " << ModeName(mode)
+              << " history=" << FLAGS_history_size
+              << " threads=" << thread_count
+              << " kpps=" << (int)(packets / seconds / 1000)
+              << " MB/s=" << (int)(packets * FLAGS_packet_size / seconds / 1e6);
+  }
+};  // end of class.
+
+}  // namespace orbit
+
+int main(int argc, char** argv) {
+  google::InstallFailureSignalHandler();
+  google::ParseCommandLineFlags(&argc, &argv, false);
+  google::InitGoogleLogging(argv[0]);
+
+  orbit::SrtpBenchmark main;
+  return main.Run();
+}
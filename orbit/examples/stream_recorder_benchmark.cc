@@ -0,0 +1,169 @@
+/*
+ * Copyright 2016 All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * stream_recorder_benchmark.cc
+ * ---------------------------------------------------------------------------
+ *  Measures the CPU of recording one stream with the StreamRecorderElement,
+ *  for every record mode:
+ *   - webm / mkv: the VP8 (or H264) and Opus packets are depayloaded and
+ *     muxed as they are.
+ *   - mp4: the Opus audio is transcoded to AAC, the H264 video is muxed as
+ *     it is (--record_passthrough).
+ *   - mp4_transcode: the video is decoded, scaled and encoded to H264 again,
+ *     as all the mp4 recording did before.
+ *  The audio and video packets of one transport of the captured file are
+ *  pushed unthrottled, the result is the CPU time per second of media, i.e.
+ *  the share of a core a recorded stream takes, from getrusage (all
+ *  threads, until the file is finished).
+ *  The modes need the plugins of gst-plugins-base (opusdec, videoscale,
+ *  videorate), -good (rtpvp8depay, rtph264depay, rtpopusdepay, vp8dec,
+ *  webmmux, matroskamux, qtmux), -bad (h264parse, voaacenc), -ugly
+ *  (x264enc) and gst-libav (avdec_h264). No before/after numbers are
+ *  recorded yet.
+ * ---------------------------------------------------------------------------
+ * Usage command line:
+ *  bazel-bin/stream_service/orbit/examples/stream_recorder_benchmark \
+ *     --replay_file=./record8.pb --record_modes=webm,mp4,mp4_transcode \
+ *     --logtostderr
+ */
+#include "stream_service/orbit/debug_server/rtp_capture.h"
+#include "stream_service/orbit/modules/stream_recorder_element.h"
+#include "stream_service/orbit/base/strutil.h"
+
+// For Gflags and Glog
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include <gstreamer-1.5/gst/gst.h>
+
+#include <string.h>
+#include <sys/resource.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+DEFINE_string(replay_file, "", "Specifies the captured pb file, with audio and video.");
+DEFINE_int32(transport_id, -1, "The transport to record, -1 is the one of the first video packet.");
+DEFINE_string(record_modes, "webm,mkv,mp4,mp4_transcode", "The record modes to test.");
+DEFINE_string(output_directory, "/tmp/", "Where the recorded files are written.");
+DECLARE_string(record_format);
+DECLARE_bool(record_passthrough);
+
+using namespace std;
+namespace orbit {
+namespace {
+  double CpuMs() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000.0 +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000.0;
+  }
+}  // namespace annoymous
+
+class StreamRecorderBenchmark {
+public:
+  StreamRecorderBenchmark() {
+  }
+
+  int Run() {
+    if (!LoadPackets()) {
+      LOG(ERROR) << "No video packet in " << FLAGS_replay_file;
+      return -1;
+    }
+    double media_seconds = media_ms_ / 1000.0;
+    LOG(INFO) << "Record " << packets_.size() << " packets, " << media_seconds
+              << " s of media, video payload " << video_encoding_;
+    vector<string> modes;
+    SplitStringUsing(FLAGS_record_modes, ",", &modes);
+    for (const string& mode : modes) {
+      if (mode == "mp4_transcode") {
+        FLAGS_record_format = "mp4";
+        FLAGS_record_passthrough = false;
+      } else {
+        FLAGS_record_format = mode;
+        FLAGS_record_passthrough = true;
+      }
+      string file = StringPrintf("%s/stream_recorder_benchmark.%s",
+                                 FLAGS_output_directory.c_str(), mode.c_str());
+      LOG(INFO) << mode << "=" << Record(file) / media_seconds << " ms/s";
+    }
+    return 0;
+  }
+
+private:
+  // Reads the RTP packets of the transport, as the replay pipeline does.
+  bool LoadPackets() {
+    std::unique_ptr<RtpReplay> replay(new RtpReplay);
+    replay->Init(FLAGS_replay_file);
+    int transport_id = FLAGS_transport_id;
+    long first_ts = -1;
+    std::shared_ptr<StoredPacket> packet;
+    while ((packet = replay->Next()) != NULL) {
+      if (packet->packet_type() != RTP_PACKET ||
+          (packet->type() != AUDIO && packet->type() != VIDEO)) {
+        continue;
+      }
+      if (transport_id == -1 && packet->type() == VIDEO) {
+        transport_id = packet->transport_id();
+      }
+      if (packet->transport_id() != transport_id) {
+        continue;
+      }
+      if (packet->type() == VIDEO && video_encoding_ == -1) {
+        const RtpHeader* head = reinterpret_cast<const RtpHeader*>(packet->data().c_str());
+        video_encoding_ = head->getPayloadType();
+        if (video_encoding_ == RED_90000_PT) {
+          const RedHeader* red_header = reinterpret_cast<const RedHeader*>(
+              packet->data().c_str() + 12);
+          video_encoding_ = red_header->payloadtype;
+        }
+      }
+      if (first_ts == -1) {
+        first_ts = packet->ts();
+      }
+      media_ms_ = packet->ts() - first_ts;
+      packets_.push_back(packet);
+    }
+    return video_encoding_ != -1 && media_ms_ > 0;
+  }
+
+  // Returns the CPU ms.
+  double Record(const string& file) {
+    double start = CpuMs();
+    StreamRecorderElement* recorder = new StreamRecorderElement(file, video_encoding_);
+    for (const auto& packet : packets_) {
+      dataPacket p;
+      p.comp = 0;
+      p.type = packet->type() == VIDEO ? VIDEO_PACKET : AUDIO_PACKET;
+      p.remote_ntp_time_ms = packet->remote_ntp_time_ms();
+      memcpy(&(p.data[0]), packet->data().c_str(), packet->packet_length());
+      p.length = packet->packet_length();
+      if (p.type == VIDEO_PACKET) {
+        recorder->PushVideoPacket(p);
+      } else {
+        recorder->PushAudioPacket(p);
+      }
+    }
+    // Flushes the queues and waits for the end of the file.
+    delete recorder;
+    return CpuMs() - start;
+  }
+
+  vector<std::shared_ptr<StoredPacket> > packets_;
+  int video_encoding_ = -1;
+  long media_ms_ = 0;
+};  // end of class.
+
+}  // namespace orbit
+
+int main(int argc, char** argv) {
+  google::InstallFailureSignalHandler();
+  google::ParseCommandLineFlags(&argc, &argv, false);
+  google::InitGoogleLogging(argv[0]);
+  gst_init(&argc, &argv);
+
+  orbit::StreamRecorderBenchmark main;
+  return main.Run();
+}
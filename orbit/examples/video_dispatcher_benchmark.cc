@@ -0,0 +1,192 @@
+/*
+ * Copyright 2016 All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * video_dispatcher_benchmark.cc
+ * ---------------------------------------------------------------------------
+ *  Measures the fan-out of the VideoDispatcherRoom: one publisher pushes
+ *  video packets as fast as the room takes them, and every packet is
+ *  relayed to each of the --viewers. The viewers don't have a transport,
+ *  they only make the one copy that TransportDelegate::RelayBuffer makes
+ *  into the egress buffer.
+ *
+ *  Reported per number of viewers:
+ *   pps              the publisher packets forwarded per second
+ *   relays/s         pps * viewers
+ *   latency_us       publish -> relayed to the last viewer, p50/p99/max
+ *   full_ring_waits  how often the publisher found the queue full
+ * ---------------------------------------------------------------------------
+ * Usage command line:
+ *  bazel-bin/stream_service/orbit/examples/video_dispatcher_benchmark \
+ *     --viewers=10,100,500 --packets=200000 --logtostderr
+ */
+#include "stream_service/orbit/video_dispatcher/video_dispatcher_plugin.h"
+#include "stream_service/orbit/video_dispatcher/video_dispatcher_room.h"
+#include "stream_service/orbit/rtp/rtp_headers.h"
+#include "stream_service/orbit/base/strutil.h"
+
+// For Gflags and Glog
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+DEFINE_int32(packet_size, 1200, "The size of each rtp packet.");
+DEFINE_int32(packets, 200000, "How many packets the publisher sends.");
+DEFINE_string(viewers, "10,100,500", "The numbers of viewers to test.");
+
+using namespace std;
+namespace orbit {
+
+namespace {
+
+long long NowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+}  // annoymous namespace
+
+// A viewer without transport. The last viewer of the room records when the
+// packet has been relayed to everyone.
+class BenchmarkViewer : public VideoDispatcherPlugin {
+ public:
+  BenchmarkViewer(std::weak_ptr<Room> room, int stream_id,
+                  vector<int32_t>* latency_us)
+    : VideoDispatcherPlugin(room, stream_id), latency_us_(latency_us) {
+    SetGateway(NULL);
+  }
+
+  void RelayRtpBuffer(const PacketBufferPtr& buffer) override {
+    PacketBufferPtr egress = PacketBuffer::Create(buffer->data(),
+                                                  buffer->length());
+    relayed_.fetch_add(1, std::memory_order_relaxed);
+    if (latency_us_ != NULL) {
+      long long sent_ns;
+      memcpy(&sent_ns, egress->data() + RTP_HEADER_BASE_SIZE, sizeof(sent_ns));
+      latency_us_->push_back((NowNs() - sent_ns) / 1000);
+    }
+  }
+
+  int64_t relayed() const {
+    return relayed_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  vector<int32_t>* latency_us_;
+  std::atomic<int64_t> relayed_{0};
+};
+
+class VideoDispatcherBenchmark {
+ public:
+  int Run() {
+    vector<string> counts;
+    SplitStringUsing(FLAGS_viewers, ",", &counts);
+    for (const string& count : counts) {
+      int viewers = atoi(count.c_str());
+      if (viewers > 0) {
+        RunRoom(viewers);
+      }
+    }
+    return 0;
+  }
+
+ private:
+  void RunRoom(int num_viewers) {
+    const int kPublisherId = 1;
+    std::shared_ptr<VideoDispatcherRoom> room =
+      std::make_shared<VideoDispatcherRoom>();
+    room->Start();
+
+    VideoDispatcherPlugin* publisher =
+      new VideoDispatcherPlugin(room, kPublisherId);
+    publisher->SetGateway(NULL);
+    room->AddParticipant(publisher);
+    vector<int32_t> latency_us;
+    latency_us.reserve(FLAGS_packets);
+    vector<BenchmarkViewer*> viewers;
+    for (int i = 0; i < num_viewers; ++i) {
+      BenchmarkViewer* viewer = new BenchmarkViewer(
+          room, kPublisherId + 1 + i,
+          i == num_viewers - 1 ? &latency_us : NULL);
+      viewers.push_back(viewer);
+      room->AddParticipant(viewer);
+    }
+    room->ProcessMessage(kPublisherId, 2, NULL);
+
+    dataPacket packet;
+    packet.comp = 0;
+    packet.type = VIDEO_PACKET;
+    packet.length = std::max(FLAGS_packet_size,
+                             (int)(RTP_HEADER_BASE_SIZE + sizeof(long long)));
+    packet.length = std::min(packet.length, (int)sizeof(packet.data));
+    for (int i = 0; i < packet.length; ++i) {
+      packet.data[i] = rand();
+    }
+    RtpHeader header;
+    header.setPayloadType(VP8_90000_PT);
+    header.setSSRC(0x1234);
+
+    int64_t full_ring_waits = 0;
+    long long start = NowNs();
+    for (int i = 0; i < FLAGS_packets; ++i) {
+      header.setSeqNumber(i);
+      header.setTimestamp(i / 10 * 3000);
+      header.setMarker(i % 10 == 9);
+      memcpy(packet.data, &header, RTP_HEADER_BASE_SIZE);
+      long long now = NowNs();
+      memcpy(packet.data + RTP_HEADER_BASE_SIZE, &now, sizeof(now));
+      while (!room->PublishPacket(kPublisherId, packet)) {
+        full_ring_waits++;
+        std::this_thread::yield();
+      }
+    }
+    while (room->forwarded_packets() < FLAGS_packets) {
+      std::this_thread::yield();
+    }
+    double seconds = (NowNs() - start) / 1e9;
+
+    int64_t relayed = 0;
+    for (BenchmarkViewer* viewer : viewers) {
+      relayed += viewer->relayed();
+    }
+    std::sort(latency_us.begin(), latency_us.end());
+    size_t size = latency_us.size();
+    LOG(INFO) << "viewers=" << num_viewers
+              << " packets=" << FLAGS_packets
+              << " pps=" << (int64_t)(FLAGS_packets / seconds)
+              << " relays/s=" << (int64_t)(relayed / seconds)
+              << " latency_us(p50/p99/max)="
+              << (size ? latency_us[size / 2] : 0) << "/"
+              << (size ? latency_us[size * 99 / 100] : 0) << "/"
+              << (size ? latency_us.back() : 0)
+              << " full_ring_waits=" << full_ring_waits;
+
+    room->RemoveParticipant(publisher);
+    delete publisher;
+    for (BenchmarkViewer* viewer : viewers) {
+      room->RemoveParticipant(viewer);
+      delete viewer;
+    }
+    room->Destroy();
+  }
+};  // end of class.
+
+}  // namespace orbit
+
+int main(int argc, char** argv) {
+  google::InstallFailureSignalHandler();
+  google::ParseCommandLineFlags(&argc, &argv, false);
+  google::InitGoogleLogging(argv[0]);
+
+  orbit::VideoDispatcherBenchmark main;
+  return main.Run();
+}
@@ -13,37 +13,61 @@
 
 namespace orbit {
 using namespace std;
-  void ExportedVar::Set(int value) {
-    Singleton<orbit::ExportedVarManager>::GetInstance()->Set(name_, value);
-  }
 
-  void ExportedVar::Increase(int diff) {
-    Singleton<orbit::ExportedVarManager>::GetInstance()->Increase(name_, diff);
-  }
+namespace {
+
+// Spreads the threads over the stripes, round robin by the first update.
+int ThreadStripe() {
+  static std::atomic<int> next_stripe(0);
+  thread_local int stripe =
+      next_stripe.fetch_add(1, std::memory_order_relaxed) %
+      ExportedVarValue::kNumStripes;
+  return stripe;
+}
+
+}  // annoymous namespace
 
-  void ExportedVar::Decrease(int diff) {
-    Singleton<orbit::ExportedVarManager>::GetInstance()->Decrease(name_, diff);
+  void ExportedVarValue::Set(int value) {
+    stripes_[0].value.store(value, std::memory_order_relaxed);
+    for (int i = 1; i < kNumStripes; ++i) {
+      stripes_[i].value.store(0, std::memory_order_relaxed);
+    }
   }
 
-  int ExportedVar::Get() {
-    return Singleton<orbit::ExportedVarManager>::GetInstance()->Get(name_);
+  void ExportedVarValue::Add(int diff) {
+    stripes_[ThreadStripe()].value.fetch_add(diff, std::memory_order_relaxed);
   }
 
+  int ExportedVarValue::Get() const {
+    long long value = 0;
+    for (int i = 0; i < kNumStripes; ++i) {
+      value += stripes_[i].value.load(std::memory_order_relaxed);
+    }
+    if (value < 0) {
+      LOG_EVERY_N(WARNING, 1000) << "It's looks like something going wrong, "
+                                 << "the var descreased to " << value;
+      value = 0;
+    }
+    return (int)value;
+  }
 
   void ExportedVar::AddToManager() {
-    orbit::ExportedVarManager* var_manager = Singleton<orbit::ExportedVarManager>::GetInstance();
-    if (!var_manager->Has(name_)) {
-      var_manager->AddVar(name_);
-    }
+    value_ = Singleton<orbit::ExportedVarManager>::GetInstance()->AddVar(name_);
   }
 
   void ExportedVar::RemoveFromManager() {
-    Singleton<orbit::ExportedVarManager>::GetInstance()->RemoveVar(name_);
+    Singleton<orbit::ExportedVarManager>::GetInstance()->ReleaseVar(name_,
+                                                                    value_);
   }
 
-  void ExportedVarManager::AddVar(const std::string& name) {
+  std::shared_ptr<ExportedVarValue> ExportedVarManager::AddVar(
+      const std::string& name) {
     std::lock_guard<std::mutex> guard(var_mutex_);
-    var_map_.insert(make_pair(name, 0));
+    std::shared_ptr<ExportedVarValue>& value = var_map_[name];
+    if (value == NULL) {
+      value.reset(new ExportedVarValue());
+    }
+    return value;
   }
 
   void ExportedVarManager::RemoveVar(const std::string& name) {
@@ -54,6 +78,17 @@ using namespace std;
     }
   }
 
+  void ExportedVarManager::ReleaseVar(
+      const std::string& name, const std::shared_ptr<ExportedVarValue>& value) {
+    std::lock_guard<std::mutex> guard(var_mutex_);
+    auto it = var_map_.find(name);
+    // The map and the caller hold the last two handles.
+    if (it != var_map_.end() && it->second == value &&
+        value.use_count() <= 2) {
+      var_map_.erase(it);
+    }
+  }
+
   bool ExportedVarManager::Has(const string& name) {
     std::lock_guard<std::mutex> guard(var_mutex_);
     auto search = var_map_.find(name);
@@ -67,7 +102,7 @@ using namespace std;
     std::lock_guard<std::mutex> guard(var_mutex_);
     auto search = var_map_.find(name);
     if (search != var_map_.end()) {
-      return search->second;
+      return search->second->Get();
     }
     return -1;
   }
@@ -76,7 +111,7 @@ using namespace std;
     std::lock_guard<std::mutex> guard(var_mutex_);
     auto search = var_map_.find(name);
     if (search != var_map_.end()) {
-      return GetAsString(search->second);
+      return GetAsString(search->second->Get());
     }
     return "";
   }
@@ -87,7 +122,7 @@ using namespace std;
     ExportedVarMap::const_iterator it = var_map_.begin();
     for (; it != var_map_.end(); ++it) {
       string name = it->first;
-      int value = it->second;
+      int value = it->second->Get();
       StringAppendF(&text, "%s=%s\n", name.c_str(), GetAsString(value).c_str());
     }
     return text;
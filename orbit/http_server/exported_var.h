@@ -15,12 +15,44 @@
 #include "glog/logging.h"
 #include <string>
 
+#include <atomic>
 #include <map>
+#include <memory>
+#include "stream_service/orbit/base/cache_line.h"
 #include "stream_service/orbit/base/singleton.h"
 #include "stream_service/orbit/base/strutil.h"
 #include <mutex>
 
 namespace orbit {
+
+// The value of an exported variable. Increase()/Decrease() add to the stripe
+// of the calling thread, so the counters bumped on the media threads don't
+// bounce one cache line between the cores. The stripes are only summed when
+// the value is read, e.g. when /varz is scraped.
+class ExportedVarValue {
+ public:
+  static const int kNumStripes = 8;
+
+  ExportedVarValue() {
+    Set(0);
+  }
+
+  // Set() is meant for the gauges owned by one thread, it is not atomic
+  // w.r.t. the concurrent Add()s.
+  void Set(int value);
+  void Add(int diff);
+  // The sum of the stripes. A counter decreased below 0 reads as 0.
+  int Get() const;
+
+ private:
+  // One stripe per cache line: the values of two stripes are a line apart.
+  struct Stripe {
+    std::atomic<long long> value;
+    char padding[CACHE_LINE_SIZE - sizeof(std::atomic<long long>)];
+  };
+  Stripe stripes_[kNumStripes];
+};
+
 // Example usage (ExportedVar)
 // class NiceConnection {
 //  private:
@@ -37,6 +69,10 @@ namespace orbit {
 //  http://HOST:PORT/varz
 // and it will display
 //  connection_number=100
+//
+// The ExportedVar holds the handle of its value, which is looked up once
+// by name when it is created, so Increase()/Decrease()/Set() take no lock.
+// The ExportedVars of the same name share the value.
 class ExportedVar {
  public:
   ExportedVar(const std::string& name, bool should_remove = true) {
@@ -65,49 +101,54 @@ class ExportedVar {
   std::string GetName() {
     return name_;
   }
-  void Set(int value);
+  void Set(int value) {
+    value_->Set(value);
+  }
 
-  void Increase(int diff);
+  void Increase(int diff) {
+    value_->Add(diff);
+  }
 
-  void Decrease(int diff);
+  void Decrease(int diff) {
+    value_->Add(-diff);
+  }
 
-  int Get();
+  int Get() {
+    return value_->Get();
+  }
  private:
   void AddToManager();
   void RemoveFromManager();
   std::string name_;
+  std::shared_ptr<ExportedVarValue> value_;
   bool should_remove_ = true;
 };
 
 class ExportedVarManager {
-  typedef std::map<std::string, int> ExportedVarMap;
+  typedef std::map<std::string, std::shared_ptr<ExportedVarValue> >
+      ExportedVarMap;
  public:
-   void AddVar(const std::string& name);
+   // Returns the value of the name, adds it if it is not there yet.
+   std::shared_ptr<ExportedVarValue> AddVar(const std::string& name);
    void RemoveVar(const std::string& name);
+   // Removes the name only if the manager holds the last handle of the
+   // value besides the given one.
+   void ReleaseVar(const std::string& name,
+                   const std::shared_ptr<ExportedVarValue>& value);
    std::string GetVarByName(const std::string& name);
    std::string DumpExportedVars();
    void Set(const std::string& name, int value) {
-     std::lock_guard<std::mutex> guard(var_mutex_);
-     var_map_[name] = value;
+     AddVar(name)->Set(value);
    }
    
    void Increase(const std::string& name, int diff) {
      assert(Has(name));
-     int value = Get(name);
-     value += diff;
-     Set(name, value);
+     AddVar(name)->Add(diff);
    }
    
    void Decrease(const std::string& name, int diff) {
      assert(Has(name));
-     int value = Get(name);
-     value -= diff;
-     if(value < 0) {
-       LOG(WARNING) << "It's looks like something going wrong, name:"
-                    <<  name << " descrease to " << value;
-       value = 0;
-     }
-     Set(name, value);
+     AddVar(name)->Add(-diff);
    }
 
    bool Has(const std::string& name);
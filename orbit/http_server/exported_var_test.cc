@@ -0,0 +1,68 @@
+// Copyright 2016 Orangelab Inc. All Rights Reserved.
+// Author: cheng@orangelab.com (Cheng Xu)
+//
+// Unittest for exported_var.h/cc
+
+#include "gtest/gtest.h"
+
+#include "exported_var.h"
+
+#include <thread>
+#include <vector>
+
+namespace orbit {
+using namespace std;
+
+namespace {
+
+TEST(ExportedVarTest, SetIncreaseDecrease) {
+  ExportedVar var("test_var", 5);
+  EXPECT_EQ(5, var.Get());
+  var.Increase(3);
+  var.Decrease(2);
+  EXPECT_EQ(6, var.Get());
+  var.Set(1);
+  EXPECT_EQ(1, var.Get());
+  var.Decrease(3);  // Reads as 0.
+  EXPECT_EQ(0, var.Get());
+  ExportedVarManager* manager = Singleton<ExportedVarManager>::GetInstance();
+  EXPECT_EQ("0", manager->GetVarByName("test_var"));
+}
+
+TEST(ExportedVarTest, IncreasedFromManyThreads) {
+  ExportedVar var("test_threads_var");
+  vector<thread> threads;
+  for (int t = 0; t < 16; ++t) {
+    threads.push_back(thread([&var] {
+      for (int i = 0; i < 10000; ++i) {
+        var.Increase(1);
+      }
+    }));
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  EXPECT_EQ(160000, var.Get());
+}
+
+TEST(ExportedVarTest, SharedByName) {
+  ExportedVarManager* manager = Singleton<ExportedVarManager>::GetInstance();
+  {
+    ExportedVar var1("test_shared_var");
+    {
+      ExportedVar var2("test_shared_var");
+      var1.Increase(1);
+      var2.Increase(2);
+      EXPECT_EQ(3, var1.Get());
+      EXPECT_NE(string::npos,
+                manager->DumpExportedVars().find("test_shared_var=3\n"));
+    }
+    // Still held by var1.
+    EXPECT_EQ("3", manager->GetVarByName("test_shared_var"));
+  }
+  EXPECT_FALSE(manager->Has("test_shared_var"));
+  EXPECT_EQ("", manager->GetVarByName("test_shared_var"));
+}
+
+}  // annoymous namespace
+}  // namespace orbit
@@ -28,6 +28,10 @@
                 <th>mean_call_time</th>
                 <th>min_call_time</th>
                 <th>max_call_time</th>
+                <th>p50_us</th>
+                <th>p90_us</th>
+                <th>p99_us</th>
+                <th>p999_us</th>
               </thead>
               <tbody>
                 <tr>
@@ -38,10 +42,14 @@
                   <td class="text-right">{{MEAN_CALL_TIME}}</td>
                   <td class="text-right">{{MIN_CALL_TIME}}</td>
                   <td class="text-right">{{MAX_CALL_TIME}}</td>
+                  <td class="text-right">{{P50_CALL_TIME}}</td>
+                  <td class="text-right">{{P90_CALL_TIME}}</td>
+                  <td class="text-right">{{P99_CALL_TIME}}</td>
+                  <td class="text-right">{{P999_CALL_TIME}}</td>
                 </tr>
                 <tr>
                   <td class="text-center">last 10 times call</td>
-                  <td colspan="6" class="text-left">{{LAST_TEN_CALL}}</td>
+                  <td colspan="10" class="text-left">{{LAST_TEN_CALL}}</td>
                 </tr>
               </tbody>
             </table>
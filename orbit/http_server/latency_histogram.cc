@@ -0,0 +1,210 @@
+/*
+ * Copyright (C) 2016 Orangelab Inc. All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * latency_histogram.cc
+ * ---------------------------------------------------------------------------
+ * Implements the latency histograms exported to the /histogramz handler.
+ * ---------------------------------------------------------------------------
+ */
+#include "latency_histogram.h"
+
+#include "stream_service/orbit/base/strutil.h"
+
+#include <algorithm>
+
+namespace orbit {
+using namespace std;
+
+namespace {
+
+// Spreads the threads over the shards, round robin by the first record.
+int ThreadShard() {
+  static std::atomic<int> next_shard(0);
+  thread_local int shard =
+      next_shard.fetch_add(1, std::memory_order_relaxed) %
+      LatencyHistogram::kNumShards;
+  return shard;
+}
+
+}  // annoymous namespace
+
+int LatencyHistogram::BucketOf(long long value) {
+  if (value < kSubBuckets) {
+    return value <= 0 ? 0 : (int)value;
+  }
+  // The value is in [2^bits, 2^(bits+1)), split into kSubBuckets.
+  int bits = 63 - __builtin_clzll((unsigned long long)value);
+  if (bits >= kMaxValueBits) {
+    return kNumBuckets - 1;
+  }
+  int shift = bits - kSubBucketBits;
+  return (bits - kSubBucketBits + 1) * kSubBuckets +
+         (int)(value >> shift) - kSubBuckets;
+}
+
+long long LatencyHistogram::BucketLowerBound(int bucket) {
+  if (bucket < kSubBuckets) {
+    return bucket;
+  }
+  int shift = bucket / kSubBuckets - 1;
+  return (long long)(kSubBuckets + bucket % kSubBuckets) << shift;
+}
+
+long long LatencyHistogram::BucketUpperBound(int bucket) {
+  if (bucket < kSubBuckets) {
+    return bucket + 1;
+  }
+  int shift = bucket / kSubBuckets - 1;
+  return (long long)(kSubBuckets + bucket % kSubBuckets + 1) << shift;
+}
+
+LatencyHistogram::LatencyHistogram(const std::string& name)
+  : name_(name), shards_(new Shard[kNumShards]) {
+  Reset();
+  Singleton<LatencyHistogramManager>::GetInstance()->AddHistogram(this);
+}
+
+LatencyHistogram::~LatencyHistogram() {
+  Singleton<LatencyHistogramManager>::GetInstance()->RemoveHistogram(this);
+}
+
+void LatencyHistogram::Record(long long value) {
+  if (value < 0) {
+    value = 0;
+  }
+  Shard& shard = shards_[ThreadShard()];
+  shard.buckets[BucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+  shard.sum.fetch_add(value, std::memory_order_relaxed);
+  long long max = max_.load(std::memory_order_relaxed);
+  while (value > max &&
+         !max_.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+  }
+}
+
+long long LatencyHistogram::SumBuckets(long long* counts) const {
+  long long total = 0;
+  for (int i = 0; i < kNumBuckets; ++i) {
+    counts[i] = 0;
+  }
+  for (int s = 0; s < kNumShards; ++s) {
+    const Shard& shard = shards_[s];
+    for (int i = 0; i < kNumBuckets; ++i) {
+      long long count = shard.buckets[i].load(std::memory_order_relaxed);
+      counts[i] += count;
+      total += count;
+    }
+  }
+  return total;
+}
+
+long long LatencyHistogram::count() const {
+  long long counts[kNumBuckets];
+  return SumBuckets(counts);
+}
+
+long long LatencyHistogram::Bucket(int bucket) const {
+  long long count = 0;
+  for (int s = 0; s < kNumShards; ++s) {
+    count += shards_[s].buckets[bucket].load(std::memory_order_relaxed);
+  }
+  return count;
+}
+
+long long LatencyHistogram::mean() const {
+  long long count = this->count();
+  if (count == 0) {
+    return 0;
+  }
+  long long sum = 0;
+  for (int s = 0; s < kNumShards; ++s) {
+    sum += shards_[s].sum.load(std::memory_order_relaxed);
+  }
+  return sum / count;
+}
+
+long long LatencyHistogram::Percentile(double percentile) const {
+  long long counts[kNumBuckets];
+  long long total = SumBuckets(counts);
+  if (total == 0) {
+    return 0;
+  }
+  long long target = (long long)(total * percentile / 100);
+  if (target < 1) {
+    target = 1;
+  }
+  long long value = BucketUpperBound(kNumBuckets - 1) - 1;
+  long long seen = 0;
+  for (int i = 0; i < kNumBuckets; ++i) {
+    seen += counts[i];
+    if (seen >= target) {
+      value = BucketUpperBound(i) - 1;
+      break;
+    }
+  }
+  return std::min(value, max());
+}
+
+void LatencyHistogram::Reset() {
+  for (int s = 0; s < kNumShards; ++s) {
+    for (int i = 0; i < kNumBuckets; ++i) {
+      shards_[s].buckets[i].store(0, std::memory_order_relaxed);
+    }
+    shards_[s].sum.store(0, std::memory_order_relaxed);
+  }
+  max_.store(0, std::memory_order_relaxed);
+}
+
+string LatencyHistogram::ToString() const {
+  return StringPrintf("%s count=%lld mean=%lld p50<=%lld p90<=%lld p99<=%lld "
+                      "p999<=%lld max=%lld",
+                      name_.c_str(), count(), mean(), Percentile(50),
+                      Percentile(90), Percentile(99), Percentile(99.9), max());
+}
+
+void LatencyHistogramManager::AddHistogram(LatencyHistogram* histogram) {
+  std::lock_guard<std::mutex> guard(histogram_mutex_);
+  histogram_map_.insert(make_pair(histogram->name(), histogram));
+}
+
+void LatencyHistogramManager::RemoveHistogram(LatencyHistogram* histogram) {
+  std::lock_guard<std::mutex> guard(histogram_mutex_);
+  auto range = histogram_map_.equal_range(histogram->name());
+  for (auto it = range.first; it != range.second; ++it) {
+    if (it->second == histogram) {
+      histogram_map_.erase(it);
+      break;
+    }
+  }
+}
+
+string LatencyHistogramManager::DumpHistograms() {
+  std::lock_guard<std::mutex> guard(histogram_mutex_);
+  string text;
+  for (auto& pair : histogram_map_) {
+    StringAppendF(&text, "%s\n", pair.second->ToString().c_str());
+  }
+  return text;
+}
+
+string LatencyHistogramManager::DumpHistogram(const std::string& name) {
+  std::lock_guard<std::mutex> guard(histogram_mutex_);
+  auto it = histogram_map_.find(name);
+  if (it == histogram_map_.end()) {
+    return "";
+  }
+  const LatencyHistogram* histogram = it->second;
+  string text = histogram->ToString() + "\n";
+  for (int i = 0; i < LatencyHistogram::kNumBuckets; ++i) {
+    // Only the buckets with values, the histogram is sparse in practice.
+    long long lower = LatencyHistogram::BucketLowerBound(i);
+    long long upper = LatencyHistogram::BucketUpperBound(i);
+    long long count = histogram->Bucket(i);
+    if (count > 0) {
+      StringAppendF(&text, "[%lld, %lld) %lld\n", lower, upper, count);
+    }
+  }
+  return text;
+}
+
+}  // namespace orbit
@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2016 Orangelab Inc. All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * latency_histogram.h
+ * ---------------------------------------------------------------------------
+ * Defines the latency histograms exported to the /histogramz handler.
+ * ---------------------------------------------------------------------------
+ */
+
+#ifndef LATENCY_HISTOGRAM_H__
+#define LATENCY_HISTOGRAM_H__
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "stream_service/orbit/base/cache_line.h"
+#include "stream_service/orbit/base/singleton.h"
+
+namespace orbit {
+// Example usage (LatencyHistogram)
+// class AudioMixerElement {
+//  private:
+//   LatencyHistogram encode_us_("audio_mixer_encode_us");
+// }
+//  And then record the latency (in us) of each encode:
+//   encode_us_.Record(GetCurrentTime_US() - begin_us);
+//
+// And then in the /histogramz handler in the browser:
+//  http://HOST:PORT/histogramz
+// and it will display
+//  audio_mixer_encode_us count=100 mean=210 p50<=207 p90<=415 p99<=991 p999<=991 max=1000
+//
+// The values are counted in HDR-style log-linear buckets: the values below
+// 16 exactly, then 16 buckets per power of two, so a percentile is at most
+// 1/16 (6.25%) above the value. Each thread records into its own shard of
+// the buckets, so Record() is two uncontended relaxed atomic adds and can
+// be called on the hot paths. The shards are only summed when the
+// histogram is read, e.g. when /histogramz or /rpcz is scraped.
+class LatencyHistogram {
+ public:
+  // The bits of the sub-bucket index: 16 buckets per power of two.
+  static const int kSubBucketBits = 4;
+  static const int kSubBuckets = 1 << kSubBucketBits;
+  // The values up to 2^40 - 1 (12 days in us) are counted, the larger ones
+  // go to the last bucket.
+  static const int kMaxValueBits = 40;
+  static const int kNumBuckets =
+      (kMaxValueBits - kSubBucketBits + 1) * kSubBuckets;
+  // The shards the threads record into.
+  static const int kNumShards = 8;
+
+  explicit LatencyHistogram(const std::string& name);
+  ~LatencyHistogram();
+
+  const std::string& name() const {
+    return name_;
+  }
+
+  void Record(long long value);
+
+  long long count() const;
+  long long max() const {
+    return max_.load(std::memory_order_relaxed);
+  }
+  // The count of the bucket, summed over the shards.
+  long long Bucket(int bucket) const;
+  long long mean() const;
+  // Returns the highest value counted by the bucket holding the given
+  // percentile (0 - 100), capped by max(), or 0 if nothing is recorded.
+  long long Percentile(double percentile) const;
+
+  // The bucket counting the value, and the [lower, upper) values of a
+  // bucket.
+  static int BucketOf(long long value);
+  static long long BucketLowerBound(int bucket);
+  static long long BucketUpperBound(int bucket);
+
+  void Reset();
+  std::string ToString() const;
+
+ private:
+  // The padding keeps the last counters of a shard and the first ones of
+  // the next on different cache lines.
+  struct Shard {
+    std::atomic<long long> buckets[kNumBuckets];
+    std::atomic<long long> sum;
+    char padding[CACHE_LINE_SIZE];
+  };
+
+  // Sums the buckets of the shards into counts, returns the total.
+  long long SumBuckets(long long* counts) const;
+
+  std::string name_;
+  std::unique_ptr<Shard[]> shards_;
+  std::atomic<long long> max_;
+};
+
+class LatencyHistogramManager {
+ public:
+  void AddHistogram(LatencyHistogram* histogram);
+  void RemoveHistogram(LatencyHistogram* histogram);
+  // Returns all the histograms, one per line, sorted by name.
+  std::string DumpHistograms();
+  // Returns the histogram with the name and its buckets, or "".
+  std::string DumpHistogram(const std::string& name);
+ private:
+  std::mutex histogram_mutex_;
+  std::multimap<std::string, LatencyHistogram*> histogram_map_;
+  DEFINE_AS_SINGLETON(LatencyHistogramManager);
+};
+}  // namespace orbit
+
+#endif  // LATENCY_HISTOGRAM_H__
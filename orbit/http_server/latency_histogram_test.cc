@@ -0,0 +1,111 @@
+// Copyright 2016 Orangelab Inc. All Rights Reserved.
+// Author: cheng@orangelab.com (Cheng Xu)
+//
+// Unittest for latency_histogram.h/cc
+
+#include "gtest/gtest.h"
+
+#include "latency_histogram.h"
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+namespace orbit {
+using namespace std;
+
+namespace {
+
+TEST(LatencyHistogramTest, EmptyHistogram) {
+  LatencyHistogram histogram("test_empty_us");
+  EXPECT_EQ(0, histogram.count());
+  EXPECT_EQ(0, histogram.mean());
+  EXPECT_EQ(0, histogram.max());
+  EXPECT_EQ(0, histogram.Percentile(99));
+}
+
+TEST(LatencyHistogramTest, RecordsIntoLogLinearBuckets) {
+  LatencyHistogram histogram("test_buckets_us");
+  histogram.Record(0);
+  histogram.Record(1);
+  histogram.Record(3);
+  histogram.Record(1000);
+  histogram.Record(-5);  // Counted as 0.
+  EXPECT_EQ(5, histogram.count());
+  EXPECT_EQ(2, histogram.Bucket(0));
+  EXPECT_EQ(1, histogram.Bucket(1));    // [1, 2)
+  EXPECT_EQ(1, histogram.Bucket(3));    // [3, 4)
+  EXPECT_EQ(1, histogram.Bucket(111));  // [992, 1024)
+  EXPECT_EQ(1000, histogram.max());
+  EXPECT_EQ(200, histogram.mean());
+}
+
+TEST(LatencyHistogramTest, BucketBounds) {
+  for (int i = 0; i < LatencyHistogram::kNumBuckets - 1; ++i) {
+    long long lower = LatencyHistogram::BucketLowerBound(i);
+    long long upper = LatencyHistogram::BucketUpperBound(i);
+    EXPECT_EQ(upper, LatencyHistogram::BucketLowerBound(i + 1));
+    EXPECT_EQ(i, LatencyHistogram::BucketOf(lower));
+    EXPECT_EQ(i, LatencyHistogram::BucketOf(upper - 1));
+    // Exact below 16, then at most 1/16 of the lower bound wide.
+    EXPECT_LE((upper - lower) * LatencyHistogram::kSubBuckets,
+              std::max(lower, (long long)LatencyHistogram::kSubBuckets));
+  }
+  EXPECT_EQ(LatencyHistogram::kNumBuckets - 1,
+            LatencyHistogram::BucketOf(1LL << 50));
+}
+
+TEST(LatencyHistogramTest, Percentiles) {
+  LatencyHistogram histogram("test_percentiles_us");
+  for (int i = 0; i < 890; ++i) {
+    histogram.Record(100);   // [100, 104)
+  }
+  for (int i = 0; i < 99; ++i) {
+    histogram.Record(3000);  // [2944, 3072)
+  }
+  for (int i = 0; i < 10; ++i) {
+    histogram.Record(20000); // [19456, 20480)
+  }
+  histogram.Record(100000);  // [98304, 102400)
+  EXPECT_EQ(103, histogram.Percentile(50));
+  EXPECT_EQ(103, histogram.Percentile(89));
+  EXPECT_EQ(3071, histogram.Percentile(90));
+  EXPECT_EQ(3071, histogram.Percentile(98.9));
+  EXPECT_EQ(20479, histogram.Percentile(99.9));
+  EXPECT_EQ(100000, histogram.Percentile(100));  // Capped by max().
+}
+
+TEST(LatencyHistogramTest, RecordsFromManyThreads) {
+  LatencyHistogram histogram("test_threads_us");
+  vector<thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.push_back(thread([&histogram, t] {
+      for (int i = 0; i < 10000; ++i) {
+        histogram.Record(t * 10 + 1);
+      }
+    }));
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  EXPECT_EQ(40000, histogram.count());
+  EXPECT_EQ(31, histogram.max());
+}
+
+TEST(LatencyHistogramTest, DumpedByManager) {
+  LatencyHistogramManager* manager =
+      Singleton<LatencyHistogramManager>::GetInstance();
+  {
+    LatencyHistogram histogram("test_dump_us");
+    histogram.Record(5);
+    EXPECT_NE(string::npos, manager->DumpHistograms().find(
+        "test_dump_us count=1 mean=5 p50<=5 p90<=5 p99<=5 p999<=5 max=5"));
+    EXPECT_NE(string::npos,
+              manager->DumpHistogram("test_dump_us").find("[5, 6) 1"));
+  }
+  EXPECT_EQ(string::npos, manager->DumpHistograms().find("test_dump_us"));
+  EXPECT_EQ("", manager->DumpHistogram("test_dump_us"));
+}
+
+}  // annoymous namespace
+}  // namespace orbit
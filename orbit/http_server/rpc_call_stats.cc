@@ -9,37 +9,173 @@
  */
 #include "rpc_call_stats.h"
 
+#include <algorithm>
+
 namespace orbit {
 using namespace std;
 
-  RpcCallStats::RpcCallStats(const std::string& method_name, std::string type) {
-    method_name_ = method_name;
+  RpcCallStats::RpcCallStats(const std::string& method_name, std::string type)
+    : RpcCallStats(Singleton<RpcCallStatsManager>::GetInstance()->
+                   GetMethodStats(method_name), type) {
+  }
+
+  RpcCallStats::RpcCallStats(RpcMethodStats* method_stats, std::string type) {
+    method_stats_ = method_stats;
     request_type_ = type;
     is_fail_ = false;
-    VLOG(4) << "method_name_=" << method_name_;
+    VLOG(4) << "method_name_=" << method_stats_->method();
     begin_ = std::chrono::high_resolution_clock::now();
-    RpcCallStatsManager* stats_manager = Singleton<RpcCallStatsManager>::GetInstance();
-    stats_manager->StartCall(method_name_);
+    method_stats_->StartCall();
   }
 
   RpcCallStats::~RpcCallStats() {
     end_ = std::chrono::high_resolution_clock::now();
     RpcCallStatsManager* stats_manager = Singleton<RpcCallStatsManager>::GetInstance();
     if (is_fail_) {
-      stats_manager->FailCall(method_name_);
-      stats_manager->AddCallRecord(begin_, method_name_, request_type_, 0, false);
+      method_stats_->FailCall();
       // If the RPC call is failed, we do not use the histogram to calculate the latency.
     } else {
-      stats_manager->SuccessCall(method_name_);
       long elapsed_nano_second = std::chrono::duration_cast<std::chrono::nanoseconds>(end_-begin_).count();
       VLOG(4) << "elapsed_nano_second=" << elapsed_nano_second;
-      stats_manager->NanoTime(method_name_, elapsed_nano_second);
-      stats_manager->AddCallRecord(begin_, method_name_, request_type_, elapsed_nano_second, true);
+      method_stats_->SuccessCall(elapsed_nano_second);
     }
+    stats_manager->AddCallRecord(begin_);
   } 
 
   void RpcCallStats::Fail() {
     is_fail_ = true;
   }
 
+  RpcMethodStats::RpcMethodStats(const std::string& method)
+    : method_(method),
+      total_call_(0),
+      success_call_(0),
+      failed_call_(0),
+      last_call_latency_nano_(-1),
+      total_call_time_ms_(0),
+      min_call_time_ms_(-1),
+      max_call_time_ms_(0),
+      latency_us_("rpc_" + method + "_us"),
+      last_call_index_(0) {
+    for (int i = 0; i < kLastCalls; ++i) {
+      last_calls_[i].store(0, std::memory_order_relaxed);
+    }
+  }
+
+  void RpcMethodStats::StartCall() {
+    total_call_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void RpcMethodStats::FailCall() {
+    failed_call_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void RpcMethodStats::SuccessCall(long nano_time) {
+    long call_time_in_ms = nano_time / (1000 * 1000);
+    last_call_latency_nano_.store(nano_time, std::memory_order_relaxed);
+    total_call_time_ms_.fetch_add(call_time_in_ms, std::memory_order_relaxed);
+    latency_us_.Record(nano_time / 1000);
+
+    long min = min_call_time_ms_.load(std::memory_order_relaxed);
+    while ((min == -1 || call_time_in_ms < min) &&
+           !min_call_time_ms_.compare_exchange_weak(
+               min, call_time_in_ms, std::memory_order_relaxed)) {
+    }
+    long max = max_call_time_ms_.load(std::memory_order_relaxed);
+    while (call_time_in_ms > max &&
+           !max_call_time_ms_.compare_exchange_weak(
+               max, call_time_in_ms, std::memory_order_relaxed)) {
+    }
+
+    unsigned int index = last_call_index_.fetch_add(1, std::memory_order_relaxed);
+    last_calls_[index % kLastCalls].store(call_time_in_ms,
+                                          std::memory_order_relaxed);
+    // Counted last, so a snapshot doesn't see a success without its time.
+    success_call_.fetch_add(1, std::memory_order_release);
+  }
+
+  RpcCallStatsData RpcMethodStats::Snapshot() const {
+    RpcCallStatsData data;
+    data.success_call = success_call_.load(std::memory_order_acquire);
+    data.failed_call = failed_call_.load(std::memory_order_relaxed);
+    data.total_call = total_call_.load(std::memory_order_relaxed);
+    data.last_call_latency_nano =
+      last_call_latency_nano_.load(std::memory_order_relaxed);
+    if (data.success_call > 0) {
+      data.mean_call_time_ms =
+        total_call_time_ms_.load(std::memory_order_relaxed) / data.success_call;
+    }
+    data.min_call_time_ms = min_call_time_ms_.load(std::memory_order_relaxed);
+    data.max_call_time_ms = max_call_time_ms_.load(std::memory_order_relaxed);
+    data.p50_call_time_us = latency_us_.Percentile(50);
+    data.p90_call_time_us = latency_us_.Percentile(90);
+    data.p99_call_time_us = latency_us_.Percentile(99);
+    data.p999_call_time_us = latency_us_.Percentile(99.9);
+    return data;
+  }
+
+  string RpcMethodStats::GetLastTenTimesCallStat() const {
+    unsigned int end = last_call_index_.load(std::memory_order_relaxed);
+    unsigned int count = std::min<unsigned int>(end, kLastCalls);
+    string ret_str;
+    for (unsigned int i = end - count; i != end; ++i) {
+      StringAppendF(&ret_str, "%ld, ",
+                    last_calls_[i % kLastCalls].load(std::memory_order_relaxed));
+    }
+    return ret_str;
+  }
+
+  RpcCallStatsManager::RpcCallStatsManager() {
+    for (int i = 0; i < kQpsSeconds; ++i) {
+      qps_slots_[i].store(0, std::memory_order_relaxed);
+    }
+  }
+
+  RpcCallStatsManager::~RpcCallStatsManager() {
+  }
+
+  RpcMethodStats* RpcCallStatsManager::GetMethodStats(const std::string& method) {
+    std::lock_guard<std::mutex> guard(var_mutex_);
+    std::unique_ptr<RpcMethodStats>& stats = rpc_call_data_map_[method];
+    if (stats == NULL) {
+      stats.reset(new RpcMethodStats(method));
+    }
+    return stats.get();
+  }
+
+  void RpcCallStatsManager::AddCallRecord(
+      std::chrono::high_resolution_clock::time_point time) {
+    unsigned long long second = std::chrono::duration_cast<std::chrono::seconds>(
+        time.time_since_epoch()).count();
+    std::atomic<unsigned long long>& slot = qps_slots_[second % kQpsSeconds];
+    unsigned long long value = slot.load(std::memory_order_relaxed);
+    while (true) {
+      // The slot still counts a second of 3 minutes ago, start it over.
+      unsigned long long next = (value >> kQpsCountBits) == second ?
+        value + 1 : (second << kQpsCountBits | 1);
+      if (slot.compare_exchange_weak(value, next, std::memory_order_relaxed)) {
+        break;
+      }
+    }
+  }
+
+  vector<int> RpcCallStatsManager::GetCallRecordStat() {
+    unsigned long long now = std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::high_resolution_clock::now().time_since_epoch()).count();
+    vector<int> call_count;
+    for (unsigned long long second = now - kQpsSeconds + 1; second <= now;
+         ++second) {
+      unsigned long long value =
+        qps_slots_[second % kQpsSeconds].load(std::memory_order_relaxed);
+      int count = 0;
+      if ((value >> kQpsCountBits) == second) {
+        count = value & ((1 << kQpsCountBits) - 1);
+      }
+      if (count > 0 || !call_count.empty()) {
+        call_count.push_back(count);
+      }
+    }
+    return call_count;
+  }
+
 }  // namespace orbit
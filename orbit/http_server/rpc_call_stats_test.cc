@@ -71,6 +71,29 @@ TEST_F(RpcCallStatsTest, TestCallCount) {
   EXPECT_EQ("ExampleService_DoSomething", all_methods[0]);
 }
 
+TEST_F(RpcCallStatsTest, TestMethodStatsHandle) {
+  RpcCallStatsManager* stats_manager = Singleton<RpcCallStatsManager>::GetInstance();
+  RpcMethodStats* stats = stats_manager->GetMethodStats("ExampleService_Handle");
+  EXPECT_EQ(stats, stats_manager->GetMethodStats("ExampleService_Handle"));
+  for (int i = 0; i < 12; ++i) {
+    RpcCallStats stat(stats);
+  }
+  {
+    RpcCallStats stat(stats);
+    stat.Fail();
+  }
+  RpcCallStatsData data = stats_manager->GetCallStat("ExampleService_Handle");
+  EXPECT_EQ(13, data.total_call);
+  EXPECT_EQ(12, data.success_call);
+  EXPECT_EQ(1, data.failed_call);
+  EXPECT_EQ(0, data.min_call_time_ms);
+  EXPECT_LE(data.p50_call_time_us, data.p99_call_time_us);
+  EXPECT_LE(data.p99_call_time_us, data.p999_call_time_us);
+  // Only the last ten calls.
+  EXPECT_EQ("0, 0, 0, 0, 0, 0, 0, 0, 0, 0, ",
+            stats_manager->GetLastTenTimesCallStat("ExampleService_Handle"));
+  EXPECT_NE("", stats_manager->GetGrpcQpsDataString());
+}
 
 }  // namespace annoymous
 
@@ -57,6 +57,14 @@ std::shared_ptr<HttpResponse> RpczHandler::HandleRequest(const HttpRequest& requ
     section_temp->SetValue("MEAN_CALL_TIME", StringPrintf("%ld", mean_call_time));
     section_temp->SetValue("MIN_CALL_TIME", StringPrintf("%ld", min_call_time));
     section_temp->SetValue("MAX_CALL_TIME", StringPrintf("%ld", max_call_time));
+    section_temp->SetValue("P50_CALL_TIME",
+                           StringPrintf("%lld", stat_data.p50_call_time_us));
+    section_temp->SetValue("P90_CALL_TIME",
+                           StringPrintf("%lld", stat_data.p90_call_time_us));
+    section_temp->SetValue("P99_CALL_TIME",
+                           StringPrintf("%lld", stat_data.p99_call_time_us));
+    section_temp->SetValue("P999_CALL_TIME",
+                           StringPrintf("%lld", stat_data.p999_call_time_us));
     // Update last 10 times call stat
     std::string last_ten_call_stat;
     last_ten_call_stat = stats_manager->GetLastTenTimesCallStat(method_name);
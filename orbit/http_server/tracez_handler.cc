@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2016 Orangelab Inc. All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * tracez_handler.cc
+ * ---------------------------------------------------------------------------
+ * Implements the http handler for /tracez page
+ * ---------------------------------------------------------------------------
+ */
+#include "tracez_handler.h"
+
+#include "stream_service/orbit/base/strutil.h"
+#include "stream_service/orbit/packet_trace.h"
+
+#include <stdlib.h>
+
+namespace orbit {
+using namespace std;
+
+std::shared_ptr<HttpResponse> TracezHandler::HandleRequest(const HttpRequest& request) {
+  std::shared_ptr<HttpResponse> http_response(new HttpResponse());
+  http_response->set_code(HTTP_OK);
+  PacketTracer* tracer = PacketTracer::GetInstance();
+  string sample;
+  if (request.GetQueryValue("sample", &sample)) {
+    int sample_rate = atoi(sample.c_str());
+    tracer->set_sample_rate(sample_rate < 0 ? 0 : sample_rate);
+    LOG(INFO) << "Set the packet trace sample rate to " << tracer->sample_rate();
+    http_response->set_content(StringPrintf("packet_trace_sample=%d\n",
+                                            tracer->sample_rate()));
+    http_response->set_content_type("text/plain");
+    return http_response;
+  }
+  http_response->set_content(tracer->DumpChromeTrace());
+  http_response->set_content_type("application/json");
+  return http_response;
+}
+
+}  // namespace orbit
@@ -0,0 +1,33 @@
+/*
+ * Copyright (C) 2016 Orangelab Inc. All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * tracez_handler.h
+ * ---------------------------------------------------------------------------
+ * Defines the http handler for /tracez page
+ * -- Exports the sampled packet traces (see packet_trace.h) as Chrome
+ *    trace-event JSON, to be loaded in chrome://tracing or Perfetto.
+ * ---------------------------------------------------------------------------
+ *   /tracez             the recorded traces
+ *   /tracez?sample=N    traces one of every N packets from now on, 0 stops
+ */
+
+#ifndef TRACEZ_HANDLER_H__
+#define TRACEZ_HANDLER_H__
+
+#include "stream_service/orbit/webrtc/base/httpcommon.h"
+#include "stream_service/orbit/http_server/http_handler.h"
+
+#include "glog/logging.h"
+
+namespace orbit {
+
+class TracezHandler : public HttpHandler {
+ public:
+  explicit TracezHandler() {};
+  virtual std::shared_ptr<HttpResponse> HandleRequest(const HttpRequest& request);
+};
+
+}  // namespace orbit
+
+#endif  // TRACEZ_HANDLER_H__
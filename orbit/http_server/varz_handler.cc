@@ -9,6 +9,7 @@
  */
 #include "varz_handler.h"
 #include "exported_var.h"
+#include "latency_histogram.h"
 #include "stream_service/orbit/base/singleton.h"
 #include "gflags/gflags.h"
 
@@ -37,6 +38,28 @@ std::shared_ptr<HttpResponse> VarzHandler::HandleRequest(const HttpRequest& requ
   return http_response;
 }
 
+std::shared_ptr<HttpResponse> HistogramzHandler::HandleRequest(const HttpRequest& request) {
+  std::shared_ptr<HttpResponse> http_response(new HttpResponse());
+  http_response->set_code(HTTP_OK);
+  LatencyHistogramManager* manager = Singleton<LatencyHistogramManager>::GetInstance();
+  string key;
+  string body;
+  if (request.GetQueryValue("key", &key)) {
+    if (HasPrefixString(key, "\"")) {
+      key = StripPrefixString(key, "\"");
+    }
+    if (HasSuffixString(key, "\"")) {
+      key = StripSuffixString(key, "\"");
+    }
+    body = manager->DumpHistogram(key);
+  } else {
+    body = manager->DumpHistograms();
+  }
+  http_response->set_content(body);
+  http_response->set_content_type("text/plain");
+  return http_response;
+}
+
 std::shared_ptr<HttpResponse> FlagzHandler::HandleRequest(const HttpRequest& request) {
   std::shared_ptr<HttpResponse> http_response(new HttpResponse());
   http_response->set_code(HTTP_OK);
@@ -32,6 +32,17 @@ class VarzHandler : public HttpHandler {
   virtual std::shared_ptr<HttpResponse> HandleRequest(const HttpRequest& request);
 };
 
+/*
+ * Histogramz handler for the latency histograms, example usages:
+ *  https://{host}:{port}/histogramz
+ *  https://{host}:{port}/histogramz?key="HISTOGRAM_NAME"
+ */
+class HistogramzHandler : public HttpHandler {
+ public:
+  explicit HistogramzHandler() {};
+  virtual std::shared_ptr<HttpResponse> HandleRequest(const HttpRequest& request);
+};
+
 class FlagzHandler : public HttpHandler {
  public:
   explicit FlagzHandler() {};
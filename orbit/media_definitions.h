@@ -36,6 +36,9 @@ struct dataPacket{
   int64_t remote_ntp_time_ms = -1;
   int arrival_time_ms = -1;
   uint32_t rtp_timestamp = -1;
+  // The simulcast layer of a video packet, 0 is the lowest (or the only)
+  // layer.
+  int simulcast_layer = 0;
 };
 
 /**
@@ -103,6 +103,7 @@ bool OpusCodec::DecodePacket(const unsigned char* buffer, int len,
   } else {
     packet->length = decode_length;
     packet->media_buf = tmp_buf;
+    AnalyzeAudioFrame(tmp_buf, decode_length, &packet->features);
   }
   return true;
 }
@@ -205,6 +206,7 @@ bool AudioBufferManager::PopAndDecode(std::shared_ptr<MediaDataPacket>& packet)
     }
     packet->length = (int)out_len * num_channels;
     packet->media_buf = (opus_int16*)out_data;
+    AnalyzeAudioFrame(packet->media_buf, packet->length, &packet->features);
     //LOG(INFO) << "GetAudio type=" << type;
     // enum NetEqOutputType {
     //   kOutputNormal,
@@ -430,6 +432,7 @@ void AudioBufferManagerOfStable1::DecodePacket(const unsigned char* buffer, int
   } else {
     packet->length = decode_length;
     packet->media_buf = tmp_buf;
+    AnalyzeAudioFrame(tmp_buf, decode_length, &packet->features);
   }
 }
 
@@ -8,13 +8,20 @@
 #include <time.h>
 #include <stdlib.h>
 
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
 #include <sys/prctl.h>
 #include "audio_mixer_element.h"
+#include "audio_task_pool.h"
 #include "stream_service/orbit/rtp/rtp_packet_queue.h"
 #include "stream_service/orbit/rtp/rtp_headers.h"
 #include "stream_service/orbit/audio_processing/audio_energy.h"
+#include "stream_service/orbit/audio_processing/audio_mix.h"
 #include "stream_service/orbit/base/timeutil.h"
 #include "stream_service/orbit/base/strutil.h"
+#include "stream_service/orbit/http_server/latency_histogram.h"
 #include "stream_service/orbit/network_status.h"
 
 #include "gflags/gflags.h"
@@ -33,6 +40,15 @@ DEFINE_bool(audio_mixer_use_stable3_loop, true,
 DEFINE_bool(audio_mixer_use_stable1, false,
             "If set, we will use the code of stable1 to mix audio."
             "This is set true by default.");
+DEFINE_int32(audio_mixer_max_speakers, 0,
+             "If > 0, only mix this number of speakers (the top speakers of "
+             "the SpeakerEstimator first). Everyone else hears the same mix "
+             "and shares one encode of it. Only for the multi thread mixer.");
+
+// If the mixer falls behind more than this, skip the missed ticks instead of
+// running them back to back.
+#define MIXER_MAX_CATCH_UP_US 200000
+
 namespace orbit {
 
 namespace {
@@ -42,6 +58,33 @@ class Initer {
     srand(time(NULL));
   }
 } init;
+
+// The energy is computed by the decoder while the PCM is still in the cache,
+// fall back to compute it here if the frame size does not match.
+opus_int32 GetPacketEnergy(MediaDataPacket* packet, int samples) {
+  if (packet->features.length == samples) {
+    return packet->features.energy;
+  }
+  int scale_factor = 0;
+  return WebRtcSpl_Energy(packet->media_buf, samples, &scale_factor);
+}
+
+// The latency (in us) of the stages of MixPacketLoopWithMultiThread() of all
+// the rooms, on /histogramz.
+struct MixerStageHistograms {
+  LatencyHistogram tick_lateness_us{"audio_mixer_tick_lateness_us"};
+  LatencyHistogram decode_us{"audio_mixer_decode_us"};
+  LatencyHistogram mix_us{"audio_mixer_mix_us"};
+  LatencyHistogram encode_us{"audio_mixer_encode_us"};
+  LatencyHistogram tick_us{"audio_mixer_tick_us"};
+  // Not a latency, shows how many listeners share the encode of the mix.
+  LatencyHistogram encodes_per_tick{"audio_mixer_encodes_per_tick"};
+};
+
+MixerStageHistograms* GetMixerStageHistograms() {
+  static MixerStageHistograms histograms;
+  return &histograms;
+}
 } // anonymous namespace
 
 //-------------------------------------------------------------------------------------------------------
@@ -91,14 +134,6 @@ bool AudioMixerElement::Start() {
     if(FLAGS_audio_mixer_with_multi_thread) {
       LOG(INFO)<<"Use multi thread";
       mixer_thread_.reset(new boost::thread([this] { this->MixPacketLoopWithMultiThread(); }));
-      int cpu_count = std::thread::hardware_concurrency();
-      if (cpu_count > 1) {
-        cpu_count = cpu_count / 2;
-      }
-      for(int i = 0; i<cpu_count; i++) {
-        std::shared_ptr<std::thread> thread = std::make_shared<std::thread>([this] {EncodeLoop();});
-        encode_threads_.push_back(thread);
-      }
     } else if(FLAGS_audio_mixer_use_janus) {
       if (FLAGS_audio_mixer_use_stable3_loop) {
         mixer_thread_.reset(new boost::thread([this] { this->MixPacketLoopOnStable3(); }));
@@ -200,12 +235,6 @@ bool AudioMixerElement::Destroy() {
   if (decode_thread_) {
     decode_thread_->join();
   }
-  vector<std::shared_ptr<std::thread>>::iterator iter;
-  for (iter = encode_threads_.begin(); iter!=encode_threads_.end(); iter++)
-  {
-    std::shared_ptr<std::thread> thread = *iter;
-    thread->join();
-  }
   LOG(INFO) << "Thread terminated on destructor";
   return true;
 }
@@ -252,58 +281,6 @@ void AudioMixerElement::DecodeLoop() {
 }
 
 
-void AudioMixerElement::EncodeLoop() {
-  while (running_) {
-    std::shared_ptr<UnencodedPacket> map_ptr;
-    if (!unencoded_queue_.TryTake(&map_ptr)) {
-      usleep(5000);
-      continue;
-    }
-
-    // Encode the audio packet
-    bool is_encode = false;
-    std::shared_ptr<MediaOutputPacket> mixed_pkt = std::make_shared<MediaOutputPacket>();
-    
-    std::vector<uint32_t> stream_vec = map_ptr->stream_vec;
-    for (size_t i = 0; i < stream_vec.size(); i ++) {
-      long begin_proc_us = GetCurrentTime_US();
-
-      int stream_id = stream_vec[i];
-      std::shared_ptr<AudioBufferManager> buffer_manager;
-      {
-        boost::mutex::scoped_lock lock(buffer_manager_mutex_);
-        auto iter = audio_buffer_managers_.find(stream_id);
-        if (iter != audio_buffer_managers_.end()) {
-          buffer_manager = iter->second;
-        } else {
-          continue;
-        }
-      }
-
-      if (!is_encode) {
-        is_encode = buffer_manager->EncodePacket(map_ptr->unencoded_buf, 480, mixed_pkt);
-      }
-       
-      boost::mutex::scoped_lock lock(mixer_listener_mutex_);
-      auto listener = audio_mixer_listeners_.find(stream_id);
-      if (listener != audio_mixer_listeners_.end()) {
-        if (is_encode == true) {
-          mixed_pkt->timestamp = map_ptr->timestamp;
-          mixed_pkt->seq_number = map_ptr->seq_number;
-          mixed_pkt->ssrc = -1;
-          IAudioMixerRtpPacketListener* rtp_listener = (*listener).second;
-          rtp_listener->OnAudioMixed(mixed_pkt);
-        }
-      }
-      long used = GetCurrentTime_US() - begin_proc_us;
-      if (used > 5000) {
-        LOG(WARNING) << "processing elapsed time=" << used << " us";
-      }
-
-    }     
-  }
-}
-
 void AudioMixerElement::MixPacketLoop() {
   while (running_) {
     auto map_ptr = std::make_shared<DataMap>();
@@ -350,8 +327,7 @@ void AudioMixerElement::HandleData(const std::map<int32_t, DataPtr> &decoded_pac
     opus_int16 *curbuf = (opus_int16 *)packet->media_buf;
 
     // calculate its energy value:
-    int scale_factor = 0;
-    opus_int32 energy = WebRtcSpl_Energy(curbuf, samples, &scale_factor);
+    opus_int32 energy = GetPacketEnergy(packet.get(), samples);
 
     if (FLAGS_audio_mixer_skip_low) {
       // If energy is low, it could be muted or low energy sound.
@@ -361,9 +337,7 @@ void AudioMixerElement::HandleData(const std::map<int32_t, DataPtr> &decoded_pac
     }
 
     // Mix all the input voice source.
-    for (int i = 0; i < samples; ++i) {
-      mixall_buf[i] += curbuf[i];
-    }
+    AudioMixAccumulate(curbuf, mixall_buf, samples);
 
     packet_map[stream_id] = packet;
     energy_map[stream_id] = energy;
@@ -385,16 +359,8 @@ void AudioMixerElement::HandleData(const std::map<int32_t, DataPtr> &decoded_pac
       curbuf = (opus_int16 *)(packet_map[stream_id]->media_buf);
     }
 
-    //packet_collections
-    if (curbuf) {
-      for (int i = 0; i < samples; ++i) {
-        outbuf[i] = mixall_buf[i] - curbuf[i];
-      }
-    } else {
-      for (int i = 0; i < samples; ++i) {
-        outbuf[i] = mixall_buf[i];
-      }
-    }
+    // Everyone but this stream, or the whole room if it is not mixed in.
+    AudioMixMinus(mixall_buf, curbuf, outbuf, samples);
 
     auto netstat = NetworkStatusManager::Get(session_id_, stream_id);
     auto audio_send_loss = netstat->GetSendFractionLost(true);
@@ -452,9 +418,7 @@ void AudioMixerElement::HandleData(const std::map<int32_t, DataPtr> &decoded_pac
 
   if (mix_all_listener_ || mix_all_rtp_packet_listener_) {
     opus_int16 outsumbuf[samples];
-    for(int i = 0; i < samples; ++i) {
-      outsumbuf[i] = mixall_buf[i];
-    }
+    AudioMixMinus(mixall_buf, NULL, outsumbuf, samples);
     if(mix_all_listener_) {
       // mixed-audio without encode
       mix_all_listener_->OnAudioMixed(reinterpret_cast<const char*>(outsumbuf),
@@ -721,9 +685,7 @@ void AudioMixerElement::MixPacketLoopOnStable3() {
       curBuffer = (opus_int16 *)pkt->media_buf;
 
       // calculate its energy value:
-      opus_int32 _curBufferEnergy = 0;
-      int scale_factor = 0;
-      _curBufferEnergy = WebRtcSpl_Energy(curBuffer, samples, &scale_factor);
+      opus_int32 _curBufferEnergy = GetPacketEnergy(pkt.get(), samples);
       audio_energy[participantCounter] = _curBufferEnergy;
 
       //Update stream audio energy
@@ -740,9 +702,7 @@ void AudioMixerElement::MixPacketLoopOnStable3() {
       }
 
       // Mix all the input voice source.
-      for(i=0; i<samples; i++) {
-        buffer[i] += curBuffer[i];
-      }
+      AudioMixAccumulate(curBuffer, buffer, samples);
       packet_collections[participantCounter] = pkt;
       participantCounter++;
     }
@@ -764,14 +724,8 @@ void AudioMixerElement::MixPacketLoopOnStable3() {
       } else {
         curBuffer = (opus_int16 *)(packet_collections[participantCounter]->media_buf);
       }
-      //packet_collections
-      for(i=0; i<samples; i++) {
-        if (curBuffer != NULL) {
-          outBuffer[i] = buffer[i]- curBuffer[i];
-        } else {
-          outBuffer[i] = buffer[i];
-        }
-      }
+      // Everyone but this stream (curBuffer may be NULL).
+      AudioMixMinus(buffer, curBuffer, outBuffer, samples);
 
       boost::mutex::scoped_lock lock(mixer_listener_mutex_);
       auto listener = audio_mixer_listeners_.find(stream_id);
@@ -809,9 +763,7 @@ void AudioMixerElement::MixPacketLoopOnStable3() {
     }
 
     if (mix_all_listener_ || mix_all_rtp_packet_listener_) {
-      for(i=0; i<samples; i++) {
-        outSumBuffer[i] = buffer[i];
-      }
+      AudioMixMinus(buffer, NULL, outSumBuffer, samples);
       if(mix_all_listener_) {
         // mixed-audio without encode
         mix_all_listener_->OnAudioMixed(reinterpret_cast<const char*>(outSumBuffer),
@@ -849,215 +801,242 @@ void AudioMixerElement::MixPacketLoopWithMultiThread() {
 
   /* Buffer (we allocate assuming 48kHz, although we'll likely use less than that) */
   int samples = mixer_samples_;
-  opus_int32 buffer[samples];
-  opus_int16 *curBuffer = NULL;
-  opus_int16 outSumBuffer[samples];
+  std::vector<opus_int32> buffer(samples);
+  std::vector<opus_int16> outSumBuffer(samples);
 
-  // Vector to keep the muted audio stream_id
-  std::vector<uint32_t> vec_stream;
+  std::vector<TickParticipant> participants;
+  // Reused across the ticks to keep the pcm buffers.
+  std::vector<EncodeJob> jobs;
 
-  memset(buffer, 0, samples * sizeof(opus_int32));
+  AudioTaskPool* pool = Singleton<AudioTaskPool>::GetInstance();
+  MixerStageHistograms* histograms = GetMixerStageHistograms();
 
   /* RTP */
   int16_t seq = 0;
   int32_t ts = 0;
 
   /* Loop */
-  int i=0;
-  int count = 0;
-  long start_time = GetCurrentTime_MS();
-  long next_loop_time = start_time + 10;
+  std::chrono::steady_clock::time_point next_tick = std::chrono::steady_clock::now();
   while(running_) {
-    start_time = GetCurrentTime_MS();
-    if (start_time < next_loop_time) {
-      usleep(1000);
-      continue;
-    }
-    next_loop_time = next_loop_time + 10;
-    /* Do we need to mix at all? */
-    boost::mutex::scoped_lock lock(buffer_manager_mutex_);
-    count = audio_buffer_managers_.size();
-
-    if(count == 0) {
-      //  LOG(INFO) << "No participant...";
-      /* No participant, do nothing */
-      continue;
+    // Sleep until the next absolute 10ms boundary, so the ticks do not drift
+    // with the processing time. If a tick is late, the next ones run back to
+    // back to catch up, as NetEq has to be polled once per 10ms.
+    next_tick += std::chrono::milliseconds(AudioBufferManager::kTimeStepMs);
+    std::this_thread::sleep_until(next_tick);
+    long long lateness_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - next_tick).count();
+    histograms->tick_lateness_us.Record(lateness_us);
+    if (lateness_us > MIXER_MAX_CATCH_UP_US) {
+      LOG(WARNING) << "Mixer is " << lateness_us << " us behind, skip the missed ticks.";
+      next_tick = std::chrono::steady_clock::now();
     }
 
-    long begin_proc_us = GetCurrentTime_US();
+    long long begin_proc_us = GetCurrentTime_US();
 
-    /* Mix all contributions */
-    for(i=0; i<samples; i++) {
-      buffer[i] = 0;
+    // Take a snapshot of the participants, so the decode and encode stages do
+    // not hold buffer_manager_mutex_ and PushPacket() is not blocked.
+    participants.clear();
+    {
+      boost::mutex::scoped_lock lock(buffer_manager_mutex_);
+      for (auto& pair : audio_buffer_managers_) {
+        TickParticipant participant;
+        participant.stream_id = pair.first;
+        participant.manager = pair.second;
+        participants.push_back(participant);
+      }
     }
-
-    map<int, std::shared_ptr<MediaDataPacket>> packet_collections;
-    opus_int32* audio_energy = (opus_int32 *)malloc(sizeof(opus_int32) * count);
-    for (int i = 0; i < count; ++i) {
-      audio_energy[i] = 0;
+    if (participants.empty()) {
+      /* No participant, do nothing */
+      continue;
     }
-    int participantCounter = 0;
-
-    // Clear vec_stream
-    vec_stream.clear();
 
-    // Add all participants audio buffer into buffer array for every participant.
-    for (std::map<int, std::shared_ptr<AudioBufferManager>>::iterator it=audio_buffer_managers_.begin(); it!=audio_buffer_managers_.end(); ++it){
-      std::shared_ptr<AudioBufferManager>  manager = it->second;
-      std::shared_ptr<MediaDataPacket> pkt = std::make_shared<MediaDataPacket>();
-
-      // the stream is muted stream
-      if (manager->GetMute()) {
-        int stream_id = it->first;
-        vec_stream.push_back(stream_id);
+    // 1. Decode all the inputs in parallel. NetEq has its own lock, so
+    //    packets can still be pushed meanwhile.
+    pool->ParallelFor(participants.size(), [&participants, samples](int i) {
+      TickParticipant& participant = participants[i];
+      auto pkt = std::make_shared<MediaDataPacket>();
+      if (participant.manager->PopAndDecode(pkt) &&
+          pkt->length >= 0 && pkt->media_buf) {
+        participant.packet = pkt;
+        participant.energy = GetPacketEnergy(pkt.get(), samples);
       }
-
-      bool has_data = manager->PopAndDecode(pkt);
-      if (!has_data) {
-        participantCounter ++;
+    });
+    long long decoded_us = GetCurrentTime_US();
+    histograms->decode_us.Record(decoded_us - begin_proc_us);
+
+    // 2. Select the streams to mix, and mix them once.
+    int contributors = 0;
+    for (TickParticipant& participant : participants) {
+      if (!participant.packet) {
         continue;
       }
-      if(pkt->length < 0) {
-        // Decode the packet has some error.
-        participantCounter ++;
-        continue;
-      }
-      curBuffer = (opus_int16 *)pkt->media_buf;
-
-      // calculate its energy value:
-      opus_int32 _curBufferEnergy = 0;
-      int scale_factor = 0;
-      _curBufferEnergy = WebRtcSpl_Energy(curBuffer, samples, &scale_factor);
-      audio_energy[participantCounter] = _curBufferEnergy;
-
       //Update stream audio energy
-      NetworkStatusManager::UpdateTimeOfStreamHighEnergy(session_id_, it->first, _curBufferEnergy);
-
+      NetworkStatusManager::UpdateTimeOfStreamHighEnergy(session_id_,
+                                                         participant.stream_id,
+                                                         participant.energy);
       if (FLAGS_audio_mixer_skip_low) {
         // If energy is low, it could be muted or low energy sound.
-        if (_curBufferEnergy < 1000000) {
-          participantCounter ++;
+        if (participant.energy < ENERGY_LOW) {
           continue;
         }
       }
-
-      // Mix all the input voice source.
-      for(i=0; i<samples; i++) {
-        buffer[i] += curBuffer[i];
-      }
-      packet_collections[participantCounter] = pkt;
-      participantCounter++;
+      participant.contributing = true;
+      contributors++;
     }
-    
-    if (packet_collections.size() == 0) {
-      free(audio_energy);
+    if (contributors == 0) {
       continue;
     }
+    if (FLAGS_audio_mixer_max_speakers > 0 &&
+        contributors > FLAGS_audio_mixer_max_speakers) {
+      contributors = SelectSpeakers(&participants);
+    }
+    std::fill(buffer.begin(), buffer.end(), 0);
+    for (TickParticipant& participant : participants) {
+      if (participant.contributing) {
+        AudioMixAccumulate(participant.packet->media_buf, buffer.data(), samples);
+      }
+    }
 
     /* Update RTP header information */
     seq++;
     ts += samples;
 
-    participantCounter = 0;
-
     if (speaker_estimator_) {
       speaker_estimator_->NextFrame();
     }
-    std::shared_ptr<MediaOutputPacket> sum_pkt = std::make_shared<MediaOutputPacket>();
-
-    // We just send packet to mute streams once.
-    bool mute_stream_send = false;
-    for (std::map<int, std::shared_ptr<AudioBufferManager>>::iterator it=audio_buffer_managers_.begin(); it!=audio_buffer_managers_.end(); ++it){
-      int stream_id = it->first;
-      std::vector<uint32_t> streams;
 
-      // If the stream_id is in vec_stream, we just encode once. Because the streams
-      // in vec_stream is the muted stream, so we just send the same encode packet.
-      auto ite_stream = find(vec_stream.begin(), vec_stream.end(), stream_id);
-      if (ite_stream != vec_stream.end()) {
-        if (mute_stream_send) {
-          participantCounter ++;
-          continue;
-        } else {
-          mute_stream_send = true;
-          streams = vec_stream;
-        }
-      } else {
-        streams.push_back(stream_id);
+    // Everyone not in the mix (muted, silent or skipped) hears the whole
+    // mix, so they share one encode of it with the mix-all listener.
+    size_t num_jobs = 0;
+    int shared_job = -1;
+    auto next_job = [&jobs, &num_jobs, samples]() -> EncodeJob& {
+      if (num_jobs == jobs.size()) {
+        jobs.push_back(EncodeJob());
       }
-      
-      if (packet_collections.find(participantCounter) == packet_collections.end()) {
-        curBuffer = NULL;
-      } else {
-        curBuffer = (opus_int16 *)(packet_collections[participantCounter]->media_buf);
+      EncodeJob& job = jobs[num_jobs++];
+      job.manager.reset();
+      job.stream_ids.clear();
+      job.pcm.resize(samples);
+      job.audio_energy = 0;
+      job.to_mix_all = false;
+      return job;
+    };
+    auto get_shared_job = [&]() -> EncodeJob& {
+      if (shared_job < 0) {
+        EncodeJob& job = next_job();
+        AudioMixMinus(buffer.data(), NULL, job.pcm.data(), samples);
+        shared_job = num_jobs - 1;
       }
-
-      opus_int16* tmp_buf = (opus_int16*)malloc(samples * sizeof(opus_int16));
-      //packet_collections
-      for(i=0; i<samples; i++) {
-        if (curBuffer != NULL) {
-          tmp_buf[i] = buffer[i]- curBuffer[i];
-        } else {
-          tmp_buf[i] = buffer[i];
+      return jobs[shared_job];
+    };
+    {
+      boost::mutex::scoped_lock lock(mixer_listener_mutex_);
+      for (TickParticipant& participant : participants) {
+        if (audio_mixer_listeners_.find(participant.stream_id) ==
+            audio_mixer_listeners_.end()) {
+          continue;
         }
-      }
-
-      {
-        boost::mutex::scoped_lock lock(mixer_listener_mutex_);
-        auto listener = audio_mixer_listeners_.find(stream_id);
-        if(listener != audio_mixer_listeners_.end()) {
-          std::shared_ptr<UnencodedPacket> unencoded_pkt = std::make_shared<UnencodedPacket>();
-          unencoded_pkt->stream_vec = streams;
-          unencoded_pkt->timestamp = ts;
-          unencoded_pkt->seq_number = seq;
-          unencoded_pkt->ssrc = -1;
-          unencoded_pkt->unencoded_buf = tmp_buf;
-          unencoded_queue_.Add(unencoded_pkt);
-          if (speaker_estimator_) {
-            speaker_estimator_->UpdateAudioEnergy(stream_id, audio_energy[participantCounter]);
-          }
+        if (speaker_estimator_) {
+          speaker_estimator_->UpdateAudioEnergy(participant.stream_id, participant.energy);
+        }
+        if (participant.contributing) {
+          EncodeJob& job = next_job();
+          job.manager = participant.manager;
+          job.stream_ids.push_back(participant.stream_id);
+          // Everyone but this stream.
+          AudioMixMinus(buffer.data(), participant.packet->media_buf,
+                        job.pcm.data(), samples);
         } else {
-          free(tmp_buf);
+          get_shared_job().stream_ids.push_back(participant.stream_id);
         }
-        participantCounter++;
       }
-
     }
 
     if (mix_all_listener_ || mix_all_rtp_packet_listener_) {
-      for(i=0; i<samples; i++) {
-        outSumBuffer[i] = buffer[i];
-      }
+      AudioMixMinus(buffer.data(), NULL, outSumBuffer.data(), samples);
       if(mix_all_listener_) {
         // mixed-audio without encode
-        mix_all_listener_->OnAudioMixed(reinterpret_cast<const char*>(outSumBuffer),
+        mix_all_listener_->OnAudioMixed(reinterpret_cast<const char*>(outSumBuffer.data()),
                                         samples * sizeof(opus_int16));
       }
       if(mix_all_rtp_packet_listener_) {
-        bool encode_result = false;
-        std::shared_ptr<MediaOutputPacket> mixed_pkt = std::make_shared<MediaOutputPacket>();
-        encode_result = EncodePacket(outSumBuffer, samples, mixed_pkt);
-        if (encode_result == true) {
-          mixed_pkt->timestamp = ts;
-          mixed_pkt->seq_number = seq;
-          mixed_pkt->ssrc = -1;
-          mixed_pkt->audio_energy = audio_energy[0];
-          mix_all_rtp_packet_listener_->OnAudioMixed(mixed_pkt);
-        } else {
-          // encode failed
-        }
+        EncodeJob& job = get_shared_job();
+        job.to_mix_all = true;
+        job.audio_energy = participants[0].energy;
       }
     }
-    free(audio_energy);
-    audio_energy = NULL;
-
-    mixer_elapsed_time_us_ = GetCurrentTime_US() - begin_proc_us;
+    long long mixed_us = GetCurrentTime_US();
+    histograms->mix_us.Record(mixed_us - decoded_us);
+
+    // 3. Encode the mix-minus outputs in parallel and send them.
+    pool->ParallelFor(num_jobs, [this, &jobs, samples, seq, ts](int i) {
+      EncodeAndSend(&jobs[i], samples, seq, ts);
+    });
+    long long encoded_us = GetCurrentTime_US();
+    histograms->encode_us.Record(encoded_us - mixed_us);
+    histograms->encodes_per_tick.Record(num_jobs);
+    VLOG(3) << "participants=" << participants.size()
+            << " contributors=" << contributors << " encodes=" << num_jobs;
+
+    // Release the decoded packets.
+    participants.clear();
+
+    mixer_elapsed_time_us_ = encoded_us - begin_proc_us;
+    histograms->tick_us.Record(mixer_elapsed_time_us_);
     if (mixer_elapsed_time_us_ > 5000) {
       LOG(WARNING) << "processing elapsed time=" << mixer_elapsed_time_us_ << " us";
       LOG(WARNING) << "Thread load may have problem now.";
     }
   }
 }
+
+int AudioMixerElement::SelectSpeakers(std::vector<TickParticipant>* participants) {
+  std::vector<pair<int, int> > candidates;
+  for (TickParticipant& participant : *participants) {
+    if (participant.contributing) {
+      candidates.push_back(std::make_pair(participant.stream_id, (int)participant.energy));
+    }
+  }
+  std::vector<int> speakers =
+      speaker_estimator_->SelectSpeakers(candidates, FLAGS_audio_mixer_max_speakers);
+  for (TickParticipant& participant : *participants) {
+    participant.contributing =
+        participant.contributing &&
+        std::find(speakers.begin(), speakers.end(), participant.stream_id) != speakers.end();
+  }
+  return speakers.size();
+}
+
+void AudioMixerElement::EncodeAndSend(EncodeJob* job, int samples,
+                                      uint16_t seq, uint32_t ts) {
+  bool is_encode = false;
+  std::shared_ptr<MediaOutputPacket> mixed_pkt = std::make_shared<MediaOutputPacket>();
+  if (job->manager) {
+    is_encode = job->manager->EncodePacket(job->pcm.data(), samples, mixed_pkt);
+  } else {
+    // The whole mix, only one job per tick uses the mixer's own encoder.
+    is_encode = EncodePacket(job->pcm.data(), samples, mixed_pkt);
+  }
+  if (!is_encode) {
+    LOG(ERROR) << "Encode the mixed audio failed.";
+    return;
+  }
+  mixed_pkt->timestamp = ts;
+  mixed_pkt->seq_number = seq;
+  mixed_pkt->ssrc = -1;
+  mixed_pkt->audio_energy = job->audio_energy;
+
+  if (job->to_mix_all && mix_all_rtp_packet_listener_) {
+    mix_all_rtp_packet_listener_->OnAudioMixed(mixed_pkt);
+  }
+  boost::mutex::scoped_lock lock(mixer_listener_mutex_);
+  for (int stream_id : job->stream_ids) {
+    auto listener = audio_mixer_listeners_.find(stream_id);
+    if (listener != audio_mixer_listeners_.end()) {
+      listener->second->OnAudioMixed(mixed_pkt);
+    }
+  }
+}
 //-------------------------------------------------------------------------------------------------------
 //              AudioMixerElementOfStable1
 //-------------------------------------------------------------------------------------------------------
@@ -1283,9 +1262,7 @@ void AudioMixerElementOfStable1::MixPacketLoop() {
       curBuffer = (opus_int16 *)pkt->media_buf;
 
       // calculate its energy value:
-      opus_int32 _curBufferEnergy = 0;
-      int scale_factor = 0;
-      _curBufferEnergy = WebRtcSpl_Energy(curBuffer, samples, &scale_factor);
+      opus_int32 _curBufferEnergy = GetPacketEnergy(pkt.get(), samples);
       audio_energy[participantCounter] = _curBufferEnergy;
 
       //Update stream audio energy
@@ -1294,9 +1271,7 @@ void AudioMixerElementOfStable1::MixPacketLoop() {
       VLOG(2) << "_curBufferEnergy=" << _curBufferEnergy;
 
       // Mix all the input voice source.
-      for(i=0; i<samples; i++) {
-        buffer[i] += curBuffer[i];
-      }
+      AudioMixAccumulate(curBuffer, buffer, samples);
       packet_collections[participantCounter] = pkt;
       participantCounter++;
     }
@@ -1316,14 +1291,8 @@ void AudioMixerElementOfStable1::MixPacketLoop() {
       } else {
         curBuffer = (opus_int16 *)(packet_collections[participantCounter]->media_buf);
       }
-      //packet_collections
-      for(i=0; i<samples; i++) {
-        if (curBuffer != NULL) {
-          outBuffer[i] = buffer[i]- curBuffer[i];
-        } else {
-          outBuffer[i] = buffer[i];
-        }
-      }
+      // Everyone but this stream (curBuffer may be NULL).
+      AudioMixMinus(buffer, curBuffer, outBuffer, samples);
 
       boost::mutex::scoped_lock lock(mixer_listener_mutex_);
       auto listener = audio_mixer_listeners_.find(stream_id);
@@ -1344,9 +1313,7 @@ void AudioMixerElementOfStable1::MixPacketLoop() {
     }
 
     if (mix_all_listener_ || mix_all_rtp_packet_listener_) {
-      for(i=0; i<samples; i++) {
-        outSumBuffer[i] = buffer[i];
-      }
+      AudioMixMinus(buffer, NULL, outSumBuffer, samples);
       if(mix_all_listener_) {
         mix_all_listener_->OnAudioMixed(reinterpret_cast<const char*>(outSumBuffer),
                                         samples*sizeof(opus_int16));
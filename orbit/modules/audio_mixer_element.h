@@ -87,12 +87,37 @@ private:
 
   void MixPacketLoopOnStable3();
 
+  // One participant in a tick of MixPacketLoopWithMultiThread().
+  struct TickParticipant {
+    int stream_id = 0;
+    std::shared_ptr<AudioBufferManager> manager;
+    DataPtr packet;             // NULL if nothing is decoded in this tick.
+    opus_int32 energy = 0;
+    bool contributing = false;  // If the packet is in the mix.
+  };
+  // One encode of a tick, sent to one or more listeners.
+  struct EncodeJob {
+    // The encoder of the listener, or NULL to use opus_codec_ for the whole mix.
+    std::shared_ptr<AudioBufferManager> manager;
+    std::vector<int> stream_ids;
+    std::vector<opus_int16> pcm;
+    opus_int32 audio_energy = 0;
+    bool to_mix_all = false;    // Also send it to mix_all_rtp_packet_listener_.
+  };
+
+  /**
+   * The 10ms tick pipeline: decodes all the inputs in parallel, mixes once,
+   * then encodes the mix-minus outputs in parallel, both on AudioTaskPool.
+   * The listeners not in the mix share one encode of the whole mix, with
+   * --audio_mixer_max_speakers that is everyone but the active speakers.
+   */
   void MixPacketLoopWithMultiThread();
-  ProductQueue<std::shared_ptr<UnencodedPacket>> unencoded_queue_;
-  std::vector<std::shared_ptr<std::thread>> encode_threads_;
+  // Keeps at most --audio_mixer_max_speakers participants contributing,
+  // returns the number of them.
+  int SelectSpeakers(std::vector<TickParticipant>* participants);
+  void EncodeAndSend(EncodeJob* job, int samples, uint16_t seq, uint32_t ts);
 
   void DecodeLoop();
-  void EncodeLoop();
   void HandleDataLoop();
   void HandleData(const std::map<int32_t, DataPtr> &decoded_packet_map);
   /**
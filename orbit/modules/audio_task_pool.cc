@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2016 Orangelab Inc. All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * audio_task_pool.cc
+ * ---------------------------------------------------------------------------
+ * Implements the process-wide audio worker pool.
+ * ---------------------------------------------------------------------------
+ */
+#include "audio_task_pool.h"
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include <sys/prctl.h>
+
+#include <algorithm>
+#include <thread>
+
+DEFINE_int32(audio_worker_threads, 0,
+             "The number of threads to decode and encode the audio of all "
+             "the mixers. Numbers <= 0 mean half of the cores.");
+
+// The idle workers wake up periodically to check if the pool is stopped.
+#define AUDIO_WORKER_IDLE_WAIT 100 // in ms
+
+namespace orbit {
+
+AudioTaskPool::AudioTaskPool() {
+  int num_workers = FLAGS_audio_worker_threads;
+  if (num_workers <= 0) {
+    num_workers = std::thread::hardware_concurrency() / 2;
+  }
+  if (num_workers <= 0) {
+    num_workers = 1;
+  }
+  LOG(INFO) << "AudioTaskPool starts with " << num_workers << " workers.";
+
+  running_ = true;
+  for (int i = 0; i < num_workers; ++i) {
+    workers_.push_back(new boost::thread([this] { WorkerLoop(); }));
+  }
+}
+
+AudioTaskPool::~AudioTaskPool() {
+  running_ = false;
+  for (boost::thread* worker : workers_) {
+    worker->join();
+    delete worker;
+  }
+  workers_.clear();
+}
+
+void AudioTaskPool::ParallelFor(int num_tasks,
+                                const std::function<void(int)>& task) {
+  if (num_tasks <= 0) {
+    return;
+  }
+  auto batch = std::make_shared<Batch>();
+  batch->task = &task;
+  batch->num_tasks = num_tasks;
+
+  // Wake up at most one worker per task, the calling thread runs tasks too.
+  int helpers = std::min(num_tasks - 1, (int)workers_.size());
+  for (int i = 0; i < helpers; ++i) {
+    queue_.Add(batch);
+  }
+  RunBatch(batch.get());
+
+  std::unique_lock<std::mutex> lock(batch->mutex);
+  while (batch->done.load() < num_tasks) {
+    batch->cv.wait(lock);
+  }
+}
+
+void AudioTaskPool::RunBatch(Batch* batch) {
+  int ran = 0;
+  int index;
+  while ((index = batch->next.fetch_add(1)) < batch->num_tasks) {
+    (*batch->task)(index);
+    ran++;
+  }
+  if (ran > 0 && batch->done.fetch_add(ran) + ran == batch->num_tasks) {
+    std::lock_guard<std::mutex> guard(batch->mutex);
+    batch->cv.notify_all();
+  }
+}
+
+void AudioTaskPool::WorkerLoop() {
+  prctl(PR_SET_NAME, (unsigned long)"AudioWorker");
+  while (running_) {
+    std::shared_ptr<Batch> batch;
+    if (!queue_.TimedTake(AUDIO_WORKER_IDLE_WAIT, &batch)) {
+      continue;
+    }
+    // The batch may have been finished by the others already, then there
+    // is nothing left to claim.
+    RunBatch(batch.get());
+  }
+}
+
+}  // namespace orbit
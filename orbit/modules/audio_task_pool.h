@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2016 Orangelab Inc. All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * audio_task_pool.h
+ * ---------------------------------------------------------------------------
+ * Defines a process-wide, fixed pool of worker threads to run the decode and
+ * encode stages of all the audio mixers in parallel.
+ * ---------------------------------------------------------------------------
+ * The mixer thread of each room runs its per-participant work with
+ * ParallelFor() once per 10ms tick. The calling thread takes part in the work
+ * as well, so a batch always completes even if all the workers are busy with
+ * the other rooms, and the number of threads does not grow with the rooms.
+ */
+
+#pragma once
+
+#include <boost/thread.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "stream_service/orbit/base/singleton.h"
+#include "stream_service/orbit/base/thread_util.h"
+
+namespace orbit {
+
+class AudioTaskPool {
+ public:
+  // Runs task(0) ... task(num_tasks - 1) on the workers and the calling
+  // thread, and returns when all of them are done. The tasks of one batch
+  // must be independent of each other.
+  void ParallelFor(int num_tasks, const std::function<void(int)>& task);
+
+  int num_workers() const {
+    return workers_.size();
+  }
+
+ private:
+  struct Batch {
+    const std::function<void(int)>* task = NULL;
+    int num_tasks = 0;
+    std::atomic<int> next{0};
+    std::atomic<int> done{0};
+    std::mutex mutex;
+    std::condition_variable cv;
+  };
+
+  void WorkerLoop();
+  // Claims and runs the tasks of the batch until there is none left.
+  void RunBatch(Batch* batch);
+
+  ProductQueue<std::shared_ptr<Batch>> queue_;
+  std::vector<boost::thread*> workers_;
+  std::atomic<bool> running_{false};
+
+  DEFINE_AS_SINGLETON_WITHOUT_CONSTRUCTOR(AudioTaskPool);
+};
+
+}  // namespace orbit
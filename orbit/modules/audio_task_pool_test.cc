@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2016 Orangelab Inc. All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * audio_task_pool_test.cc
+ * ---------------------------------------------------------------------------
+ * Unittest for the audio worker pool.
+ * ---------------------------------------------------------------------------
+ */
+
+#include "audio_task_pool.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace orbit {
+namespace {
+
+AudioTaskPool* Pool() {
+  return Singleton<AudioTaskPool>::GetInstance();
+}
+
+TEST(AudioTaskPoolTest, RunsEveryTaskOnce) {
+  for (int num_tasks : {0, 1, 2, 7, 200}) {
+    std::vector<int> runs(num_tasks, 0);
+    Pool()->ParallelFor(num_tasks, [&runs](int i) { runs[i]++; });
+    for (int i = 0; i < num_tasks; ++i) {
+      EXPECT_EQ(1, runs[i]) << "task " << i << " of " << num_tasks;
+    }
+  }
+}
+
+TEST(AudioTaskPoolTest, ReturnsAfterAllTasksAreDone) {
+  std::atomic<int> done(0);
+  Pool()->ParallelFor(16, [&done](int i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    done++;
+  });
+  EXPECT_EQ(16, done.load());
+}
+
+TEST(AudioTaskPoolTest, SharedByManyCallers) {
+  // Like the mixer threads of many rooms ticking at the same time.
+  std::vector<std::thread> rooms;
+  std::atomic<int> total(0);
+  for (int r = 0; r < 8; ++r) {
+    rooms.push_back(std::thread([&total] {
+      for (int tick = 0; tick < 50; ++tick) {
+        std::atomic<int> done(0);
+        Pool()->ParallelFor(10, [&done](int i) { done++; });
+        EXPECT_EQ(10, done.load());
+        total += done.load();
+      }
+    }));
+  }
+  for (auto& room : rooms) {
+    room.join();
+  }
+  EXPECT_EQ(8 * 50 * 10, total.load());
+}
+
+}  // annoymous namespace
+}  // namespace orbit
@@ -13,6 +13,7 @@
 #ifndef MEDIA_PACKET_H__
 #define MEDIA_PACKET_H__
 #include "stream_service/orbit/media_definitions.h"
+#include "stream_service/orbit/audio_processing/audio_energy.h"
 #include <opus/opus.h>
 
 #include <vector>
@@ -23,6 +24,9 @@ namespace orbit{
     packetType type;
     opus_int16* media_buf = NULL;
     int length;
+    // Computed right after decoding, while media_buf is still in the cache.
+    // Only valid if features.length == length.
+    AudioFrameFeatures features;
     MediaDataPacket() {
       type = OTHER_PACKET;
       media_buf = NULL;
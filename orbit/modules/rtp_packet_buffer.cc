@@ -12,51 +12,89 @@
 
 #include "gflags/gflags.h"
 
+#include <algorithm>
+
 #include "stream_service/orbit/webrtc/webrtc_format_util.h"
 
 namespace orbit {
-  void RtpPacketBuffer::PushPacket(const char *data, int length) {
-    std::lock_guard<std::mutex> guard(queue_mutex_);
+  namespace {
+  // The smallest power of two which is >= value.
+  int RoundUpToPowerOfTwo(int value) {
+    int result = 1;
+    while (result < value) {
+      result <<= 1;
+    }
+    return result;
+  }
+
+  std::shared_ptr<dataPacket> ToDataPacket(const PacketBufferPtr& buffer) {
+    if (buffer == NULL) {
+      return NULL;
+    }
     std::shared_ptr<dataPacket> pkt(new dataPacket());
-    memcpy(pkt->data, (const char *)data, length);
-    pkt->length = length;
-    queue_.push(pkt);
+    buffer->CopyTo(pkt.get());
+    return pkt;
+  }
+  }  // annoymous namespace
+
+  RtpPacketBuffer::RtpPacketBuffer(int prebuffering_size, int capacity) {
+    prebuffering_size_ = prebuffering_size;
+    // The sequence numbers in the ring must be less than half of the 16 bits
+    // apart, to be compared with the wrap.
+    capacity = std::max(capacity, 2 * prebuffering_size);
+    capacity = std::min(RoundUpToPowerOfTwo(capacity), 0x4000);
+    slots_.resize(capacity);
+    mask_ = capacity - 1;
+  }
+
+  void RtpPacketBuffer::PushPacket(const char *data, int length) {
+    if (length < (int)sizeof(RtpHeader)) {
+      LOG(ERROR) << "Drop the packet shorter than a rtp header, length=" << length;
+      return;
+    }
+    PacketBufferPtr buffer = PacketBuffer::Create(data, length);
+    if (buffer == NULL) {
+      LOG(ERROR) << "Drop the packet larger than a PacketBuffer, length=" << length;
+      return;
+    }
+    PushBuffer(buffer);
   }
 
   void RtpPacketBuffer::PushPacket(const dataPacket& packet) {
-    std::lock_guard<std::mutex> guard(queue_mutex_);
-    std::shared_ptr<dataPacket> pkt(new dataPacket());
-    memcpy(pkt->data, (const char *)(&(packet.data[0])), packet.length);
-    pkt->length = packet.length;
+    if (packet.length < (int)sizeof(RtpHeader)) {
+      LOG(ERROR) << "Drop the packet shorter than a rtp header, length="
+                 << packet.length;
+      return;
+    }
+    PushBuffer(PacketBuffer::Create(packet));
+  }
 
-    pkt->remote_ntp_time_ms = packet.remote_ntp_time_ms;
-    pkt->arrival_time_ms = packet.arrival_time_ms;
-    pkt->rtp_timestamp = packet.rtp_timestamp;
-    queue_.push(pkt);
+  void RtpPacketBuffer::PushBuffer(const PacketBufferPtr& buffer) {
+    std::lock_guard<std::mutex> guard(queue_mutex_);
+    InsertLocked(buffer);
   }
 
   std::shared_ptr<dataPacket> RtpPacketBuffer::PopPacket() {
-    std::lock_guard<std::mutex> guard(queue_mutex_);
-    if (queue_.size() > prebuffering_size_) {
-      std::shared_ptr<orbit::dataPacket> rtp_packet = queue_.top();
-      queue_.pop();
-      return rtp_packet;
-    }
-    return NULL;    
+    return ToDataPacket(PopBuffer());
   }
 
   std::shared_ptr<dataPacket> RtpPacketBuffer::TopPacket() {
+    return ToDataPacket(TopBuffer());
+  }
+
+  PacketBufferPtr RtpPacketBuffer::PopBuffer() {
     std::lock_guard<std::mutex> guard(queue_mutex_);
-    if (queue_.size() > prebuffering_size_) {
-      std::shared_ptr<orbit::dataPacket> rtp_packet = queue_.top();
-      return rtp_packet;
-    }
-    return NULL;    
+    return PopLocked();
+  }
+
+  PacketBufferPtr RtpPacketBuffer::TopBuffer() {
+    std::lock_guard<std::mutex> guard(queue_mutex_);
+    return TopLocked();
   }
 
   int RtpPacketBuffer::GetSize() {  // total size of all items in the queue
     std::lock_guard<std::mutex> guard(queue_mutex_);
-    return queue_.size();
+    return count_;
   }
 
   bool RtpPacketBuffer::IsEmpty() { //Whether or not has data;
@@ -64,33 +102,145 @@ namespace orbit {
   }
 
   bool RtpPacketBuffer::PrebufferingDone() {
-    return GetSize() > prebuffering_size_;
+    std::lock_guard<std::mutex> guard(queue_mutex_);
+    return count_ > prebuffering_size_;
   }
 
-  void VideoAwareFrameBuffer::PushPacket(const char *data, int length) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    RtpHeader* h1 = (RtpHeader*)(data);
-    int cur_seq = h1->getSeqNumber();
+  int64_t RtpPacketBuffer::duplicated_packets() {
+    std::lock_guard<std::mutex> guard(queue_mutex_);
+    return duplicated_packets_;
+  }
+
+  int64_t RtpPacketBuffer::late_packets() {
+    std::lock_guard<std::mutex> guard(queue_mutex_);
+    return late_packets_;
+  }
+
+  int64_t RtpPacketBuffer::lost_packets() {
+    std::lock_guard<std::mutex> guard(queue_mutex_);
+    return lost_packets_;
+  }
+
+  int64_t RtpPacketBuffer::overflow_packets() {
+    std::lock_guard<std::mutex> guard(queue_mutex_);
+    return overflow_packets_;
+  }
+
+  bool RtpPacketBuffer::InsertLocked(const PacketBufferPtr& buffer) {
+    uint16_t seq = SequenceOf(*buffer);
+    int capacity = slots_.size();
+    if (count_ == 0 && !popped_) {
+      head_seq_ = seq;
+    }
+    // The distance from the head, negative if seq is older than the head.
+    int offset = (int16_t)(uint16_t)(seq - head_seq_);
+    if (offset < -capacity || offset >= 2 * capacity ||
+        (count_ == 0 && offset >= capacity)) {
+      // Too far away from the ring, the stream is restarted (or jumped), so
+      // start over from this packet.
+      VLOG(2) << "Restart the buffer at seq " << seq << ", head_seq=" << head_seq_;
+      overflow_packets_ += count_;
+      CleanBufferLocked();
+      head_seq_ = seq;
+      offset = 0;
+    } else if (offset < 0) {
+      if (popped_ || (uint16_t)(tail_seq_ - seq) >= capacity) {
+        late_packets_++;
+        return false;
+      }
+      // Nothing is popped yet, hold the packet older than all the others.
+      head_seq_ = seq;
+      offset = 0;
+    } else if (offset >= capacity) {
+      // Drop the oldest packets to make room for the new one.
+      uint16_t new_head = seq - capacity + 1;
+      while (head_seq_ != new_head) {
+        PacketBufferPtr& slot = Slot(head_seq_);
+        if (slot != NULL) {
+          slot.reset();
+          count_--;
+          overflow_packets_++;
+        }
+        head_seq_++;
+      }
+      popped_ = true;
+    }
+
+    PacketBufferPtr& slot = Slot(seq);
+    if (slot != NULL) {
+      duplicated_packets_++;
+      return false;
+    }
+    slot = buffer;
+    if (count_ == 0 || IsNewerSequence(seq, tail_seq_)) {
+      tail_seq_ = seq;
+    }
+    count_++;
+    return true;
+  }
+
+  PacketBufferPtr RtpPacketBuffer::PopLocked() {
+    if (count_ == 0 || count_ <= prebuffering_size_) {
+      return NULL;
+    }
+    // The slots are skipped if the packets are still missing.
+    while (Slot(head_seq_) == NULL) {
+      head_seq_++;
+      lost_packets_++;
+    }
+    PacketBufferPtr buffer;
+    buffer.swap(Slot(head_seq_));
+    head_seq_++;
+    count_--;
+    popped_ = true;
+    return buffer;
+  }
+
+  PacketBufferPtr RtpPacketBuffer::TopLocked() {
+    if (count_ == 0 || count_ <= prebuffering_size_) {
+      return NULL;
+    }
+    uint16_t seq = head_seq_;
+    while (Slot(seq) == NULL) {
+      seq++;
+    }
+    return Slot(seq);
+  }
+
+  void RtpPacketBuffer::CleanBufferLocked() {
+    if (count_ > 0) {
+      for (PacketBufferPtr& slot : slots_) {
+        slot.reset();
+      }
+    }
+    count_ = 0;
+    popped_ = false;
+  }
+
+  void VideoAwareFrameBuffer::PushBuffer(const PacketBufferPtr& buffer) {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    int cur_seq = SequenceOf(*buffer);
 
     if (buffer_type_ == NORMAL_BUFFER) {
-      CleanBuffer();
+      CleanBufferLocked();
       return;
-    } 
+    }
     if (buffer_type_ == STORAGE_BUFFER) {
       // data is a frame
-      if (IsKeyFramePacket(reinterpret_cast<const unsigned char*>(data), length)) {
+      if (IsKeyFramePacket(reinterpret_cast<const unsigned char*>(buffer->data()),
+                           buffer->length())) {
         // If the packet is a key frame.
-        CleanBuffer();
+        CleanBufferLocked();
         key_frame_seq_ = cur_seq;
         has_key_frame_ = true;
-        RtpPacketBuffer::PushPacket(data, length);
+        InsertLocked(buffer);
       } else {
         // Not a key frame, just insert into the queue.
         if (has_key_frame_) {
           // assert the first data in the queue is KeyFrame, and the inserted packet
           // should not be inserted before the KeyFrame.
-          if (cur_seq > key_frame_seq_) {
-            RtpPacketBuffer::PushPacket(data, length);
+          if (IsNewerSequence(cur_seq, key_frame_seq_)) {
+            InsertLocked(buffer);
           }
         } else {
           // No Op.
@@ -99,14 +249,14 @@ namespace orbit {
       }
     }
     if (buffer_type_ == PLAY_BUFFER) {
-      RtpPacketBuffer::PushPacket(data, length);
+      InsertLocked(buffer);
     }
   }
 
-  std::shared_ptr<dataPacket> VideoAwareFrameBuffer::PopPacket() {
-    std::lock_guard<std::mutex> lock(mutex_);
+  PacketBufferPtr VideoAwareFrameBuffer::PopBuffer() {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
     if (buffer_type_ == PLAY_BUFFER) {
-      return RtpPacketBuffer::PopPacket();
+      return PopLocked();
     }
     LOG(ERROR) << "In STORAGE_BUFFER and NORMAL_BUFFER, PopPacket() is not"
                << "supposed to call. BufferType=" << GetBufferTypeAsString(buffer_type_);
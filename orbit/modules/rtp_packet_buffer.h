@@ -10,8 +10,11 @@
  *    conditions the rtp transportations, for examples:
  *     - A prebuffering_size is used to configure the prebuffering threshold. During
  *        prebuffering phase, the PopPacket() will not pop any packets from the queue.
- *     - The Queue use a priority_queue to store the inserted packets in the order
- *        of sequence number.
+ *     - The Queue is a ring of pooled PacketBuffers indexed by the sequence
+ *        number (seq & mask), so a push or a pop is O(1) and the packets are
+ *        popped in the order of sequence number. The duplicated packets and
+ *        the packets older than the popped ones are dropped, the missing
+ *        packets are skipped (not waited for) when popping.
  *    Sample usage of this queue: 
  *     -  If use as a simple jittersbuffer, change the prebuffering_size to hold
  *        the received packets in the queue for a longer time, and it will be
@@ -33,84 +36,122 @@
 
 #pragma once
 
+#include <stdint.h>
+
 #include <mutex>
-#include <queue>
 #include <memory>
+#include <vector>
 
 #include "stream_service/orbit/media_definitions.h"
+#include "stream_service/orbit/packet_buffer.h"
 #include "stream_service/orbit/rtp/rtp_headers.h"
 #include "glog/logging.h"
 
 #include "gtest/gtest_prod.h"
 
+// The default number of slots of the ring, must be a power of two. It should
+// hold the largest key frame plus the prebuffering packets.
+#define RTP_PACKET_BUFFER_DEFAULT_CAPACITY 2048
+
 namespace orbit {
 
 class RtpPacketBuffer {
  public:
-  RtpPacketBuffer(int prebuffering_size) {
-    prebuffering_size_ = prebuffering_size;
-  }
+  // The capacity is rounded up to a power of two, and to at least twice
+  // of the prebuffering_size.
+  RtpPacketBuffer(int prebuffering_size,
+                  int capacity = RTP_PACKET_BUFFER_DEFAULT_CAPACITY);
   virtual ~RtpPacketBuffer() {
   }
 
   // push and pop methods.
-  virtual void PushPacket(const char *data, int length);
-  virtual void PushPacket(const dataPacket& packet);
-
-  virtual std::shared_ptr<dataPacket> PopPacket();
-  virtual std::shared_ptr<dataPacket> TopPacket();
+  void PushPacket(const char *data, int length);
+  void PushPacket(const dataPacket& packet);
+  // Takes a reference of the buffer, the buffer should not be modified
+  // afterwards.
+  virtual void PushBuffer(const PacketBufferPtr& buffer);
+
+  // The dataPacket versions copy the packet out of the pooled buffer, the
+  // Buffer versions don't.
+  std::shared_ptr<dataPacket> PopPacket();
+  std::shared_ptr<dataPacket> TopPacket();
+  virtual PacketBufferPtr PopBuffer();
+  virtual PacketBufferPtr TopBuffer();
 
   virtual int GetSize();  // total size of all items in the queue
   virtual bool IsEmpty(); //Whether or not has data;
   virtual bool PrebufferingDone(); // Whether the data prebuffering is done.
   // Clean the buffer.
   virtual void CleanBuffer() {
-    while(!IsEmpty()) {
-      //PopPacket();
-      queue_.pop();
-    }
+    std::lock_guard<std::mutex> guard(queue_mutex_);
+    CleanBufferLocked();
   }
 
   virtual void SetPrebufferingSize(int size) {
+    std::lock_guard<std::mutex> guard(queue_mutex_);
     prebuffering_size_ = size;
   }
 
+  // Stats
+  int capacity() const {
+    return slots_.size();
+  }
+  // The packets already in the buffer.
+  int64_t duplicated_packets();
+  // The packets older than the popped ones, or too old to fit in the ring.
+  int64_t late_packets();
+  // The missing packets skipped by PopPacket().
+  int64_t lost_packets();
+  // The packets dropped to make room for the newer ones.
+  int64_t overflow_packets();
+
+  // Returns true if seq is newer than prev_seq, taking into account RTP
+  // sequence number wrap.
+  static bool IsNewerSequence(uint16_t seq, uint16_t prev_seq) {
+    return seq != prev_seq && (uint16_t)(seq - prev_seq) < 0x8000;
+  }
+
  protected:
-  // Implements x < y, taking into account RTP sequence number wrap
-  // The general idea is if there's a very large difference between
-  // x and y, that implies that the larger one is actually "less than"
-  // the smaller one.
-  //
-  // I picked 0x8000 as my "very large" threshold because it splits
-  // 0xffff, so it seems like a logical choice.
-  class dataPacketComparator {
-  public:
-    bool operator() (std::shared_ptr<orbit::dataPacket> a,
-                     std::shared_ptr<orbit::dataPacket> b) {
-      RtpHeader* h1 = reinterpret_cast<RtpHeader*>(&(a->data[0]));
-      RtpHeader* h2 = reinterpret_cast<RtpHeader*>(&(b->data[0]));
-      uint16_t x = h1->getSeqNumber();
-      uint16_t y = h2->getSeqNumber();
-      int diff = x - y;
-      if (diff > 0) {
-        return (diff < 0x8000);
-      } else if (diff < 0) {
-        return (diff < -0x8000);
-      } else { // diff == 0
-        return false;
-      }
-    }
-  };
-  
-  // A priority queue to make the inserted dataPacket sorted.
-  std::priority_queue<std::shared_ptr<orbit::dataPacket>,
-    std::vector<std::shared_ptr<orbit::dataPacket>>,
-    dataPacketComparator> queue_;
+  // The methods below should be called with queue_mutex_ held.
+  // Returns false if the packet is dropped.
+  bool InsertLocked(const PacketBufferPtr& buffer);
+  PacketBufferPtr PopLocked();
+  PacketBufferPtr TopLocked();
+  void CleanBufferLocked();
+
+  static uint16_t SequenceOf(const PacketBuffer& buffer) {
+    return reinterpret_cast<const RtpHeader*>(buffer.data())->getSeqNumber();
+  }
 
-  // A mutex to protect the access to priority queue above.
+  // A mutex to protect all the fields below, and the fields of the
+  // subclasses.
   std::mutex queue_mutex_;
 
   int prebuffering_size_ = 0;
+
+ private:
+  PacketBufferPtr& Slot(uint16_t seq) {
+    return slots_[seq & mask_];
+  }
+
+  // slots_[seq & mask_] holds the packet of seq, for the seqs in
+  // [head_seq_, head_seq_ + capacity).
+  std::vector<PacketBufferPtr> slots_;
+  uint16_t mask_ = 0;
+  // The oldest seq which can be popped, all the slots before it are empty.
+  uint16_t head_seq_ = 0;
+  // The newest seq in the ring, valid only if count_ > 0.
+  uint16_t tail_seq_ = 0;
+  int count_ = 0;
+  // Whether any packet is popped since the buffer is cleaned. If so, the
+  // packets before head_seq_ are late, otherwise the ring grows backward to
+  // hold them.
+  bool popped_ = false;
+
+  int64_t duplicated_packets_ = 0;
+  int64_t late_packets_ = 0;
+  int64_t lost_packets_ = 0;
+  int64_t overflow_packets_ = 0;
 };
 
 class VideoAwareFrameBuffer : public RtpPacketBuffer {
@@ -126,11 +167,11 @@ class VideoAwareFrameBuffer : public RtpPacketBuffer {
   };
   static std::string GetBufferTypeAsString(BufferType type) {
     switch(type) {
-    case NORMAL_BUFFER: 
+    case NORMAL_BUFFER:
       return "NORMAL_BUFFER";
-    case STORAGE_BUFFER: 
+    case STORAGE_BUFFER:
       return "STORAGE_BUFFER";
-    case PLAY_BUFFER: 
+    case PLAY_BUFFER:
       return "PLAY_BUFFER";
     }
     return "INVALID";
@@ -142,25 +183,27 @@ class VideoAwareFrameBuffer : public RtpPacketBuffer {
   virtual ~VideoAwareFrameBuffer() {
   }
 
+  // The buffer type shares the queue_mutex_ with the packets, so a push or
+  // a pop takes only one lock.
   void SetBufferType(BufferType type) {
-    std::lock_guard<std::mutex> lock(mutex_);
+    std::lock_guard<std::mutex> lock(queue_mutex_);
     // Change to another buffer type.
     buffer_type_ = type;
   }
   BufferType GetBufferType() {
-    std::lock_guard<std::mutex> lock(mutex_);
+    std::lock_guard<std::mutex> lock(queue_mutex_);
     return buffer_type_;
   }
 
   void ResetBuffer() {
-    std::lock_guard<std::mutex> lock(mutex_);
+    std::lock_guard<std::mutex> lock(queue_mutex_);
     has_key_frame_ = false;
-    CleanBuffer();
+    CleanBufferLocked();
   }
 
   // push and pop methods.
-  virtual void PushPacket(const char *data, int length);
-  virtual std::shared_ptr<dataPacket> PopPacket();
+  virtual void PushBuffer(const PacketBufferPtr& buffer) override;
+  virtual PacketBufferPtr PopBuffer() override;
 
   static bool IsKeyFramePacketStatic(const unsigned char* buf, int length);
 
@@ -168,10 +211,12 @@ class VideoAwareFrameBuffer : public RtpPacketBuffer {
     return IsKeyFramePacketStatic(buf, length);
   }
   virtual bool IsKeyFramePacket(std::shared_ptr<dataPacket> rtp_packet) {
-    return IsKeyFramePacket((const unsigned char*)&(rtp_packet->data[0]), rtp_packet->length);    
+    return IsKeyFramePacket((const unsigned char*)&(rtp_packet->data[0]), rtp_packet->length);
+  }
+  virtual bool IsKeyFramePacket(const PacketBufferPtr& rtp_packet) {
+    return IsKeyFramePacket((const unsigned char*)rtp_packet->data(), rtp_packet->length());
   }
  private:
-  std::mutex mutex_;
   BufferType buffer_type_;
   bool has_key_frame_ = false;
   int key_frame_seq_ = 0;
@@ -38,6 +38,24 @@ public:
   }
 };
 
+// Pushes a 50 bytes rtp packet of seq into the buffer.
+void PushSeq(RtpPacketBuffer* buffer, uint16_t seq) {
+  char data[50];
+  memset(data, 0, sizeof(data));
+  RtpHeader* h = (RtpHeader*)data;
+  h->setSeqNumber(seq);
+  buffer->PushPacket(data, sizeof(data));
+}
+
+// Returns the seq of the popped packet, or -1 if nothing is popped.
+int PopSeq(RtpPacketBuffer* buffer) {
+  std::shared_ptr<dataPacket> packet = buffer->PopPacket();
+  if (packet == NULL) {
+    return -1;
+  }
+  return reinterpret_cast<RtpHeader*>(&(packet->data[0]))->getSeqNumber();
+}
+
 class RtpPacketBufferTest : public testing::Test {
  protected:
   virtual void SetUp() override {
@@ -221,4 +239,77 @@ TEST_F(RtpPacketBufferTest, PlayBufferTest) {
   }
 }
 
+TEST_F(RtpPacketBufferTest, PopsReorderedPacketsInOrder) {
+  RtpPacketBuffer buffer(0);
+  for (uint16_t seq : {3, 1, 2, 5, 4}) {
+    PushSeq(&buffer, seq);
+  }
+  EXPECT_EQ(5, buffer.GetSize());
+  for (int seq = 1; seq <= 5; ++seq) {
+    EXPECT_EQ(seq, PopSeq(&buffer));
+  }
+  EXPECT_EQ(-1, PopSeq(&buffer));
+  EXPECT_TRUE(buffer.IsEmpty());
+}
+
+TEST_F(RtpPacketBufferTest, DropsDuplicatedAndLatePackets) {
+  RtpPacketBuffer buffer(0);
+  PushSeq(&buffer, 100);
+  PushSeq(&buffer, 101);
+  PushSeq(&buffer, 101);
+  EXPECT_EQ(2, buffer.GetSize());
+  EXPECT_EQ(1, buffer.duplicated_packets());
+
+  EXPECT_EQ(100, PopSeq(&buffer));
+  // 100 is popped already, and 99 is older than it.
+  PushSeq(&buffer, 100);
+  PushSeq(&buffer, 99);
+  EXPECT_EQ(1, buffer.GetSize());
+  EXPECT_EQ(2, buffer.late_packets());
+  EXPECT_EQ(101, PopSeq(&buffer));
+}
+
+TEST_F(RtpPacketBufferTest, SkipsMissingPackets) {
+  RtpPacketBuffer buffer(0);
+  PushSeq(&buffer, 10);
+  PushSeq(&buffer, 13);
+  EXPECT_EQ(10, PopSeq(&buffer));
+  EXPECT_EQ(13, PopSeq(&buffer));
+  EXPECT_EQ(2, buffer.lost_packets());
+  // 12 comes after 13 is popped, it is late.
+  PushSeq(&buffer, 12);
+  EXPECT_TRUE(buffer.IsEmpty());
+}
+
+TEST_F(RtpPacketBufferTest, HandlesSequenceWrap) {
+  RtpPacketBuffer buffer(2);
+  for (uint16_t seq : {65534, 0, 65535, 1}) {
+    PushSeq(&buffer, seq);
+  }
+  EXPECT_TRUE(buffer.PrebufferingDone());
+  EXPECT_EQ(65534, PopSeq(&buffer));
+  EXPECT_EQ(65535, PopSeq(&buffer));
+  // Holds the last 2 packets for prebuffering.
+  EXPECT_EQ(-1, PopSeq(&buffer));
+  buffer.SetPrebufferingSize(0);
+  EXPECT_EQ(0, PopSeq(&buffer));
+  EXPECT_EQ(1, PopSeq(&buffer));
+}
+
+TEST_F(RtpPacketBufferTest, DropsOldestPacketsWhenFull) {
+  RtpPacketBuffer buffer(0, 16);
+  EXPECT_EQ(16, buffer.capacity());
+  for (int seq = 0; seq < 20; ++seq) {
+    PushSeq(&buffer, seq);
+  }
+  EXPECT_EQ(16, buffer.GetSize());
+  EXPECT_EQ(4, buffer.overflow_packets());
+  EXPECT_EQ(4, PopSeq(&buffer));
+
+  // A jump far away restarts the buffer.
+  PushSeq(&buffer, 30000);
+  EXPECT_EQ(1, buffer.GetSize());
+  EXPECT_EQ(30000, PopSeq(&buffer));
+}
+
 }  // namespace orbit
@@ -0,0 +1,147 @@
+/*
+ * Copyright 2016 (C) Orange Labs Inc. All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * simulcast_layer_selector.cc
+ * ---------------------------------------------------------------------------
+ *  Implements the per viewer simulcast layer selection.
+ * ---------------------------------------------------------------------------
+ */
+
+#include "simulcast_layer_selector.h"
+
+#include "glog/logging.h"
+
+namespace orbit {
+
+void SimulcastLayerSelector::OnPublisherPacket(int publisher_id, int layer,
+                                               int length, int64_t now_ms) {
+  if (layer < 0 || layer >= SIMULCAST_MAX_LAYERS) {
+    return;
+  }
+  Layer& l = publishers_[publisher_id].layers[layer];
+  if (l.window_start_ms < 0) {
+    l.window_start_ms = now_ms;
+  } else if (now_ms - l.window_start_ms >= SIMULCAST_BITRATE_WINDOW_MS) {
+    l.bitrate_bps = l.window_bytes * 8 * 1000 / (now_ms - l.window_start_ms);
+    l.measured = true;
+    l.window_start_ms = now_ms;
+    l.window_bytes = 0;
+  }
+  l.window_bytes += length;
+  l.last_packet_ms = now_ms;
+}
+
+void SimulcastLayerSelector::OnReceiverEstimate(int viewer_id,
+                                                uint64_t bitrate_bps) {
+  Viewer& viewer = viewers_[viewer_id];
+  viewer.has_estimate = true;
+  viewer.estimate_bps = bitrate_bps;
+}
+
+int SimulcastLayerSelector::TargetLayer(int viewer_id, int publisher_id,
+                                        int64_t now_ms) {
+  Viewer& viewer = viewers_[viewer_id];
+  auto iter = publishers_.find(publisher_id);
+  if (iter == publishers_.end()) {
+    return viewer.current_layer;
+  }
+  const Publisher& publisher = iter->second;
+  uint64_t budget_bps = viewer.estimate_bps *
+                        (100 - SIMULCAST_ESTIMATE_HEADROOM_PERCENT) / 100;
+  int target = -1;
+  for (int i = 0; i < SIMULCAST_MAX_LAYERS; ++i) {
+    const Layer& layer = publisher.layers[i];
+    if (!Available(layer, now_ms)) {
+      continue;
+    }
+    if (target != -1 && viewer.has_estimate &&
+        (!layer.measured || layer.bitrate_bps > budget_bps)) {
+      break;
+    }
+    target = i;
+  }
+  if (target == -1) {
+    // Nothing is sent, keeps the layer for when the publisher is back.
+    return viewer.current_layer;
+  }
+  if (target <= viewer.current_layer ||
+      !Available(publisher.layers[viewer.current_layer], now_ms)) {
+    viewer.upgrade_since_ms = -1;
+    return target;
+  }
+  if (viewer.upgrade_since_ms < 0) {
+    viewer.upgrade_since_ms = now_ms;
+  }
+  if (now_ms - viewer.upgrade_since_ms < SIMULCAST_UPGRADE_HOLD_MS) {
+    return viewer.current_layer;
+  }
+  return target;
+}
+
+int SimulcastLayerSelector::CurrentLayer(int viewer_id) const {
+  auto iter = viewers_.find(viewer_id);
+  if (iter == viewers_.end()) {
+    return 0;
+  }
+  return iter->second.current_layer;
+}
+
+void SimulcastLayerSelector::SetCurrentLayer(int viewer_id, int layer) {
+  if (layer < 0 || layer >= SIMULCAST_MAX_LAYERS) {
+    LOG(ERROR) << "Invalid simulcast layer " << layer;
+    return;
+  }
+  Viewer& viewer = viewers_[viewer_id];
+  if (viewer.current_layer != layer) {
+    VLOG(2) << "Viewer " << viewer_id << " switches from simulcast layer "
+            << viewer.current_layer << " to " << layer;
+  }
+  viewer.current_layer = layer;
+  viewer.upgrade_since_ms = -1;
+}
+
+uint32_t SimulcastLayerSelector::LayerBitrate(int publisher_id,
+                                              int layer) const {
+  auto iter = publishers_.find(publisher_id);
+  if (iter == publishers_.end() || layer < 0 || layer >= SIMULCAST_MAX_LAYERS) {
+    return 0;
+  }
+  return iter->second.layers[layer].bitrate_bps;
+}
+
+bool SimulcastLayerSelector::LayerAvailable(int publisher_id, int layer,
+                                            int64_t now_ms) const {
+  auto iter = publishers_.find(publisher_id);
+  if (iter == publishers_.end() || layer < 0 || layer >= SIMULCAST_MAX_LAYERS) {
+    return false;
+  }
+  return Available(iter->second.layers[layer], now_ms);
+}
+
+bool SimulcastLayerSelector::ShouldRequestKeyFrame(int publisher_id,
+                                                   int64_t now_ms) {
+  Publisher& publisher = publishers_[publisher_id];
+  if (publisher.last_key_frame_request_ms >= 0 &&
+      now_ms - publisher.last_key_frame_request_ms <
+      SIMULCAST_KEY_FRAME_REQUEST_INTERVAL_MS) {
+    return false;
+  }
+  publisher.last_key_frame_request_ms = now_ms;
+  return true;
+}
+
+void SimulcastLayerSelector::RemovePublisher(int publisher_id) {
+  publishers_.erase(publisher_id);
+}
+
+void SimulcastLayerSelector::RemoveViewer(int viewer_id) {
+  viewers_.erase(viewer_id);
+}
+
+bool SimulcastLayerSelector::Available(const Layer& layer, int64_t now_ms) {
+  return layer.last_packet_ms >= 0 &&
+         now_ms - layer.last_packet_ms < SIMULCAST_LAYER_TIMEOUT_MS;
+}
+
+}  // namespace orbit
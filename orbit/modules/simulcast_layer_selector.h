@@ -0,0 +1,93 @@
+/*
+ * Copyright 2016 (C) Orange Labs Inc. All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * simulcast_layer_selector.h
+ * ---------------------------------------------------------------------------
+ *  Chooses the simulcast layer each viewer receives of its publisher:
+ *   - The bitrate of each layer of a publisher is measured per window, a
+ *     layer without packets for SIMULCAST_LAYER_TIMEOUT_MS is not available
+ *     (the browser stops the upper layers when its uplink is poor).
+ *   - A viewer gets the highest available layer whose bitrate fits into its
+ *     REMB estimate minus a headroom, and at least the lowest layer. Without
+ *     an estimate yet, it goes up to the highest layer.
+ *   - A lower layer is chosen at once, a higher one only once the estimate
+ *     has allowed it for SIMULCAST_UPGRADE_HOLD_MS, so the layer doesn't
+ *     flap with the estimate.
+ *  The switch itself is done by the forwarder on a key frame of the new
+ *  layer, which then calls SetCurrentLayer().
+ *  Not thread safe, the owner serializes the calls.
+ * ---------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <map>
+
+#define SIMULCAST_MAX_LAYERS 3
+#define SIMULCAST_BITRATE_WINDOW_MS 1000
+#define SIMULCAST_LAYER_TIMEOUT_MS 2000
+#define SIMULCAST_UPGRADE_HOLD_MS 3000
+// The part of the estimate which is not given to the video layer.
+#define SIMULCAST_ESTIMATE_HEADROOM_PERCENT 15
+#define SIMULCAST_KEY_FRAME_REQUEST_INTERVAL_MS 1000
+
+namespace orbit {
+
+class SimulcastLayerSelector {
+ public:
+  SimulcastLayerSelector() {}
+  ~SimulcastLayerSelector() {}
+
+  // A packet of the layer of the publisher is received.
+  void OnPublisherPacket(int publisher_id, int layer, int length,
+                         int64_t now_ms);
+  // The REMB of the viewer.
+  void OnReceiverEstimate(int viewer_id, uint64_t bitrate_bps);
+
+  // The layer the viewer should receive of the publisher.
+  int TargetLayer(int viewer_id, int publisher_id, int64_t now_ms);
+  // The layer the viewer receives, 0 if never set.
+  int CurrentLayer(int viewer_id) const;
+  void SetCurrentLayer(int viewer_id, int layer);
+
+  // The bitrate of the layer measured over the last window, 0 if not known.
+  uint32_t LayerBitrate(int publisher_id, int layer) const;
+  bool LayerAvailable(int publisher_id, int layer, int64_t now_ms) const;
+
+  // Whether to ask the publisher for a key frame to switch a viewer, at most
+  // once per SIMULCAST_KEY_FRAME_REQUEST_INTERVAL_MS.
+  bool ShouldRequestKeyFrame(int publisher_id, int64_t now_ms);
+
+  void RemovePublisher(int publisher_id);
+  void RemoveViewer(int viewer_id);
+
+ private:
+  struct Layer {
+    int64_t last_packet_ms = -1;
+    int64_t window_start_ms = -1;
+    int64_t window_bytes = 0;
+    uint32_t bitrate_bps = 0;
+    bool measured = false;
+  };
+  struct Publisher {
+    Layer layers[SIMULCAST_MAX_LAYERS];
+    int64_t last_key_frame_request_ms = -1;
+  };
+  struct Viewer {
+    bool has_estimate = false;
+    uint64_t estimate_bps = 0;
+    int current_layer = 0;
+    // Since when a higher layer than the current one is allowed, or -1.
+    int64_t upgrade_since_ms = -1;
+  };
+
+  static bool Available(const Layer& layer, int64_t now_ms);
+
+  std::map<int, Publisher> publishers_;
+  std::map<int, Viewer> viewers_;
+};
+
+}  // namespace orbit
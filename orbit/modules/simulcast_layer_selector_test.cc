@@ -0,0 +1,132 @@
+/*
+ * Copyright 2016 (C) Orange Labs Inc. All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * simulcast_layer_selector_test.cc
+ */
+
+#include "gtest/gtest.h"
+#include "glog/logging.h"
+
+#include "simulcast_layer_selector.h"
+
+namespace orbit {
+namespace {
+
+const int kPublisher = 1;
+const int kViewer = 2;
+
+class SimulcastLayerSelectorTest : public testing::Test {
+ protected:
+  virtual void SetUp() override {
+    now_ms_ = 10000;
+  }
+
+  virtual void TearDown() override {
+  }
+
+  // Sends the layers at 160k, 480k and 1.6m bps for the duration, one
+  // packet per layer every 10ms.
+  void SendLayers(int layers, int64_t duration_ms) {
+    const int kBitrates[] = {160000, 480000, 1600000};
+    for (int64_t end = now_ms_ + duration_ms; now_ms_ < end; now_ms_ += 10) {
+      for (int layer = 0; layer < layers; ++layer) {
+        selector_.OnPublisherPacket(kPublisher, layer,
+                                    kBitrates[layer] / 8 / 100, now_ms_);
+      }
+    }
+  }
+
+  SimulcastLayerSelector selector_;
+  int64_t now_ms_;
+};
+
+TEST_F(SimulcastLayerSelectorTest, MeasuresTheLayers) {
+  SendLayers(3, 2100);
+  EXPECT_EQ(160000, selector_.LayerBitrate(kPublisher, 0));
+  EXPECT_EQ(480000, selector_.LayerBitrate(kPublisher, 1));
+  EXPECT_EQ(1600000, selector_.LayerBitrate(kPublisher, 2));
+  EXPECT_TRUE(selector_.LayerAvailable(kPublisher, 2, now_ms_));
+  EXPECT_FALSE(selector_.LayerAvailable(
+      kPublisher, 2, now_ms_ + SIMULCAST_LAYER_TIMEOUT_MS));
+  EXPECT_EQ(0, selector_.LayerBitrate(kPublisher + 1, 0));
+}
+
+TEST_F(SimulcastLayerSelectorTest, HighestLayerWithoutEstimate) {
+  SendLayers(3, 2100);
+  EXPECT_EQ(0, selector_.TargetLayer(kViewer, kPublisher, now_ms_));
+  SendLayers(3, SIMULCAST_UPGRADE_HOLD_MS);
+  EXPECT_EQ(2, selector_.TargetLayer(kViewer, kPublisher, now_ms_));
+  selector_.SetCurrentLayer(kViewer, 2);
+  // Only the lowest layer is sent.
+  SendLayers(1, SIMULCAST_LAYER_TIMEOUT_MS);
+  EXPECT_EQ(0, selector_.TargetLayer(kViewer, kPublisher, now_ms_));
+}
+
+TEST_F(SimulcastLayerSelectorTest, LayerFitsTheEstimate) {
+  SendLayers(3, 2100);
+  selector_.SetCurrentLayer(kViewer, 2);
+  selector_.OnReceiverEstimate(kViewer, 800000);
+  // Downgrades at once.
+  EXPECT_EQ(1, selector_.TargetLayer(kViewer, kPublisher, now_ms_));
+  selector_.SetCurrentLayer(kViewer, 1);
+
+  // Not even the lowest layer fits, which is still sent.
+  selector_.OnReceiverEstimate(kViewer, 100000);
+  EXPECT_EQ(0, selector_.TargetLayer(kViewer, kPublisher, now_ms_));
+  selector_.SetCurrentLayer(kViewer, 0);
+}
+
+TEST_F(SimulcastLayerSelectorTest, UpgradeIsHeld) {
+  SendLayers(3, 2100);
+  selector_.OnReceiverEstimate(kViewer, 300000);
+  EXPECT_EQ(0, selector_.TargetLayer(kViewer, kPublisher, now_ms_));
+
+  selector_.OnReceiverEstimate(kViewer, 5000000);
+  EXPECT_EQ(0, selector_.TargetLayer(kViewer, kPublisher, now_ms_));
+  SendLayers(3, SIMULCAST_UPGRADE_HOLD_MS / 2);
+  EXPECT_EQ(0, selector_.TargetLayer(kViewer, kPublisher, now_ms_));
+  SendLayers(3, SIMULCAST_UPGRADE_HOLD_MS / 2);
+  EXPECT_EQ(2, selector_.TargetLayer(kViewer, kPublisher, now_ms_));
+
+  // The estimate drops during the hold, which starts over.
+  selector_.OnReceiverEstimate(kViewer, 300000);
+  EXPECT_EQ(0, selector_.TargetLayer(kViewer, kPublisher, now_ms_));
+  selector_.OnReceiverEstimate(kViewer, 5000000);
+  SendLayers(3, SIMULCAST_UPGRADE_HOLD_MS / 2);
+  EXPECT_EQ(0, selector_.TargetLayer(kViewer, kPublisher, now_ms_));
+}
+
+TEST_F(SimulcastLayerSelectorTest, SwitchesAwayFromStoppedLayer) {
+  SendLayers(3, 2100);
+  selector_.OnReceiverEstimate(kViewer, 800000);
+  selector_.SetCurrentLayer(kViewer, 1);
+  EXPECT_EQ(1, selector_.TargetLayer(kViewer, kPublisher, now_ms_));
+
+  // The publisher stops the layer 1 and 2, the viewer goes to the lowest.
+  SendLayers(1, SIMULCAST_LAYER_TIMEOUT_MS);
+  EXPECT_EQ(0, selector_.TargetLayer(kViewer, kPublisher, now_ms_));
+  selector_.SetCurrentLayer(kViewer, 0);
+
+  // Restarted: the layers are not measured yet, so they don't fit.
+  SendLayers(3, SIMULCAST_BITRATE_WINDOW_MS / 2);
+  EXPECT_EQ(0, selector_.TargetLayer(kViewer, kPublisher, now_ms_));
+}
+
+TEST_F(SimulcastLayerSelectorTest, KeyFrameRequestIsThrottled) {
+  EXPECT_TRUE(selector_.ShouldRequestKeyFrame(kPublisher, now_ms_));
+  EXPECT_FALSE(selector_.ShouldRequestKeyFrame(kPublisher, now_ms_ + 10));
+  EXPECT_TRUE(selector_.ShouldRequestKeyFrame(kPublisher + 1, now_ms_ + 10));
+  EXPECT_TRUE(selector_.ShouldRequestKeyFrame(
+      kPublisher, now_ms_ + SIMULCAST_KEY_FRAME_REQUEST_INTERVAL_MS));
+}
+
+TEST_F(SimulcastLayerSelectorTest, RemoveViewer) {
+  selector_.SetCurrentLayer(kViewer, 2);
+  EXPECT_EQ(2, selector_.CurrentLayer(kViewer));
+  selector_.RemoveViewer(kViewer);
+  EXPECT_EQ(0, selector_.CurrentLayer(kViewer));
+}
+
+}  // annoymous namespace
+}  // namespace orbit
@@ -10,6 +10,9 @@
 
 #include "glog/logging.h"
 
+#include <algorithm>
+#include <tuple>
+
 namespace orbit {
 SpeakerEstimator::SpeakerEstimator() {
   frame_count_ = 0;
@@ -47,6 +50,41 @@ int SpeakerEstimator::CurrentSpeaker() {
   return max_times_stream_id;
 }
 
+vector<int> SpeakerEstimator::GetTopSpeakers(int n) {
+  SPEAKER_INFO infos = last_speaker_info;
+  std::stable_sort(infos.begin(), infos.end(),
+                   [](const SPEAKER_INFO::value_type& a,
+                      const SPEAKER_INFO::value_type& b) {
+    if (a.second->max_times != b.second->max_times) {
+      return a.second->max_times > b.second->max_times;
+    }
+    return a.second->total_energy > b.second->total_energy;
+  });
+  vector<int> speakers;
+  for (size_t i = 0; i < infos.size() && (int)i < n; ++i) {
+    speakers.push_back(infos[i].first);
+  }
+  return speakers;
+}
+
+vector<int> SpeakerEstimator::SelectSpeakers(const vector<pair<int, int> >& candidates,
+                                             int max_speakers) {
+  vector<int> top_speakers = GetTopSpeakers(max_speakers);
+  // <rank in top_speakers (or max_speakers if not in), -audio_energy, stream_id>
+  vector<std::tuple<int, long, int> > ranks;
+  for (auto& candidate : candidates) {
+    auto top = std::find(top_speakers.begin(), top_speakers.end(), candidate.first);
+    int rank = (top == top_speakers.end()) ? max_speakers : top - top_speakers.begin();
+    ranks.push_back(std::make_tuple(rank, -(long)candidate.second, candidate.first));
+  }
+  std::sort(ranks.begin(), ranks.end());
+  vector<int> selected;
+  for (size_t i = 0; i < ranks.size() && (int)i < max_speakers; ++i) {
+    selected.push_back(std::get<2>(ranks[i]));
+  }
+  return selected;
+}
+
 void SpeakerEstimator::UpdateAudioEnergy(int stream_id, int audio_energy) {
   intra_frame_count_.push_back(std::make_pair(stream_id, audio_energy));
 }
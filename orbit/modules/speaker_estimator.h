@@ -37,6 +37,8 @@ struct EnergyHolder {
 //  * UpdateAudioEnergy()
 //  * NextFrame()
 //  * GetLastSpeakers()
+//  * GetTopSpeakers()
+//  * SelectSpeakers()
 class SpeakerEstimator {
  public:
   //const int kEstimateFrameSize = 100;
@@ -58,6 +60,17 @@ class SpeakerEstimator {
   SPEAKER_INFO GetLastSpeakers(){
     return last_speaker_info;
   }
+
+  // Returns at most n stream_ids of the last estimate window, the one which
+  // is the loudest most often first (the same order as CurrentSpeaker()).
+  vector<int> GetTopSpeakers(int n);
+
+  // Picks at most max_speakers streams to mix from the candidates
+  // <stream_id, audio_energy> of the current frame: the top speakers of the
+  // last window first, then the loudest candidates of the current frame, so
+  // a new speaker is mixed before the next window ends.
+  vector<int> SelectSpeakers(const vector<pair<int, int> >& candidates,
+                             int max_speakers);
  private:
   ISpeakerChangeListener* speaker_change_listener_ = NULL;
 
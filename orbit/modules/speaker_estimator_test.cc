@@ -120,6 +120,61 @@ TEST_F(SpeakerEstimatorTest, BaseTestCase2) {
   }
 }
 
+TEST_F(SpeakerEstimatorTest, GetTopSpeakers) {
+  SpeakerEstimator estimator(4);
+  // 101 is the loudest 3 times, 100 once.
+  for (int i = 0; i < 3; ++i) {
+    estimator.UpdateAudioEnergy(100, 12000000);
+    estimator.UpdateAudioEnergy(101, 14000000);
+    estimator.NextFrame();
+  }
+  estimator.UpdateAudioEnergy(100, 15000000);
+  estimator.UpdateAudioEnergy(101, 14000000);
+  estimator.NextFrame();
+
+  vector<int> top = estimator.GetTopSpeakers(3);
+  ASSERT_EQ(2, top.size());
+  EXPECT_EQ(101, top[0]);
+  EXPECT_EQ(100, top[1]);
+  top = estimator.GetTopSpeakers(1);
+  ASSERT_EQ(1, top.size());
+  EXPECT_EQ(101, top[0]);
+}
+
+TEST_F(SpeakerEstimatorTest, SelectSpeakers) {
+  SpeakerEstimator estimator(2);
+  // Nothing estimated yet, the loudest ones of the frame are selected.
+  vector<pair<int, int> > candidates = {
+    {100, 1000}, {101, 5000}, {102, 3000}, {103, 20000000},
+  };
+  vector<int> selected = estimator.SelectSpeakers(candidates, 2);
+  ASSERT_EQ(2, selected.size());
+  EXPECT_EQ(103, selected[0]);
+  EXPECT_EQ(101, selected[1]);
+
+  // 100 becomes the top speaker of the window.
+  for (int i = 0; i < 2; ++i) {
+    estimator.UpdateAudioEnergy(100, 30000000);
+    estimator.UpdateAudioEnergy(101, 5000);
+    estimator.NextFrame();
+  }
+  // The top speaker is kept in the mix even if it is quiet in this frame,
+  // the other slot goes to the loudest of the frame.
+  selected = estimator.SelectSpeakers(candidates, 2);
+  ASSERT_EQ(2, selected.size());
+  EXPECT_EQ(100, selected[0]);
+  EXPECT_EQ(103, selected[1]);
+
+  // Not a candidate in this frame (e.g. nothing decoded), not selected.
+  candidates = {{101, 5000}, {102, 3000}};
+  selected = estimator.SelectSpeakers(candidates, 2);
+  ASSERT_EQ(2, selected.size());
+  EXPECT_EQ(101, selected[0]);
+  EXPECT_EQ(102, selected[1]);
+
+  // Everyone is selected if there are fewer candidates than max_speakers.
+  EXPECT_EQ(2, estimator.SelectSpeakers(candidates, 5).size());
+}
 
 }  // annoymous namespace
 }  // namespace orbit
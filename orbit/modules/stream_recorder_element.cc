@@ -16,7 +16,9 @@
 
 DEFINE_string(record_path, "/tmp/orbit_recorder/default.webm",
               "Specify stream record location.");
-DEFINE_string(record_format, "webm", "Set the default format for the recorded file. Current support 'webm' and 'mp4'");
+DEFINE_string(record_format, "webm", "Set the default format for the recorded file. Current support 'webm', 'mkv' and 'mp4'");
+DEFINE_bool(record_passthrough, true, "Only depayload and remux the video when the format can hold "
+            "the codec (e.g. H264 to mp4), else it is decoded and encoded again.");
 
 DECLARE_bool(save_dot_file);
 DEFINE_bool(use_push_mode, true, "Push rtp packet to appsrc else use pull mode for queue. ");
@@ -135,14 +137,19 @@ StreamRecorderElement::StreamRecorderElement(const std::string& file_name,
 
   video_encoding_ = encoding;
 
-  if(FLAGS_record_format == "webm") {
+  if(FLAGS_record_format == "webm" || FLAGS_record_format == "mkv") {
     SetupRecorderElements_webm(export_file);
     SetupAudioElements_webm();
-    SetupVideoElements_webm();
+    SetupVideoElements_passthrough();
   } else {
     SetupRecorderElements_mp4(export_file);
+    // qtmux can't hold Opus, the audio is always transcoded to AAC.
     SetupAudioElements_mp4();
-    SetupVideoElements_mp4();
+    if (FLAGS_record_passthrough && video_encoding_ == H264_90000_PT) {
+      SetupVideoElements_passthrough();
+    } else {
+      SetupVideoElements_mp4();
+    }
   }
 
 
@@ -166,12 +173,12 @@ void StreamRecorderElement::FlushData() {
   while(true) {
     flushed = true;
     if(!audio_queue_->IsEmpty()) {
-      std::shared_ptr<dataPacket> dataPacket = audio_queue_->PopPacket();
+      PacketBufferPtr dataPacket = audio_queue_->PopBuffer();
       _PushAudioPacket(dataPacket);
       flushed = false;
     }
     if(!video_queue_->IsEmpty()) {
-      std::shared_ptr<dataPacket> dataPacket = video_queue_->PopPacket();
+      PacketBufferPtr dataPacket = video_queue_->PopBuffer();
       _PushVideoPacket(dataPacket);
       flushed = false;
     }
@@ -192,10 +199,19 @@ void StreamRecorderElement::Destroy() {
   while(true) {
     GstMessage* msg = gst_bus_poll(bus, GST_MESSAGE_ANY, GST_CLOCK_TIME_NONE);
 //    LOG(INFO)<<"==========="<<msg->type;
-    if(msg->type == GST_MESSAGE_EOS){
+    GstMessageType type = GST_MESSAGE_TYPE(msg);
+    gst_message_unref(msg);
+    if(type == GST_MESSAGE_EOS){
+      break;
+    }
+    // A failed pipeline never posts the EOS, e.g. a muxer that didn't get
+    // any data.
+    if(type == GST_MESSAGE_ERROR){
+      LOG(ERROR) << "Recorder pipeline failed before the end of the stream";
       break;
     }
   }
+  gst_object_unref(bus);
   if (pipeline_ != NULL) {
     gst_element_set_state (pipeline_, GST_STATE_NULL);
     gst_object_unref(pipeline_);
@@ -207,7 +223,16 @@ void StreamRecorderElement::Start() {
 }
 
 void StreamRecorderElement::SetupRecorderElements_webm(const std::string& file_location) {
-  muxer_ = gst_element_factory_make("webmmux","webmmux");
+  // webmmux only takes VP8 and VP9, H264 is kept as it is in a Matroska file.
+  bool matroska = (FLAGS_record_format == "mkv" || video_encoding_ == H264_90000_PT);
+  if (matroska) {
+    if (FLAGS_record_format != "mkv") {
+      LOG(WARNING) << "WebM can't hold H264, record " << file_location << " as Matroska.";
+    }
+    muxer_ = gst_element_factory_make("matroskamux","matroskamux");
+  } else {
+    muxer_ = gst_element_factory_make("webmmux","webmmux");
+  }
   g_object_set(G_OBJECT(muxer_),"version", 1, NULL);
   file_sink_ = gst_element_factory_make("filesink","filesink");
   g_object_set(G_OBJECT(file_sink_),
@@ -217,7 +242,7 @@ void StreamRecorderElement::SetupRecorderElements_webm(const std::string& file_l
       "blocksize", 1500,
       NULL);
 
-  GstCaps* caps = gst_caps_new_simple("video/webm", NULL);
+  GstCaps* caps = gst_caps_new_simple(matroska ? "video/x-matroska" : "video/webm", NULL);
   gst_bin_add_many(GST_BIN(pipeline_),muxer_, file_sink_, NULL);
   g_object_set(GST_OBJECT(muxer_), "streamable", false, NULL);
   gst_element_link_filtered(muxer_, file_sink_, caps);
@@ -252,7 +277,7 @@ void StreamRecorderElement::PushAudioPacket(const dataPacket& packet) {
   if(FLAGS_use_push_mode) {
     audio_queue_->PushPacket(packet);
     if(audio_queue_->PrebufferingDone()){
-      std::shared_ptr<dataPacket> dataPacket = audio_queue_->PopPacket();
+      PacketBufferPtr dataPacket = audio_queue_->PopBuffer();
       _PushAudioPacket(dataPacket);
     }
   } else {
@@ -270,7 +295,7 @@ void StreamRecorderElement::PushVideoPacket(const dataPacket& packet){
     if(FLAGS_use_push_mode){
       video_queue_->PushPacket(packet);
       if(video_queue_->PrebufferingDone()){
-        std::shared_ptr<dataPacket> dataPacket = video_queue_->PopPacket();
+        PacketBufferPtr dataPacket = video_queue_->PopBuffer();
         _PushVideoPacket(dataPacket);
       }
     } else {
@@ -279,6 +304,17 @@ void StreamRecorderElement::PushVideoPacket(const dataPacket& packet){
   }
 }
 
+void StreamRecorderElement::PushVideoBuffer(const PacketBufferPtr& buffer) {
+  video_queue_data_ = true;
+  if (running_ && IsValidVideoPacket(buffer->data(), buffer->length())) {
+    video_queue_->PushBuffer(buffer);
+    if (FLAGS_use_push_mode && video_queue_->PrebufferingDone()) {
+      PacketBufferPtr dataPacket = video_queue_->PopBuffer();
+      _PushVideoPacket(dataPacket);
+    }
+  }
+}
+
 void StreamRecorderElement::SetupAudioElements_webm() {
   GstCaps *caps = NULL;
   GstCaps *mux_caps = NULL;
@@ -416,29 +452,29 @@ void StreamRecorderElement::RelayMediaOutputPacket(const std::shared_ptr<MediaOu
   }
 }
 
-void StreamRecorderElement::SetupVideoElements_webm() {
+/**
+ * The encoded video is only depayloaded and muxed, without decoding, for
+ * all the formats that can hold the codec.
+ */
+void StreamRecorderElement::SetupVideoElements_passthrough() {
   GstCaps *mux_caps = NULL;
   std::string encoding_name = "VP8";
-  std::string video_decoder = "vp8dec";
   std::string rtp_depay_element = "rtpvp8depay";
   std::string rtp_caps = "video/x-vp8";
   switch(video_encoding_) {
   case VP8_90000_PT:
     encoding_name = "VP8";
     rtp_depay_element = "rtpvp8depay";
-    video_decoder = "vp8dec";
     rtp_caps = "video/x-vp8";
     break;
   case VP9_90000_PT:
     encoding_name = "VP9";
     rtp_depay_element = "rtpvp9depay";
-    video_decoder = "vp9dec";
     rtp_caps = "video/x-vp9";
     break;
   case H264_90000_PT:
     encoding_name = "H264";
     rtp_depay_element = "rtph264depay";
-    video_decoder = "avdec_h264";
     rtp_caps = "video/x-h264";
     break;
   }
@@ -471,15 +507,39 @@ void StreamRecorderElement::SetupVideoElements_webm() {
 
 
   rtp_depay_ = gst_element_factory_make(rtp_depay_element.c_str(), "video_rtp_depay");
+  assert(video_src_);
+  assert(video_jitter_buffer_);
+  assert(rtp_depay_);
   gst_bin_add_many(GST_BIN(pipeline_),video_src_, video_jitter_buffer_, rtp_depay_,NULL);
-  gst_element_link_many(video_src_, video_jitter_buffer_, rtp_depay_, NULL);
+  bool result = gst_element_link_many(video_src_, video_jitter_buffer_, rtp_depay_, NULL);
+  assert(result);
 
-  mux_caps = gst_caps_new_simple(rtp_caps.c_str(),
-      "media", G_TYPE_STRING, "video",
-      "clock-rate", G_TYPE_INT, 90000,
-      "payload", G_TYPE_INT, video_encoding_,
-      "encoding-name", G_TYPE_STRING, encoding_name.c_str(), NULL);
-  gst_element_link_filtered(rtp_depay_, muxer_, mux_caps);
+  GstElement* mux_src = rtp_depay_;
+  if (video_encoding_ == H264_90000_PT) {
+    // The muxers want avc aligned to access units, with the SPS/PPS in the
+    // caps, h264parse converts the stream without decoding it.
+    GstElement* h264parse = gst_element_factory_make("h264parse", "parser");
+    assert(h264parse);
+    gst_bin_add(GST_BIN(pipeline_), h264parse);
+    result = gst_element_link(rtp_depay_, h264parse);
+    assert(result);
+    mux_src = h264parse;
+    mux_caps = gst_caps_new_simple(rtp_caps.c_str(),
+        "stream-format", G_TYPE_STRING, "avc",
+        "alignment",  G_TYPE_STRING, "au",
+        NULL);
+  } else {
+    mux_caps = gst_caps_new_simple(rtp_caps.c_str(),
+        "media", G_TYPE_STRING, "video",
+        "clock-rate", G_TYPE_INT, 90000,
+        "payload", G_TYPE_INT, video_encoding_,
+        "encoding-name", G_TYPE_STRING, encoding_name.c_str(), NULL);
+  }
+  result = gst_element_link_filtered(mux_src, muxer_, mux_caps);
+  if (!result) {
+    LOG(ERROR) << "Can't link the " << encoding_name << " video to " << GST_OBJECT_NAME(muxer_);
+  }
+  assert(result);
   GstPad* pad = gst_element_get_static_pad(muxer_, "src");
   if(pad != NULL) {
     LOG(INFO)<<"++++++++++++++GetPad";
@@ -496,8 +556,8 @@ void StreamRecorderElement::SetupVideoElements_webm() {
   }
 }
 
-void StreamRecorderElement::_PushAudioPacket(std::shared_ptr<dataPacket> dataPacket) {
-  const RtpHeader *h = reinterpret_cast<const RtpHeader*>(dataPacket->data);
+void StreamRecorderElement::_PushAudioPacket(const PacketBufferPtr& dataPacket) {
+  const RtpHeader *h = reinterpret_cast<const RtpHeader*>(dataPacket->data());
   if(audio_start_time_ == 0) {
     audio_start_time_ = h->getTimestamp();
     GstClock *clock  = GST_ELEMENT_CLOCK(audio_src_);
@@ -510,9 +570,9 @@ void StreamRecorderElement::_PushAudioPacket(std::shared_ptr<dataPacket> dataPac
     audio_ntp_start_time_ = dataPacket->remote_ntp_time_ms - (h->getTimestamp() - audio_start_time_)/48;
   }
   GstFlowReturn ret = GST_FLOW_CUSTOM_SUCCESS_1;
-  char *data = (char*)malloc(dataPacket->length);
-  memcpy(data, dataPacket->data, dataPacket->length);
-  GstBuffer *buffer = gst_buffer_new_wrapped(data, dataPacket->length);
+  char *data = (char*)malloc(dataPacket->length());
+  memcpy(data, dataPacket->data(), dataPacket->length());
+  GstBuffer *buffer = gst_buffer_new_wrapped(data, dataPacket->length());
   long time = 0;
   if(audio_ntp_start_time_ > 0 && FLAGS_use_ntp_time) {
     time = dataPacket->remote_ntp_time_ms - audio_ntp_start_time_;
@@ -527,8 +587,8 @@ void StreamRecorderElement::_PushAudioPacket(std::shared_ptr<dataPacket> dataPac
   gst_buffer_unref(buffer);
 }
 
-void StreamRecorderElement::_PushVideoPacket(std::shared_ptr<dataPacket> dataPacket) {
-  const RtpHeader* h = reinterpret_cast<const RtpHeader*>(dataPacket->data);
+void StreamRecorderElement::_PushVideoPacket(const PacketBufferPtr& dataPacket) {
+  const RtpHeader* h = reinterpret_cast<const RtpHeader*>(dataPacket->data());
   if(video_start_time_ == 0) {
     video_start_time_ = h->getTimestamp();
     GstClock *clock  = GST_ELEMENT_CLOCK(video_src_);
@@ -543,9 +603,9 @@ void StreamRecorderElement::_PushVideoPacket(std::shared_ptr<dataPacket> dataPac
   }
 
   GstFlowReturn ret = GST_FLOW_CUSTOM_SUCCESS_1;
-  char *data = (char*)malloc(dataPacket->length);
-  memcpy(data, dataPacket->data, dataPacket->length);
-  GstBuffer *buffer = gst_buffer_new_wrapped(data, dataPacket->length);
+  char *data = (char*)malloc(dataPacket->length());
+  memcpy(data, dataPacket->data(), dataPacket->length());
+  GstBuffer *buffer = gst_buffer_new_wrapped(data, dataPacket->length());
   long time = 0;
   if(video_ntp_start_time_ > 0 && FLAGS_use_ntp_time) {
     time = dataPacket->remote_ntp_time_ms - video_ntp_start_time_;
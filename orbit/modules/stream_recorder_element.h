@@ -86,6 +86,9 @@ public:
   }
 
   void PushVideoPacket(const dataPacket& packet);
+  // Takes a reference of the RTP packet instead of copying it, the buffer
+  // may be shared with others and is not modified.
+  void PushVideoBuffer(const PacketBufferPtr& buffer);
 
   void PushAudioPacket(const dataPacket& packet);
 
@@ -114,8 +117,9 @@ private:
   int video_encoding_;
   
   void SetupAudioElements_webm();
-  void SetupVideoElements_webm();
   void SetupRecorderElements_webm(const std::string& file_location);
+  // Depayloads and muxes the video as it is, for webm, mkv and H264 to mp4.
+  void SetupVideoElements_passthrough();
 
   void SetupAudioElements_mp4();
   void SetupVideoElements_mp4();
@@ -123,8 +127,8 @@ private:
   void FlushData();
   void Destroy();
 
-  void _PushAudioPacket(std::shared_ptr<dataPacket> dataPacket);
-  void _PushVideoPacket(std::shared_ptr<dataPacket> dataPacket);
+  void _PushAudioPacket(const PacketBufferPtr& dataPacket);
+  void _PushVideoPacket(const PacketBufferPtr& dataPacket);
 
   std::shared_ptr<RtpPacketBuffer> video_queue_;  // inbuf
   std::shared_ptr<RtpPacketBuffer> audio_queue_;  // inbuf
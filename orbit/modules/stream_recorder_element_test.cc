@@ -0,0 +1,161 @@
+/*
+ * Copyright 2016 (C) Orange Labs Inc. All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * stream_recorder_element_test.cc
+ * ---------------------------------------------------------------------------
+ * Builds the recorder pipeline of every record mode and checks that all the
+ * elements are linked, from the appsrcs to the filesink.
+ * ---------------------------------------------------------------------------
+ */
+
+#include "gtest/gtest.h"
+#include "gflags/gflags.h"
+
+#include "stream_recorder_element.h"
+
+#include <string>
+#include <vector>
+
+DECLARE_string(record_format);
+DECLARE_bool(record_passthrough);
+
+// The pipeline can't be built without the plugins. The test is reported as
+// skipped (gtest >= 1.10), or fails with the older gtest, it never passes
+// without checking anything.
+#ifdef GTEST_SKIP
+#define REQUIRE_PLUGINS(...)                                          \
+  do {                                                                \
+    std::string missing = MissingPlugins(__VA_ARGS__);                \
+    if (!missing.empty()) {                                           \
+      GTEST_SKIP() << "No GStreamer plugins:" << missing;             \
+    }                                                                 \
+  } while (0)
+#else
+#define REQUIRE_PLUGINS(...)                                          \
+  do {                                                                \
+    std::string missing = MissingPlugins(__VA_ARGS__);                \
+    if (!missing.empty()) {                                           \
+      FAIL() << "No GStreamer plugins:" << missing;                   \
+    }                                                                 \
+  } while (0)
+#endif
+
+namespace orbit {
+namespace {
+
+const char* kMuxerNames[] = {"webmmux", "matroskamux", "mp4mux"};
+
+class StreamRecorderElementTest : public testing::Test {
+ protected:
+  virtual void SetUp() override {
+    gst_init(NULL, NULL);
+  }
+
+  virtual void TearDown() override {
+    FLAGS_record_format = "webm";
+    FLAGS_record_passthrough = true;
+  }
+
+  // Returns the names of the plugins not installed, separated by spaces.
+  std::string MissingPlugins(const std::vector<std::string>& names) {
+    std::string missing;
+    for (const std::string& name : names) {
+      GstElementFactory* factory = gst_element_factory_find(name.c_str());
+      if (factory == NULL) {
+        missing += " " + name;
+        continue;
+      }
+      gst_object_unref(factory);
+    }
+    return missing;
+  }
+
+  // Expects every pad of every element in the pipeline to be linked, and the
+  // muxer to have the audio and the video sink pads. Returns the muxer name.
+  std::string ExpectLinked(StreamRecorderElement* recorder) {
+    GstElement* pipeline = recorder->GetPipeline();
+    std::string muxer_name;
+    GstIterator* elements = gst_bin_iterate_elements(GST_BIN(pipeline));
+    GValue element_value = G_VALUE_INIT;
+    while (gst_iterator_next(elements, &element_value) == GST_ITERATOR_OK) {
+      GstElement* element = GST_ELEMENT(g_value_get_object(&element_value));
+      std::string element_name = GST_OBJECT_NAME(element);
+      for (const char* name : kMuxerNames) {
+        if (element_name == name) {
+          muxer_name = element_name;
+          EXPECT_EQ(2, element->numsinkpads) << element_name;
+        }
+      }
+      GstIterator* pads = gst_element_iterate_pads(element);
+      GValue pad_value = G_VALUE_INIT;
+      while (gst_iterator_next(pads, &pad_value) == GST_ITERATOR_OK) {
+        GstPad* pad = GST_PAD(g_value_get_object(&pad_value));
+        EXPECT_TRUE(gst_pad_is_linked(pad))
+            << element_name << ":" << GST_OBJECT_NAME(pad) << " is not linked";
+        g_value_reset(&pad_value);
+      }
+      g_value_unset(&pad_value);
+      gst_iterator_free(pads);
+      g_value_reset(&element_value);
+    }
+    g_value_unset(&element_value);
+    gst_iterator_free(elements);
+    EXPECT_FALSE(muxer_name.empty());
+    return muxer_name;
+  }
+
+  std::string Link(const std::string& format, bool passthrough, int video_encoding) {
+    FLAGS_record_format = format;
+    FLAGS_record_passthrough = passthrough;
+    std::string file = "/tmp/stream_recorder_element_test." + format;
+    StreamRecorderElement* recorder = new StreamRecorderElement(file, video_encoding);
+    std::string muxer_name = ExpectLinked(recorder);
+    delete recorder;
+    return muxer_name;
+  }
+};
+
+TEST_F(StreamRecorderElementTest, WebmVp8) {
+  REQUIRE_PLUGINS({"webmmux", "rtpvp8depay", "rtpopusdepay", "filesink"});
+  EXPECT_EQ("webmmux", Link("webm", true, VP8_90000_PT));
+}
+
+TEST_F(StreamRecorderElementTest, WebmH264IsMatroska) {
+  REQUIRE_PLUGINS({"matroskamux", "rtph264depay", "h264parse", "rtpopusdepay", "filesink"});
+  EXPECT_EQ("matroskamux", Link("webm", true, H264_90000_PT));
+}
+
+TEST_F(StreamRecorderElementTest, MkvVp8) {
+  REQUIRE_PLUGINS({"matroskamux", "rtpvp8depay", "rtpopusdepay", "filesink"});
+  EXPECT_EQ("matroskamux", Link("mkv", true, VP8_90000_PT));
+}
+
+TEST_F(StreamRecorderElementTest, MkvH264) {
+  REQUIRE_PLUGINS({"matroskamux", "rtph264depay", "h264parse", "rtpopusdepay", "filesink"});
+  EXPECT_EQ("matroskamux", Link("mkv", true, H264_90000_PT));
+}
+
+TEST_F(StreamRecorderElementTest, Mp4H264Passthrough) {
+  REQUIRE_PLUGINS({"qtmux", "rtph264depay", "h264parse",
+                   "rtpopusdepay", "opusdec", "voaacenc", "filesink"});
+  EXPECT_EQ("mp4mux", Link("mp4", true, H264_90000_PT));
+}
+
+TEST_F(StreamRecorderElementTest, Mp4H264Transcode) {
+  REQUIRE_PLUGINS({"qtmux", "rtph264depay", "avdec_h264", "videoscale", "videorate",
+                   "x264enc", "h264parse", "rtpopusdepay", "opusdec", "voaacenc",
+                   "filesink"});
+  EXPECT_EQ("mp4mux", Link("mp4", false, H264_90000_PT));
+}
+
+// VP8 can't be put in mp4 as it is, it is always transcoded.
+TEST_F(StreamRecorderElementTest, Mp4Vp8Transcode) {
+  REQUIRE_PLUGINS({"qtmux", "rtpvp8depay", "vp8dec", "videoscale", "videorate",
+                   "x264enc", "h264parse", "rtpopusdepay", "opusdec", "voaacenc",
+                   "filesink"});
+  EXPECT_EQ("mp4mux", Link("mp4", true, VP8_90000_PT));
+}
+
+}  // namespace annoymous
+}  // namespace orbit
@@ -60,12 +60,12 @@ std::shared_ptr<VideoAwareFrameBuffer> VideoForwardElement::GetVideoQueue(int vi
 
 // Do a pop() function and get the rtp_packet as return from a given buffer.
 // Returns NULL if no buffer or buffer is still pre-buffering phase.
-std::shared_ptr<orbit::dataPacket> VideoForwardElement::PopFromBuffer(
+PacketBufferPtr VideoForwardElement::PopFromBuffer(
     int viewer_id, bool pop_from_queue) {
   if (viewer_id == -1) {
     return NULL;
   }
-  std::shared_ptr<orbit::dataPacket> rtp_packet;
+  PacketBufferPtr rtp_packet;
   std::shared_ptr<VideoAwareFrameBuffer> viewer_buffer = GetVideoQueue(viewer_id);
   if (viewer_buffer == NULL) {
     LOG(ERROR) << "Viewer buffer is NULL? Why. viewer_id=" << viewer_id;
@@ -78,9 +78,9 @@ std::shared_ptr<orbit::dataPacket> VideoForwardElement::PopFromBuffer(
       return NULL;
     }
     if (pop_from_queue) {
-      rtp_packet = viewer_buffer->PopPacket();
+      rtp_packet = viewer_buffer->PopBuffer();
     } else {
-      rtp_packet = viewer_buffer->TopPacket();
+      rtp_packet = viewer_buffer->TopBuffer();
     }
   } else {
     return NULL;
@@ -394,9 +394,9 @@ void VideoForwardElement::SelectiveVideoForwardLoop() {
           // assert(switch_context->new_stream_id != -1)
           assert(switch_context->new_stream_id != -1);
           std::shared_ptr<VideoAwareFrameBuffer> new_stream_buffer = GetVideoQueue(switch_context->new_stream_id);
-          std::shared_ptr<dataPacket> rtp_packet;
+          PacketBufferPtr rtp_packet;
           if (new_stream_buffer != NULL) {
-            rtp_packet = new_stream_buffer->TopPacket();
+            rtp_packet = new_stream_buffer->TopBuffer();
           }
           if (new_stream_buffer != NULL && rtp_packet != NULL &&
               new_stream_buffer->IsKeyFramePacket(rtp_packet)) {
@@ -407,7 +407,7 @@ void VideoForwardElement::SelectiveVideoForwardLoop() {
             switch_context->changing_ = false;
             switch_context->stream_id = switch_context->new_stream_id;
             switch_context->new_stream_id = -1;
-            const RtpHeader* h = reinterpret_cast<const RtpHeader*>(rtp_packet->data);
+            const RtpHeader* h = reinterpret_cast<const RtpHeader*>(rtp_packet->data());
             switch_context->base_ts = h->getTimestamp();
             switch_context->base_seq = h->getSeqNumber();
             switch_context->last_ts = switch_context->ts + 2880;
@@ -449,7 +449,7 @@ void VideoForwardElement::SelectiveVideoForwardLoop() {
 
     // Use a <int, packet> map to store the stream_id with the corresponding
     // poped rtp_packets.
-    map<int, shared_ptr<orbit::dataPacket>> play_packets;
+    map<int, PacketBufferPtr> play_packets;
     int i = 0;
     for (int this_stream_id : stream_ids) {
       auto switch_contexts_iter = video_switch_contexts_.find(this_stream_id);
@@ -463,7 +463,7 @@ void VideoForwardElement::SelectiveVideoForwardLoop() {
         continue;
       }
 
-      std::shared_ptr<orbit::dataPacket> rtp_packet;
+      PacketBufferPtr rtp_packet;
       if (play_packets.find(source_stream_id) != play_packets.end()) {
         rtp_packet = play_packets[source_stream_id];
       } else {
@@ -472,10 +472,10 @@ void VideoForwardElement::SelectiveVideoForwardLoop() {
       }
 
       if (rtp_packet) {
-        const unsigned char* data_buf = reinterpret_cast<const unsigned char*>(&(rtp_packet->data[0]));
+        const unsigned char* data_buf = reinterpret_cast<const unsigned char*>(rtp_packet->data());
         // Construct the media packet.
         // Output the mixed_pkt as the forwarding packet to all the participants.
-        const RtpHeader* h = reinterpret_cast<const RtpHeader*>(rtp_packet->data);
+        const RtpHeader* h = reinterpret_cast<const RtpHeader*>(rtp_packet->data());
         assert (switch_context->base_seq != -1);
         uint16_t next_seq = switch_context->last_seq + (h->getSeqNumber() - switch_context->base_seq);
         if ((next_seq > switch_context->seq) && abs(next_seq - switch_context->seq) > 500) {
@@ -491,10 +491,10 @@ void VideoForwardElement::SelectiveVideoForwardLoop() {
         mixed_pkt->seq_number = switch_context->seq;
         mixed_pkt->end_frame = h->getMarker();
         mixed_pkt->ssrc = -1;
-        unsigned char* tmp_buf = (unsigned char*)malloc(rtp_packet->length-12);
-        memcpy(tmp_buf, data_buf+12, rtp_packet->length-12);
+        unsigned char* tmp_buf = (unsigned char*)malloc(rtp_packet->length()-12);
+        memcpy(tmp_buf, data_buf+12, rtp_packet->length()-12);
         mixed_pkt->encoded_buf = tmp_buf;
-        mixed_pkt->length = rtp_packet->length-12;
+        mixed_pkt->length = rtp_packet->length()-12;
         
         video_forward_event_listener_->OnRelayRtpPacket(this_stream_id, mixed_pkt);
         /**
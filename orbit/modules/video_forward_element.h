@@ -37,6 +37,7 @@
 
 #include "video_map.h"
 #include "video_frame_queue.h"
+#include "simulcast_layer_selector.h"
 
 #include <memory>
 #include <mutex>
@@ -76,6 +77,8 @@ struct VideoSwitchContext {
   /* Changing status */
   bool changing_ = false;
   int new_stream_id = -1;
+  /* Rebases seq and ts on the next forwarded frame (VideoForwardElementNew) */
+  bool rebase = false;
 
   std::string DebugString() {
     std::ostringstream oss;
@@ -92,10 +95,14 @@ class FirSender {
  public:
   FirSender(IVideoForwardEventListener *video_forward_event_listener)
    : video_forward_event_listener_(video_forward_event_listener) {}
-  void SendFir(int32_t stream_id);
+  // Sends a FIR and a PLI to the stream. media_ssrc is the ssrc of the
+  // simulcast layer asked for a key frame, 0 lets the transport fill in the
+  // ssrc of the lowest (or the only) layer.
+  void SendFir(int32_t stream_id, uint32_t media_ssrc = 0);
  private:
   mutable std::mutex mutex_;
-  std::map<int32_t, int> firseq_map_;
+  // The FIR seq of each <stream_id, media ssrc>.
+  std::map<std::pair<int32_t, uint32_t>, int> firseq_map_;
   IVideoForwardEventListener *video_forward_event_listener_;
 };
 
@@ -106,6 +113,8 @@ class AbstractVideoForwardElement : public IVideoPacketListener {
   virtual void UnlinkVideoStream(int stream_id) = 0;
   virtual void ChangeToSpeaker(int stream_id) = 0;
   virtual void RequestSpeakerKeyFrame() = 0;
+  // The REMB of the viewer, which selects the simulcast layer it receives.
+  virtual void OnReceiverEstimate(int stream_id, uint64_t bitrate_bps) {}
 };
 
 class VideoForwardElement : public AbstractVideoForwardElement {
@@ -143,7 +152,7 @@ private:
 
   std::shared_ptr<VideoAwareFrameBuffer> GetVideoQueue(int new_viewer);
   bool HasKeyFrameArrive(int new_viewer_id);
-  std::shared_ptr<orbit::dataPacket> PopFromBuffer(int viewer_id, bool pop_from_queue);
+  PacketBufferPtr PopFromBuffer(int viewer_id, bool pop_from_queue);
 
   IVideoForwardEventListener* video_forward_event_listener_;
 
@@ -164,6 +173,10 @@ private:
 };
 
 // The New VideoForwardElement, implements the AbstractVideoForwardElement interface.
+// If a publisher sends simulcast, each viewer receives the layer chosen by
+// the SimulcastLayerSelector from its REMB. The viewer is switched to
+// another layer on a key frame of that layer, with the seq/ts rewritten to
+// go on from the previous layer.
 class VideoForwardElementNew : public AbstractVideoForwardElement {
  public:
   VideoForwardElementNew(IVideoForwardEventListener *video_forward_event_listener);
@@ -173,23 +186,51 @@ class VideoForwardElementNew : public AbstractVideoForwardElement {
   virtual void UnlinkVideoStream(int stream_id) override;
   virtual void ChangeToSpeaker(int stream_id) override;
   virtual void RequestSpeakerKeyFrame() override;
+  virtual void OnReceiverEstimate(int stream_id, uint64_t bitrate_bps) override;
  private:
   static const long VIDEO_FORWARD_THREAD_SLEEP_MS = 1;
+  // The ts between the last frame before a switch and the first one after
+  // it, a frame at 30 fps of the 90 kHz clock.
+  static const uint32_t VIDEO_SWITCH_TS_GAP = 2880;
+  // <stream_id, simulcast layer>
+  typedef std::pair<int32_t, int> LayerId;
 
   bool Contains(int stream_id) const;
+  // Asks the publisher for a key frame of the simulcast layer.
+  void RequestKeyFrame(int32_t stream_id, int layer);
+  // Returns the queue of the simulcast layer of the stream, creates it if
+  // needed, or NULL if the layer is not valid.
+  std::shared_ptr<VideoFrameQueue> LayerQueue(int stream_id, int layer);
   void ForwardLoop();
   void ForwardData();
+  // Pops the decodable frames of the layer into released_frames, once per
+  // ForwardData(). Returns the frames released.
+  const std::vector<std::shared_ptr<VideoFrame>>& ReleaseFrames(
+      const LayerId& layer_id,
+      std::map<LayerId, std::vector<std::shared_ptr<VideoFrame>>>* released_frames);
+  // Relays the frames from begin to the viewer, rebasing the seq and ts on
+  // the first one after a switch.
+  void ForwardFrames(int32_t id, const std::shared_ptr<VideoSwitchContext>& sc,
+                     const std::vector<std::shared_ptr<VideoFrame>>& frames,
+                     size_t begin, bool first);
 
   typedef std::recursive_mutex Mutex;
   typedef std::lock_guard<Mutex> Lock;
   mutable Mutex mutex_;
   FirSender *fir_sender_ = nullptr;
   IVideoForwardEventListener *video_forward_event_listener_ = nullptr;
+  // The lowest (or the only) layer of each stream, as the VideoMap knows.
   std::map<int, std::shared_ptr<VideoFrameQueue>> queue_map_;
+  // The upper simulcast layers, created when their first packet comes.
+  std::map<LayerId, std::shared_ptr<VideoFrameQueue>> layer_queue_map_;
+  // The ssrc of the upper simulcast layers, from their packets.
+  std::map<LayerId, uint32_t> layer_ssrc_map_;
+  SimulcastLayerSelector selector_;
   VideoMap *video_mapper_ = nullptr;
   std::map<int, std::shared_ptr<VideoSwitchContext>> video_switch_contexts_;
-  std::thread forward_loop_;
+  // Declared before forward_loop_, which reads it as soon as it starts.
   bool running_ = true;
+  std::thread forward_loop_;
 };
 
 } /* namespace orbit */
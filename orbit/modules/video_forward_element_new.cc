@@ -16,21 +16,30 @@
 #include "glog/logging.h"
 #include "gflags/gflags.h"
 
+#include <set>
+
 using namespace std;
 namespace orbit {
-void FirSender::SendFir(int32_t stream_id) {
-  LOG(INFO) << "-----" << "FirSender::SendFir";
+void FirSender::SendFir(int32_t stream_id, uint32_t media_ssrc) {
+  LOG(INFO) << "-----" << "FirSender::SendFir ssrc=" << media_ssrc;
   std::lock_guard<std::mutex> lock(mutex_);
   char buf[20];
   memset(buf, 0, 20);
   int fir_tmp = 0;
-  auto it = firseq_map_.find(stream_id);
+  auto key = std::make_pair(stream_id, media_ssrc);
+  auto it = firseq_map_.find(key);
   if(it != firseq_map_.end()) {
     fir_tmp = it->second;
   }
 
   int len = janus_rtcp_fir((char *)&buf, 20, &fir_tmp);
-  firseq_map_[stream_id] = fir_tmp;
+  firseq_map_[key] = fir_tmp;
+  if (media_ssrc != 0) {
+    rtcp_fb *rtcpfb = (rtcp_fb *)buf;
+    rtcp_fir *fir = (rtcp_fir *)rtcpfb->fci;
+    rtcpfb->media = htonl(media_ssrc);
+    fir->ssrc = htonl(media_ssrc);
+  }
 
   dataPacket p;
   p.comp = 0;
@@ -46,6 +55,9 @@ void FirSender::SendFir(int32_t stream_id) {
   /* Send a PLI too, just in case... */
   memset(buf, 0, 12);
   len = janus_rtcp_pli((char *)&buf, 12);
+  if (media_ssrc != 0) {
+    ((rtcp_fb *)buf)->media = htonl(media_ssrc);
+  }
 
   p.length = len;
   memcpy(&(p.data[0]), buf, len);
@@ -69,11 +81,21 @@ VideoForwardElementNew::VideoForwardElementNew(IVideoForwardEventListener* video
     LOG(INFO) << "stream enabled : " << stream;
     auto queue = queue_map_[stream];
     queue->Enable();
+    for (auto &pair : layer_queue_map_) {
+      if (pair.first.first == stream) {
+        pair.second->Enable();
+      }
+    }
   });
   video_mapper_->AddDisabledListener([this](int stream) {
     LOG(INFO) << "stream disabled : " << stream;
     auto queue = queue_map_[stream];
     queue->Disable();
+    for (auto &pair : layer_queue_map_) {
+      if (pair.first.first == stream) {
+        pair.second->Disable();
+      }
+    }
   });
   video_mapper_->AddHasLookerListener([this](int stream) {
     LOG(INFO) << "stream has looker : " << stream;
@@ -89,13 +111,10 @@ VideoForwardElementNew::VideoForwardElementNew(IVideoForwardEventListener* video
     LOG(INFO) << "stream's video source changed, now "
         << stream << " see " << video_mapper_->GetSrc(stream);
     int src = video_mapper_->GetSrc(stream);
-    auto queue = queue_map_[src];
-    auto frame = queue->TopPacket();
-    auto switch_context = video_switch_contexts_[stream];
-    switch_context->base_ts  = frame->ts();
-    switch_context->base_seq = frame->seq();
-    switch_context->last_ts  = switch_context->ts + 2880;
-    switch_context->last_seq = switch_context->seq + 1;
+    // Starts from the lowest layer of the new source, whose queue kept its
+    // last key frame while nobody looked at it.
+    selector_.SetCurrentLayer(stream, 0);
+    video_switch_contexts_[stream]->rebase = true;
   });
 }
 
@@ -121,7 +140,16 @@ void VideoForwardElementNew::OnIncomingPacket(const int stream_id, const dataPac
   if (!Contains(stream_id)) {
     return;
   }
-  auto queue = queue_map_[stream_id];
+  selector_.OnPublisherPacket(stream_id, packet.simulcast_layer,
+                              packet.length, GetCurrentTime_MS());
+  auto queue = LayerQueue(stream_id, packet.simulcast_layer);
+  if (!queue) {
+    return;
+  }
+  if (packet.simulcast_layer > 0) {
+    const RtpHeader *head = reinterpret_cast<const RtpHeader *>(packet.data);
+    layer_ssrc_map_[LayerId(stream_id, packet.simulcast_layer)] = head->getSSRC();
+  }
   queue->PushPacket((uint8_t *)(packet.data), packet.length);
 }
 
@@ -137,6 +165,12 @@ void VideoForwardElementNew::LinkVideoStream(int stream_id) {
     LOG(INFO) << "after queue prepared : " << id;
     video_mapper_->SetPrepared(id);
   });
+  queue->SetKeyFrameRequestListener([this](VideoFrameQueue::id_t id) {
+    LOG(INFO) << "queue requests key frame : " << id;
+    if (fir_sender_) {
+      fir_sender_->SendFir(id);
+    }
+  });
   queue_map_[stream_id] = queue;
 
   auto switch_context = std::make_shared<VideoSwitchContext>();
@@ -152,6 +186,22 @@ void VideoForwardElementNew::UnlinkVideoStream(int stream_id) {
 
   video_mapper_->Remove(stream_id);
   queue_map_.erase(stream_id);
+  for (auto iter = layer_queue_map_.begin(); iter != layer_queue_map_.end();) {
+    if (iter->first.first == stream_id) {
+      iter = layer_queue_map_.erase(iter);
+    } else {
+      ++iter;
+    }
+  }
+  for (auto iter = layer_ssrc_map_.begin(); iter != layer_ssrc_map_.end();) {
+    if (iter->first.first == stream_id) {
+      iter = layer_ssrc_map_.erase(iter);
+    } else {
+      ++iter;
+    }
+  }
+  selector_.RemovePublisher(stream_id);
+  selector_.RemoveViewer(stream_id);
   video_switch_contexts_.erase(stream_id);
 }
 
@@ -174,10 +224,60 @@ void VideoForwardElementNew::RequestSpeakerKeyFrame() {
   }
 }
 
+void VideoForwardElementNew::OnReceiverEstimate(int stream_id,
+                                                uint64_t bitrate_bps) {
+  Lock lock(mutex_);
+  selector_.OnReceiverEstimate(stream_id, bitrate_bps);
+}
+
 bool VideoForwardElementNew::Contains(int stream_id) const {
   return queue_map_.find(stream_id) != queue_map_.end();
 }
 
+void VideoForwardElementNew::RequestKeyFrame(int32_t stream_id, int layer) {
+  Lock lock(mutex_);
+  if (!fir_sender_) {
+    return;
+  }
+  // The transport addresses the FIR to the lowest layer, the upper layers
+  // are asked by their own ssrc.
+  uint32_t media_ssrc = 0;
+  if (layer > 0) {
+    auto iter = layer_ssrc_map_.find(LayerId(stream_id, layer));
+    if (iter == layer_ssrc_map_.end()) {
+      LOG(WARNING) << "No ssrc of layer " << layer << " of stream " << stream_id;
+      return;
+    }
+    media_ssrc = iter->second;
+  }
+  fir_sender_->SendFir(stream_id, media_ssrc);
+}
+
+std::shared_ptr<VideoFrameQueue> VideoForwardElementNew::LayerQueue(int stream_id,
+                                                                   int layer) {
+  if (layer == 0) {
+    return queue_map_[stream_id];
+  }
+  if (layer < 0 || layer >= SIMULCAST_MAX_LAYERS) {
+    return nullptr;
+  }
+  auto &queue = layer_queue_map_[LayerId(stream_id, layer)];
+  if (!queue) {
+    LOG(INFO) << "stream " << stream_id << " sends simulcast layer " << layer;
+    // The VideoMap only knows the lowest layer, so it is not told when the
+    // upper layers are prepared.
+    queue = std::make_shared<VideoFrameQueue>(stream_id, nullptr);
+    queue->SetKeyFrameRequestListener([this, layer](VideoFrameQueue::id_t id) {
+      LOG(INFO) << "layer " << layer << " queue requests key frame : " << id;
+      RequestKeyFrame(id, layer);
+    });
+    if (queue_map_[stream_id]->Enabled()) {
+      queue->Enable();
+    }
+  }
+  return queue;
+}
+
 void VideoForwardElementNew::ForwardLoop() {
   long start_time = GetCurrentTime_MS();
   while (running_) {
@@ -192,51 +292,146 @@ void VideoForwardElementNew::ForwardLoop() {
   }
 }
 
+const std::vector<std::shared_ptr<VideoFrame>>&
+VideoForwardElementNew::ReleaseFrames(
+    const LayerId& layer_id,
+    std::map<LayerId, std::vector<std::shared_ptr<VideoFrame>>>* released_frames) {
+  auto iter = released_frames->find(layer_id);
+  if (iter != released_frames->end()) {
+    return iter->second;
+  }
+  std::vector<std::shared_ptr<VideoFrame>>& frames = (*released_frames)[layer_id];
+  std::shared_ptr<VideoFrameQueue> queue;
+  if (layer_id.second == 0) {
+    auto queue_iter = queue_map_.find(layer_id.first);
+    if (queue_iter != queue_map_.end()) {
+      queue = queue_iter->second;
+    }
+  } else {
+    auto queue_iter = layer_queue_map_.find(layer_id);
+    if (queue_iter != layer_queue_map_.end()) {
+      queue = queue_iter->second;
+    }
+  }
+  if (queue) {
+    std::shared_ptr<VideoFrame> frame;
+    while ((frame = queue->PopFrame()) != nullptr) {
+      frames.push_back(frame);
+    }
+  }
+  return frames;
+}
+
 void VideoForwardElementNew::ForwardData() {
+  // The frames are only released from the queues the viewers need. A queue
+  // nobody looks at keeps its last key frame and the frames after it, so a
+  // viewer switched to it starts at once from that key frame.
+  std::map<LayerId, std::vector<std::shared_ptr<VideoFrame>>> released_frames;
+
   std::vector<VideoMap::id_t> stream_ids;
   video_mapper_->GetAllId(&stream_ids);
 
+  long now_ms = GetCurrentTime_MS();
+  std::set<LayerId> looked_layers;
   bool first = true;
   for (int32_t id : stream_ids) {
     int32_t src = video_mapper_->GetSrc(id);
     if (src == VideoMap::NOID) {
       continue;
     }
-    auto queue = queue_map_[src];
-    auto frame = queue->TopPacket();
-    if (!frame) {
+    auto sc = video_switch_contexts_[id];
+    int layer = selector_.CurrentLayer(id);
+    int target = selector_.TargetLayer(id, src, now_ms);
+    bool switched = false;
+    if (target != layer) {
+      // Switches at the first key frame of the target layer, or keeps the
+      // current layer until there is one.
+      auto &frames = ReleaseFrames(LayerId(src, target), &released_frames);
+      for (size_t i = 0; i < frames.size(); ++i) {
+        if (!frames[i]->is_keyframe()) {
+          continue;
+        }
+        sc->rebase = true;
+        selector_.SetCurrentLayer(id, target);
+        layer = target;
+        ForwardFrames(id, sc, frames, i, first);
+        first = false;
+        switched = true;
+        break;
+      }
+      if (!switched && selector_.ShouldRequestKeyFrame(src, now_ms)) {
+        RequestKeyFrame(src, target);
+      }
+    }
+    looked_layers.insert(LayerId(src, layer));
+    if (switched) {
       continue;
     }
-    auto sc = video_switch_contexts_[id];
-
-    sc->seq = frame->seq() - sc->base_seq + sc->last_seq;
-    sc->ts  = frame->ts()  - sc->base_ts  + sc->last_ts;
-
-    auto packet = std::make_shared<MediaOutputPacket>();
-    packet->timestamp  = sc->ts;
-    packet->seq_number = sc->seq;
-    packet->end_frame  = frame->marker();
-    packet->ssrc       = -1;
-    unsigned char *tmp_buf = (unsigned char*)malloc(frame->len() - 12);
-    memcpy(tmp_buf, frame->data() + 12, frame->len() - 12);
-    packet->encoded_buf = tmp_buf;
-    packet->length     = frame->len() - 12;
-
-    video_forward_event_listener_->OnRelayRtpPacket(id, packet);
-
-    /**
-     * Here we relay packet one more times for event listener used for live stream and so on.
-     * stream_id is 0;
-     */
-    if (first) {
-      video_forward_event_listener_->OnRelayRtpPacket(0, packet);
-      first = false;
+    auto &frames = ReleaseFrames(LayerId(src, layer), &released_frames);
+    if (frames.empty()) {
+      continue;
     }
+    ForwardFrames(id, sc, frames, 0, first);
+    first = false;
   }
+  // The queues still looked at but not needed now (e.g. the lowest layer
+  // while the viewers get an upper one) are drained, they don't trim
+  // themselves.
   for (auto &pair : queue_map_) {
-    auto queue = pair.second;
-    if (queue) {
-      queue->PopPacket();
+    if (pair.second->HasLooker()) {
+      ReleaseFrames(LayerId(pair.first, 0), &released_frames);
+    }
+  }
+  for (auto &pair : layer_queue_map_) {
+    if (pair.second->HasLooker()) {
+      ReleaseFrames(pair.first, &released_frames);
+    }
+  }
+
+  // The upper layers nobody receives only keep their last key frame, and
+  // don't ask for key frames when they drop frames.
+  for (auto &pair : layer_queue_map_) {
+    pair.second->SetHasLooker(looked_layers.count(pair.first) > 0);
+  }
+}
+
+void VideoForwardElementNew::ForwardFrames(int32_t id,
+    const std::shared_ptr<VideoSwitchContext>& sc,
+    const std::vector<std::shared_ptr<VideoFrame>>& frames,
+    size_t begin, bool first) {
+  for (size_t i = begin; i < frames.size(); ++i) {
+    auto &frame = frames[i];
+    if (sc->rebase) {
+      sc->base_ts  = frame->ts();
+      sc->base_seq = frame->first_seq();
+      sc->last_ts  = sc->ts + VIDEO_SWITCH_TS_GAP;
+      sc->last_seq = sc->seq + 1;
+      sc->rebase = false;
+    }
+    for (auto &rtp_packet : frame->packets()) {
+      const RtpHeader *h = reinterpret_cast<const RtpHeader*>(rtp_packet->data());
+      sc->seq = h->getSeqNumber() - sc->base_seq + sc->last_seq;
+      sc->ts  = frame->ts() - sc->base_ts + sc->last_ts;
+
+      auto packet = std::make_shared<MediaOutputPacket>();
+      packet->timestamp  = sc->ts;
+      packet->seq_number = sc->seq;
+      packet->end_frame  = h->getMarker();
+      packet->ssrc       = -1;
+      unsigned char *tmp_buf = (unsigned char*)malloc(rtp_packet->length() - 12);
+      memcpy(tmp_buf, rtp_packet->data() + 12, rtp_packet->length() - 12);
+      packet->encoded_buf = tmp_buf;
+      packet->length     = rtp_packet->length() - 12;
+
+      video_forward_event_listener_->OnRelayRtpPacket(id, packet);
+
+      /**
+       * Here we relay packet one more times for event listener used for live stream and so on.
+       * stream_id is 0;
+       */
+      if (first) {
+        video_forward_event_listener_->OnRelayRtpPacket(0, packet);
+      }
     }
   }
 }
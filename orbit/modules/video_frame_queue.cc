@@ -7,6 +7,11 @@
 
 #include "video_frame_queue.h"
 
+#include <math.h>
+
+#include <algorithm>
+
+#include "stream_service/orbit/base/timeutil.h"
 #include "stream_service/orbit/rtp/rtp_headers.h"
 #include "stream_service/orbit/webrtc/webrtc_format_util.h"
 
@@ -14,92 +19,229 @@
 
 namespace orbit {
 
-VideoFrame::VideoFrame(const uint8_t *data, size_t len) {
-  memcpy(data_, data, len);
-  len_ = len;
-  is_keyframe_ = IsKeyFrame(data, len);
+namespace {
 
-  const RtpHeader *h = reinterpret_cast<const RtpHeader*>(data);
-  seq_ = h->getSeqNumber();
-  ts_ = h->getTimestamp();
-  marker_ = h->getMarker();
+uint16_t SeqOf(const PacketBufferPtr& packet) {
+  return reinterpret_cast<const RtpHeader*>(packet->data())->getSeqNumber();
 }
 
-bool VideoFrame::IsKeyFrame(const uint8_t *data, size_t len) {
-  webrtc::RtpDepacketizer::ParsedPayload payload;
-  const RtpHeader *h = reinterpret_cast<const RtpHeader*>(data);
-  int video_payload = (int)(h->getPayloadType());
-  bool ok = RtpDepacketizer_Parse(video_payload, &payload, data + 12, len - 12);
-  return ok && payload.frame_type == webrtc::kVideoFrameKey;
+// a < b, taking into account the wrap.
+bool SeqLess(uint16_t a, uint16_t b) {
+  return a != b && (uint16_t)(b - a) < 0x8000;
+}
+
+bool TsLess(uint32_t a, uint32_t b) {
+  return a != b && (uint32_t)(b - a) < 0x80000000;
+}
+
+}  // annoymous namespace
+
+uint16_t VideoFrame::first_seq() const {
+  return SeqOf(packets_.front());
+}
+
+uint16_t VideoFrame::last_seq() const {
+  return SeqOf(packets_.back());
+}
+
+bool VideoFrame::complete() const {
+  if (!has_first_ || !has_marker_) {
+    return false;
+  }
+  return (size_t)(uint16_t)(last_seq() - first_seq()) + 1 == packets_.size();
+}
+
+bool VideoFrame::Insert(const PacketBufferPtr& packet, bool first_packet,
+                        bool keyframe) {
+  uint16_t seq = SeqOf(packet);
+  // The packets mostly come in order, search from the back.
+  auto iter = packets_.end();
+  while (iter != packets_.begin() && SeqLess(seq, SeqOf(*(iter - 1)))) {
+    --iter;
+  }
+  if (iter != packets_.begin() && SeqOf(*(iter - 1)) == seq) {
+    return false;
+  }
+  packets_.insert(iter, packet);
+  has_first_ |= first_packet;
+  has_marker_ |= (reinterpret_cast<const RtpHeader*>(packet->data())->getMarker() != 0);
+  is_keyframe_ |= keyframe;
+  return true;
+}
+
+void VideoFrameQueue::SetKeyFrameRequestListener(std::function<void(id_t)> listener) {
+  Lock lock(mutex_);
+  key_frame_request_listener_ = listener;
 }
 
 void VideoFrameQueue::PushPacket(const uint8_t *data, size_t len) {
-  if (!data || len <= 0) {
+  PushPacket(data, len, GetCurrentTime_MS());
+}
+
+void VideoFrameQueue::PushPacket(const uint8_t *data, size_t len, long now_ms) {
+  if (!data || len <= 12) {
     return;
   }
   Lock lock(mutex_);
   if (!enabled_) {
     return;
   }
-  auto frame = std::make_shared<VideoFrame>(data, len);
-  if (has_looker_) {
-    PushPacketWhenHasLooker(frame);
-  } else {
-    PushPacketWhenNoLooker(frame);
+  PacketBufferPtr packet = PacketBuffer::Create((const char*)data, len);
+  if (packet == NULL) {
+    LOG(ERROR) << "Drop the video packet too large, len=" << len;
+    return;
   }
-}
-
-void VideoFrameQueue::PushPacketWhenHasLooker(std::shared_ptr<VideoFrame> frame) {
-  uint16_t seq = frame->seq();
-  if (Contains(seq)) {
+  const RtpHeader *h = reinterpret_cast<const RtpHeader*>(data);
+  if (has_released_ && SeqLess(h->getSeqNumber(), next_seq_)) {
+    // Late, the frame is released (or dropped) already.
     return;
   }
-  frames_[seq] = frame;
-  CheckPrepared();
-}
+  webrtc::RtpDepacketizer::ParsedPayload payload;
+  int video_payload = (int)(h->getPayloadType());
+  if (!RtpDepacketizer_Parse(video_payload, &payload, data + 12, len - 12)) {
+    return;
+  }
+  bool keyframe = (payload.frame_type == webrtc::kVideoFrameKey);
+  bool first_packet = payload.type.Video.isFirstPacket;
 
-void VideoFrameQueue::PushPacketWhenNoLooker(std::shared_ptr<VideoFrame> frame) {
-  uint16_t seq = frame->seq();
-  if (Contains(seq)) {
+  std::shared_ptr<VideoFrame> frame = FindOrCreateFrame(h->getTimestamp(), now_ms);
+  if (!frame) {
     return;
   }
-  if (frame->is_keyframe()) {
-    frames_.clear();
-    frames_[seq] = frame;
-    prepared_listener_(id_);
+  bool was_keyframe = frame->is_keyframe();
+  if (!frame->Insert(packet, first_packet, keyframe)) {
+    return;
+  }
+  if (keyframe && !was_keyframe &&
+      (!last_key_frame_ || TsLess(last_key_frame_->ts(), frame->ts()))) {
+    last_key_frame_ = frame;
+  }
+
+  if (has_looker_) {
+    CheckPrepared();
   } else {
-    if (FirstIsKeyFrame()) {
-      frames_[seq] = frame;
+    TrimToLastKeyFrame();
+    if (keyframe && !was_keyframe) {
+      FirePreparedEvent();
     }
   }
 }
 
-std::shared_ptr<VideoFrame> VideoFrameQueue::PopPacket() {
-  Lock lock(mutex_);
-  if (!enabled_) {
+std::shared_ptr<VideoFrame> VideoFrameQueue::FindOrCreateFrame(uint32_t ts,
+                                                               long now_ms) {
+  if (has_released_ && !TsLess(last_released_ts_, ts)) {
     return nullptr;
   }
-  auto iter = frames_.begin();
-  if (iter == frames_.end()) {
-    return nullptr;
+  // The new frames mostly go to the back.
+  auto iter = frames_.end();
+  while (iter != frames_.begin() && TsLess(ts, (*(iter - 1))->ts())) {
+    --iter;
+  }
+  if (iter != frames_.begin() && (*(iter - 1))->ts() == ts) {
+    return *(iter - 1);
   }
-  std::shared_ptr<VideoFrame> frame = iter->second;
-  frames_.erase(iter);
-  CheckPrepared();
+  UpdateJitter(ts, now_ms);
+  auto frame = std::make_shared<VideoFrame>(ts, now_ms);
+  frames_.insert(iter, frame);
   return frame;
 }
 
-std::shared_ptr<VideoFrame> VideoFrameQueue::TopPacket() const {
+void VideoFrameQueue::UpdateJitter(uint32_t ts, long now_ms) {
+  if (has_last_frame_ && !TsLess(last_frame_ts_, ts)) {
+    // A reordered frame, not counted.
+    return;
+  }
+  if (has_last_frame_) {
+    // In ms, the video rtp clock is 90khz.
+    double d = (now_ms - last_frame_arrival_ms_) -
+               (int32_t)(ts - last_frame_ts_) / 90.0;
+    jitter_ms_ += (fabs(d) - jitter_ms_) / 16;
+  }
+  has_last_frame_ = true;
+  last_frame_ts_ = ts;
+  last_frame_arrival_ms_ = now_ms;
+}
+
+std::shared_ptr<VideoFrame> VideoFrameQueue::PopFrame() {
+  return PopFrame(GetCurrentTime_MS());
+}
+
+std::shared_ptr<VideoFrame> VideoFrameQueue::PopFrame(long now_ms) {
   Lock lock(mutex_);
   if (!enabled_) {
     return nullptr;
   }
-  auto iter = frames_.begin();
-  if (iter == frames_.end()) {
+  long delay_ms = target_delay_ms();
+  while (!frames_.empty()) {
+    std::shared_ptr<VideoFrame> frame = frames_.front();
+    bool continuous = has_released_ && !waiting_for_key_frame_ &&
+                      frame->first_seq() == next_seq_;
+    if (frame->complete() && (frame->is_keyframe() || continuous)) {
+      PopFrontFrame();
+      has_released_ = true;
+      next_seq_ = frame->last_seq() + 1;
+      last_released_ts_ = frame->ts();
+      waiting_for_key_frame_ = false;
+      if (has_looker_) {
+        CheckPrepared();
+      }
+      return frame;
+    }
+    if (frame->complete() && waiting_for_key_frame_) {
+      // A delta frame can't be decoded without the key frame.
+      DropFrontFrame(now_ms);
+      continue;
+    }
+    if (now_ms - frame->arrival_time_ms() < delay_ms &&
+        frames_.size() <= VIDEO_JITTER_MAX_FRAMES) {
+      // Wait for the missing packets.
+      return nullptr;
+    }
+    VLOG(3) << "Drop the incomplete video frame, id=" << id_
+            << " ts=" << frame->ts() << " packets=" << frame->packets().size();
+    DropFrontFrame(now_ms);
+  }
+  return nullptr;
+}
+
+void VideoFrameQueue::DropFrontFrame(long now_ms) {
+  std::shared_ptr<VideoFrame> frame = frames_.front();
+  PopFrontFrame();
+  dropped_frames_++;
+  // The packets of the dropped frame are late from now on.
+  has_released_ = true;
+  next_seq_ = frame->last_seq() + 1;
+  last_released_ts_ = frame->ts();
+  waiting_for_key_frame_ = true;
+  RequestKeyFrame(now_ms);
+}
+
+void VideoFrameQueue::RequestKeyFrame(long now_ms) {
+  if (!has_looker_) {
+    // Nobody is watching, the key frame will be requested when switched to.
+    return;
+  }
+  if (last_key_frame_request_ms_ != 0 &&
+      now_ms - last_key_frame_request_ms_ < VIDEO_JITTER_KEY_FRAME_REQUEST_INTERVAL_MS) {
+    return;
+  }
+  // A key frame is on the way, no need to ask for another one.
+  if (last_key_frame_) {
+    return;
+  }
+  last_key_frame_request_ms_ = now_ms;
+  key_frame_requests_++;
+  if (key_frame_request_listener_) {
+    key_frame_request_listener_(id_);
+  }
+}
+
+std::shared_ptr<VideoFrame> VideoFrameQueue::TopFrame() const {
+  Lock lock(mutex_);
+  if (!enabled_ || frames_.empty()) {
     return nullptr;
   }
-  std::shared_ptr<VideoFrame> frame = iter->second;
-  return frame;
+  return frames_.front();
 }
 
 void VideoFrameQueue::Enable() {
@@ -111,7 +253,7 @@ void VideoFrameQueue::Disable() {
   Lock lock(mutex_);
   if (enabled_) {
     enabled_ = false;
-    frames_.clear();
+    Clear();
   }
 }
 
@@ -130,21 +272,67 @@ bool VideoFrameQueue::HasLooker() const {
   return has_looker_;
 }
 
-bool VideoFrameQueue::FirstIsKeyFrame() const {
-  auto iter = frames_.cbegin();
-  if (iter == frames_.cend()) {
-    return false;
+int VideoFrameQueue::FrameCount() const {
+  Lock lock(mutex_);
+  return frames_.size();
+}
+
+double VideoFrameQueue::jitter_ms() const {
+  Lock lock(mutex_);
+  return jitter_ms_;
+}
+
+long VideoFrameQueue::target_delay_ms() const {
+  Lock lock(mutex_);
+  long delay_ms = VIDEO_JITTER_MIN_DELAY_MS +
+                  (long)(VIDEO_JITTER_DELAY_FACTOR * jitter_ms_);
+  return std::min(delay_ms, (long)VIDEO_JITTER_MAX_DELAY_MS);
+}
+
+int64_t VideoFrameQueue::dropped_frames() const {
+  Lock lock(mutex_);
+  return dropped_frames_;
+}
+
+int64_t VideoFrameQueue::key_frame_requests() const {
+  Lock lock(mutex_);
+  return key_frame_requests_;
+}
+
+void VideoFrameQueue::TrimToLastKeyFrame() {
+  if (!last_key_frame_) {
+    // No key frame yet, nothing to keep.
+    frames_.clear();
+    return;
   }
-  std::shared_ptr<VideoFrame> frame = iter->second;
-  if (frame) {
-    return frame->is_keyframe();
-  } else {
-    return false;
+  // The frames before it are trimmed on every push, mostly none is left.
+  while (frames_.front() != last_key_frame_) {
+    frames_.pop_front();
   }
 }
 
-bool VideoFrameQueue::Contains(uint16_t seq) const {
-  return frames_.find(seq) != frames_.end();
+void VideoFrameQueue::PopFrontFrame() {
+  if (frames_.front() == last_key_frame_) {
+    // The latest key frame, there is no other after it.
+    last_key_frame_.reset();
+  }
+  frames_.pop_front();
+}
+
+void VideoFrameQueue::Clear() {
+  frames_.clear();
+  last_key_frame_.reset();
+  has_released_ = false;
+  waiting_for_key_frame_ = true;
+  has_last_frame_ = false;
+  jitter_ms_ = 0;
+}
+
+bool VideoFrameQueue::FirstIsKeyFrame() const {
+  if (frames_.empty()) {
+    return false;
+  }
+  return frames_.front()->is_keyframe();
 }
 
 void VideoFrameQueue::FirePreparedEvent() {
@@ -1,32 +1,73 @@
+/*
+ * video_frame_queue.h
+ *
+ *  Created on: 2016-9-20
+ *      Author: cxy
+ * ---------------------------------------------------------------------------
+ * A frame level jitter buffer of one video stream.
+ * ---------------------------------------------------------------------------
+ *  - The packets are held in pooled PacketBuffers, and grouped into frames by
+ *    the rtp timestamp. A frame is complete when it has the first packet of
+ *    the frame, the packet with the marker bit, and no gap between them.
+ *  - PopFrame() only releases whole decodable frames: a complete key frame,
+ *    or a complete delta frame following the last released frame.
+ *  - An incomplete (or not continuous) frame at the head is waited for, up to
+ *    a delay adapting to the measured frame jitter. Then it is dropped, the
+ *    delta frames are dropped until the next key frame, and a key frame is
+ *    requested (at most once per VIDEO_JITTER_KEY_FRAME_REQUEST_INTERVAL_MS).
+ *  - Without a looker, only the latest key frame and the frames after it are
+ *    kept, so the stream can be switched to at once.
+ */
 
 #pragma once
 
 #include <stdint.h>
 
+#include <deque>
+#include <functional>
 #include <mutex>
-#include <map>
 #include <memory>
+#include <vector>
+
+#include "stream_service/orbit/packet_buffer.h"
+
+// The frames are released without waiting if the jitter is low.
+#define VIDEO_JITTER_MIN_DELAY_MS 20
+#define VIDEO_JITTER_MAX_DELAY_MS 200
+// The delay to wait for a missing packet is this many times of the jitter.
+#define VIDEO_JITTER_DELAY_FACTOR 3
+// The frames held beyond this are dropped even if not expired.
+#define VIDEO_JITTER_MAX_FRAMES 64
+#define VIDEO_JITTER_KEY_FRAME_REQUEST_INTERVAL_MS 1000
 
 namespace orbit {
 
+// The packets of one frame (with the same rtp timestamp), in the order of
+// the sequence number.
 class VideoFrame final {
  public:
-  VideoFrame(const uint8_t *data, size_t len);
-  uint16_t seq() const { return seq_; }
+  VideoFrame(uint32_t ts, long arrival_time_ms)
+    : ts_(ts), arrival_time_ms_(arrival_time_ms) {}
+
   uint32_t ts() const { return ts_; }
-  uint8_t  marker() const { return marker_; }
-  const uint8_t *data() const { return data_; }
-  size_t len() const { return len_; }
+  // When the first packet (in arrival order) of the frame is received.
+  long arrival_time_ms() const { return arrival_time_ms_; }
+  uint16_t first_seq() const;
+  uint16_t last_seq() const;
   bool is_keyframe() const { return is_keyframe_; }
+  // Has the first packet, the marker packet and all the packets between.
+  bool complete() const;
+  const std::vector<PacketBufferPtr>& packets() const { return packets_; }
+
+  // Inserts the packet in order. Returns false if it is a duplicate.
+  bool Insert(const PacketBufferPtr& packet, bool first_packet, bool keyframe);
  private:
-  static bool IsKeyFrame(const uint8_t *data, size_t len);
-
-  uint16_t seq_;
-  uint32_t ts_;
-  uint8_t  marker_;
-  uint8_t  data_[1500];
-  size_t   len_;
-  bool     is_keyframe_;
+  const uint32_t ts_;
+  const long arrival_time_ms_;
+  bool is_keyframe_ = false;
+  bool has_first_ = false;
+  bool has_marker_ = false;
+  std::vector<PacketBufferPtr> packets_;
 };
 
 class VideoFrameQueue final {
@@ -35,35 +76,78 @@ class VideoFrameQueue final {
   VideoFrameQueue(id_t id, std::function<void(id_t)> prepared_listener)
    : id_(id), prepared_listener_(prepared_listener) {}
 
+  // The listener is called when the frames are dropped and a key frame is
+  // needed to go on.
+  void SetKeyFrameRequestListener(std::function<void(id_t)> listener);
+
   void PushPacket(const uint8_t *data, size_t len);
-  std::shared_ptr<VideoFrame> PopPacket();
-  std::shared_ptr<VideoFrame> TopPacket() const;
+  void PushPacket(const uint8_t *data, size_t len, long now_ms);
+  // Pops the next decodable frame, or returns NULL if there is none yet.
+  std::shared_ptr<VideoFrame> PopFrame();
+  std::shared_ptr<VideoFrame> PopFrame(long now_ms);
+  // Returns the oldest frame held, which may be incomplete.
+  std::shared_ptr<VideoFrame> TopFrame() const;
 
   void Enable();
   void Disable();
   bool Enabled() const;
   void SetHasLooker(bool has_looker);
   bool HasLooker() const;
+
+  // Stats
+  int FrameCount() const;
+  double jitter_ms() const;
+  long target_delay_ms() const;
+  int64_t dropped_frames() const;
+  int64_t key_frame_requests() const;
  private:
   typedef std::recursive_mutex Mutex;
   typedef std::lock_guard<Mutex> Lock;
 
-  bool Contains(uint16_t seq) const;
+  // Returns the frame of the timestamp, creates it if needed, or returns
+  // NULL if the frame is released already.
+  std::shared_ptr<VideoFrame> FindOrCreateFrame(uint32_t ts, long now_ms);
+  void UpdateJitter(uint32_t ts, long now_ms);
+  void DropFrontFrame(long now_ms);
+  void RequestKeyFrame(long now_ms);
+  // Drops the frames before the latest key frame.
+  void TrimToLastKeyFrame();
+  // Removes the front frame, keeps last_key_frame_ up to date.
+  void PopFrontFrame();
+  void Clear();
   void FirePreparedEvent();
   bool FirstIsKeyFrame() const;
   void CheckPrepared();
 
-  void PushPacketWhenHasLooker(std::shared_ptr<VideoFrame> frame);
-  void PushPacketWhenNoLooker(std::shared_ptr<VideoFrame> frame);
-
   mutable Mutex mutex_;
   const id_t id_;
 
   std::function<void(id_t)> prepared_listener_;
-  std::map<uint16_t, std::shared_ptr<VideoFrame>> frames_;
+  std::function<void(id_t)> key_frame_request_listener_;
+  // Ordered by the rtp timestamp.
+  std::deque<std::shared_ptr<VideoFrame>> frames_;
+  // The key frame with the latest timestamp in frames_, or NULL if there is
+  // no key frame, so the pushes don't scan the frames.
+  std::shared_ptr<VideoFrame> last_key_frame_;
 
   bool enabled_ = false;
   bool has_looker_ = false;
+
+  // The decoding state of the released frames.
+  bool has_released_ = false;
+  uint16_t next_seq_ = 0;
+  uint32_t last_released_ts_ = 0;
+  bool waiting_for_key_frame_ = true;
+  long last_key_frame_request_ms_ = 0;
+
+  // The inter-arrival jitter of the frames (RFC 3550).
+  bool has_last_frame_ = false;
+  uint32_t last_frame_ts_ = 0;
+  long last_frame_arrival_ms_ = 0;
+  double jitter_ms_ = 0;
+
+  int64_t dropped_frames_ = 0;
+  int64_t key_frame_requests_ = 0;
 };
 
 } // namespace orbit
@@ -0,0 +1,205 @@
+/*
+ * Copyright 2016 (C) Orange Labs Inc. All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * video_frame_queue_test.cc
+ */
+
+#include "gtest/gtest.h"
+#include "glog/logging.h"
+
+#include "video_frame_queue.h"
+
+#include <string.h>
+
+#include <vector>
+
+#include "stream_service/orbit/rtp/rtp_headers.h"
+
+namespace orbit {
+namespace {
+
+// Makes a VP8 rtp packet. The first packet of a frame has the S bit and
+// partition 0, and a key frame has the P bit cleared in the payload header.
+std::vector<uint8_t> MakeVp8Packet(uint16_t seq, uint32_t ts, bool first,
+                                   bool marker, bool keyframe) {
+  std::vector<uint8_t> packet(12 + 1 + 20, 0);
+  RtpHeader* h = reinterpret_cast<RtpHeader*>(packet.data());
+  h->setVersion(2);
+  h->setPayloadType(VP8_90000_PT);
+  h->setSeqNumber(seq);
+  h->setTimestamp(ts);
+  h->setMarker(marker ? 1 : 0);
+  packet[12] = first ? 0x10 : 0x00;
+  packet[13] = keyframe ? 0x00 : 0x01;
+  return packet;
+}
+
+class VideoFrameQueueTest : public testing::Test {
+ protected:
+  virtual void SetUp() override {
+    queue_.reset(new VideoFrameQueue(1, [this](VideoFrameQueue::id_t id) {
+      prepared_count_++;
+    }));
+    queue_->SetKeyFrameRequestListener([this](VideoFrameQueue::id_t id) {
+      key_frame_request_count_++;
+    });
+    queue_->Enable();
+    queue_->SetHasLooker(true);
+  }
+
+  void Push(uint16_t seq, uint32_t ts, bool first, bool marker,
+            bool keyframe = false) {
+    std::vector<uint8_t> packet = MakeVp8Packet(seq, ts, first, marker, keyframe);
+    queue_->PushPacket(packet.data(), packet.size(), now_ms_);
+  }
+
+  // Pushes a frame of the packets [seq, seq + count).
+  void PushFrame(uint16_t seq, int count, uint32_t ts, bool keyframe = false) {
+    for (int i = 0; i < count; ++i) {
+      Push(seq + i, ts, i == 0, i == count - 1, keyframe && i == 0);
+    }
+  }
+
+  std::unique_ptr<VideoFrameQueue> queue_;
+  long now_ms_ = 100000;
+  int prepared_count_ = 0;
+  int key_frame_request_count_ = 0;
+};
+
+TEST_F(VideoFrameQueueTest, ReleasesWholeFrames) {
+  PushFrame(100, 3, 9000, true);
+  // Only the first two packets of the delta frame.
+  Push(103, 12000, true, false);
+  Push(104, 12000, false, false);
+
+  std::shared_ptr<VideoFrame> frame = queue_->PopFrame(now_ms_);
+  ASSERT_TRUE(frame != nullptr);
+  EXPECT_TRUE(frame->is_keyframe());
+  EXPECT_EQ(3u, frame->packets().size());
+  EXPECT_EQ(100, frame->first_seq());
+  EXPECT_EQ(102, frame->last_seq());
+  // The delta frame is incomplete yet.
+  EXPECT_TRUE(queue_->PopFrame(now_ms_) == nullptr);
+
+  Push(105, 12000, false, true);
+  frame = queue_->PopFrame(now_ms_);
+  ASSERT_TRUE(frame != nullptr);
+  EXPECT_FALSE(frame->is_keyframe());
+  EXPECT_EQ(3u, frame->packets().size());
+  EXPECT_EQ(0, queue_->FrameCount());
+}
+
+TEST_F(VideoFrameQueueTest, AssemblesReorderedAndDuplicatedPackets) {
+  Push(102, 9000, false, true);
+  Push(100, 9000, true, false, true);
+  Push(102, 9000, false, true);
+  Push(101, 9000, false, false);
+
+  std::shared_ptr<VideoFrame> frame = queue_->PopFrame(now_ms_);
+  ASSERT_TRUE(frame != nullptr);
+  ASSERT_EQ(3u, frame->packets().size());
+  for (int i = 0; i < 3; ++i) {
+    const RtpHeader* h =
+        reinterpret_cast<const RtpHeader*>(frame->packets()[i]->data());
+    EXPECT_EQ(100 + i, h->getSeqNumber());
+  }
+}
+
+TEST_F(VideoFrameQueueTest, HandlesSequenceWrap) {
+  PushFrame(65534, 3, 9000, true);
+  PushFrame(1, 2, 12000);
+  std::shared_ptr<VideoFrame> frame = queue_->PopFrame(now_ms_);
+  ASSERT_TRUE(frame != nullptr);
+  EXPECT_EQ(65534, frame->first_seq());
+  EXPECT_EQ(0, frame->last_seq());
+  frame = queue_->PopFrame(now_ms_);
+  ASSERT_TRUE(frame != nullptr);
+  EXPECT_EQ(1, frame->first_seq());
+}
+
+TEST_F(VideoFrameQueueTest, DropsIncompleteFrameAfterDelay) {
+  PushFrame(100, 2, 9000, true);
+  ASSERT_TRUE(queue_->PopFrame(now_ms_) != nullptr);
+
+  // Packet 103 of the next frame is lost, and the frame after it is
+  // complete but can't be decoded without it.
+  Push(102, 12000, true, false);
+  Push(104, 12000, false, true);
+  PushFrame(105, 2, 15000);
+  EXPECT_TRUE(queue_->PopFrame(now_ms_) == nullptr);
+  EXPECT_EQ(0, key_frame_request_count_);
+
+  // 103 is not back in time.
+  now_ms_ += queue_->target_delay_ms();
+  EXPECT_TRUE(queue_->PopFrame(now_ms_) == nullptr);
+  EXPECT_EQ(2, queue_->dropped_frames());
+  EXPECT_EQ(1, key_frame_request_count_);
+  // Late packets of the dropped frames are ignored.
+  Push(103, 12000, false, false);
+  EXPECT_EQ(0, queue_->FrameCount());
+
+  // The delta frames are dropped until the key frame, without requesting
+  // another key frame too soon.
+  PushFrame(107, 2, 18000);
+  EXPECT_TRUE(queue_->PopFrame(now_ms_) == nullptr);
+  EXPECT_EQ(1, key_frame_request_count_);
+  PushFrame(109, 2, 21000, true);
+  std::shared_ptr<VideoFrame> frame = queue_->PopFrame(now_ms_);
+  ASSERT_TRUE(frame != nullptr);
+  EXPECT_TRUE(frame->is_keyframe());
+}
+
+TEST_F(VideoFrameQueueTest, KeepsLastKeyFrameWithoutLooker) {
+  queue_->SetHasLooker(false);
+  PushFrame(100, 2, 9000);
+  EXPECT_EQ(0, queue_->FrameCount());
+  PushFrame(102, 2, 12000, true);
+  PushFrame(104, 2, 15000);
+  EXPECT_EQ(2, queue_->FrameCount());
+  EXPECT_EQ(1, prepared_count_);
+  PushFrame(106, 2, 18000, true);
+  EXPECT_EQ(1, queue_->FrameCount());
+  EXPECT_EQ(2, prepared_count_);
+  EXPECT_EQ(106, queue_->TopFrame()->first_seq());
+}
+
+TEST_F(VideoFrameQueueTest, TracksLastKeyFrameAcrossReorderAndPop) {
+  queue_->SetHasLooker(false);
+  PushFrame(102, 2, 12000, true);
+  // The packets of an older key frame come late, it doesn't become the
+  // last key frame.
+  PushFrame(100, 2, 9000, true);
+  EXPECT_EQ(1, queue_->FrameCount());
+  EXPECT_EQ(102, queue_->TopFrame()->first_seq());
+
+  // Released to a looker, the queue has no key frame left, so the delta
+  // frames are not kept without a looker.
+  queue_->SetHasLooker(true);
+  ASSERT_TRUE(queue_->PopFrame(now_ms_) != nullptr);
+  queue_->SetHasLooker(false);
+  PushFrame(104, 2, 15000);
+  EXPECT_EQ(0, queue_->FrameCount());
+  PushFrame(106, 2, 18000, true);
+  PushFrame(108, 2, 21000);
+  EXPECT_EQ(2, queue_->FrameCount());
+  EXPECT_EQ(106, queue_->TopFrame()->first_seq());
+}
+
+TEST_F(VideoFrameQueueTest, AdaptsDelayToJitter) {
+  EXPECT_EQ(VIDEO_JITTER_MIN_DELAY_MS, queue_->target_delay_ms());
+  // 30fps, the frames arrive 0 or 60ms late alternately.
+  for (int i = 0; i < 100; ++i) {
+    now_ms_ += (i % 2) ? 93 : 33;
+    PushFrame(100 + 2 * i, 2, 9000 + 3000 * i, i == 0);
+    while (queue_->PopFrame(now_ms_) != nullptr) {
+    }
+  }
+  EXPECT_GT(queue_->jitter_ms(), 20);
+  EXPECT_GT(queue_->target_delay_ms(), VIDEO_JITTER_MIN_DELAY_MS);
+  EXPECT_LE(queue_->target_delay_ms(), VIDEO_JITTER_MAX_DELAY_MS);
+  EXPECT_EQ(0, queue_->dropped_frames());
+}
+
+}  // annoymous namespace
+}  // namespace orbit
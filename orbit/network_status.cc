@@ -90,51 +90,69 @@ bool operator< (const NetworkStatusManager::Key &a,
   return a.stream_id() < b.stream_id();
 }
 
-std::map<NetworkStatusManager::Key, std::shared_ptr<NetworkStatus>> 
-    NetworkStatusManager::map_;
-std::mutex NetworkStatusManager::mutex_;
+const int NetworkStatusManager::kShards;
+NetworkStatusManager::Shard NetworkStatusManager::shards_[kShards];
+
+NetworkStatusManager::Shard& NetworkStatusManager::ShardOf(const Key& key) {
+  uint32_t hash = (uint32_t)key.session_id() * 31 + (uint32_t)key.stream_id();
+  return shards_[hash % kShards];
+}
+
+std::shared_ptr<const NetworkStatusManager::StatusMap>
+NetworkStatusManager::Snapshot(const Shard& shard) {
+  return std::atomic_load(&shard.map);
+}
 
-std::map<NetworkStatusManager::Key, long> 
-    NetworkStatusManager::stream_update_map_;
-  
 void NetworkStatusManager::Init(int32_t session_id, int32_t stream_id) {
-  std::lock_guard<std::mutex> lock(mutex_);
   Key key(session_id, stream_id);
   std::shared_ptr<NetworkStatus> p = std::make_shared<NetworkStatus>(session_id,
                                                                      stream_id);
-  map_[key] = p;
+  p->UpdateIncomingTime(GetCurrentTime_MS());
 
-  long current_time = GetCurrentTime_MS();
-  stream_update_map_[key] = current_time;
+  Shard& shard = ShardOf(key);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  std::shared_ptr<StatusMap> map;
+  if (shard.map != nullptr) {
+    map = std::make_shared<StatusMap>(*shard.map);
+  } else {
+    map = std::make_shared<StatusMap>();
+  }
+  (*map)[key] = p;
+  std::atomic_store(&shard.map, std::shared_ptr<const StatusMap>(map));
 }
 
 // update stream incomming packet time
 void NetworkStatusManager::UpdateStreamIncommingTime(int32_t session_id, int32_t stream_id) {
-  std::lock_guard<std::mutex> lock(mutex_);
-  Key key(session_id, stream_id);
-  long current_time = GetCurrentTime_MS();
-  stream_update_map_[key] = current_time;
+  std::shared_ptr<NetworkStatus> network_status = Get(session_id, stream_id);
+  if (network_status != nullptr) {
+    network_status->UpdateIncomingTime(GetCurrentTime_MS());
+  }
 }
 
 long NetworkStatusManager::GetStreamLastTime(int32_t session_id, int32_t stream_id) {
-  std::lock_guard<std::mutex> lock(mutex_);
-  Key key(session_id, stream_id);
-  long time = stream_update_map_[key];
-
-  return time;
+  std::shared_ptr<NetworkStatus> network_status = Get(session_id, stream_id);
+  if (network_status == nullptr) {
+    return 0;
+  }
+  return network_status->last_incoming_time_ms();
 }
 
 void NetworkStatusManager::TraverseStreamMap(std::vector<NetworkStatusManager::Key>* remove_stream) {
-  std::lock_guard<std::mutex> lock(mutex_);
   long current_time = GetCurrentTime_MS();
 
-  auto ite = stream_update_map_.begin();
-  for (; ite != stream_update_map_.end(); ite ++) {
-    if (ite->second == 0)
+  for (int i = 0; i < kShards; ++i) {
+    std::shared_ptr<const StatusMap> map = Snapshot(shards_[i]);
+    if (map == nullptr) {
       continue;
+    }
+    for (auto ite = map->begin(); ite != map->end(); ite ++) {
+      long last_time = ite->second->last_incoming_time_ms();
+      if (last_time == 0)
+        continue;
 
-    if (current_time - ite->second > FLAGS_leave_time) {
-      remove_stream->push_back(ite->first);
+      if (current_time - last_time > FLAGS_leave_time) {
+        remove_stream->push_back(ite->first);
+      }
     }
   }
 }
@@ -142,11 +160,8 @@ void NetworkStatusManager::TraverseStreamMap(std::vector<NetworkStatusManager::K
 void NetworkStatusManager::GetProbeNetResponse(const int& session_id,
                                                const int& stream_id,
                                                olive::ProbeNetTestResult* probe_result) {
-  std::lock_guard<std::mutex> lock(mutex_);
-  Key key(session_id, stream_id);
-  auto ite = map_.find(key);
-  if (ite != map_.end()) {
-    std::shared_ptr<NetworkStatus> network_status = ite->second;
+  std::shared_ptr<NetworkStatus> network_status = Get(session_id, stream_id);
+  if (network_status != nullptr) {
     bool has_video = network_status->CheckHasVideoPacket();
     bool has_audio = network_status->CheckHasAudioPacket(stream_id);
 
@@ -158,23 +173,24 @@ void NetworkStatusManager::GetProbeNetResponse(const int& session_id,
 }
 
 void NetworkStatusManager::UpdateTimeOfStreamHighEnergy(const int& session_id, const int& stream_id, opus_int32 audio_energy) {
-  std::lock_guard<std::mutex> lock(mutex_);
-  Key key(session_id, stream_id);
-  auto ite = map_.find(key);
-  if (ite != map_.end()) {
-    // audio_mixer_element.h : ENERGY_LOW = 1000000
-    if (audio_energy > 1000000) {
-      (ite->second)->UpdateHighEnergyTime(stream_id);
+  // audio_mixer_element.h : ENERGY_LOW = 1000000
+  if (audio_energy > 1000000) {
+    std::shared_ptr<NetworkStatus> network_status = Get(session_id, stream_id);
+    if (network_status != nullptr) {
+      network_status->UpdateHighEnergyTime(stream_id);
     }
   }
 }
 
 std::shared_ptr<NetworkStatus> NetworkStatusManager::Get(int32_t session_id,
                                                          int32_t stream_id) {
-  std::lock_guard<std::mutex> lock(mutex_);
   Key key(session_id, stream_id);
-  auto iter = map_.find(key);
-  if (iter != map_.end()) {
+  std::shared_ptr<const StatusMap> map = Snapshot(ShardOf(key));
+  if (map == nullptr) {
+    return nullptr;
+  }
+  auto iter = map->find(key);
+  if (iter != map->end()) {
     return iter->second;
   }
   return nullptr;
@@ -182,10 +198,14 @@ std::shared_ptr<NetworkStatus> NetworkStatusManager::Get(int32_t session_id,
 
 void NetworkStatusManager::Destroy(int32_t session_id, int32_t stream_id) {
   Key key(session_id, stream_id);
-  std::lock_guard<std::mutex> lock(mutex_);
-  map_.erase(key);
-
-  stream_update_map_.erase(key);
+  Shard& shard = ShardOf(key);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  if (shard.map == nullptr || shard.map->find(key) == shard.map->end()) {
+    return;
+  }
+  std::shared_ptr<StatusMap> map = std::make_shared<StatusMap>(*shard.map);
+  map->erase(key);
+  std::atomic_store(&shard.map, std::shared_ptr<const StatusMap>(map));
 }
 
 NetworkStatus ::NetworkStatus(unsigned int session_id, unsigned int stream_id) {
@@ -20,6 +20,7 @@
 #include <vector>
 
 #include "common_def.h"
+#include "stream_service/orbit/base/cache_line.h"
 #include "stream_service/proto/stream_service.grpc.pb.h"
 #include "stream_service/orbit/audio_processing/audio_energy.h"
 
@@ -155,13 +156,18 @@ class NetworkStatusManager final {
   };
   
   NetworkStatusManager() = delete;
+  // Creates the NetworkStatus of the stream. The per packet updates should go
+  // to the NetworkStatus returned by Get(), resolved once per stream.
   static void Init(int32_t session_id, int32_t stream_id);
   static std::shared_ptr<NetworkStatus> Get(int32_t session_id, 
                                             int32_t stream_id);
   static void Destroy(int32_t session_id, int32_t stream_id);
+  // Prefer NetworkStatus::UpdateIncomingTime(), this looks up the stream.
   static void UpdateStreamIncommingTime(int32_t session_id, int32_t stream_id);
   static long GetStreamLastTime(int32_t session_id, int32_t stream_id);
 
+  // Finds the streams without any incoming packet for FLAGS_leave_time ms.
+  // Reads a snapshot of each shard, it doesn't block the ingress nor Init().
   static void TraverseStreamMap(std::vector<NetworkStatusManager::Key>* remove_stream);
   static void GetProbeNetResponse(const int& session_id,
                                   const int& stream_id,
@@ -169,10 +175,21 @@ class NetworkStatusManager final {
   static void UpdateTimeOfStreamHighEnergy(const int& session_id, const int& stream_id, opus_int32 audio_energy);
   
  private:
-  static std::map<Key, std::shared_ptr<NetworkStatus>> map_;
-  static std::mutex mutex_;
+  typedef std::map<Key, std::shared_ptr<NetworkStatus>> StatusMap;
+
+  // The streams are spread over the shards by their key. The map of a shard
+  // is copy-on-write: the readers take a snapshot with std::atomic_load()
+  // without any lock, the writers (Init/Destroy) copy it under the shard
+  // mutex and publish the new one with std::atomic_store().
+  static const int kShards = 16;
+  struct Shard {
+    alignas(64) std::mutex mutex;
+    std::shared_ptr<const StatusMap> map;
+  };
+  static Shard shards_[kShards];
 
-  static std::map<Key, long> stream_update_map_;
+  static Shard& ShardOf(const Key& key);
+  static std::shared_ptr<const StatusMap> Snapshot(const Shard& shard);
 
   friend bool operator< (const Key &, const Key &);
 };
@@ -372,6 +389,18 @@ class NetworkStatus  {
    */
   void UpdateHighEnergyTime(const int& stream_id);
 
+  /**
+   * Records the time of the last incoming packet of the stream. Called on
+   * every incoming packet, so it is only a relaxed store.
+   */
+  void UpdateIncomingTime(long long now_ms) {
+    last_incoming_time_ms_.store(now_ms, std::memory_order_relaxed);
+  }
+
+  long long last_incoming_time_ms() const {
+    return last_incoming_time_ms_.load(std::memory_order_relaxed);
+  }
+
  private:
 
   /*
@@ -518,6 +547,12 @@ class NetworkStatus  {
     //map to record the time of low audio energy for every stream
   std::mutex stream_energy_mtx_;
   std::map<uint32_t, long> map_stream_energy_;
+
+  // Written by the ingress thread on every packet, keep it on its own cache
+  // line. Padded rather than alignas, make_shared doesn't honour it.
+  char last_incoming_time_padding0_[CACHE_LINE_SIZE];
+  std::atomic<long long> last_incoming_time_ms_{0};
+  char last_incoming_time_padding_[CACHE_LINE_SIZE];
 };
 
 } /* namespace orbit */
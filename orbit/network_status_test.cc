@@ -179,5 +179,37 @@ TEST_F(NetworkStatusTest, correctStatisticSendFractionLostForAudio) {
   EXPECT_EQ(expected_value_2, send_fraction_lost2);
 }
 
+TEST_F(NetworkStatusTest, managerInitGetDestroy) {
+  // Spread over more than one shard.
+  for (int stream_id = 1; stream_id <= 40; ++stream_id) {
+    NetworkStatusManager::Init(333, stream_id);
+  }
+  std::shared_ptr<NetworkStatus> network_status =
+    NetworkStatusManager::Get(333, 7);
+  ASSERT_TRUE(network_status != nullptr);
+  EXPECT_EQ(7, network_status->stream_id());
+  EXPECT_TRUE(NetworkStatusManager::Get(333, 41) == nullptr);
+
+  network_status->UpdateIncomingTime(12345);
+  EXPECT_EQ(12345, NetworkStatusManager::GetStreamLastTime(333, 7));
+  NetworkStatusManager::UpdateStreamIncommingTime(333, 7);
+  EXPECT_LT(12345, NetworkStatusManager::GetStreamLastTime(333, 7));
+
+  // The streams just created are not timed out.
+  std::vector<NetworkStatusManager::Key> remove_stream;
+  NetworkStatusManager::TraverseStreamMap(&remove_stream);
+  for (const NetworkStatusManager::Key& key : remove_stream) {
+    EXPECT_NE(333, key.session_id());
+  }
+
+  for (int stream_id = 1; stream_id <= 40; ++stream_id) {
+    NetworkStatusManager::Destroy(333, stream_id);
+  }
+  EXPECT_TRUE(NetworkStatusManager::Get(333, 7) == nullptr);
+  EXPECT_EQ(0, NetworkStatusManager::GetStreamLastTime(333, 7));
+  // The handle resolved before is still valid.
+  EXPECT_EQ(7, network_status->stream_id());
+}
+
 }  // anonymous namespace
 }  // namespace orbit
@@ -13,9 +13,11 @@
 //#include "stream_service/third_party/libnice/upstream/nice/nice.h"
 #include <cstdio>
 #include <poll.h>
+#include <string.h>
 
 #include "logger_helper.h"
 #include "nice_connection.h"
+#include "nice_reactor.h"
 #include "sdp_info.h"
 #include "stream_service/orbit/base/strutil.h"
 #include "stream_service/orbit/base/timeutil.h"
@@ -38,8 +40,6 @@
 
 #define REMOTE_CANDIDATE_TIMEOUT 60000
 
-#define NICE_QUEUE_MAX_NUMBER 1000
-
 DEFINE_string(apply_network_interfaces, "eth0,eth1,wlan0",
               "Apply the following interfaces to ICE.");
 DEFINE_bool(enable_keepalive, true,
@@ -90,20 +90,6 @@ namespace orbit {
   }
 
 
-  struct queue_not_empty
-  {
-    std::queue<packetPtr>& queue;
-
-    queue_not_empty(std::queue<packetPtr>& queue_):
-      queue(queue_)
-    {}
-    bool operator()() const
-    {
-      return !queue.empty();
-    }
-  };
-
-
   int timed_poll(GPollFD* fds, guint nfds, gint timeout){
     return poll((pollfd*)fds,nfds,200);
   }
@@ -112,8 +98,8 @@ namespace orbit {
       guint len, gchar* buf, gpointer user_data) {
     if (agent==NULL||user_data==NULL||len==0) return;
     NiceConnection* nicecon = (NiceConnection*) user_data;
-    nicecon->queueData(component_id, reinterpret_cast<char*> (buf), 
-                       static_cast<unsigned int> (len));
+    nicecon->deliverData(component_id, reinterpret_cast<char*> (buf),
+                         static_cast<unsigned int> (len));
   }
 
   void cb_new_candidate(NiceAgent *agent, guint stream_id, guint component_id, 
@@ -150,6 +136,7 @@ namespace orbit {
     NiceConnection *conn = (NiceConnection*) user_data;
     LOG(INFO) << "cb_new_selected_pair:" << component_id
             << " lfoundation" << lfoundation << " rfoundation:" << rfoundation;
+    conn->updateSelectedSocket(component_id);
     CandidatePair pair = conn->getSelectedPair();
     conn->onNewSelectedPair(pair);
   }
@@ -238,8 +225,14 @@ namespace orbit {
     }
     
     g_type_init();
-    context_ = g_main_context_new();
-    g_main_context_set_poll_func(context_,timed_poll);
+    if (NiceReactor::IsEnabled()) {
+      // The agent lives on a shared loop, no thread of its own.
+      context_ = Singleton<NiceReactor>::GetInstance()->AcquireContext(
+          &reactor_loop_);
+    } else {
+      context_ = g_main_context_new();
+      g_main_context_set_poll_func(context_,timed_poll);
+    }
     VLOG(3) << "Creating Agent";
 
     nice_debug_enable( FALSE );
@@ -342,44 +335,19 @@ namespace orbit {
     else{
       running_=false;
     }
-    m_Thread_ = boost::thread(&NiceConnection::init, this);
-
-    // Update the stats
-    drop_queue_packet_ = 0;
+    if (reactor_loop_ >= 0) {
+      if (running_) {
+        nice_agent_gather_candidates(agent_, 1);
+      }
+    } else {
+      m_Thread_ = boost::thread(&NiceConnection::init, this);
+    }
   }
 
   NiceConnection::~NiceConnection() {
     this->close();
   }
   
-  packetPtr NiceConnection::getPacket(){
-      if(this->checkIceState()==NICE_FINISHED || !running_) {
-          packetPtr p (new dataPacket());
-          p->length=-1;
-          return p;
-      }
-      boost::unique_lock<boost::mutex> lock(queueMutex_);
-      boost::system_time const timeout=boost::get_system_time()+ boost::posix_time::milliseconds(300);
-      if(!cond_.timed_wait(lock,timeout, queue_not_empty(niceQueue_))){
-        packetPtr p (new dataPacket());
-        p->length=0;
-        return p;
-      }
-      if(this->checkIceState()==NICE_FINISHED || !running_) {
-          packetPtr p (new dataPacket());
-          p->length=-1;
-          return p;
-      }
-      if(!niceQueue_.empty()){
-        packetPtr p (niceQueue_.front());
-        niceQueue_.pop();
-        return  p;
-      }
-      packetPtr p (new dataPacket());
-      p->length=0;
-      return p;
-  }
-
   void NiceConnection::close() {
     if(this->checkIceState()==NICE_FINISHED){
       return;
@@ -387,46 +355,56 @@ namespace orbit {
     running_ = false;
     VLOG(3) << "Closing nice";
     this->updateIceState(NICE_FINISHED);
-    cond_.notify_one();
-    boost::system_time const timeout = 
-        boost::get_system_time()+ boost::posix_time::milliseconds(500);
-    if (!m_Thread_.timed_join(timeout) ){
-      m_Thread_.interrupt();
+    // The callbacks which start from now on don't reach the listener, those
+    // in flight are waited for below.
+    listener_ = NULL;
+    if (reactor_loop_ >= 0) {
+      // Tear down the agent on its loop, so none of its callbacks is running
+      // or will run after that.
+      NiceReactor* reactor = Singleton<NiceReactor>::GetInstance();
+      reactor->RunInLoop(context_, [this]() {
+          destroyAgent();
+        });
+      reactor->ReleaseContext(reactor_loop_, context_);
+      context_ = NULL;
+      reactor_loop_ = -1;
+    } else {
+      // The thread leaves its loop within a poll (200 ms at most) once
+      // running_ is cleared, and may be in a callback until then.
+      if (m_Thread_.joinable() &&
+          m_Thread_.get_id() != boost::this_thread::get_id()) {
+        m_Thread_.join();
+      }
+      destroyAgent();
+    }
+    if (context_!=NULL) {
+      g_main_context_unref(context_);
+      context_=NULL;
     }
 
+    VLOG(3) << "Nice Closed.";
+  }
+
+  void NiceConnection::destroyAgent() {
     if (agent_!=NULL){
       // disconnect the handlers of this agent
       g_signal_handler_disconnect ( G_OBJECT( agent_ ), gather_done_handler_);
       g_signal_handler_disconnect ( G_OBJECT( agent_ ), state_change_handler_);
       g_signal_handler_disconnect ( G_OBJECT( agent_ ), new_pair_handler_);
       g_signal_handler_disconnect ( G_OBJECT( agent_ ), new_candidate_handler_);
+      for (unsigned int i = 1; i<=iceComponents_; i++) {
+        nice_agent_attach_recv(agent_, 1, i, context_, NULL, NULL);
+      }
+      clearSelectedSockets();
       g_object_unref(agent_);
       agent_ = NULL;
     }
-    if (context_!=NULL) {
-      g_main_context_unref(context_);
-      context_=NULL;
-    }
-
-    listener_ = NULL;
-    VLOG(3) << "Nice Closed.";
   }
 
-  void NiceConnection::queueData(unsigned int component_id, char* buf, int len) {
-
-    if (this->checkIceState() == NICE_READY && running_){
-      boost::mutex::scoped_lock lock(queueMutex_);
-      while (niceQueue_.size() > NICE_QUEUE_MAX_NUMBER) {
-        niceQueue_.pop();
-        boost::unique_lock<boost::mutex> lock(stats_mutex_);
-        drop_queue_packet_++;
-      }
-      packetPtr p_ (new dataPacket());
-      memcpy(p_->data, buf, len);
-      p_->comp = component_id;
-      p_->length = len;
-      niceQueue_.push(p_);
-      cond_.notify_one();
+  void NiceConnection::deliverData(unsigned int component_id, char* buf, int len) {
+    NiceConnectionListener* listener = listener_.load();
+    if (this->checkIceState() == NICE_READY && running_ && listener != NULL) {
+      listener->onNiceData(component_id, buf, len, this);
     }
   }
 
@@ -449,6 +427,61 @@ namespace orbit {
     return val;
   }
 
+  void NiceConnection::updateSelectedSocket(unsigned int compId) {
+    SelectedSocket selected;
+    NiceCandidate* local = NULL;
+    NiceCandidate* remote = NULL;
+    if (nice_agent_get_selected_pair(agent_, 1, compId, &local, &remote) &&
+        local->type != NICE_CANDIDATE_TYPE_RELAYED &&
+        local->transport == NICE_CANDIDATE_TRANSPORT_UDP) {
+      // The socket is only used to send, libnice still receives from it.
+      selected.socket = nice_agent_get_selected_socket(agent_, 1, compId);
+      if (selected.socket != NULL) {
+        selected.fd = g_socket_get_fd(selected.socket);
+        memset(&selected.remote, 0, sizeof(selected.remote));
+        nice_address_copy_to_sockaddr(
+            &remote->addr, reinterpret_cast<struct sockaddr*>(&selected.remote));
+        selected.remote_len = selected.remote.ss_family == AF_INET6 ?
+            sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+      }
+    }
+    VLOG(3) << "updateSelectedSocket compId=" << compId << " fd=" << selected.fd;
+
+    boost::mutex::scoped_lock lock(selectedSocketMutex_);
+    SelectedSocket& old = selected_sockets_[compId];
+    if (old.socket != NULL) {
+      g_object_unref(old.socket);
+    }
+    old = selected;
+  }
+
+  bool NiceConnection::getSelectedSocket(unsigned int compId, int* fd,
+                                         struct sockaddr_storage* remote,
+                                         socklen_t* remote_len) {
+    if (this->checkIceState() != NICE_READY || !running_) {
+      return false;
+    }
+    boost::mutex::scoped_lock lock(selectedSocketMutex_);
+    auto it = selected_sockets_.find(compId);
+    if (it == selected_sockets_.end() || it->second.fd < 0) {
+      return false;
+    }
+    *fd = it->second.fd;
+    memcpy(remote, &it->second.remote, it->second.remote_len);
+    *remote_len = it->second.remote_len;
+    return true;
+  }
+
+  void NiceConnection::clearSelectedSockets() {
+    boost::mutex::scoped_lock lock(selectedSocketMutex_);
+    for (auto& item : selected_sockets_) {
+      if (item.second.socket != NULL) {
+        g_object_unref(item.second.socket);
+      }
+    }
+    selected_sockets_.clear();
+  }
+
   void NiceConnection::init() {
     /* Set thread name */
     prctl(PR_SET_NAME, (unsigned long)"NiceConnectInit");
@@ -622,7 +655,10 @@ namespace orbit {
       cand_info.transProtocol = std::string(*transportName.get());
       cand_info.username = ufrag_;
       cand_info.password = upass_;
-      this->getNiceListener()->onCandidate(cand_info, this);
+      NiceConnectionListener* listener = listener_.load();
+      if (listener != NULL) {
+        listener->onCandidate(cand_info, this);
+      }
     }
     // for nice_agent_get_local_candidates,  the caller owns the returned GSList as well as the candidates contained within it.
     // let's free everything in the list, as well as the list.
@@ -645,15 +681,17 @@ namespace orbit {
   }
 
   void NiceConnection::onNewSelectedPair(CandidatePair pair) {
-    if (this->listener_ != NULL) {
-      this->listener_->onNewSelectedPair(pair, this);
+    NiceConnectionListener* listener = listener_.load();
+    if (listener != NULL) {
+      listener->onNewSelectedPair(pair, this);
     }    
   }
 
   void NiceConnection::updateComponentState(unsigned int compId,
                                             guint component_state) {
     IceState nice_state;
-    if (this->listener_ != NULL && component_state != -1) {
+    NiceConnectionListener* listener = listener_.load();
+    if (listener != NULL && component_state != -1) {
       std::string showStatus = "";
       switch(component_state) {
       case NICE_COMPONENT_STATE_DISCONNECTED :
@@ -685,7 +723,7 @@ namespace orbit {
         showStatus =
           "UNKNOWN(" + std::to_string((unsigned int)component_state) + ")";
       }
-      this->listener_->updateNiceComponentState(showStatus, this);
+      listener->updateNiceComponentState(showStatus, this);
     }
 
     if (nice_state == NICE_FAILED) {
@@ -743,9 +781,10 @@ namespace orbit {
     if(iceState_==state)
       return;
 
+    NiceConnectionListener* listener = listener_.load();
     if (state == NICE_GATHERING_DONE) {
-      if (this->listener_ != NULL) {
-        this->listener_->onCandidateGatheringDone(this);
+      if (listener != NULL) {
+        listener->onCandidateGatheringDone(this);
       }
     } else {
       ELOG_INFO("%s - NICE State Changing from %u to %u %p", transportName->c_str(), this->iceState_, state, this);
@@ -766,8 +805,8 @@ namespace orbit {
       }
       // Important: send this outside our state lock.  Otherwise,
       // serious risk of deadlock.
-      if (this->listener_ != NULL) {
-        this->listener_->updateIceState(state, this);
+      if (listener != NULL) {
+        listener->updateIceState(state, this);
       }
     }
   }
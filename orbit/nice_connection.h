@@ -13,9 +13,11 @@
 #ifndef NICE_CONNECTION_H_
 #define NICE_CONNECTION_H_
 
+#include <sys/socket.h>
+
+#include <map>
 #include <string>
 #include <vector>
-#include <queue>
 #include <atomic>
 #include <boost/scoped_ptr.hpp>
 #include <boost/thread.hpp>
@@ -25,6 +27,7 @@
 
 typedef struct _NiceAgent NiceAgent;
 typedef struct _GMainContext GMainContext;
+typedef struct _GSocket GSocket;
 
 typedef unsigned int uint;
 
@@ -37,7 +40,6 @@ namespace orbit {
 #define NICE_STREAM_DEF_PWD     (22 + 1)   /* pwd + NULL */
 
 //forward declarations
-typedef std::shared_ptr<dataPacket> packetPtr;
 class CandidateInfo;
 class WebRtcConnection;
 
@@ -164,6 +166,15 @@ class NiceConnection {
 	 * @return Bytes sent.
 	 */
 	int sendData(unsigned int compId, const void* buf, int len);
+  /**
+   * Gets the local UDP socket and the remote address of the selected pair,
+   * to send the data directly (e.g. batched with sendmmsg) instead of via
+   * sendData(). The socket stays open until the connection is closed.
+   * @return false if no pair is selected yet, or the pair is relayed or TCP.
+   */
+  bool getSelectedSocket(unsigned int compId, int* fd,
+                         struct sockaddr_storage* remote, socklen_t* remote_len);
+  void updateSelectedSocket(unsigned int compId);
 
 	void updateIceState(IceState state);
   IceState checkIceState();
@@ -171,35 +182,53 @@ class NiceConnection {
                             unsigned int component_state);
   void onNewSelectedPair(CandidatePair pair);
 
-  void queueData(unsigned int component_id, char* buf, int len);
+  /*
+   * Passes a received packet to the listener, on the thread of the agent's
+   * context: a NiceReactor loop, or the thread of the connection.
+   */
+  void deliverData(unsigned int component_id, char* buf, int len);
   
   CandidatePair getSelectedPair();
 
-  packetPtr getPacket();
   void close();
 
 private:
 	void init();
+  // Disconnects the callbacks and releases the agent.
+  void destroyAgent();
 
   void ApplyNetworkInterfaces();
 
 	NiceAgent* agent_;
-	NiceConnectionListener* listener_;
-  std::queue<packetPtr> niceQueue_;
+	// Cleared by close() before it waits for the callbacks in flight, load
+	// it once per callback.
+	std::atomic<NiceConnectionListener*> listener_;
   unsigned int candsDelivered_;
 
 	GMainContext* context_;
+  // The NiceReactor loop of the agent, or -1 if the agent runs its own
+  // context on m_Thread_.
+  int reactor_loop_ = -1;
 	boost::thread m_Thread_;
 	IceState iceState_;
-  boost::mutex queueMutex_;
-	boost::condition_variable cond_;
   unsigned int iceComponents_;
   std::map <unsigned int, IceState> comp_state_list_;
-  bool running_;
+  std::atomic<bool> running_{false};
 	std::string ufrag_, upass_;
 
   std::set<std::string> apply_network_interfaces_;
 
+  // The socket of the selected pair of each component.
+  struct SelectedSocket {
+    GSocket* socket = NULL;  // Holds a reference, so the fd stays open.
+    int fd = -1;
+    struct sockaddr_storage remote;
+    socklen_t remote_len = 0;
+  };
+  boost::mutex selectedSocketMutex_;
+  std::map<unsigned int, SelectedSocket> selected_sockets_;
+  void clearSelectedSockets();
+
   boost::mutex candidatesMutex_;
   std::vector<CandidateInfo> candidates_;
 
@@ -211,10 +240,6 @@ private:
   unsigned long new_pair_handler_{0};
   unsigned long new_candidate_handler_{0};
 
-  // Stats
-  boost::mutex stats_mutex_;
-  int drop_queue_packet_;
-
   long long last_candidate_timestamp_;
 };
 } /* namespace orbit */
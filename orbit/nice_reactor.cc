@@ -0,0 +1,473 @@
+/*
+ * Copyright 2016 All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * nice_reactor.cc
+ * ---------------------------------------------------------------------------
+ * Implements the event loops shared by the NiceConnections.
+ * ---------------------------------------------------------------------------
+ */
+#include "nice_reactor.h"
+
+#include <glib.h>
+
+#include "stream_service/orbit/base/strutil.h"
+#include "stream_service/orbit/base/timeutil.h"
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/prctl.h>
+#include <unistd.h>
+
+#include <set>
+#include <unordered_map>
+#include <utility>
+
+DEFINE_int32(nice_reactor_threads, 0,
+             "The number of the event loops shared by all the ICE "
+             "connections. 0 means one GMainContext and one thread per "
+             "connection, as before.");
+
+// The max time to wait in epoll, the same cap as the timed_poll of the
+// per-connection loops.
+#define NICE_REACTOR_MAX_WAIT 200 // in ms
+// Re-register the fds of a context this often, in case one of its sockets
+// was closed and a new one got the same fd between two queries.
+#define NICE_REACTOR_RESYNC_INTERVAL 1000 // in ms
+// The epoll events taken by one wait at first, doubled when it is full.
+#define NICE_REACTOR_MAX_EVENTS 256
+
+namespace orbit {
+
+namespace {
+
+typedef std::vector<std::pair<int, uint32_t> > EpollFds;
+
+uint32_t PollToEpollEvents(gushort events) {
+  uint32_t result = 0;
+  if (events & G_IO_IN) result |= EPOLLIN;
+  if (events & G_IO_PRI) result |= EPOLLPRI;
+  if (events & G_IO_OUT) result |= EPOLLOUT;
+  return result;
+}
+
+gushort EpollToPollEvents(uint32_t events) {
+  gushort result = 0;
+  if (events & EPOLLIN) result |= G_IO_IN;
+  if (events & EPOLLPRI) result |= G_IO_PRI;
+  if (events & EPOLLOUT) result |= G_IO_OUT;
+  if (events & EPOLLERR) result |= G_IO_ERR;
+  if (events & EPOLLHUP) result |= G_IO_HUP;
+  return result;
+}
+
+// A context has a few fds only, a linear search is the fastest.
+std::pair<int, uint32_t>* FindFd(EpollFds* fds, int fd) {
+  for (auto& item : *fds) {
+    if (item.first == fd) {
+      return &item;
+    }
+  }
+  return NULL;
+}
+
+// A closure run on a loop thread by RunInLoop().
+struct Invocation {
+  std::function<void()> func;
+  boost::mutex mutex;
+  boost::condition_variable cond;
+  bool done = false;
+};
+
+gboolean RunInvocation(gpointer user_data) {
+  Invocation* invocation = static_cast<Invocation*>(user_data);
+  invocation->func();
+  boost::mutex::scoped_lock lock(invocation->mutex);
+  invocation->done = true;
+  invocation->cond.notify_all();
+  return G_SOURCE_REMOVE;
+}
+
+}  // anonymous namespace
+
+// A context driven by a loop, only used on the loop thread. It is always
+// prepared and queried, waiting for check and dispatch.
+struct NiceReactor::Context {
+  GMainContext* context = NULL;
+  gint max_priority = 0;
+  std::vector<GPollFD> fds;  // The fds of the last query.
+  int num_fds = 0;
+  EpollFds ready;            // The epoll events since the last query.
+  EpollFds registered;       // The fds registered in epoll, with the events.
+  long long deadline_ms = -1;  // The timeout of the last query, -1 if none.
+  long long last_resync_ms = 0;
+  bool scheduled = false;    // Dispatched in the current wakeup.
+};
+
+struct NiceReactor::Loop {
+  int index;
+  int epoll_fd = -1;
+  // Wakes up the loop when a context is added or removed.
+  int event_fd = -1;
+  boost::scoped_ptr<boost::thread> thread;
+  std::atomic<int> num_connections{0};
+  boost::scoped_ptr<ExportedVar> connections_var;
+
+  boost::mutex mutex;
+  std::vector<GMainContext*> added;    // Holds a reference for the loop.
+  std::vector<GMainContext*> removed;
+
+  // Only used on the loop thread.
+  std::unordered_map<GMainContext*, Context*> contexts;
+  std::unordered_map<int, Context*> owners;  // fd -> context in epoll.
+  std::set<std::pair<long long, Context*> > timers;
+  EpollFds wanted;  // Reused by SyncEpoll.
+
+  void Signal();
+  // Takes the contexts added and removed by the other threads.
+  void UpdateContexts();
+  // Runs prepare and query on the context, registers its fds and timeout.
+  void Prepare(Context* ctx);
+  // Runs check and dispatch on the context, then prepares it again.
+  void Dispatch(Context* ctx);
+  // Makes the epoll set match the fds of the last query of the context.
+  void SyncEpoll(Context* ctx, long long now);
+  void SetDeadline(Context* ctx, long long deadline_ms);
+  void RemoveContext(Context* ctx);
+};
+
+void NiceReactor::Loop::Signal() {
+  uint64_t one = 1;
+  if (write(event_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+    LOG(ERROR) << "write(eventfd) failed, errno=" << errno;
+  }
+}
+
+void NiceReactor::Loop::UpdateContexts() {
+  uint64_t value;
+  if (read(event_fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+    LOG(ERROR) << "read(eventfd) failed, errno=" << errno;
+  }
+  std::vector<GMainContext*> to_add;
+  std::vector<GMainContext*> to_remove;
+  {
+    boost::mutex::scoped_lock lock(mutex);
+    to_add.swap(added);
+    to_remove.swap(removed);
+  }
+  for (GMainContext* context : to_add) {
+    if (!g_main_context_acquire(context)) {
+      LOG(ERROR) << "NiceReactor loop " << index
+                 << " failed to acquire a context.";
+      g_main_context_unref(context);
+      continue;
+    }
+    Context* ctx = new Context();
+    ctx->context = context;
+    ctx->fds.resize(8);
+    contexts[context] = ctx;
+    Prepare(ctx);
+  }
+  for (GMainContext* context : to_remove) {
+    auto it = contexts.find(context);
+    if (it == contexts.end()) {
+      continue;
+    }
+    RemoveContext(it->second);
+    contexts.erase(it);
+  }
+}
+
+void NiceReactor::Loop::Prepare(Context* ctx) {
+  gint timeout = -1;
+  g_main_context_prepare(ctx->context, &ctx->max_priority);
+  int n;
+  while ((n = g_main_context_query(ctx->context, ctx->max_priority, &timeout,
+                                   ctx->fds.data(), ctx->fds.size())) >
+         (int)ctx->fds.size()) {
+    ctx->fds.resize(n);
+  }
+  ctx->num_fds = n;
+  long long now = GetCurrentTime_MS();
+  SyncEpoll(ctx, now);
+  SetDeadline(ctx, timeout < 0 ? -1 : now + timeout);
+}
+
+void NiceReactor::Loop::Dispatch(Context* ctx) {
+  for (int i = 0; i < ctx->num_fds; ++i) {
+    GPollFD* fd = &ctx->fds[i];
+    fd->revents = 0;
+    std::pair<int, uint32_t>* ready = FindFd(&ctx->ready, fd->fd);
+    if (ready != NULL) {
+      fd->revents = EpollToPollEvents(ready->second) &
+                    (fd->events | G_IO_ERR | G_IO_HUP | G_IO_NVAL);
+    }
+  }
+  ctx->ready.clear();
+  if (g_main_context_check(ctx->context, ctx->max_priority, ctx->fds.data(),
+                           ctx->num_fds)) {
+    g_main_context_dispatch(ctx->context);
+  }
+  Prepare(ctx);
+}
+
+void NiceReactor::Loop::SyncEpoll(Context* ctx, long long now) {
+  wanted.clear();
+  for (int i = 0; i < ctx->num_fds; ++i) {
+    uint32_t events = PollToEpollEvents(ctx->fds[i].events);
+    std::pair<int, uint32_t>* item = FindFd(&wanted, ctx->fds[i].fd);
+    if (item != NULL) {
+      item->second |= events;
+    } else {
+      wanted.push_back(std::make_pair(ctx->fds[i].fd, events));
+    }
+  }
+  bool resync = (now - ctx->last_resync_ms >= NICE_REACTOR_RESYNC_INTERVAL);
+  if (resync) {
+    ctx->last_resync_ms = now;
+  }
+
+  for (const auto& item : ctx->registered) {
+    if (FindFd(&wanted, item.first) != NULL) {
+      continue;
+    }
+    // The fd may be another context's now, if it was closed and reused.
+    auto owner = owners.find(item.first);
+    if (owner != owners.end() && owner->second == ctx) {
+      // Fails if the fd is already closed, which removed it anyway.
+      epoll_ctl(epoll_fd, EPOLL_CTL_DEL, item.first, NULL);
+      owners.erase(owner);
+    }
+  }
+  for (const auto& item : wanted) {
+    std::pair<int, uint32_t>* old = FindFd(&ctx->registered, item.first);
+    auto owner = owners.find(item.first);
+    if (!resync && old != NULL && old->second == item.second &&
+        owner != owners.end() && owner->second == ctx) {
+      continue;
+    }
+    struct epoll_event event;
+    event.events = item.second;
+    event.data.fd = item.first;
+    // MOD even if the events are the same: the fd may be a new socket.
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, item.first, &event) < 0 &&
+        errno == ENOENT &&
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, item.first, &event) < 0) {
+      LOG(ERROR) << "epoll_ctl(ADD) failed, fd=" << item.first
+                 << " errno=" << errno;
+      continue;
+    }
+    owners[item.first] = ctx;
+  }
+  ctx->registered.swap(wanted);
+}
+
+void NiceReactor::Loop::SetDeadline(Context* ctx, long long deadline_ms) {
+  if (ctx->deadline_ms == deadline_ms) {
+    return;
+  }
+  if (ctx->deadline_ms >= 0) {
+    timers.erase(std::make_pair(ctx->deadline_ms, ctx));
+  }
+  ctx->deadline_ms = deadline_ms;
+  if (deadline_ms >= 0) {
+    timers.insert(std::make_pair(deadline_ms, ctx));
+  }
+}
+
+void NiceReactor::Loop::RemoveContext(Context* ctx) {
+  for (const auto& item : ctx->registered) {
+    auto owner = owners.find(item.first);
+    if (owner != owners.end() && owner->second == ctx) {
+      epoll_ctl(epoll_fd, EPOLL_CTL_DEL, item.first, NULL);
+      owners.erase(owner);
+    }
+  }
+  SetDeadline(ctx, -1);
+  g_main_context_release(ctx->context);
+  g_main_context_unref(ctx->context);
+  delete ctx;
+}
+
+bool NiceReactor::IsEnabled() {
+  return FLAGS_nice_reactor_threads > 0;
+}
+
+NiceReactor::NiceReactor() {
+  int num_loops = FLAGS_nice_reactor_threads;
+  if (num_loops <= 0) {
+    num_loops = 1;
+  }
+  LOG(INFO) << "NiceReactor starts with " << num_loops << " loops.";
+
+  running_ = true;
+  for (int i = 0; i < num_loops; ++i) {
+    Loop* loop = new Loop();
+    loop->index = i;
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    CHECK(loop->epoll_fd >= 0) << "epoll_create1 failed, errno=" << errno;
+    loop->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    CHECK(loop->event_fd >= 0) << "eventfd failed, errno=" << errno;
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = loop->event_fd;
+    CHECK(epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->event_fd, &event) == 0)
+        << "epoll_ctl(ADD) failed, errno=" << errno;
+    loop->connections_var.reset(
+        new ExportedVar(StringPrintf("nice_reactor_%d_connections", i), 0));
+    loops_.push_back(loop);
+  }
+  for (Loop* loop : loops_) {
+    loop->thread.reset(
+        new boost::thread(boost::bind(&NiceReactor::LoopMain, this, loop)));
+  }
+}
+
+NiceReactor::~NiceReactor() {
+  running_ = false;
+  for (Loop* loop : loops_) {
+    loop->Signal();
+  }
+  for (Loop* loop : loops_) {
+    if (loop->thread != NULL) {
+      loop->thread->join();
+    }
+    for (GMainContext* context : loop->added) {
+      g_main_context_unref(context);
+    }
+    close(loop->event_fd);
+    close(loop->epoll_fd);
+    delete loop;
+  }
+  loops_.clear();
+}
+
+GMainContext* NiceReactor::AcquireContext(int* index) {
+  Loop* home = loops_[0];
+  for (Loop* loop : loops_) {
+    if (loop->num_connections < home->num_connections) {
+      home = loop;
+    }
+  }
+  home->connections_var->Set(++home->num_connections);
+  *index = home->index;
+  GMainContext* context = g_main_context_new();
+  {
+    boost::mutex::scoped_lock lock(home->mutex);
+    home->added.push_back(g_main_context_ref(context));
+  }
+  home->Signal();
+  return context;
+}
+
+void NiceReactor::ReleaseContext(int index, GMainContext* context) {
+  Loop* loop = loops_[index];
+  loop->connections_var->Set(--loop->num_connections);
+  {
+    // The loop drops its own reference.
+    boost::mutex::scoped_lock lock(loop->mutex);
+    loop->removed.push_back(context);
+  }
+  loop->Signal();
+  g_main_context_unref(context);
+}
+
+void NiceReactor::RunInLoop(GMainContext* context,
+                            const std::function<void()>& func) {
+  if (g_main_context_is_owner(context) || !running_) {
+    func();
+    return;
+  }
+  Invocation invocation;
+  invocation.func = func;
+  GSource* source = g_idle_source_new();
+  g_source_set_priority(source, G_PRIORITY_HIGH);
+  g_source_set_callback(source, RunInvocation, &invocation, NULL);
+  // Wakes up the context.
+  g_source_attach(source, context);
+  g_source_unref(source);
+  boost::mutex::scoped_lock lock(invocation.mutex);
+  while (!invocation.done) {
+    invocation.cond.wait(lock);
+  }
+}
+
+void NiceReactor::LoopMain(Loop* loop) {
+  /* Set thread name */
+  prctl(PR_SET_NAME, (unsigned long)"NiceReactor");
+
+  std::vector<struct epoll_event> events(NICE_REACTOR_MAX_EVENTS);
+  std::vector<Context*> runnable;
+
+  while (running_) {
+    long long now = GetCurrentTime_MS();
+    int timeout = NICE_REACTOR_MAX_WAIT;
+    if (!loop->timers.empty()) {
+      long long wait = loop->timers.begin()->first - now;
+      if (wait < timeout) {
+        timeout = wait < 0 ? 0 : wait;
+      }
+    }
+    int count = epoll_wait(loop->epoll_fd, events.data(), events.size(),
+                           timeout);
+    if (count < 0) {
+      if (errno != EINTR) {
+        LOG(ERROR) << "epoll_wait failed, errno=" << errno;
+      }
+      count = 0;
+    }
+
+    // Only the contexts with a ready fd or an expired timeout are run.
+    bool update = false;
+    runnable.clear();
+    for (int i = 0; i < count; ++i) {
+      int fd = events[i].data.fd;
+      if (fd == loop->event_fd) {
+        update = true;
+        continue;
+      }
+      auto owner = loop->owners.find(fd);
+      if (owner == loop->owners.end()) {
+        continue;
+      }
+      Context* ctx = owner->second;
+      uint32_t ready_events = events[i].events;  // epoll_event is packed.
+      ctx->ready.push_back(std::make_pair(fd, ready_events));
+      if (!ctx->scheduled) {
+        ctx->scheduled = true;
+        runnable.push_back(ctx);
+      }
+    }
+    if (count == (int)events.size()) {
+      events.resize(events.size() * 2);
+    }
+    now = GetCurrentTime_MS();
+    for (auto it = loop->timers.begin();
+         it != loop->timers.end() && it->first <= now; ++it) {
+      Context* ctx = it->second;
+      if (!ctx->scheduled) {
+        ctx->scheduled = true;
+        runnable.push_back(ctx);
+      }
+    }
+    for (Context* ctx : runnable) {
+      ctx->scheduled = false;
+      loop->Dispatch(ctx);
+    }
+    if (update) {
+      loop->UpdateContexts();
+    }
+  }
+
+  for (auto& item : loop->contexts) {
+    loop->RemoveContext(item.second);
+  }
+  loop->contexts.clear();
+}
+
+}  // namespace orbit
@@ -0,0 +1,76 @@
+/*
+ * Copyright 2016 All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * nice_reactor.h
+ * ---------------------------------------------------------------------------
+ * Defines a process-wide pool of event loops shared by the NiceConnections,
+ * instead of one thread per connection.
+ * ---------------------------------------------------------------------------
+ * Each connection still has its own GMainContext, but the contexts are
+ * driven by the loop threads with epoll: a loop keeps the fds of each of
+ * its contexts registered in one epoll set, and the next timeout of each
+ * context in a timer set. A wakeup only runs check and dispatch on the
+ * contexts with a ready fd or an expired timeout, then prepare and query
+ * on them again, and updates the epoll set with the fds these contexts
+ * added or removed. So a wakeup costs the fds of the woken contexts, not
+ * the fds of all the connections on the loop.
+ *
+ * A source attached from another thread wakes up its context with the
+ * wakeup fd of the context, which is registered like the other fds.
+ *
+ * The callbacks of an agent are all run on its loop thread, so tearing down
+ * an agent with RunInLoop() never races with its callbacks.
+ *
+ * Enabled with --nice_reactor_threads > 0. The connections per loop are
+ * exported on /varz as nice_reactor_<N>_connections.
+ */
+
+#pragma once
+
+#include <boost/thread.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include <atomic>
+#include <functional>
+#include <vector>
+
+#include "stream_service/orbit/base/singleton.h"
+#include "stream_service/orbit/http_server/exported_var.h"
+
+typedef struct _GMainContext GMainContext;
+
+namespace orbit {
+
+class NiceReactor {
+ public:
+  // Whether the NiceConnections should use the reactor.
+  static bool IsEnabled();
+
+  // Creates a context on the loop with the fewest connections. Returns it
+  // (the reference is the caller's) and sets the index of the loop in *loop.
+  GMainContext* AcquireContext(int* loop);
+  // Takes the context off its loop and drops the caller's reference.
+  void ReleaseContext(int loop, GMainContext* context);
+
+  // Runs func in a dispatch of the context, on its loop thread, and waits
+  // for it. Runs it right away if called on the loop thread itself.
+  void RunInLoop(GMainContext* context, const std::function<void()>& func);
+
+  int num_loops() const {
+    return loops_.size();
+  }
+
+ private:
+  struct Context;
+  struct Loop;
+
+  void LoopMain(Loop* loop);
+
+  std::vector<Loop*> loops_;
+  std::atomic<bool> running_{false};
+
+  DEFINE_AS_SINGLETON_WITHOUT_CONSTRUCTOR(NiceReactor);
+};
+
+}  // namespace orbit
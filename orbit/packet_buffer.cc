@@ -0,0 +1,223 @@
+/*
+ * Copyright 2016 All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * packet_buffer.cc
+ * ---------------------------------------------------------------------------
+ * Implements the pooled PacketBuffer.
+ * ---------------------------------------------------------------------------
+ */
+
+#include "packet_buffer.h"
+
+#include <string.h>
+
+#include "glog/logging.h"
+
+// The number of buffers allocated at once when the pool is empty.
+#define PACKET_BUFFER_SLAB_SIZE 256
+// The max number of free buffers cached by one thread. When exceeded, half
+// of them are given back to the global free list.
+#define PACKET_BUFFER_THREAD_CACHE_SIZE 128
+// The number of buffers moved from the global free list to a thread cache.
+#define PACKET_BUFFER_REFILL_SIZE 32
+
+namespace orbit {
+
+//-------------------------------------------------------------------------
+// PacketBuffer
+//-------------------------------------------------------------------------
+const int PacketBuffer::kMaxPacketSize;
+const int PacketBuffer::kHeadroom;
+const int PacketBuffer::kTailroom;
+const int PacketBuffer::kCapacity;
+
+PacketBufferPtr PacketBuffer::Create() {
+  return PacketBufferPtr(PacketBufferPool::GetInstance()->Allocate());
+}
+
+PacketBufferPtr PacketBuffer::Create(const char* data, int len) {
+  if (len < 0 || len > kMaxPacketSize) {
+    LOG(ERROR) << "PacketBuffer::Create packet is too large, len=" << len;
+    return PacketBufferPtr();
+  }
+  PacketBufferPtr buffer = Create();
+  memcpy(buffer->data(), data, len);
+  buffer->length_ = len;
+  return buffer;
+}
+
+PacketBufferPtr PacketBuffer::Create(const dataPacket& packet) {
+  PacketBufferPtr buffer = Create(packet.data, packet.length);
+  if (buffer != NULL) {
+    buffer->comp = packet.comp;
+    buffer->type = packet.type;
+    buffer->remote_ntp_time_ms = packet.remote_ntp_time_ms;
+    buffer->arrival_time_ms = packet.arrival_time_ms;
+    buffer->rtp_timestamp = packet.rtp_timestamp;
+    buffer->simulcast_layer = packet.simulcast_layer;
+  }
+  return buffer;
+}
+
+PacketBufferPtr PacketBuffer::Clone() const {
+  PacketBufferPtr buffer = Create();
+  buffer->offset_ = offset_;
+  buffer->length_ = length_;
+  memcpy(buffer->data(), data(), length_);
+  buffer->comp = comp;
+  buffer->type = type;
+  buffer->remote_ntp_time_ms = remote_ntp_time_ms;
+  buffer->arrival_time_ms = arrival_time_ms;
+  buffer->rtp_timestamp = rtp_timestamp;
+  buffer->simulcast_layer = simulcast_layer;
+  buffer->trace = trace;
+  return buffer;
+}
+
+void PacketBuffer::CopyTo(dataPacket* packet) const {
+  int len = length_;
+  if (len > (int)sizeof(packet->data)) {
+    len = sizeof(packet->data);
+  }
+  memcpy(packet->data, data(), len);
+  packet->length = len;
+  packet->comp = comp;
+  packet->type = type;
+  packet->remote_ntp_time_ms = remote_ntp_time_ms;
+  packet->arrival_time_ms = arrival_time_ms;
+  packet->rtp_timestamp = rtp_timestamp;
+  packet->simulcast_layer = simulcast_layer;
+}
+
+char* PacketBuffer::Prepend(int size) {
+  if (size < 0 || size > offset_) {
+    return NULL;
+  }
+  offset_ -= size;
+  length_ += size;
+  return data();
+}
+
+bool PacketBuffer::TrimFront(int size) {
+  if (size < 0 || size > length_) {
+    return false;
+  }
+  offset_ += size;
+  length_ -= size;
+  return true;
+}
+
+void PacketBuffer::Reset() {
+  offset_ = kHeadroom;
+  length_ = 0;
+  comp = 0;
+  type = OTHER_PACKET;
+  remote_ntp_time_ms = -1;
+  arrival_time_ms = -1;
+  rtp_timestamp = -1;
+  simulcast_layer = 0;
+  trace = PacketTraceContext();
+}
+
+void intrusive_ptr_release(PacketBuffer* buffer) {
+  if (buffer->ref_count_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    PacketBufferPool::GetInstance()->Release(buffer);
+  }
+}
+
+//-------------------------------------------------------------------------
+// PacketBufferPool
+//-------------------------------------------------------------------------
+struct PacketBufferPool::ThreadCache {
+  PacketBuffer* head = NULL;
+  int count = 0;
+  ~ThreadCache() {
+    // Give the cached buffers back when the thread exits.
+    PacketBufferPool::GetInstance()->Flush(this, 0);
+  }
+};
+
+PacketBufferPool* PacketBufferPool::GetInstance() {
+  // Never deleted: the buffers may be released by other static destructors
+  // or by the thread caches at exit.
+  static PacketBufferPool* pool = new PacketBufferPool();
+  return pool;
+}
+
+PacketBufferPool::ThreadCache* PacketBufferPool::GetThreadCache() {
+  static thread_local ThreadCache cache;
+  return &cache;
+}
+
+PacketBuffer* PacketBufferPool::Allocate() {
+  ThreadCache* cache = GetThreadCache();
+  if (cache->head == NULL) {
+    Refill(cache);
+  }
+  PacketBuffer* buffer = cache->head;
+  cache->head = buffer->next_free_;
+  cache->count--;
+  buffer->next_free_ = NULL;
+  buffer->Reset();
+  return buffer;
+}
+
+void PacketBufferPool::Release(PacketBuffer* buffer) {
+  ThreadCache* cache = GetThreadCache();
+  buffer->next_free_ = cache->head;
+  cache->head = buffer;
+  cache->count++;
+  if (cache->count > PACKET_BUFFER_THREAD_CACHE_SIZE) {
+    // The buffers are often allocated on one thread (ingress) and released
+    // on another one (egress), don't let them pile up in one cache.
+    Flush(cache, PACKET_BUFFER_THREAD_CACHE_SIZE / 2);
+  }
+}
+
+void PacketBufferPool::Refill(ThreadCache* cache) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (free_list_ == NULL) {
+    AllocateSlab();
+  }
+  for (int i = 0; i < PACKET_BUFFER_REFILL_SIZE && free_list_ != NULL; ++i) {
+    PacketBuffer* buffer = free_list_;
+    free_list_ = buffer->next_free_;
+    free_count_--;
+    buffer->next_free_ = cache->head;
+    cache->head = buffer;
+    cache->count++;
+  }
+}
+
+void PacketBufferPool::Flush(ThreadCache* cache, int keep) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  while (cache->count > keep) {
+    PacketBuffer* buffer = cache->head;
+    cache->head = buffer->next_free_;
+    cache->count--;
+    buffer->next_free_ = free_list_;
+    free_list_ = buffer;
+    free_count_++;
+  }
+}
+
+void PacketBufferPool::AllocateSlab() {
+  // Called with mutex_ held.
+  PacketBuffer* slab = new PacketBuffer[PACKET_BUFFER_SLAB_SIZE];
+  for (int i = 0; i < PACKET_BUFFER_SLAB_SIZE; ++i) {
+    slab[i].next_free_ = free_list_;
+    free_list_ = &slab[i];
+  }
+  free_count_ += PACKET_BUFFER_SLAB_SIZE;
+  allocated_buffers_ += PACKET_BUFFER_SLAB_SIZE;
+  VLOG(2) << "PacketBufferPool allocated a new slab, total buffers="
+          << allocated_buffers_;
+}
+
+int64_t PacketBufferPool::free_buffers() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return free_count_;
+}
+
+}  // namespace orbit
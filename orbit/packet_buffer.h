@@ -0,0 +1,186 @@
+/*
+ * Copyright 2016 All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * packet_buffer.h
+ * ---------------------------------------------------------------------------
+ * Defines a pooled, reference counted buffer to hold a RTP/RTCP packet.
+ * ---------------------------------------------------------------------------
+ * A PacketBuffer is allocated from a slab backed pool, and is shared (not
+ * copied) by holding a PacketBufferPtr (boost::intrusive_ptr). The buffer is
+ * returned to the pool when the last reference is gone.
+ *
+ * The packet data is placed after some headroom, so the RTP header can be
+ * extended in place (e.g. adding a RTX/RED header), and followed by some
+ * tailroom, so the SRTP auth tag can be appended in place.
+ *
+ *   |<- headroom ->|<------- length ------->|<- tailroom ->|
+ *   +--------------+------------------------+--------------+
+ *   |              | RTP header | payload   |  (SRTP tag)  |
+ *   +--------------+------------------------+--------------+
+ *                  ^ data()
+ *
+ * Example usage:
+ *   PacketBufferPtr buffer = PacketBuffer::Create(buf, len);
+ *   if (buffer == NULL) { ... packet too large ... }
+ *   RtpHeader* h = reinterpret_cast<RtpHeader*>(buffer->data());
+ *   h->setSSRC(ssrc);
+ *   transport->write(buffer->data(), buffer->length());
+ *
+ * The buffer is NOT copy-on-write: before modifying a buffer which may be
+ * shared with others (ref_count() > 1), Clone() it.
+ */
+
+#ifndef PACKET_BUFFER_H_
+#define PACKET_BUFFER_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <boost/intrusive_ptr.hpp>
+
+#include "media_definitions.h"
+#include "packet_trace.h"
+
+namespace orbit {
+
+class PacketBuffer;
+class PacketBufferPool;
+typedef boost::intrusive_ptr<PacketBuffer> PacketBufferPtr;
+
+class PacketBuffer {
+ public:
+  // The max size of a packet, the same as dataPacket::data.
+  static const int kMaxPacketSize = 1500;
+  // The room before the packet to grow the header in place.
+  static const int kHeadroom = 64;
+  // The room after the packet for the SRTP auth tag (and MKI).
+  static const int kTailroom = 64;
+  static const int kCapacity = kHeadroom + kMaxPacketSize + kTailroom;
+
+  // Allocates an empty buffer from the pool.
+  static PacketBufferPtr Create();
+  // Allocates a buffer from the pool and copies data into it.
+  // Returns NULL if len is larger than kMaxPacketSize.
+  static PacketBufferPtr Create(const char* data, int len);
+  // Allocates a buffer from the pool and copies the dataPacket into it.
+  static PacketBufferPtr Create(const dataPacket& packet);
+
+  // Returns a private copy of this buffer.
+  PacketBufferPtr Clone() const;
+  // Copies this buffer into a dataPacket, for the plugins which still
+  // consume dataPacket.
+  void CopyTo(dataPacket* packet) const;
+
+  char* data() {
+    return storage_ + offset_;
+  }
+  const char* data() const {
+    return storage_ + offset_;
+  }
+  int length() const {
+    return length_;
+  }
+  // Sets the length of the data, returns false if it doesn't fit.
+  bool set_length(int length) {
+    if (length < 0 || offset_ + length > kCapacity) {
+      return false;
+    }
+    length_ = length;
+    return true;
+  }
+  int headroom() const {
+    return offset_;
+  }
+  int tailroom() const {
+    return kCapacity - offset_ - length_;
+  }
+  // Grows the data in front by size bytes, returns the new data() or NULL
+  // if there is not enough headroom.
+  char* Prepend(int size);
+  // Removes size bytes from the front of the data.
+  bool TrimFront(int size);
+
+  int ref_count() const {
+    return ref_count_.load(std::memory_order_relaxed);
+  }
+  // True if the caller holds the only reference, then the buffer can be
+  // modified without a Clone().
+  bool unique() const {
+    return ref_count_.load(std::memory_order_acquire) == 1;
+  }
+
+  // Metadata of the packet, same as those in dataPacket.
+  int comp = 0;
+  packetType type = OTHER_PACKET;
+  int64_t remote_ntp_time_ms = -1;
+  int arrival_time_ms = -1;
+  uint32_t rtp_timestamp = -1;
+  int simulcast_layer = 0;
+  // The sampled trace of the packet, see packet_trace.h.
+  PacketTraceContext trace;
+
+ private:
+  PacketBuffer() {}
+  ~PacketBuffer() {}
+  PacketBuffer(const PacketBuffer&) = delete;
+  PacketBuffer& operator=(const PacketBuffer&) = delete;
+
+  // Resets the buffer before handing it out from the pool.
+  void Reset();
+
+  friend void intrusive_ptr_add_ref(PacketBuffer* buffer);
+  friend void intrusive_ptr_release(PacketBuffer* buffer);
+  friend class PacketBufferPool;
+
+  std::atomic<int> ref_count_{0};
+  int offset_ = kHeadroom;
+  int length_ = 0;
+  PacketBuffer* next_free_ = NULL;  // Used by the pool's free lists.
+  char storage_[kCapacity];
+};
+
+inline void intrusive_ptr_add_ref(PacketBuffer* buffer) {
+  buffer->ref_count_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void intrusive_ptr_release(PacketBuffer* buffer);
+
+// The process-wide pool of PacketBuffers. The buffers are allocated in slabs
+// and never given back to the system. Each thread keeps a small cache of free
+// buffers, so Allocate()/Release() normally don't take any lock.
+class PacketBufferPool {
+ public:
+  static PacketBufferPool* GetInstance();
+
+  PacketBuffer* Allocate();
+  void Release(PacketBuffer* buffer);
+
+  // Stats
+  int64_t allocated_buffers() const {
+    return allocated_buffers_;
+  }
+  int64_t free_buffers() const;
+
+ private:
+  PacketBufferPool() {}
+  ~PacketBufferPool() {}
+
+  struct ThreadCache;
+  static ThreadCache* GetThreadCache();
+  // Moves some buffers between the thread cache and the global free list.
+  void Refill(ThreadCache* cache);
+  void Flush(ThreadCache* cache, int keep);
+  void AllocateSlab();
+
+  mutable std::mutex mutex_;       // protects the fields below.
+  PacketBuffer* free_list_ = NULL;
+  int64_t free_count_ = 0;
+  std::atomic<int64_t> allocated_buffers_{0};
+
+  friend struct ThreadCache;
+};
+
+}  // namespace orbit
+
+#endif  // PACKET_BUFFER_H_
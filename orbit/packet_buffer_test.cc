@@ -0,0 +1,109 @@
+/*
+ * Copyright 2016 All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * packet_buffer_test.cc
+ */
+
+#include "packet_buffer.h"
+
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace orbit {
+namespace {
+
+TEST(PacketBufferTest, CreateAndCopy) {
+  const char kData[] = "0123456789";
+  PacketBufferPtr buffer = PacketBuffer::Create(kData, 10);
+  ASSERT_TRUE(buffer != NULL);
+  EXPECT_EQ(10, buffer->length());
+  EXPECT_EQ(0, memcmp(kData, buffer->data(), 10));
+  EXPECT_EQ(PacketBuffer::kHeadroom, buffer->headroom());
+  EXPECT_EQ(PacketBuffer::kCapacity - PacketBuffer::kHeadroom - 10,
+            buffer->tailroom());
+  EXPECT_EQ(1, buffer->ref_count());
+
+  // Too large.
+  std::vector<char> large(PacketBuffer::kMaxPacketSize + 1);
+  EXPECT_TRUE(PacketBuffer::Create(&large[0], large.size()) == NULL);
+}
+
+TEST(PacketBufferTest, SharedNotCopied) {
+  PacketBufferPtr buffer = PacketBuffer::Create("abcd", 4);
+  PacketBufferPtr shared = buffer;
+  EXPECT_EQ(2, buffer->ref_count());
+  EXPECT_EQ(buffer->data(), shared->data());
+
+  EXPECT_FALSE(buffer->unique());
+
+  PacketBufferPtr cloned = buffer->Clone();
+  EXPECT_EQ(1, cloned->ref_count());
+  EXPECT_TRUE(cloned->unique());
+  EXPECT_NE(buffer->data(), cloned->data());
+  EXPECT_EQ(0, memcmp(buffer->data(), cloned->data(), 4));
+}
+
+TEST(PacketBufferTest, PrependAndTrim) {
+  PacketBufferPtr buffer = PacketBuffer::Create("payload", 7);
+  char* header = buffer->Prepend(2);
+  ASSERT_TRUE(header != NULL);
+  header[0] = 'h';
+  header[1] = 'h';
+  EXPECT_EQ(9, buffer->length());
+  EXPECT_EQ(0, memcmp("hhpayload", buffer->data(), 9));
+  EXPECT_TRUE(buffer->TrimFront(2));
+  EXPECT_EQ(0, memcmp("payload", buffer->data(), 7));
+  EXPECT_TRUE(buffer->Prepend(PacketBuffer::kHeadroom + 1) == NULL);
+}
+
+TEST(PacketBufferTest, DataPacketShim) {
+  dataPacket packet;
+  packet.comp = 1;
+  packet.type = AUDIO_PACKET;
+  packet.length = 5;
+  memcpy(packet.data, "hello", 5);
+  PacketBufferPtr buffer = PacketBuffer::Create(packet);
+  EXPECT_EQ(AUDIO_PACKET, buffer->type);
+
+  dataPacket copied;
+  buffer->CopyTo(&copied);
+  EXPECT_EQ(5, copied.length);
+  EXPECT_EQ(1, copied.comp);
+  EXPECT_EQ(0, memcmp("hello", copied.data, 5));
+}
+
+TEST(PacketBufferTest, BuffersAreRecycled) {
+  PacketBufferPool* pool = PacketBufferPool::GetInstance();
+  for (int i = 0; i < 10000; ++i) {
+    PacketBufferPtr buffer = PacketBuffer::Create("x", 1);
+  }
+  int64_t allocated = pool->allocated_buffers();
+  for (int i = 0; i < 10000; ++i) {
+    PacketBufferPtr buffer = PacketBuffer::Create("x", 1);
+  }
+  EXPECT_EQ(allocated, pool->allocated_buffers());
+}
+
+TEST(PacketBufferTest, ReleasedOnAnotherThread) {
+  const int kPackets = 20000;
+  std::vector<PacketBufferPtr> buffers;
+  for (int i = 0; i < kPackets; ++i) {
+    buffers.push_back(PacketBuffer::Create("x", 1));
+  }
+  std::thread releaser([&buffers]() {
+    buffers.clear();
+  });
+  releaser.join();
+  PacketBufferPool* pool = PacketBufferPool::GetInstance();
+  // All the buffers are free again, either in the global free list or in
+  // the cache of this thread.
+  EXPECT_GE(pool->allocated_buffers(), kPackets);
+  EXPECT_GE(pool->free_buffers(), kPackets - 128);
+}
+
+}  // namespace
+}  // namespace orbit
@@ -0,0 +1,258 @@
+/*
+ * Copyright 2016 All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * packet_trace.cc
+ * ---------------------------------------------------------------------------
+ * Implements the sampled per-stage latency tracing of the media packets.
+ * ---------------------------------------------------------------------------
+ */
+
+#include "packet_trace.h"
+
+#include "stream_service/orbit/base/strutil.h"
+#include "stream_service/orbit/base/timeutil.h"
+#include "stream_service/orbit/http_server/latency_histogram.h"
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <set>
+
+// The events kept per thread for /tracez.
+#define PACKET_TRACE_RING_SIZE 1024
+
+DEFINE_int32(packet_trace_sample, 0, "Traces one of every N received "
+             "packets through the pipeline stages, see /tracez and the "
+             "trace_* histograms in /histogramz. 0 disables the tracing, it "
+             "can be changed at runtime by /tracez?sample=N.");
+
+namespace orbit {
+
+namespace {
+
+const char* const kStageNames[TRACE_STAGE_COUNT] = {
+  "nice_queue",
+  "srtp_unprotect",
+  "delegate",
+  "plugin_queue",
+  "plugin",
+  "sender_queue",
+  "srtp_protect",
+  "socket_write",
+  "total",
+};
+
+int GetThreadId() {
+  thread_local int tid = syscall(SYS_gettid);
+  return tid;
+}
+
+}  // annoymous namespace
+
+// The events recorded by one thread. The lock is only contended by the
+// dump, the sampled packets are too few to make it matter.
+class PacketTracer::Ring {
+ public:
+  Ring() : events_(PACKET_TRACE_RING_SIZE) {
+  }
+
+  void Add(const PacketTraceEvent& event) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    events_[next_ % events_.size()] = event;
+    next_++;
+  }
+
+  void CopyTo(std::vector<PacketTraceEvent>* events) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    size_t count = std::min<size_t>(next_, events_.size());
+    for (size_t i = next_ - count; i != next_; ++i) {
+      events->push_back(events_[i % events_.size()]);
+    }
+  }
+
+ private:
+  std::mutex mutex_;
+  std::vector<PacketTraceEvent> events_;
+  size_t next_ = 0;
+};
+
+struct PacketTracer::RoomHistograms {
+  std::unique_ptr<LatencyHistogram> stages[TRACE_STAGE_COUNT];
+};
+
+// Gives the ring of a thread back when the thread exits.
+class RingHolder {
+ public:
+  ~RingHolder() {
+    if (ring != NULL) {
+      PacketTracer::GetInstance()->RemoveRing(ring);
+    }
+  }
+  PacketTracer::Ring* ring = NULL;
+};
+
+thread_local PacketTraceContext* PacketTracer::current_ = NULL;
+
+PacketTracer::PacketTracer()
+  : sample_rate_(FLAGS_packet_trace_sample), next_id_(1) {
+}
+
+PacketTracer::~PacketTracer() {
+}
+
+const char* PacketTracer::StageName(int stage) {
+  if (stage < 0 || stage >= TRACE_STAGE_COUNT) {
+    return "unknown";
+  }
+  return kStageNames[stage];
+}
+
+PacketTraceContext PacketTracer::Sample() {
+  PacketTraceContext context;
+  int sample_rate = GetInstance()->sample_rate();
+  if (sample_rate <= 0) {
+    return context;
+  }
+  thread_local unsigned int received = 0;
+  if (++received % sample_rate != 0) {
+    return context;
+  }
+  uint32_t id = GetInstance()->next_id_.fetch_add(1, std::memory_order_relaxed);
+  context.id = (id == 0 ? 1 : id);
+  context.begin_us = GetCurrentTime_US();
+  context.stage_us = context.begin_us;
+  return context;
+}
+
+void PacketTracer::EndTrace(PacketTraceContext* context) {
+  if (context->sampled()) {
+    GetInstance()->RecordEvent(*context, TRACE_STAGE_TOTAL, context->begin_us,
+                               GetCurrentTime_US());
+  }
+}
+
+void PacketTracer::Record(PacketTraceContext* context, PacketTraceStage stage) {
+  int64_t now = GetCurrentTime_US();
+  RecordEvent(*context, stage, context->stage_us, now);
+  context->stage_us = now;
+}
+
+void PacketTracer::RecordEvent(const PacketTraceContext& context,
+                               PacketTraceStage stage, int64_t begin_us,
+                               int64_t end_us) {
+  PacketTraceEvent event;
+  event.id = context.id;
+  event.stage = stage;
+  event.room = context.room;
+  event.tid = GetThreadId();
+  event.begin_us = begin_us;
+  event.duration_us = std::max<int64_t>(end_us - begin_us, 0);
+  LocalRing()->Add(event);
+
+  if (context.room == 0) {
+    return;
+  }
+  std::lock_guard<std::mutex> guard(rooms_mutex_);
+  // The packets still in flight when the room is removed must not bring
+  // its histograms back.
+  auto room = rooms_.find(context.room);
+  if (room == rooms_.end()) {
+    return;
+  }
+  std::unique_ptr<LatencyHistogram>& histogram = room->second->stages[stage];
+  if (histogram == NULL) {
+    histogram.reset(new LatencyHistogram(StringPrintf(
+        "trace_%d_%s_us", context.room, StageName(stage))));
+  }
+  // Recorded under the lock, RemoveRoom() frees the histograms.
+  histogram->Record(event.duration_us);
+}
+
+PacketTracer::Ring* PacketTracer::LocalRing() {
+  thread_local RingHolder holder;
+  if (holder.ring == NULL) {
+    holder.ring = new Ring();
+    std::lock_guard<std::mutex> guard(rings_mutex_);
+    rings_.push_back(holder.ring);
+  }
+  return holder.ring;
+}
+
+void PacketTracer::RemoveRing(Ring* ring) {
+  {
+    std::lock_guard<std::mutex> guard(rings_mutex_);
+    rings_.erase(std::remove(rings_.begin(), rings_.end(), ring), rings_.end());
+  }
+  delete ring;
+}
+
+void PacketTracer::AddRoom(int room) {
+  std::lock_guard<std::mutex> guard(rooms_mutex_);
+  std::unique_ptr<RoomHistograms>& histograms = rooms_[room];
+  if (histograms == NULL) {
+    histograms.reset(new RoomHistograms());
+  }
+}
+
+void PacketTracer::RemoveRoom(int room) {
+  std::lock_guard<std::mutex> guard(rooms_mutex_);
+  rooms_.erase(room);
+}
+
+bool PacketTracer::AddStageBuckets(int room, PacketTraceStage stage,
+                                   long long* counts) {
+  std::lock_guard<std::mutex> guard(rooms_mutex_);
+  auto it = rooms_.find(room);
+  if (it == rooms_.end() || it->second->stages[stage] == NULL) {
+    return false;
+  }
+  const LatencyHistogram* histogram = it->second->stages[stage].get();
+  for (int bucket = 0; bucket < LatencyHistogram::kNumBuckets; ++bucket) {
+    counts[bucket] += histogram->Bucket(bucket);
+  }
+  return true;
+}
+
+std::vector<PacketTraceEvent> PacketTracer::GetEvents() {
+  std::vector<PacketTraceEvent> events;
+  std::lock_guard<std::mutex> guard(rings_mutex_);
+  for (Ring* ring : rings_) {
+    ring->CopyTo(&events);
+  }
+  return events;
+}
+
+std::string PacketTracer::DumpChromeTrace() {
+  std::vector<PacketTraceEvent> events = GetEvents();
+  std::string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  std::set<int> rooms;
+  bool first = true;
+  for (const PacketTraceEvent& event : events) {
+    StringAppendF(&json, "%s\n{\"name\":\"%s\",\"cat\":\"packet\",\"ph\":\"X\","
+                  "\"pid\":%d,\"tid\":%d,\"ts\":%lld,\"dur\":%d,"
+                  "\"args\":{\"packet\":%u}}",
+                  first ? "" : ",", StageName(event.stage), event.room,
+                  event.tid, (long long)event.begin_us, event.duration_us,
+                  event.id);
+    rooms.insert(event.room);
+    first = false;
+  }
+  // Names the processes after the rooms.
+  for (int room : rooms) {
+    StringAppendF(&json, "%s\n{\"name\":\"process_name\",\"ph\":\"M\","
+                  "\"pid\":%d,\"args\":{\"name\":\"%s\"}}",
+                  first ? "" : ",", room,
+                  room == 0 ? "no room" :
+                  StringPrintf("room %d", room).c_str());
+    first = false;
+  }
+  json += "\n]}\n";
+  return json;
+}
+
+}  // namespace orbit
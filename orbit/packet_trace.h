@@ -0,0 +1,197 @@
+/*
+ * Copyright 2016 All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * packet_trace.h
+ * ---------------------------------------------------------------------------
+ * Defines the sampled per-stage latency tracing of the media packets.
+ * ---------------------------------------------------------------------------
+ * One of every --packet_trace_sample received packets is given a trace id
+ * by the DtlsTransport. The trace is carried with the packet through the
+ * stages of the pipeline:
+ *
+ *   nice_queue      received by libnice -> handed to the transport, incl.
+ *                   the transport's ingress queue with the NiceReactor
+ *   srtp_unprotect  SRTP/SRTCP unprotect
+ *   delegate        TransportDelegate::onTransportBuffer before the plugin
+ *   plugin_queue    the plugin queue (--async_plugin_delivery only)
+ *   plugin          the plugin and the room, incl. the fan-out
+ *   sender_queue    queued in the RtpSender of each subscriber
+ *   srtp_protect    SRTP protect of the egress batch
+ *   socket_write    handed to the socket (or to the UDP batch)
+ *   total           received -> socket_write
+ *
+ * While a packet is processed synchronously on one thread, its context is
+ * the current context of the thread (PacketTraceScope), so the stages
+ * don't need the packet at hand. The RtpSender copies the context into its
+ * queue, so each forwarded copy of the packet is traced on its own.
+ *
+ * The stages are recorded into a small ring buffer of the recording thread
+ * (exported as Chrome trace-event JSON by /tracez) and into the per-stage
+ * histograms of the room ("trace_<session_id>_<stage>_us" in /histogramz),
+ * from AddRoom() to RemoveRoom().
+ * The packets produced by the mixers (decoded and encoded again) start no
+ * trace of their own.
+ *
+ * Example usage:
+ *   PacketTraceScope scope(&buffer->trace);
+ *   ... unprotect the packet ...
+ *   PacketTracer::EndStage(TRACE_STAGE_SRTP_UNPROTECT);
+ */
+
+#ifndef PACKET_TRACE_H_
+#define PACKET_TRACE_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "stream_service/orbit/base/singleton.h"
+
+namespace orbit {
+
+class LatencyHistogram;
+
+enum PacketTraceStage {
+  TRACE_STAGE_NICE_QUEUE = 0,
+  TRACE_STAGE_SRTP_UNPROTECT,
+  TRACE_STAGE_DELEGATE,
+  TRACE_STAGE_PLUGIN_QUEUE,
+  TRACE_STAGE_PLUGIN,
+  TRACE_STAGE_SENDER_QUEUE,
+  TRACE_STAGE_SRTP_PROTECT,
+  TRACE_STAGE_SOCKET_WRITE,
+  TRACE_STAGE_TOTAL,
+  TRACE_STAGE_COUNT
+};
+
+// The trace of one packet. id is 0 if the packet is not sampled.
+struct PacketTraceContext {
+  uint32_t id = 0;
+  int room = 0;               // The session id, once the delegate is known.
+  int64_t begin_us = 0;       // Received by libnice.
+  int64_t stage_us = 0;       // The begin of the current stage.
+
+  bool sampled() const {
+    return id != 0;
+  }
+};
+
+// A recorded stage, as dumped to the trace viewer.
+struct PacketTraceEvent {
+  uint32_t id;
+  int16_t stage;
+  int room;
+  int tid;
+  int64_t begin_us;
+  int32_t duration_us;
+};
+
+class PacketTracer {
+ public:
+  static const char* StageName(int stage);
+
+  // Returns a new sampled context for one of every sample_rate() packets
+  // received on the calling thread, and an unsampled one otherwise.
+  static PacketTraceContext Sample();
+
+  // The context of the packet being processed on the calling thread, or
+  // NULL.
+  static PacketTraceContext* Current() {
+    return current_;
+  }
+  static void set_current(PacketTraceContext* context) {
+    current_ = context;
+  }
+
+  // Records the stage of the current packet as [stage_us, now), and starts
+  // the next stage. Does nothing if the packet is not sampled.
+  static void EndStage(PacketTraceStage stage) {
+    PacketTraceContext* context = current_;
+    if (context != NULL && context->sampled()) {
+      GetInstance()->Record(context, stage);
+    }
+  }
+  static void EndStage(PacketTraceContext* context, PacketTraceStage stage) {
+    if (context->sampled()) {
+      GetInstance()->Record(context, stage);
+    }
+  }
+  // Records the total of the packet, [begin_us, now).
+  static void EndTrace(PacketTraceContext* context);
+
+  static PacketTracer* GetInstance() {
+    return Singleton<PacketTracer>::GetInstance();
+  }
+
+  // 0 disables the tracing.
+  int sample_rate() const {
+    return sample_rate_.load(std::memory_order_relaxed);
+  }
+  void set_sample_rate(int sample_rate) {
+    sample_rate_.store(sample_rate, std::memory_order_relaxed);
+  }
+
+  // Returns the events recorded in the rings as Chrome trace-event JSON
+  // (chrome://tracing, Perfetto), one process per room.
+  std::string DumpChromeTrace();
+  // Returns all the recorded events, oldest first per thread.
+  std::vector<PacketTraceEvent> GetEvents();
+  // Starts recording the per-stage histograms of the room. The stages of
+  // the rooms not added (or removed already) are only kept in the rings.
+  void AddRoom(int room);
+  // Drops the histograms of the room.
+  void RemoveRoom(int room);
+  // Adds the bucket counts of the stage histogram of the room to counts
+  // (LatencyHistogram::kNumBuckets of them), e.g. to sum several rooms.
+  // Returns false if nothing is recorded for the stage of the room.
+  bool AddStageBuckets(int room, PacketTraceStage stage, long long* counts);
+
+ private:
+  class Ring;
+  struct RoomHistograms;
+
+  void Record(PacketTraceContext* context, PacketTraceStage stage);
+  void RecordEvent(const PacketTraceContext& context, PacketTraceStage stage,
+                   int64_t begin_us, int64_t end_us);
+  Ring* LocalRing();
+  void RemoveRing(Ring* ring);
+
+  static thread_local PacketTraceContext* current_;
+
+  std::atomic<int> sample_rate_;
+  std::atomic<uint32_t> next_id_;
+
+  std::mutex rings_mutex_;
+  std::vector<Ring*> rings_;
+
+  std::mutex rooms_mutex_;
+  std::map<int, std::unique_ptr<RoomHistograms> > rooms_;
+
+  friend class RingHolder;
+  DEFINE_AS_SINGLETON_WITHOUT_CONSTRUCTOR(PacketTracer);
+};
+
+// Makes the context the current context of the thread for the scope.
+class PacketTraceScope {
+ public:
+  explicit PacketTraceScope(PacketTraceContext* context)
+    : previous_(PacketTracer::Current()) {
+    PacketTracer::set_current(context);
+  }
+  ~PacketTraceScope() {
+    PacketTracer::set_current(previous_);
+  }
+
+ private:
+  PacketTraceContext* previous_;
+};
+
+}  // namespace orbit
+
+#endif  // PACKET_TRACE_H_
@@ -0,0 +1,112 @@
+/*
+ * Copyright 2016 All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * packet_trace_test.cc
+ */
+
+#include "packet_trace.h"
+
+#include "stream_service/orbit/http_server/latency_histogram.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace orbit {
+namespace {
+
+TEST(PacketTraceTest, SamplesOneOfN) {
+  PacketTracer* tracer = PacketTracer::GetInstance();
+  tracer->set_sample_rate(0);
+  EXPECT_FALSE(PacketTracer::Sample().sampled());
+
+  tracer->set_sample_rate(4);
+  int sampled = 0;
+  for (int i = 0; i < 100; ++i) {
+    PacketTraceContext context = PacketTracer::Sample();
+    if (context.sampled()) {
+      EXPECT_GT(context.begin_us, 0);
+      EXPECT_EQ(context.begin_us, context.stage_us);
+      sampled++;
+    }
+  }
+  EXPECT_EQ(25, sampled);
+  tracer->set_sample_rate(0);
+}
+
+TEST(PacketTraceTest, RecordsTheStagesOfTheCurrentPacket) {
+  PacketTracer* tracer = PacketTracer::GetInstance();
+  tracer->set_sample_rate(1);
+  PacketTraceContext context = PacketTracer::Sample();
+  tracer->set_sample_rate(0);
+  ASSERT_TRUE(context.sampled());
+  context.room = 4242;
+  tracer->AddRoom(4242);
+
+  EXPECT_TRUE(PacketTracer::Current() == NULL);
+  // Not traced, nothing is recorded.
+  PacketTracer::EndStage(TRACE_STAGE_NICE_QUEUE);
+  {
+    PacketTraceScope scope(&context);
+    EXPECT_EQ(&context, PacketTracer::Current());
+    PacketTracer::EndStage(TRACE_STAGE_NICE_QUEUE);
+    PacketTracer::EndStage(TRACE_STAGE_SRTP_UNPROTECT);
+    PacketTracer::EndStage(TRACE_STAGE_DELEGATE);
+  }
+  EXPECT_TRUE(PacketTracer::Current() == NULL);
+  PacketTracer::EndTrace(&context);
+
+  // Recorded on another thread, e.g. an egress worker.
+  std::thread([&context] {
+    PacketTracer::EndStage(&context, TRACE_STAGE_SENDER_QUEUE);
+  }).join();
+
+  int count = 0;
+  for (const PacketTraceEvent& event : tracer->GetEvents()) {
+    if (event.id == context.id) {
+      EXPECT_EQ(4242, event.room);
+      EXPECT_GE(event.duration_us, 0);
+      count++;
+    }
+  }
+  // The ring of the exited thread is gone.
+  EXPECT_EQ(4, count);
+
+  std::string json = tracer->DumpChromeTrace();
+  EXPECT_EQ(0, json.find("{\"displayTimeUnit\":\"ms\",\"traceEvents\":["));
+  EXPECT_NE(std::string::npos, json.find("\"name\":\"srtp_unprotect\""));
+  EXPECT_NE(std::string::npos, json.find("\"pid\":4242"));
+  EXPECT_NE(std::string::npos, json.find("\"name\":\"room 4242\""));
+
+  LatencyHistogramManager* histograms =
+      Singleton<LatencyHistogramManager>::GetInstance();
+  EXPECT_NE(std::string::npos, histograms->DumpHistograms().find(
+      "trace_4242_delegate_us count=1"));
+  EXPECT_NE(std::string::npos, histograms->DumpHistograms().find(
+      "trace_4242_total_us count=1"));
+  std::vector<long long> counts(LatencyHistogram::kNumBuckets, 0);
+  EXPECT_TRUE(tracer->AddStageBuckets(4242, TRACE_STAGE_DELEGATE, &counts[0]));
+  EXPECT_TRUE(tracer->AddStageBuckets(4242, TRACE_STAGE_DELEGATE, &counts[0]));
+  long long total = 0;
+  for (long long count : counts) {
+    total += count;
+  }
+  EXPECT_EQ(2, total);
+  EXPECT_FALSE(tracer->AddStageBuckets(4242, TRACE_STAGE_PLUGIN, &counts[0]));
+  tracer->RemoveRoom(4242);
+  EXPECT_EQ(std::string::npos,
+            histograms->DumpHistograms().find("trace_4242_"));
+  EXPECT_FALSE(tracer->AddStageBuckets(4242, TRACE_STAGE_DELEGATE, &counts[0]));
+
+  // A packet still in flight doesn't bring the removed room back.
+  PacketTracer::EndStage(&context, TRACE_STAGE_PLUGIN);
+  EXPECT_EQ(std::string::npos,
+            histograms->DumpHistograms().find("trace_4242_"));
+  EXPECT_FALSE(tracer->AddStageBuckets(4242, TRACE_STAGE_PLUGIN, &counts[0]));
+}
+
+}  // namespace
+}  // namespace orbit
@@ -0,0 +1,278 @@
+/*
+ * Copyright 2016 (C) Orange Labs Inc. All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * plugin_dispatcher.cc
+ * ---------------------------------------------------------------------------
+ * Implements the process-wide plugin dispatcher.
+ * ---------------------------------------------------------------------------
+ */
+#include "plugin_dispatcher.h"
+
+#include "stream_service/orbit/base/strutil.h"
+#include "stream_service/orbit/base/timeutil.h"
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include <sys/prctl.h>
+#include <unistd.h>
+#include <thread>
+
+DEFINE_int32(plugin_worker_threads, 0,
+             "The number of threads to deliver the incoming packets to the "
+             "plugins with --async_plugin_delivery. Numbers <= 0 mean the "
+             "number of cores.");
+
+// The idle workers wake up periodically to update /varz.
+#define PLUGIN_WORKER_IDLE_WAIT 50 // in ms
+// The max number of packets delivered for one queue before moving on to the
+// next runnable queue.
+#define PLUGIN_QUEUE_BUDGET 64
+// Update the per-worker counters on /varz every second.
+#define PLUGIN_EXPORT_INTERVAL 1000 // in ms
+
+namespace orbit {
+
+PluginDeliveryQueue::PluginDeliveryQueue(int capacity,
+                                         const DeliverFunc& deliver)
+  : ring_(capacity), deliver_(deliver) {
+  dispatcher_ = Singleton<PluginDispatcher>::GetInstance();
+  dispatcher_->Register(this);
+}
+
+PluginDeliveryQueue::~PluginDeliveryQueue() {
+  Stop();
+}
+
+bool PluginDeliveryQueue::Push(const PacketBufferPtr& buffer) {
+  if (closing_ || !ring_.TryPush(buffer)) {
+    int64_t dropped = ++dropped_packets_;
+    LOG_EVERY_N(WARNING, 100) << "Plugin delivery queue is full, dropped "
+                              << dropped << " packets so far.";
+    return false;
+  }
+  pushed_packets_++;
+  int queued = ring_.SizeApprox();
+  if (queued > max_queued_packets_) {
+    max_queued_packets_ = queued;
+  }
+  dispatcher_->Schedule(this);
+  return true;
+}
+
+void PluginDeliveryQueue::Stop() {
+  if (stopped_) {
+    return;
+  }
+  stopped_ = true;
+  dispatcher_->Unregister(this);
+  // No worker runs the queue anymore, drop what is left.
+  PacketBufferPtr buffer;
+  while (ring_.TryPop(&buffer)) {
+    dropped_packets_++;
+  }
+}
+
+int PluginDeliveryQueue::Deliver(int max_packets) {
+  int delivered = 0;
+  PacketBufferPtr buffer;
+  while (delivered < max_packets && !closing_ && ring_.TryPop(&buffer)) {
+    deliver_(buffer);
+    delivered++;
+  }
+  buffer.reset();
+  delivered_packets_ += delivered;
+  return delivered;
+}
+
+PluginDispatcher::PluginDispatcher() {
+  int num_workers = FLAGS_plugin_worker_threads;
+  if (num_workers <= 0) {
+    num_workers = std::thread::hardware_concurrency();
+  }
+  if (num_workers <= 0) {
+    num_workers = 1;
+  }
+  LOG(INFO) << "PluginDispatcher starts with " << num_workers << " workers.";
+
+  running_ = true;
+  for (int i = 0; i < num_workers; ++i) {
+    Worker* worker = new Worker();
+    worker->index = i;
+    worker->queued_packets_var.reset(
+        new ExportedVar(StringPrintf("plugin_worker_%d_queued_packets", i)));
+    worker->dropped_packets_var.reset(
+        new ExportedVar(StringPrintf("plugin_worker_%d_dropped_packets", i)));
+    worker->queues_var.reset(
+        new ExportedVar(StringPrintf("plugin_worker_%d_queues", i)));
+    workers_.push_back(worker);
+  }
+  for (Worker* worker : workers_) {
+    worker->thread.reset(
+        new boost::thread(boost::bind(&PluginDispatcher::WorkerLoop, this, worker)));
+  }
+}
+
+PluginDispatcher::~PluginDispatcher() {
+  running_ = false;
+  for (Worker* worker : workers_) {
+    worker->notifier.ForceNotify();
+  }
+  for (Worker* worker : workers_) {
+    if (worker->thread != NULL) {
+      worker->thread->join();
+    }
+    delete worker;
+  }
+  workers_.clear();
+}
+
+void PluginDispatcher::Register(PluginDeliveryQueue* queue) {
+  // Shard the queue onto the worker with the fewest queues.
+  Worker* home = workers_[0];
+  for (Worker* worker : workers_) {
+    if (worker->num_queues < home->num_queues) {
+      home = worker;
+    }
+  }
+  home->num_queues++;
+  queue->worker_index_ = home->index;
+  queue->closing_ = false;
+  std::lock_guard<std::mutex> lock(home->mutex);
+  home->queues.push_back(queue);
+}
+
+void PluginDispatcher::Unregister(PluginDeliveryQueue* queue) {
+  queue->closing_ = true;
+  Worker* home = workers_[queue->worker_index_];
+  {
+    std::lock_guard<std::mutex> lock(home->mutex);
+    for (auto it = home->run_queue.begin(); it != home->run_queue.end();) {
+      if (*it == queue) {
+        it = home->run_queue.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+  // Wait for the worker if it is still running the queue.
+  while (queue->run_count_ > 0) {
+    usleep(100);
+  }
+  {
+    std::lock_guard<std::mutex> lock(home->mutex);
+    for (auto it = home->queues.begin(); it != home->queues.end(); ++it) {
+      if (*it == queue) {
+        home->queues.erase(it);
+        break;
+      }
+    }
+  }
+  home->num_queues--;
+  queue->scheduled_ = false;
+}
+
+void PluginDispatcher::Schedule(PluginDeliveryQueue* queue) {
+  bool expected = false;
+  if (!queue->scheduled_.compare_exchange_strong(expected, true)) {
+    // Already in the run queue or being run, the worker will pick up the
+    // new packets.
+    return;
+  }
+  if (!Enqueue(queue)) {
+    queue->scheduled_ = false;
+  }
+}
+
+bool PluginDispatcher::Enqueue(PluginDeliveryQueue* queue) {
+  Worker* home = workers_[queue->worker_index_];
+  {
+    std::lock_guard<std::mutex> lock(home->mutex);
+    if (queue->closing_) {
+      return false;
+    }
+    home->run_queue.push_back(queue);
+  }
+  home->notifier.Notify();
+  return true;
+}
+
+PluginDeliveryQueue* PluginDispatcher::TakeQueue(Worker* worker) {
+  // No stealing: the ring has a single consumer, which is the home worker.
+  std::lock_guard<std::mutex> lock(worker->mutex);
+  if (worker->run_queue.empty()) {
+    return NULL;
+  }
+  PluginDeliveryQueue* queue = worker->run_queue.front();
+  worker->run_queue.pop_front();
+  queue->run_count_++;
+  return queue;
+}
+
+void PluginDispatcher::WorkerLoop(Worker* worker) {
+  /* Set thread name */
+  prctl(PR_SET_NAME, (unsigned long)"PluginWorker");
+
+  while (running_) {
+    PluginDeliveryQueue* queue = TakeQueue(worker);
+    if (queue == NULL) {
+      worker->notifier.PrepareWait();
+      queue = TakeQueue(worker);
+      if (queue == NULL) {
+        worker->notifier.Wait(PLUGIN_WORKER_IDLE_WAIT);
+        ExportCounters(worker);
+        continue;
+      }
+      worker->notifier.CancelWait();
+    }
+
+    queue->Deliver(PLUGIN_QUEUE_BUDGET);
+    bool requeue = !queue->ring_.EmptyApprox();
+    if (!requeue) {
+      queue->scheduled_ = false;
+      // A packet may have been pushed after the check above, but its
+      // Schedule() saw scheduled_ == true and returned. Re-check it.
+      if (!queue->ring_.EmptyApprox()) {
+        bool expected = false;
+        requeue = queue->scheduled_.compare_exchange_strong(expected, true);
+      }
+    }
+    if (requeue) {
+      // Put it to the back of the run queue, so the other queues on this
+      // worker get their turn.
+      if (!Enqueue(queue)) {
+        queue->scheduled_ = false;
+      }
+    }
+    // NOTE: the queue may be deleted as soon as run_count_ drops to zero,
+    // don't touch it after this line.
+    queue->run_count_--;
+    ExportCounters(worker);
+  }
+}
+
+void PluginDispatcher::ExportCounters(Worker* worker) {
+  long long now = GetCurrentTime_MS();
+  if (now - worker->last_export_ms < PLUGIN_EXPORT_INTERVAL) {
+    return;
+  }
+  worker->last_export_ms = now;
+  int queued_packets = 0;
+  int64_t dropped_packets = 0;
+  {
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    for (PluginDeliveryQueue* queue : worker->queues) {
+      queued_packets += queue->QueuedPacketsApprox();
+      dropped_packets += queue->dropped_packets();
+    }
+  }
+  worker->queued_packets_var->Set(queued_packets);
+  // The counters of the unregistered queues are gone, don't go negative.
+  int64_t dropped = dropped_packets - worker->last_dropped_packets;
+  worker->dropped_packets_var->Set(dropped > 0 ? dropped : 0);
+  worker->last_dropped_packets = dropped_packets;
+  worker->queues_var->Set(worker->num_queues);
+}
+
+}  // namespace orbit
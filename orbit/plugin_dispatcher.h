@@ -0,0 +1,143 @@
+/*
+ * Copyright 2016 (C) Orange Labs Inc. All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * plugin_dispatcher.h
+ * ---------------------------------------------------------------------------
+ * Defines a process-wide dispatcher to deliver the incoming packets to the
+ * plugins with a fixed pool of worker threads, so a slow plugin (the audio
+ * mixer, the recorder's appsrc) doesn't stall the receiving thread of its
+ * connection.
+ * ---------------------------------------------------------------------------
+ * Each connection owns a PluginDeliveryQueue, a bounded SPSC ring filled by
+ * its receiving thread. The queue is homed on one worker when it is
+ * registered, and only that worker drains it, so the packets are delivered
+ * in order. When the ring is full the packet is dropped and counted, the
+ * receiving thread never waits for the plugin.
+ *
+ * The per-worker counters are exported on /varz as:
+ *   plugin_worker_<N>_queued_packets
+ *   plugin_worker_<N>_dropped_packets  (in the last second)
+ *   plugin_worker_<N>_queues
+ */
+
+#pragma once
+
+#include <boost/thread.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "packet_buffer.h"
+#include "stream_service/orbit/base/event_notifier.h"
+#include "stream_service/orbit/base/singleton.h"
+#include "stream_service/orbit/base/spsc_ring.h"
+#include "stream_service/orbit/http_server/exported_var.h"
+
+namespace orbit {
+
+class PluginDispatcher;
+
+class PluginDeliveryQueue {
+ public:
+  typedef std::function<void(const PacketBufferPtr&)> DeliverFunc;
+
+  // deliver is called on a dispatcher worker for each packet, in order.
+  PluginDeliveryQueue(int capacity, const DeliverFunc& deliver);
+  // Stops the queue if not yet.
+  ~PluginDeliveryQueue();
+
+  // Queues the packet for delivery. Never blocks: returns false and counts
+  // the drop if the queue is full. Must only be called from one thread at a
+  // time (the receiving thread of the connection).
+  bool Push(const PacketBufferPtr& buffer);
+
+  // Stops the delivery and drops the queued packets. Blocks until the
+  // worker doesn't run deliver anymore.
+  void Stop();
+
+  int64_t pushed_packets() const {
+    return pushed_packets_;
+  }
+  int64_t delivered_packets() const {
+    return delivered_packets_;
+  }
+  int64_t dropped_packets() const {
+    return dropped_packets_;
+  }
+  // The max number of packets queued, a sign of backpressure.
+  int max_queued_packets() const {
+    return max_queued_packets_;
+  }
+  int QueuedPacketsApprox() const {
+    return ring_.SizeApprox();
+  }
+
+ private:
+  friend class PluginDispatcher;
+
+  // Delivers at most max_packets, on the home worker only.
+  int Deliver(int max_packets);
+
+  SpscRing<PacketBufferPtr> ring_;
+  DeliverFunc deliver_;
+  PluginDispatcher* dispatcher_;
+  bool stopped_ = false;
+
+  // Fields owned by the PluginDispatcher.
+  int worker_index_ = 0;
+  std::atomic<bool> scheduled_{false};
+  std::atomic<bool> closing_{false};
+  std::atomic<int> run_count_{0};
+
+  std::atomic<int64_t> pushed_packets_{0};
+  std::atomic<int64_t> delivered_packets_{0};
+  std::atomic<int64_t> dropped_packets_{0};
+  std::atomic<int> max_queued_packets_{0};
+};
+
+class PluginDispatcher {
+ public:
+  // Assigns the queue to the worker with the fewest queues.
+  void Register(PluginDeliveryQueue* queue);
+  // Removes the queue. Blocks until no worker is running the queue anymore.
+  void Unregister(PluginDeliveryQueue* queue);
+  // Makes the queue runnable. Cheap if the queue is already runnable.
+  void Schedule(PluginDeliveryQueue* queue);
+
+  int num_workers() const {
+    return workers_.size();
+  }
+
+ private:
+  struct Worker {
+    int index;
+    std::mutex mutex;                              // protects the fields below.
+    std::deque<PluginDeliveryQueue*> run_queue;    // The runnable queues.
+    std::vector<PluginDeliveryQueue*> queues;      // The queues homed here.
+    EventNotifier notifier;
+    boost::scoped_ptr<boost::thread> thread;
+    std::atomic<int> num_queues{0};
+    boost::scoped_ptr<ExportedVar> queued_packets_var;
+    boost::scoped_ptr<ExportedVar> dropped_packets_var;
+    boost::scoped_ptr<ExportedVar> queues_var;
+    long long last_export_ms = 0;
+    int64_t last_dropped_packets = 0;
+  };
+
+  void WorkerLoop(Worker* worker);
+  PluginDeliveryQueue* TakeQueue(Worker* worker);
+  bool Enqueue(PluginDeliveryQueue* queue);
+  void ExportCounters(Worker* worker);
+
+  std::vector<Worker*> workers_;
+  std::atomic<bool> running_{false};
+
+  DEFINE_AS_SINGLETON_WITHOUT_CONSTRUCTOR(PluginDispatcher);
+};
+
+}  // namespace orbit
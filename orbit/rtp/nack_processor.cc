@@ -6,6 +6,7 @@
  */
 
 #include <glib.h>
+#include <algorithm>
 #include <iostream>
 #include <boost/scoped_ptr.hpp>
 #include "gflags/gflags.h"
@@ -24,7 +25,6 @@ DEFINE_bool(enable_nack_request_fir,
             "enable send FIR to request intra-frame.");
 
 #define KEY_FRAME_INTERVAL 3000      // in milliseconds
-#define MAX_RETRANSMIT_QUEUE_SIZE 300
 #define RETRANSMIT_PACKETS_LIMIT 100
 
 
@@ -33,125 +33,84 @@ namespace orbit {
 using namespace std;
 
 NackProcessor::NackProcessor() {
-	last_seqs_video_ = NULL;
 	trans_delegate_ = NULL;
+	rtcp_processor_ = NULL;
 }
 
 NackProcessor::NackProcessor(TransportDelegate *trans_delegate,
     RtcpProcessor *rtcp_processor) {
-	last_seqs_video_ = NULL;
 	trans_delegate_ = trans_delegate;
 	rtcp_processor_ = rtcp_processor;
 }
 
 NackProcessor::~NackProcessor() {
-  janus_seq_list_free(&last_seqs_video_);
-  retransmit_list_.clear();
+  retransmit_history_.Clear();
 }
 
 unsigned int NackProcessor::GetRetransmitListSize() {
-  boost::mutex::scoped_lock lock(retransmit_mutex_);
-  return retransmit_list_.size();
+  return retransmit_history_.size();
+}
+
+// Keep the sent packet in the retransmit history, the oldest packets are
+// evicted by the newer ones or when they are expired.
+void NackProcessor::PushBuffer(const PacketBufferPtr& buffer) {
+  retransmit_history_.Put(buffer, getTimeMS());
 }
 
-// Push the send packet to retransmit_list queue
-// Will remove old retransmit packets to keep size of retransmit list
 void NackProcessor::PushPacket(char* buf, int len) {
-	RtpHeader* rtp = reinterpret_cast<RtpHeader*>(buf);
-	char* rbuf = reinterpret_cast<char*>(malloc(len));
-	memcpy(rbuf, buf, len);
-  auto rp = std::make_shared<RtpRetransmitPacket>();
-	rp->seqn = rtp->getSeqNumber();
-	rp->buf = (unsigned char*) rbuf;
-	rp->buf_size = len;
-	rp->retries = 0;
-	rp->ts = getTimeMS();
-	{
-    boost::mutex::scoped_lock lock(retransmit_mutex_);
-    retransmit_list_.push_back(rp);
-    int list_size = retransmit_list_.size();
-    while (list_size > MAX_RETRANSMIT_QUEUE_SIZE) {
-      retransmit_list_.pop_front();
-      list_size--;
-    }
-	}
+  PacketBufferPtr buffer = PacketBuffer::Create(buf, len);
+  if (buffer == NULL) {
+    LOG(ERROR) << "PushPacket: packet is too large, len=" << len;
+    return;
+  }
+  PushBuffer(buffer);
 }
 
 int NackProcessor::GetRtcpNackPackets(char* buf, int buflen) {
-  GSList *nacks = janus_rtcp_get_nacks(buf, buflen);
-  guint nacks_count = g_slist_length(nacks);
-  if (nacks_count) {
-    g_slist_free(nacks);
-  }
-  return nacks_count;
+  return CountRtcpNacks(buf, buflen);
 }
 
 /*
  * The function is used to parse the incoming NACK packet(the received NACK 
  * packet is sent by client). To verify whether there are some packets lost ? 
- * If there are some packets lost and be found in local retransmit_list, the 
+ * If there are some packets lost and be found in the retransmit history, the
  * lost packets will be retransmit by transport delegate.  
  */
 int NackProcessor::ProcessRtcpNackPackets(char* buf, int buflen) {
-  GSList *nacks = janus_rtcp_get_nacks(buf, buflen);
-  guint nacks_count = g_slist_length(nacks);
   int lost_not_retrans = 0;
-  if(nacks_count) {
-    VLOG(3) << "Just got some NACKS ( " << nacks_count << ") we should handle...";
-
-    GSList *nack_list = nacks;
-    long now = getTimeMS();
-    // NOTE: make it as an constant varible.
-    long retransmit_wait_time = 30;
-
-    boost::mutex::scoped_lock lock(retransmit_mutex_);
-    while (nack_list) {
-      unsigned int seqn = GPOINTER_TO_UINT(nack_list->data);
-      std::list<RtpRetransmitPacketPtr>::reverse_iterator it;
-      bool find_in_retransmit = false;
-      for (it = retransmit_list_.rbegin(); it != retransmit_list_.rend(); ++it) {
-        RtpRetransmitPacketPtr rp = *it;
-        if (seqn == rp->seqn) {
-          find_in_retransmit = true;
-          // NOTE: make it as constant and check the right setting. 3 or 5?
-          if (rp->retries < 5) { // allow to retransmit 5 times
-            if ( rp->retries == 0 || (now - rp->ts) > retransmit_wait_time) {
-              /* Statistical number of packet loss, excluding retransmission */
-              if (rp->retries == 0) {
-                lost_not_retrans++;
-              }
-              rp->ts = getTimeMS();
-              rp->retries += 1;
-              /* Enqueue it */
-              dataPacket packet;
-              packet.comp = 0;
-              packet.length = rp->buf_size;
-              packet.type = RETRANSMIT_PACKET;
-              memcpy(&(packet.data[0]),rp->buf,rp->buf_size);
-              trans_delegate_->RelayPacket(packet);
-
-              VLOG(3) << "retransmit. seq: " << seqn << ", cur tries is " 
-                      << rp->retries;
-              break;
-            } else {
-              VLOG(3) << "ignore retransmit. seq: " << seqn
-                      << ", tries too frequent. cur tries is " << rp->retries;
-              break;
-            }
-          } else {
-            VLOG(3) << "ignore retransmit. seq: " << seqn 
-                    << ", to many tries than " << rp->retries;
-            break;
-          }
+  long long now = getTimeMS();
+  // The FCI is walked in place, the NACKed seqs are not collected.
+  int nacks_count = ForEachRtcpNack(buf, buflen, [&](uint16_t seqn) {
+      PacketBufferPtr buffer;
+      int retries = 0;
+      switch (retransmit_history_.GetForRetransmit(seqn, now, &buffer,
+                                                   &retries)) {
+      case RetransmitHistory::RETRANSMIT:
+        /* Statistical number of packet loss, excluding retransmission */
+        if (retries == 0) {
+          lost_not_retrans++;
         }
-      } // for
-      if (!find_in_retransmit) {
-        VLOG(3) << "Not in retransmit_list(" << seqn << ")";
+        // Send the stored packet itself, it is not copied nor rewritten.
+        trans_delegate_->RetransmitBuffer(buffer);
+        VLOG(3) << "retransmit. seq: " << seqn << ", cur tries is "
+                << retries + 1;
+        break;
+      case RetransmitHistory::TOO_FREQUENT:
+        VLOG(3) << "ignore retransmit. seq: " << seqn
+                << ", tries too frequent.";
+        break;
+      case RetransmitHistory::TOO_MANY_RETRIES:
+        VLOG(3) << "ignore retransmit. seq: " << seqn
+                << ", too many tries.";
+        break;
+      case RetransmitHistory::NOT_FOUND:
+        VLOG(3) << "Not in retransmit history(" << seqn << ")";
+        break;
       }
-      nack_list = nack_list->next;
-    } // while(nack_list)
-    g_slist_free(nacks);
-  } // if(nacks_count)
+    });
+  if (nacks_count) {
+    VLOG(3) << "Just got some NACKS ( " << nacks_count << ") handled.";
+  }
 
   return lost_not_retrans;
 }
@@ -163,7 +122,7 @@ int NackProcessor::ProcessRtcpNackPackets(char* buf, int buflen) {
  */
 int NackProcessor::SendNackByCondition(uint16_t seqnumber, packetType media_type) {
   // The nackbuf is the RTCP NACK packet to send it back to sender.
-  char nackbuf[120];
+  char nackbuf[NackList::kMaxRtcpSize];
   int res = KeepTrackRtpSequenceNumber(seqnumber, nackbuf);
   if (res > 0) {
     rtcp_processor_->SendRTCP(RTCP_RTP_Feedback_PT, media_type, nackbuf, res);
@@ -180,95 +139,15 @@ int NackProcessor::KeepTrackRtpSequenceNumber(/* IN */uint16_t new_seqn,
                                               /* OUT */char *nackbuf) {
   int res = 0;
   if (seqn_mtx_.try_lock()) {
-    seq_info_t **last_seqs = &last_seqs_video_;
-    seq_info_t *cur_seq = *last_seqs;
-    guint16 cur_seqn;
-    int last_seqs_len = 0;
-    if (cur_seq) {
-      cur_seq = cur_seq->prev;
-      cur_seqn = cur_seq->seq;  //seq number
-    } else {
-      /* First seq, set up to add one seq */
-      cur_seqn = new_seqn - (guint16) 1; /* Can wrap */
-    }
+    NackList nacks;
+    nack_tracker_.OnPacketReceived(new_seqn, janus_get_monotonic_time(),
+                                   &nacks);
 
-    if (!janus_seq_in_range(new_seqn, cur_seqn, LAST_SEQS_MAX_LEN)
-        && !janus_seq_in_range(cur_seqn, new_seqn, 1000)) {
-      /* Jump too big, start fresh */
-      LOG(INFO) << "Big sequence number jump ,cur_seqn=" << cur_seqn
-      		<< ",new_seqn=" << new_seqn;
-      janus_seq_list_free(last_seqs);
-      cur_seq = NULL;
-      cur_seqn = new_seqn - (guint16) 1;
-    }
-    
-    GSList *nacks = NULL;
-    gint64 now = janus_get_monotonic_time();
-    
-    if (janus_seq_in_range(new_seqn, cur_seqn, LAST_SEQS_MAX_LEN)) {
-      /* Add new seq objs forward */
-      while (cur_seqn != new_seqn) {
-      	cur_seqn += (guint16) 1; /* can wrap */
-      	seq_info_t *seq_obj = (seq_info_t *) g_malloc0(sizeof(seq_info_t));
-      	seq_obj->seq = cur_seqn;
-      	seq_obj->ts = now;
-        seq_obj->times = 0;
-      	seq_obj->state = (cur_seqn == new_seqn) ? SEQ_RECVED : SEQ_MISSING;
-      	janus_seq_append(last_seqs, seq_obj);
-      	last_seqs_len++;
-      	seq_obj = NULL;
-      }
-    }
-    
-    if (cur_seq) {
-      /* Scan old seq objs backwards */
-      for (;;) {
-        last_seqs_len++;
-        if (cur_seq->seq == new_seqn) {
-          VLOG(3) << "Recieved missed sequence number" << cur_seq->seq;
-          cur_seq->state = SEQ_RECVED;
-        } else if (cur_seq->state
-             == SEQ_MISSING && now - cur_seq->ts > SEQ_MISSING_WAIT) {
-          VLOG(3) << " Missed sequence number sending 1st NACK: "
-                  << cur_seq->seq;
-          nacks = g_slist_append(nacks, GUINT_TO_POINTER(cur_seq->seq));
-          cur_seq->state = SEQ_NACKED;
-          cur_seq->ts = now;
-          cur_seq->times++;
-        }else if (cur_seq->state == SEQ_NACKED &&
-                  now - cur_seq->ts > SEQ_NACKED_WAIT &&
-                  cur_seq->times <= MAX_TIMES_OF_RESEND) {
-          nacks = g_slist_append(nacks, GUINT_TO_POINTER(cur_seq->seq));
-          cur_seq->ts = now;
-          cur_seq->times++;
-          if (cur_seq->times > MAX_TIMES_OF_RESEND) {
-            cur_seq->state = SEQ_GIVEUP;
-          }
-          VLOG(3) << " Missed sequence number sending next NACK "
-                  << cur_seq->seq;
-        }
-        if (cur_seq == *last_seqs) {
-          /* Just processed head */
-          break;
-        }
-        cur_seq = cur_seq->prev;
-      }
-    } // end if (cur_seq)
-    
-    // delete cell from the head of list if it's length is larger than 
-    // LAST_SEQS_MAX_LEN
-    while (last_seqs_len > LAST_SEQS_MAX_LEN) {
-      seq_info_t *node = janus_seq_pop_head(last_seqs);
-      g_free(node);
-      last_seqs_len--;
-    }
-
-    guint nacks_count = g_slist_length(nacks);
     long long current_time = getTimeMS();
-    if (nacks_count > RETRANSMIT_PACKETS_LIMIT && 
+    if (nacks.seq_count() > RETRANSMIT_PACKETS_LIMIT &&
         current_time - last_fir_request_ >= KEY_FRAME_INTERVAL) {
-      // clear the retransmit list and send a key frame request
-      janus_seq_list_free(&last_seqs_video_);
+      // clear the tracked seqs and send a key frame request
+      nack_tracker_.Reset();
       if (FLAGS_enable_nack_request_fir) {
         SendFirPacket();
         last_fir_request_ = current_time;
@@ -281,24 +160,22 @@ int NackProcessor::KeepTrackRtpSequenceNumber(/* IN */uint16_t new_seqn,
     }
 
     seqn_mtx_.unlock();
-    g_slist_free(nacks);
-    nacks = NULL;
   } // end if (seqn_mtx_.try_lock())
 
   return res;
 }
 
-void NackProcessor::RtcpNackCreate(GSList *nacks, char* nackbuf, 
+void NackProcessor::RtcpNackCreate(const NackList& nacks, char* nackbuf,
                                    int* nackbuf_size) {
   *nackbuf_size = 0;
-  guint nacks_count = g_slist_length(nacks);
-  if (nacks_count) {
+  if (!nacks.empty()) {
     /* Generate a NACK and send it */
-    VLOG(3) << "now sending NACK msg for " << nacks_count
+    VLOG(3) << "now sending NACK msg for " << nacks.seq_count()
               << "missed packets";
-    nacks = g_slist_reverse(nacks);
-    int res = janus_rtcp_nacks(nackbuf, 120, nacks);
-    *nackbuf_size = res;
+    int res = nacks.WriteRtcp(nackbuf, NackList::kMaxRtcpSize);
+    if (res > 0) {
+      *nackbuf_size = res;
+    }
   }
 }
 
@@ -328,16 +205,34 @@ void NackProcessor::SendFirPacket() {
 
 void NackProcessor::SendRtcpNackList(const std::vector<uint16_t>& nack_list, 
                                      packetType packet_type) {
-  char nackbuf[120];  
+  char nackbuf[NackList::kMaxRtcpSize];
   int res;
-  GSList *nacks = NULL;
-  for (auto nack_it : nack_list) {
-    nacks = g_slist_append(nacks, GUINT_TO_POINTER(nack_it));
+  // The NackList needs the seqs in ascending order.
+  std::vector<uint16_t> sorted(nack_list);
+  if (!sorted.empty()) {
+    uint16_t base = sorted[0];
+    for (uint16_t seqn : sorted) {
+      if ((int16_t)(seqn - base) < 0) {
+        base = seqn;
+      }
+    }
+    std::sort(sorted.begin(), sorted.end(),
+              [base](uint16_t a, uint16_t b) {
+                return (uint16_t)(a - base) < (uint16_t)(b - base);
+              });
+  }
+  NackList nacks;
+  for (uint16_t seqn : sorted) {
+    if (!nacks.Add(seqn)) {
+      LOG(WARNING) << "Too many nacks, the rest are not sent, size="
+                   << nack_list.size();
+      break;
+    }
   }
   RtcpNackCreate(nacks, nackbuf, &res);
-
-  g_slist_free(nacks);
-  nacks = NULL;
+  if (res <= 0) {
+    return;
+  }
 
   /* Enqueue it */
   dataPacket packet;
@@ -13,34 +13,15 @@
 #include "glog/logging.h"
 #include "stream_service/orbit/rtp/janus_rtcp_processor.h"
 #include "stream_service/orbit/media_definitions.h"
+#include "stream_service/orbit/packet_buffer.h"
+#include "retransmit_history.h"
+#include "nack_tracker.h"
 
 namespace orbit {
 
 class RtcpProcessor;
 class TransportDelegate;
 
-struct RtpRetransmitPacket {
-  uint16_t seqn;
-  unsigned char* buf;
-  int buf_size;
-  long ts;
-  int retries;
-  RtpRetransmitPacket() {
-    buf = NULL;
-  }
-  RtpRetransmitPacket(unsigned char* buf_, int buf_size_) {
-    buf = buf_;
-    buf_size = buf_size_;
-  }
-  ~RtpRetransmitPacket() {
-    if (buf != NULL) {
-      free(buf);
-      buf = NULL;
-    }  
-  }
-};
-typedef std::shared_ptr<RtpRetransmitPacket> RtpRetransmitPacketPtr;
-
 // Keep track seqnumber to generate nack message (chenteng)
 // Deal with nack message (chenteng)
 class NackProcessor {
@@ -81,6 +62,13 @@ class NackProcessor {
    */
   int SendNackByCondition(uint16_t seqnumber, packetType media_type);
 
+  /*
+   * Keeps the sent packet in the retransmit history. The buffer is shared
+   * with the send path, not copied, and must not be modified afterwards.
+   */
+  void PushBuffer(const PacketBufferPtr& buffer);
+
+  // Copies the packet into a pooled buffer, and keeps it as above.
   void PushPacket(char* buf, int len);
 
   unsigned int GetRetransmitListSize();
@@ -117,18 +105,17 @@ private:
    * @param[out] nackbuf : created NACK packet
    * @param[out] nackbuf_size : the length of NACK packet.
    */
-  void RtcpNackCreate(/* IN */GSList *nacks, 
+  void RtcpNackCreate(/* IN */const NackList& nacks,
                       /* OUT */char* nackbuf, int* nackbuf_size);
 
   TransportDelegate *trans_delegate_;
   RtcpProcessor *rtcp_processor_;
 
-  // retransmit container
-  std::list<RtpRetransmitPacketPtr> retransmit_list_;
-  boost::mutex retransmit_mutex_;
+  // The sent packets, to answer the NACKs of the remote.
+  RetransmitHistory retransmit_history_;
 
-  // seqnumber container
-  seq_info_t* last_seqs_video_;
+  // Tracks the received seqnumbers to find the lost packets.
+  NackTracker nack_tracker_;
   std::mutex seqn_mtx_;
 
   /* key frame request */
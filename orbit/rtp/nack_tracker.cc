@@ -0,0 +1,156 @@
+/*
+ * Copyright 2016 All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * nack_tracker.cc
+ */
+
+#include "nack_tracker.h"
+
+#include <string.h>
+
+#include "glog/logging.h"
+
+// A seq this far behind the highest one is a restart of the stream, not a
+// late packet.
+#define MAX_BACKWARD_JUMP 1000
+
+namespace orbit {
+
+const int NackTracker::kWindowSize;
+const int NackTracker::kSlots;
+
+NackTracker::NackTracker() {
+  Reset();
+}
+
+void NackTracker::Reset() {
+  started_ = false;
+  highest_seqn_ = 0;
+  memset(pending_, 0, sizeof(pending_));
+  memset(state_, 0, sizeof(state_));
+  memset(times_, 0, sizeof(times_));
+  memset(ts_us_, 0, sizeof(ts_us_));
+}
+
+int NackTracker::lost_packets() const {
+  int count = 0;
+  for (int i = 0; i < kSlots / 64; ++i) {
+    count += __builtin_popcountll(pending_[i]);
+  }
+  return count;
+}
+
+void NackTracker::OnPacketReceived(uint16_t seqn, int64_t now_us,
+                                   NackList* nacks) {
+  if (!started_) {
+    started_ = true;
+    highest_seqn_ = seqn;
+    state_[seqn & (kSlots - 1)] = SLOT_RECEIVED;
+    return;
+  }
+
+  uint16_t forward = seqn - highest_seqn_;
+  uint16_t backward = highest_seqn_ - seqn;
+  if (forward == 0) {
+    // Duplicated.
+  } else if (forward < kWindowSize) {
+    Advance(seqn, now_us);
+  } else if (backward < MAX_BACKWARD_JUMP) {
+    if (backward < kWindowSize) {
+      int slot = seqn & (kSlots - 1);
+      if (state_[slot] != SLOT_RECEIVED) {
+        VLOG(3) << "Recieved missed sequence number" << seqn;
+        state_[slot] = SLOT_RECEIVED;
+        ClearPending(slot);
+      }
+    }
+  } else {
+    /* Jump too big, start fresh */
+    LOG(INFO) << "Big sequence number jump ,cur_seqn=" << highest_seqn_
+              << ",new_seqn=" << seqn;
+    Reset();
+    started_ = true;
+    highest_seqn_ = seqn;
+    return;
+  }
+
+  CollectNacks(now_us, nacks);
+}
+
+void NackTracker::Advance(uint16_t new_highest, int64_t now_us) {
+  uint16_t seqn = highest_seqn_;
+  do {
+    seqn++;
+    // The seq falling out of the window is forgotten.
+    ClearPending((uint16_t)(seqn - kWindowSize) & (kSlots - 1));
+    int slot = seqn & (kSlots - 1);
+    if (seqn == new_highest) {
+      state_[slot] = SLOT_RECEIVED;
+      ClearPending(slot);
+    } else {
+      state_[slot] = SLOT_MISSING;
+      times_[slot] = 0;
+      ts_us_[slot] = now_us;
+      SetPending(slot);
+    }
+  } while (seqn != new_highest);
+  highest_seqn_ = new_highest;
+}
+
+void NackTracker::CollectNacks(int64_t now_us, NackList* nacks) {
+  // Walks the window from the oldest seq, so the seqs are ascending.
+  int from = (uint16_t)(highest_seqn_ - kWindowSize + 1) & (kSlots - 1);
+  int to = from + kWindowSize;
+  if (to <= kSlots) {
+    CollectNacksInSlots(from, to, now_us, nacks);
+  } else {
+    CollectNacksInSlots(from, kSlots, now_us, nacks);
+    CollectNacksInSlots(0, to - kSlots, now_us, nacks);
+  }
+}
+
+void NackTracker::CollectNacksInSlots(int from, int to, int64_t now_us,
+                                      NackList* nacks) {
+  for (int word = from >> 6; word <= (to - 1) >> 6; ++word) {
+    uint64_t bits = pending_[word];
+    int base = word << 6;
+    if (from > base) {
+      bits &= ~(uint64_t)0 << (from - base);
+    }
+    if (to < base + 64) {
+      bits &= ((uint64_t)1 << (to - base)) - 1;
+    }
+    while (bits != 0) {
+      int slot = base + __builtin_ctzll(bits);
+      bits &= bits - 1;
+      uint16_t seqn =
+        highest_seqn_ - ((uint16_t)(highest_seqn_ - slot) & (kSlots - 1));
+      if (state_[slot] == SLOT_MISSING &&
+          now_us - ts_us_[slot] > SEQ_MISSING_WAIT) {
+        if (!nacks->Add(seqn)) {
+          return;
+        }
+        VLOG(3) << " Missed sequence number sending 1st NACK: " << seqn;
+        state_[slot] = SLOT_NACKED;
+        ts_us_[slot] = now_us;
+        times_[slot]++;
+      } else if (state_[slot] == SLOT_NACKED &&
+                 now_us - ts_us_[slot] > SEQ_NACKED_WAIT &&
+                 times_[slot] <= MAX_TIMES_OF_RESEND) {
+        if (!nacks->Add(seqn)) {
+          return;
+        }
+        VLOG(3) << " Missed sequence number sending next NACK " << seqn;
+        ts_us_[slot] = now_us;
+        times_[slot]++;
+        if (times_[slot] > MAX_TIMES_OF_RESEND) {
+          state_[slot] = SLOT_GIVEUP;
+          ClearPending(slot);
+        }
+      }
+    }
+  }
+}
+
+}  // namespace orbit
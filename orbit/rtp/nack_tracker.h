@@ -0,0 +1,94 @@
+/*
+ * Copyright 2016 All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * nack_tracker.h
+ * ---------------------------------------------------------------------------
+ * Keeps track of the received RTP seqs of a stream, and decides which lost
+ * packets should be NACKed.
+ * ---------------------------------------------------------------------------
+ * The last LAST_SEQS_MAX_LEN seqs are tracked in a sliding window of fixed
+ * slots indexed by (seq & mask), with a bitmap of the lost packets not yet
+ * given up, so a received packet costs O(1) plus a scan of the lost ones,
+ * without any allocation.
+ *
+ * A lost packet is NACKed after SEQ_MISSING_WAIT, then again every
+ * SEQ_NACKED_WAIT, at most MAX_TIMES_OF_RESEND times (the same policy as
+ * the janus seq_info_t list used before).
+ *
+ * Example usage:
+ *   NackTracker tracker;
+ *   NackList nacks;
+ *   tracker.OnPacketReceived(seqn, now_us, &nacks);
+ *   if (!nacks.empty()) { ... nacks.WriteRtcp(buf, len) and send it ... }
+ */
+
+#ifndef NACK_TRACKER_H_
+#define NACK_TRACKER_H_
+
+#include <stdint.h>
+
+#include "rtcp_nack.h"
+
+namespace orbit {
+
+class NackTracker {
+ public:
+  // The seqs tracked before the highest one received.
+  static const int kWindowSize = LAST_SEQS_MAX_LEN;
+  // The slots, a power of 2 larger than kWindowSize.
+  static const int kSlots = 256;
+
+  NackTracker();
+
+  // Tracks the received seqn, and appends the seqs to NACK now into nacks.
+  // now_us is a monotonic time in microseconds.
+  void OnPacketReceived(uint16_t seqn, int64_t now_us, NackList* nacks);
+
+  // Forgets all the tracked seqs, the next packet starts fresh.
+  void Reset();
+
+  // The number of the lost packets still tracked (not received or given up).
+  int lost_packets() const;
+
+  bool started() const {
+    return started_;
+  }
+  uint16_t highest_seqn() const {
+    return highest_seqn_;
+  }
+
+ private:
+  enum SlotState {
+    SLOT_RECEIVED = 0,
+    SLOT_MISSING,
+    SLOT_NACKED,
+    SLOT_GIVEUP,
+  };
+
+  // Slides the window forward to new_highest, the seqs skipped are missing.
+  void Advance(uint16_t new_highest, int64_t now_us);
+  // Appends the lost seqs due to be NACKed (in ascending seq order).
+  void CollectNacks(int64_t now_us, NackList* nacks);
+  void CollectNacksInSlots(int from, int to, int64_t now_us,
+                           NackList* nacks);
+
+  void SetPending(int slot) {
+    pending_[slot >> 6] |= (uint64_t)1 << (slot & 63);
+  }
+  void ClearPending(int slot) {
+    pending_[slot >> 6] &= ~((uint64_t)1 << (slot & 63));
+  }
+
+  bool started_;
+  uint16_t highest_seqn_;
+  // Bit set for the slots in SLOT_MISSING or SLOT_NACKED state.
+  uint64_t pending_[kSlots / 64];
+  uint8_t state_[kSlots];
+  uint8_t times_[kSlots];
+  int64_t ts_us_[kSlots];
+};
+
+}  // namespace orbit
+
+#endif  // NACK_TRACKER_H_
@@ -0,0 +1,162 @@
+/*
+ * Copyright 2016 All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * nack_tracker_test.cc
+ */
+
+#include "nack_tracker.h"
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace orbit {
+namespace {
+
+std::vector<uint16_t> SeqsOf(const NackList& nacks) {
+  std::vector<uint16_t> seqs;
+  char buf[NackList::kMaxRtcpSize];
+  int len = nacks.WriteRtcp(buf, sizeof(buf));
+  if (len > 0) {
+    ForEachRtcpNack(buf, len, [&seqs](uint16_t seqn) {
+        seqs.push_back(seqn);
+      });
+  }
+  return seqs;
+}
+
+TEST(NackListTest, BuildAndParse) {
+  NackList nacks;
+  EXPECT_TRUE(nacks.empty());
+  char buf[NackList::kMaxRtcpSize];
+  EXPECT_EQ(-1, nacks.WriteRtcp(buf, sizeof(buf)));
+
+  // 65530 and the following 16 seqs fit in one item.
+  nacks.Add(65530);
+  nacks.Add(65531);
+  nacks.Add(65531);
+  nacks.Add(10);
+  nacks.Add(11);
+  EXPECT_EQ(2, nacks.item_count());
+  EXPECT_EQ(4, nacks.seq_count());
+  EXPECT_EQ(65530, nacks.item(0).pid);
+  EXPECT_EQ(0x8001, nacks.item(0).blp);
+  EXPECT_EQ(11, nacks.item(1).pid);
+
+  int len = nacks.WriteRtcp(buf, sizeof(buf));
+  EXPECT_EQ(20, len);
+  EXPECT_EQ(-1, nacks.WriteRtcp(buf, 19));
+  std::vector<uint16_t> expected = {65530, 65531, 10, 11};
+  EXPECT_EQ(expected, SeqsOf(nacks));
+  EXPECT_EQ(4, CountRtcpNacks(buf, len));
+  // Truncated.
+  EXPECT_EQ(0, CountRtcpNacks(buf, len - 4));
+}
+
+TEST(NackListTest, Full) {
+  NackList nacks;
+  for (int i = 0; i < NackList::kMaxItems; ++i) {
+    EXPECT_TRUE(nacks.Add(i * 100));
+  }
+  EXPECT_FALSE(nacks.Add(NackList::kMaxItems * 100));
+  // Still fits in the last item.
+  EXPECT_TRUE(nacks.Add((NackList::kMaxItems - 1) * 100 + 16));
+}
+
+TEST(NackTrackerTest, NacksAfterMissingWait) {
+  NackTracker tracker;
+  NackList nacks;
+  int64_t now = 1000000;
+  tracker.OnPacketReceived(100, now, &nacks);
+  tracker.OnPacketReceived(103, now, &nacks);
+  EXPECT_TRUE(nacks.empty());
+  EXPECT_EQ(2, tracker.lost_packets());
+
+  // 102 arrives late.
+  now += SEQ_MISSING_WAIT / 2;
+  tracker.OnPacketReceived(102, now, &nacks);
+  EXPECT_TRUE(nacks.empty());
+  EXPECT_EQ(1, tracker.lost_packets());
+
+  now += SEQ_MISSING_WAIT;
+  tracker.OnPacketReceived(104, now, &nacks);
+  std::vector<uint16_t> expected = {101};
+  EXPECT_EQ(expected, SeqsOf(nacks));
+
+  // Not again before SEQ_NACKED_WAIT.
+  nacks.Clear();
+  tracker.OnPacketReceived(105, now + 1000, &nacks);
+  EXPECT_TRUE(nacks.empty());
+  now += SEQ_NACKED_WAIT + 1;
+  tracker.OnPacketReceived(106, now, &nacks);
+  EXPECT_EQ(expected, SeqsOf(nacks));
+
+  // Received after the NACK.
+  nacks.Clear();
+  tracker.OnPacketReceived(101, now, &nacks);
+  EXPECT_EQ(0, tracker.lost_packets());
+  now += SEQ_NACKED_WAIT + 1;
+  tracker.OnPacketReceived(107, now, &nacks);
+  EXPECT_TRUE(nacks.empty());
+}
+
+TEST(NackTrackerTest, GivesUp) {
+  NackTracker tracker;
+  NackList nacks;
+  int64_t now = 0;
+  tracker.OnPacketReceived(1, now, &nacks);
+  tracker.OnPacketReceived(3, now, &nacks);
+  int sent = 0;
+  uint16_t seqn = 4;
+  for (int i = 0; i < MAX_TIMES_OF_RESEND * 2; ++i) {
+    now += SEQ_NACKED_WAIT + 1;
+    nacks.Clear();
+    tracker.OnPacketReceived(seqn++, now, &nacks);
+    sent += nacks.seq_count();
+  }
+  EXPECT_EQ(MAX_TIMES_OF_RESEND + 1, sent);
+  EXPECT_EQ(0, tracker.lost_packets());
+}
+
+TEST(NackTrackerTest, WrapAroundInAscendingOrder) {
+  NackTracker tracker;
+  NackList nacks;
+  int64_t now = 0;
+  tracker.OnPacketReceived(65530, now, &nacks);
+  tracker.OnPacketReceived(65533, now, &nacks);
+  tracker.OnPacketReceived(2, now, &nacks);
+  EXPECT_EQ(2 + 4, tracker.lost_packets());
+  now += SEQ_MISSING_WAIT + 1;
+  tracker.OnPacketReceived(3, now, &nacks);
+  std::vector<uint16_t> expected = {65531, 65532, 65534, 65535, 0, 1};
+  EXPECT_EQ(expected, SeqsOf(nacks));
+}
+
+TEST(NackTrackerTest, WindowAndJumps) {
+  NackTracker tracker;
+  NackList nacks;
+  int64_t now = 0;
+  tracker.OnPacketReceived(1000, now, &nacks);
+  tracker.OnPacketReceived(1002, now, &nacks);
+  EXPECT_EQ(1, tracker.lost_packets());
+  // 1001 falls out of the window.
+  for (int seqn = 1003; seqn < 1002 + NackTracker::kWindowSize; ++seqn) {
+    tracker.OnPacketReceived(seqn, now, &nacks);
+  }
+  EXPECT_EQ(0, tracker.lost_packets());
+
+  // A big jump starts fresh.
+  tracker.OnPacketReceived(30000, now, &nacks);
+  EXPECT_EQ(30000, tracker.highest_seqn());
+  EXPECT_EQ(0, tracker.lost_packets());
+  // An old packet is ignored.
+  tracker.OnPacketReceived(29500, now, &nacks);
+  EXPECT_EQ(30000, tracker.highest_seqn());
+  now += SEQ_MISSING_WAIT + 1;
+  tracker.OnPacketReceived(30001, now, &nacks);
+  EXPECT_TRUE(nacks.empty());
+}
+
+}  // anonymous namespace
+}  // namespace orbit
@@ -0,0 +1,100 @@
+/*
+ * Copyright 2016 All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * retransmit_history.cc
+ */
+
+#include "retransmit_history.h"
+
+#include "rtp_headers.h"
+#include "glog/logging.h"
+
+namespace orbit {
+
+const int RetransmitHistory::kDefaultCapacity;
+const int RetransmitHistory::kDefaultMaxAgeMs;
+const int RetransmitHistory::kMaxRetries;
+const int RetransmitHistory::kMinRetransmitIntervalMs;
+
+RetransmitHistory::RetransmitHistory(int capacity, int max_age_ms)
+  : max_age_ms_(max_age_ms) {
+  capacity_ = 1;
+  while (capacity_ < capacity) {
+    capacity_ <<= 1;
+  }
+  mask_ = capacity_ - 1;
+  slots_.reset(new Slot[capacity_]);
+}
+
+RetransmitHistory::~RetransmitHistory() {
+}
+
+void RetransmitHistory::Put(const PacketBufferPtr& buffer, long long now_ms) {
+  if (buffer == NULL || buffer->length() < (int)sizeof(RtpHeader)) {
+    return;
+  }
+  uint16_t seqn =
+    reinterpret_cast<const RtpHeader*>(buffer->data())->getSeqNumber();
+  Slot& slot = slots_[seqn & mask_];
+  PacketBufferPtr evicted;
+  slot.Lock();
+  evicted.swap(slot.buffer);
+  slot.buffer = buffer;
+  slot.seqn = seqn;
+  slot.retries = 0;
+  slot.stored_ms = now_ms;
+  slot.sent_ms = now_ms;
+  slot.Unlock();
+  if (evicted == NULL) {
+    size_.fetch_add(1, std::memory_order_relaxed);
+  }
+  // The evicted buffer goes back to the pool here, out of the slot lock.
+}
+
+RetransmitHistory::LookupResult RetransmitHistory::GetForRetransmit(
+    uint16_t seqn, long long now_ms, PacketBufferPtr* buffer, int* retries) {
+  Slot& slot = slots_[seqn & mask_];
+  PacketBufferPtr expired;
+  LookupResult result = NOT_FOUND;
+  slot.Lock();
+  if (slot.buffer == NULL || slot.seqn != seqn) {
+    result = NOT_FOUND;
+  } else if (now_ms - slot.stored_ms > max_age_ms_) {
+    expired.swap(slot.buffer);
+    result = NOT_FOUND;
+  } else if (slot.retries >= kMaxRetries) {
+    result = TOO_MANY_RETRIES;
+  } else if (slot.retries > 0 &&
+             now_ms - slot.sent_ms <= kMinRetransmitIntervalMs) {
+    result = TOO_FREQUENT;
+  } else {
+    if (retries != NULL) {
+      *retries = slot.retries;
+    }
+    slot.retries++;
+    slot.sent_ms = now_ms;
+    *buffer = slot.buffer;
+    result = RETRANSMIT;
+  }
+  slot.Unlock();
+  if (expired != NULL) {
+    size_.fetch_sub(1, std::memory_order_relaxed);
+  }
+  return result;
+}
+
+void RetransmitHistory::Clear() {
+  for (int i = 0; i < capacity_; ++i) {
+    PacketBufferPtr evicted;
+    Slot& slot = slots_[i];
+    slot.Lock();
+    evicted.swap(slot.buffer);
+    slot.Unlock();
+    if (evicted != NULL) {
+      size_.fetch_sub(1, std::memory_order_relaxed);
+    }
+  }
+}
+
+}  // namespace orbit
@@ -0,0 +1,114 @@
+/*
+ * Copyright 2016 All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * retransmit_history.h
+ * ---------------------------------------------------------------------------
+ * Keeps the recently sent RTP packets of a stream, to answer the NACKs.
+ * ---------------------------------------------------------------------------
+ * The history is a fixed ring of slots indexed by (seq & mask), each holding
+ * a reference to the pooled PacketBuffer which was sent, so storing a packet
+ * doesn't copy or allocate and a NACK is answered in O(1).
+ *
+ * A packet is evicted when its slot is reused by a newer seq, or when it is
+ * older than max_age_ms. Each slot has its own spin lock, held only to
+ * copy a few fields, so Put() from the sending thread never waits for the
+ * NACK handling (nor the other way around), except on the very same slot.
+ *
+ * Example usage:
+ *   RetransmitHistory history;
+ *   history.Put(buffer, now_ms);  // for each sent packet.
+ *   ...
+ *   PacketBufferPtr buffer;
+ *   if (history.GetForRetransmit(seqn, now_ms, &buffer, NULL) ==
+ *       RetransmitHistory::RETRANSMIT) {
+ *     ... send buffer again ...
+ *   }
+ */
+
+#ifndef RETRANSMIT_HISTORY_H_
+#define RETRANSMIT_HISTORY_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+
+#include "stream_service/orbit/packet_buffer.h"
+
+namespace orbit {
+
+class RetransmitHistory {
+ public:
+  // Must be a power of 2.
+  static const int kDefaultCapacity = 512;
+  static const int kDefaultMaxAgeMs = 1000;
+  // A packet is retransmitted at most kMaxRetries times, and not again
+  // within kMinRetransmitIntervalMs.
+  static const int kMaxRetries = 5;
+  static const int kMinRetransmitIntervalMs = 30;
+
+  enum LookupResult {
+    RETRANSMIT = 0,    // The packet should be sent again.
+    NOT_FOUND,         // Never stored, evicted or expired.
+    TOO_FREQUENT,      // Retransmitted less than the min interval ago.
+    TOO_MANY_RETRIES,  // Already retransmitted kMaxRetries times.
+  };
+
+  // capacity is rounded up to a power of 2.
+  explicit RetransmitHistory(int capacity = kDefaultCapacity,
+                             int max_age_ms = kDefaultMaxAgeMs);
+  ~RetransmitHistory();
+
+  // Stores a sent RTP packet. The buffer is shared, not copied, it must not
+  // be modified afterwards.
+  void Put(const PacketBufferPtr& buffer, long long now_ms);
+
+  // Looks up the packet with the seqn, and if it should be retransmitted,
+  // counts the retry and returns the buffer. retries (if not NULL) is set to
+  // the number of retransmissions before this one.
+  LookupResult GetForRetransmit(uint16_t seqn, long long now_ms,
+                                PacketBufferPtr* buffer, int* retries);
+
+  // Releases all the stored packets.
+  void Clear();
+
+  // The number of packets stored, including those expired but not yet
+  // released.
+  int size() const {
+    return size_.load(std::memory_order_relaxed);
+  }
+  int capacity() const {
+    return capacity_;
+  }
+
+ private:
+  struct Slot {
+    std::atomic_flag lock = ATOMIC_FLAG_INIT;
+    uint16_t seqn = 0;
+    int retries = 0;
+    long long stored_ms = 0;
+    long long sent_ms = 0;
+    PacketBufferPtr buffer;
+
+    void Lock() {
+      while (lock.test_and_set(std::memory_order_acquire)) {
+      }
+    }
+    void Unlock() {
+      lock.clear(std::memory_order_release);
+    }
+  };
+
+  int capacity_;
+  int mask_;
+  int max_age_ms_;
+  std::unique_ptr<Slot[]> slots_;
+  std::atomic<int> size_{0};
+
+  RetransmitHistory(const RetransmitHistory&) = delete;
+  RetransmitHistory& operator=(const RetransmitHistory&) = delete;
+};
+
+}  // namespace orbit
+
+#endif  // RETRANSMIT_HISTORY_H_
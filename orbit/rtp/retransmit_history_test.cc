@@ -0,0 +1,114 @@
+/*
+ * Copyright 2016 All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * retransmit_history_test.cc
+ */
+
+#include "retransmit_history.h"
+
+#include <string.h>
+
+#include "rtp_headers.h"
+#include "gtest/gtest.h"
+
+namespace orbit {
+namespace {
+
+PacketBufferPtr MakePacket(uint16_t seqn) {
+  char data[100];
+  memset(data, 0, sizeof(data));
+  RtpHeader* h = reinterpret_cast<RtpHeader*>(data);
+  h->setVersion(2);
+  h->setSeqNumber(seqn);
+  return PacketBuffer::Create(data, sizeof(data));
+}
+
+TEST(RetransmitHistoryTest, Defaults) {
+  RetransmitHistory history;
+  EXPECT_EQ(0, history.size());
+  EXPECT_EQ(RetransmitHistory::kDefaultCapacity, history.capacity());
+  PacketBufferPtr buffer;
+  EXPECT_EQ(RetransmitHistory::NOT_FOUND,
+            history.GetForRetransmit(1, 0, &buffer, NULL));
+  EXPECT_TRUE(buffer == NULL);
+}
+
+TEST(RetransmitHistoryTest, SharesTheBuffer) {
+  RetransmitHistory history(16, 1000);
+  PacketBufferPtr sent = MakePacket(100);
+  history.Put(sent, 0);
+  EXPECT_EQ(1, history.size());
+  EXPECT_EQ(2, sent->ref_count());
+
+  PacketBufferPtr buffer;
+  int retries = -1;
+  EXPECT_EQ(RetransmitHistory::RETRANSMIT,
+            history.GetForRetransmit(100, 10, &buffer, &retries));
+  EXPECT_EQ(sent.get(), buffer.get());
+  EXPECT_EQ(0, retries);
+  EXPECT_EQ(RetransmitHistory::NOT_FOUND,
+            history.GetForRetransmit(101, 10, &buffer, NULL));
+}
+
+TEST(RetransmitHistoryTest, RetryLimits) {
+  RetransmitHistory history(16, 1000);
+  history.Put(MakePacket(7), 0);
+  PacketBufferPtr buffer;
+  int retries = -1;
+  long long now = 0;
+  EXPECT_EQ(RetransmitHistory::RETRANSMIT,
+            history.GetForRetransmit(7, now, &buffer, &retries));
+  EXPECT_EQ(0, retries);
+  // Too soon after the first retransmission.
+  EXPECT_EQ(RetransmitHistory::TOO_FREQUENT,
+            history.GetForRetransmit(7, now + 10, &buffer, NULL));
+  for (int i = 1; i < RetransmitHistory::kMaxRetries; ++i) {
+    now += RetransmitHistory::kMinRetransmitIntervalMs + 1;
+    EXPECT_EQ(RetransmitHistory::RETRANSMIT,
+              history.GetForRetransmit(7, now, &buffer, &retries));
+    EXPECT_EQ(i, retries);
+  }
+  now += RetransmitHistory::kMinRetransmitIntervalMs + 1;
+  EXPECT_EQ(RetransmitHistory::TOO_MANY_RETRIES,
+            history.GetForRetransmit(7, now, &buffer, NULL));
+}
+
+TEST(RetransmitHistoryTest, EvictedByNewerSeq) {
+  RetransmitHistory history(16, 1000);
+  for (int seqn = 65530; seqn < 65536 + 20; ++seqn) {
+    history.Put(MakePacket((uint16_t)seqn), 0);
+  }
+  EXPECT_EQ(16, history.size());
+  PacketBufferPtr buffer;
+  // The oldest packets were overwritten, across the wraparound.
+  EXPECT_EQ(RetransmitHistory::NOT_FOUND,
+            history.GetForRetransmit(65533, 0, &buffer, NULL));
+  EXPECT_EQ(RetransmitHistory::RETRANSMIT,
+            history.GetForRetransmit(4, 0, &buffer, NULL));
+  EXPECT_EQ(RetransmitHistory::RETRANSMIT,
+            history.GetForRetransmit(19, 0, &buffer, NULL));
+}
+
+TEST(RetransmitHistoryTest, ExpiredAndClear) {
+  RetransmitHistory history(16, 100);
+  PacketBufferPtr sent = MakePacket(1);
+  history.Put(sent, 0);
+  history.Put(MakePacket(2), 50);
+  PacketBufferPtr buffer;
+  EXPECT_EQ(RetransmitHistory::NOT_FOUND,
+            history.GetForRetransmit(1, 120, &buffer, NULL));
+  // The expired buffer is released.
+  EXPECT_EQ(1, sent->ref_count());
+  EXPECT_EQ(1, history.size());
+  EXPECT_EQ(RetransmitHistory::RETRANSMIT,
+            history.GetForRetransmit(2, 120, &buffer, NULL));
+
+  history.Clear();
+  EXPECT_EQ(0, history.size());
+  EXPECT_EQ(RetransmitHistory::NOT_FOUND,
+            history.GetForRetransmit(2, 120, &buffer, NULL));
+}
+
+}  // anonymous namespace
+}  // namespace orbit
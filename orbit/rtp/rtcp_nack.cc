@@ -0,0 +1,66 @@
+/*
+ * Copyright 2016 All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * rtcp_nack.cc
+ */
+
+#include "rtcp_nack.h"
+
+#include <string.h>
+
+namespace orbit {
+
+const int NackList::kMaxItems;
+const int NackList::kMaxRtcpSize;
+
+bool NackList::Add(uint16_t seqn) {
+  if (item_count_ > 0) {
+    NackItem& last = items_[item_count_ - 1];
+    uint16_t diff = seqn - last.pid;
+    if (diff == 0) {
+      return true;
+    }
+    if (diff <= 16) {
+      uint16_t bit = 1 << (diff - 1);
+      if ((last.blp & bit) == 0) {
+        last.blp |= bit;
+        seq_count_++;
+      }
+      return true;
+    }
+  }
+  if (item_count_ >= kMaxItems) {
+    return false;
+  }
+  items_[item_count_].pid = seqn;
+  items_[item_count_].blp = 0;
+  item_count_++;
+  seq_count_++;
+  return true;
+}
+
+int NackList::WriteRtcp(char* buf, int len) const {
+  int size = 12 + item_count_ * 4;
+  if (item_count_ == 0 || len < size) {
+    return -1;
+  }
+  memset(buf, 0, 12);
+  rtcp_header *rtcp = (rtcp_header *)buf;
+  rtcp->version = 2;
+  rtcp->type = RTCP_RTPFB;
+  rtcp->rc = 1;  /* FMT=1 */
+  rtcp->length = htons(size / 4 - 1);
+  rtcp_nack *nack = (rtcp_nack *)((rtcp_fb *)rtcp)->fci;
+  for (int i = 0; i < item_count_; ++i, ++nack) {
+    nack->pid = htons(items_[i].pid);
+    nack->blp = htons(items_[i].blp);
+  }
+  return size;
+}
+
+int CountRtcpNacks(const char* packet, int len) {
+  return ForEachRtcpNack(packet, len, [](uint16_t) {});
+}
+
+}  // namespace orbit
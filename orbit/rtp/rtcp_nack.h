@@ -0,0 +1,133 @@
+/*
+ * Copyright 2016 All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * rtcp_nack.h
+ * ---------------------------------------------------------------------------
+ * Builds and parses the RTCP Generic NACK (RFC 4585 section 6.2.1) without
+ * any allocation.
+ * ---------------------------------------------------------------------------
+ * Example usage:
+ *   NackList nacks;
+ *   nacks.Add(seq1);  // in ascending order (modulo the wraparound).
+ *   nacks.Add(seq2);
+ *   char buf[NackList::kMaxRtcpSize];
+ *   int len = nacks.WriteRtcp(buf, sizeof(buf));
+ *
+ *   ForEachRtcpNack(packet, len, [](uint16_t seqn) { ... });
+ */
+
+#ifndef RTCP_NACK_H_
+#define RTCP_NACK_H_
+
+#include <arpa/inet.h>
+#include <endian.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "janus_rtcp_defines.h"
+
+namespace orbit {
+
+// A NACK item (the PID and the bitmask of the following lost packets), in
+// host byte order.
+struct NackItem {
+  uint16_t pid;
+  uint16_t blp;
+};
+
+// A fixed size list of NACK items, filled by the seqs in ascending order.
+class NackList {
+ public:
+  // A NACK item covers 17 seqs, so 16 items cover more than the
+  // LAST_SEQS_MAX_LEN seqs tracked by the NackTracker.
+  static const int kMaxItems = 16;
+  // The RTCP header, the sender and media ssrcs, and the items.
+  static const int kMaxRtcpSize = 12 + kMaxItems * 4;
+
+  NackList() {}
+
+  // Adds a lost seq, which must be after the last one added. Returns false
+  // if there is no room for a new item.
+  bool Add(uint16_t seqn);
+
+  // Writes the RTCP RTPFB/NACK packet (with zero ssrcs, they are fixed
+  // by the transport) into buf. Returns the length, or -1 if the list is
+  // empty or buf is too small.
+  int WriteRtcp(char* buf, int len) const;
+
+  void Clear() {
+    item_count_ = 0;
+    seq_count_ = 0;
+  }
+  bool empty() const {
+    return item_count_ == 0;
+  }
+  int item_count() const {
+    return item_count_;
+  }
+  // The number of the seqs in the items.
+  int seq_count() const {
+    return seq_count_;
+  }
+  const NackItem& item(int i) const {
+    return items_[i];
+  }
+
+ private:
+  NackItem items_[kMaxItems];
+  int item_count_ = 0;
+  int seq_count_ = 0;
+};
+
+// Calls f(seqn) for each seq NACKed by the RTCP (maybe compound) packet, by
+// walking the FCI in place. Returns the number of seqs.
+template <typename Func>
+int ForEachRtcpNack(const char* packet, int len, Func f) {
+  if (packet == NULL || len < (int)sizeof(rtcp_header)) {
+    return 0;
+  }
+  int count = 0;
+  const char* end = packet + len;
+  const char* p = packet;
+  while (p + sizeof(rtcp_header) <= end) {
+    const rtcp_header* rtcp = reinterpret_cast<const rtcp_header*>(p);
+    if (rtcp->version != 2) {
+      break;
+    }
+    int length = ntohs(rtcp->length);
+    const char* next = p + length * 4 + 4;
+    if (next > end) {
+      break;
+    }
+    if (rtcp->type == RTCP_RTPFB && rtcp->rc == 1) {
+      const rtcp_fb* rtcpfb = reinterpret_cast<const rtcp_fb*>(p);
+      int items = length - 2;  /* Skip SSRCs */
+      const rtcp_nack* nack = reinterpret_cast<const rtcp_nack*>(rtcpfb->fci);
+      for (int i = 0; i < items; ++i, ++nack) {
+        uint16_t pid = ntohs(nack->pid);
+        uint16_t blp = ntohs(nack->blp);
+        f(pid);
+        count++;
+        while (blp != 0) {
+          int j = __builtin_ctz(blp);
+          f((uint16_t)(pid + j + 1));
+          count++;
+          blp &= blp - 1;
+        }
+      }
+    }
+    if (length == 0) {
+      break;
+    }
+    p = next;
+  }
+  return count;
+}
+
+// Returns the number of seqs NACKed by the RTCP packet.
+int CountRtcpNacks(const char* packet, int len);
+
+}  // namespace orbit
+
+#endif  // RTCP_NACK_H_
@@ -574,20 +574,21 @@ void RtcpProcessor::RtcpProcessIncomingRtcp(packetType packet_type,
   rtcp_receiver_->RtcpProcessIncomingRtcp(packet_type,buf,len);
 }
 
-  void RtcpProcessor::NackPushVideoPacket(char* buf, int len) {
+  void RtcpProcessor::NackPushVideoPacket(const PacketBufferPtr& buffer) {
     //Use the packet's ssrc identifier to get the relative nack processor
-    RtpHeader* rtp_header = reinterpret_cast<RtpHeader*>(buf);
+    const RtpHeader* rtp_header =
+      reinterpret_cast<const RtpHeader*>(buffer->data());
     uint32_t seq = rtp_header->getSeqNumber();
     uint32_t ssrc = rtp_header->getSSRC();
     VLOG(3) <<"Nack push video packet ,seq = " << seq
               <<", ssrc = " << ssrc;
     std::shared_ptr<NackProcessor> video_nack_processor = GetNackProcessor(ssrc);
     if (video_nack_processor.get() != NULL)
-      video_nack_processor->PushPacket(buf, len);
+      video_nack_processor->PushBuffer(buffer);
   }
 
-  void RtcpProcessor::NackPushAudioPacket(char* buf, int len) {
-    audio_nack_processor_->PushPacket(buf, len);
+  void RtcpProcessor::NackPushAudioPacket(const PacketBufferPtr& buffer) {
+    audio_nack_processor_->PushBuffer(buffer);
   }
 
   void RtcpProcessor::SendRembPacket(uint64_t bitrate) {
@@ -17,6 +17,7 @@
 #include "rtp_headers.h"
 #include "janus_rtcp_processor.h"
 #include "stream_service/orbit/media_definitions.h"
+#include "stream_service/orbit/packet_buffer.h"
 
 #include "webrtc/system_wrappers/include/clock.h"
 #include "webrtc/modules/rtp_rtcp/include/rtp_header_parser.h"
@@ -134,9 +135,13 @@ class RtcpProcessor {
      */
     void RtcpProcessIncomingRtcp(packetType packet_type, char* buf, int len);
 
-    void NackPushVideoPacket(char* buf, int len);
+    /*
+     * Keeps the sent packet for retransmission. The buffer is shared with
+     * the send path, not copied.
+     */
+    void NackPushVideoPacket(const PacketBufferPtr& buffer);
 
-    void NackPushAudioPacket(char* buf, int len);
+    void NackPushAudioPacket(const PacketBufferPtr& buffer);
 
     void SendRembPacket(uint64_t bitrate);
 
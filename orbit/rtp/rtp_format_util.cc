@@ -13,10 +13,13 @@
 
 namespace orbit {
   bool IsValidVideoPacket(const orbit::dataPacket& rtp_packet) {
+    return IsValidVideoPacket(rtp_packet.data, rtp_packet.length);
+  }
+
+  bool IsValidVideoPacket(const char* rtp_packet, int length) {
     webrtc::RtpDepacketizer::ParsedPayload payload;
-    const unsigned char* buf = 
-      reinterpret_cast<const unsigned char*>(&(rtp_packet.data[0]));
-    int length = rtp_packet.length;
+    const unsigned char* buf =
+      reinterpret_cast<const unsigned char*>(rtp_packet);
 
     const RtpHeader* h = reinterpret_cast<const RtpHeader*>(buf);
     int video_payload = (int)(h->getPayloadType());
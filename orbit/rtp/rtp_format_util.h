@@ -11,6 +11,7 @@
 namespace orbit {
   class dataPacket; 
   bool IsValidVideoPacket(const orbit::dataPacket& rtp_packet);
+  bool IsValidVideoPacket(const char* rtp_packet, int length);
   bool IsKeyFramePacket(std::shared_ptr<orbit::dataPacket> rtp_packet); 
 
 } // end namespace orbit
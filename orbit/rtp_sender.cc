@@ -12,104 +12,215 @@
 #include "stream_service/orbit/base/timeutil.h"
 #include "stream_service/orbit/transport_delegate.h"
 #include "rtp/rtp_headers.h"
-#include <sys/prctl.h>
+#include "stream_service/orbit/base/singleton.h"
 
-#define SEND_QUEUE_SLEEP_TIME 1000 // in us, i.e. 1000us = 1ms
+#include <algorithm>
+
+// The max number of packets sent from one queue before re-checking the
+// higher priority queues.
+#define SEND_QUEUE_BATCH_SIZE 16
 
 namespace orbit {
+namespace {
+  // The capacity of the sender queue of each SendPacketClass.
+  const size_t kSendQueueCapacity[SEND_CLASS_COUNT] = {
+    256,   // SEND_CLASS_RTCP
+    512,   // SEND_CLASS_AUDIO
+    512,   // SEND_CLASS_RETRANSMIT
+    2048,  // SEND_CLASS_VIDEO
+  };
+}  // annoymous namespace
+
   RtpSender::RtpSender(TransportDelegate* transport_delegate) {
     transport_delegate_ = transport_delegate;
-
-    running_ = true;
-    sender_thread_.reset(
-      new boost::thread(boost::bind(&RtpSender::SendThreadLoop, this)));
+    for (int i = 0; i < SEND_CLASS_COUNT; ++i) {
+      send_queues_[i].reset(new MpscRing<RtpSendPacket>(kSendQueueCapacity[i]));
+    }
+    scheduler_ = Singleton<EgressScheduler>::GetInstance();
+    scheduler_->Register(this);
   }
 
   RtpSender::~RtpSender() {
-    running_ = false;
-    if (sender_thread_ != NULL) {
-      sender_thread_->join();
-    }
-    // clear send_pq_
-    {
-      boost::mutex::scoped_lock lock(send_pq_mutex_);
-      int queue_size = send_pq_.size();
-      if (queue_size > 0) {
-        LOG(INFO) << "RtpSender::~RtpSender free the send_pq_ which size = " << queue_size;
-      }
-      while(queue_size > 0) {
-        RtpSendPacket p = send_pq_.top();
-        if (p.buf) {
-          free(p.buf);
-          p.buf = NULL;
-        }
-        send_pq_.pop();
-        queue_size --;
-      }
-    }// end clear send_pq_
+    scheduler_->Unregister(this);
+    ClearQueues();
+    if (dropped_packets_ > 0) {
+      LOG(INFO) << "RtpSender::~RtpSender dropped_packets=" << dropped_packets_;
+    }
+  }
+
+  void RtpSender::Wakeup() {
+    scheduler_->Schedule(this);
+  }
+
+  int RtpSender::GetSendPacketClass(int priority, char* data, int len) {
+    RtcpHeader* rtcp = reinterpret_cast<RtcpHeader*>(data);
+    if (rtcp->isRtcp()) {
+      return SEND_CLASS_RTCP;
+    }
+    switch (priority) {
+    case AUDIO_PRIORITY:
+      return SEND_CLASS_AUDIO;
+    case RETRANSMIT_PRIORITY:
+    case VIDEO_RTX_PRIORITY:
+      return SEND_CLASS_RETRANSMIT;
+    default:
+      return SEND_CLASS_VIDEO;
+    }
   }
 
   void RtpSender::WriteAndSend(Transport* transport, int priority,
-                               unsigned char* data, int len) {
-    unsigned char* buf = reinterpret_cast<unsigned char*>(malloc(len));
-    memcpy(buf, data, len);
+                               const PacketBufferPtr& buffer) {
     RtpSendPacket packet;
     packet.priority = priority;
     packet.transport = transport;
     /* Get the sequence number of the RTP packet (buf) */
-    const RtpHeader* h = reinterpret_cast<const RtpHeader*>(buf);
+    const RtpHeader* h = reinterpret_cast<const RtpHeader*>(buffer->data());
     packet.seqn = h->getSeqNumber();
 
     // Get the inqueue current timestamp.
     packet.queue_ts = getTimeMS();
-    packet.buf = buf;
-    packet.buf_size = len;
-    boost::mutex::scoped_lock lock(send_pq_mutex_);
-    send_pq_.push(packet);  
+    packet.buffer = buffer;
+    PacketTraceContext* trace = PacketTracer::Current();
+    if (trace != NULL && trace->sampled()) {
+      packet.trace = *trace;
+      packet.trace.stage_us = GetCurrentTime_US();
+    }
+
+    int send_class = GetSendPacketClass(priority, buffer->data(), buffer->length());
+    if (!send_queues_[send_class]->TryPush(packet)) {
+      // Never block the media threads, drop the packet instead. The receiver
+      // will NACK the lost video packets.
+      dropped_packets_++;
+      LOG_EVERY_N(WARNING, 100) << "RtpSender queue is full, send_class="
+                                << send_class << " dropped_packets="
+                                << dropped_packets_;
+      return;
+    }
+    scheduler_->Schedule(this);
+  }
+
+  bool RtpSender::IsTransportReady() const {
+    return transport_delegate_->transport_state_ == TRANSPORT_READY;
   }
 
-  void RtpSender::SendThreadLoop() {
-    /* Set thread name */
-    prctl(PR_SET_NAME, (unsigned long)"TransportSendLoop");
+  bool RtpSender::HasPendingPackets() const {
+    for (int i = 0; i < SEND_CLASS_COUNT; ++i) {
+      if (!send_queues_[i]->EmptyApprox()) {
+        return true;
+      }
+    }
+    return false;
+  }
 
-    auto mypq = &(send_pq_);
-    while (running_) {
-      bool transport_ready = (transport_delegate_->transport_state_ == TRANSPORT_READY);
-      if (!transport_ready || mypq->empty()) {
-        usleep(SEND_QUEUE_SLEEP_TIME);
-        continue;
+  int RtpSender::DrainQueue(int send_class, int max_packets,
+                            UdpBatchSender* batch) {
+    MpscRing<RtpSendPacket>* queue = send_queues_[send_class].get();
+    // The packets for the same transport are handed over together, so the
+    // transport protects them into the batch in one go.
+    PacketBufferPtr buffers[SEND_QUEUE_BATCH_SIZE];
+    PacketTraceContext traces[SEND_QUEUE_BATCH_SIZE];
+    Transport* transport = NULL;
+    int count = 0;
+    int sent = 0;
+    RtpSendPacket p;
+    if (max_packets > SEND_QUEUE_BATCH_SIZE) {
+      max_packets = SEND_QUEUE_BATCH_SIZE;
+    }
+    while (sent < max_packets && queue->TryPop(&p)) {
+      int buf_size = p.buffer->length();
+      if (VLOG_IS_ON(3)) {
+        const RtpHeader* h = reinterpret_cast<const RtpHeader*>(p.buffer->data());
+        VLOG(3) << "SendBUF******* ---- buf_size=" << buf_size
+                << " send_class=" << send_class
+                << " payload=" << (int)(h->getPayloadType())
+                << " ts=" <<  h->getTimestamp()
+                << " seq=" << h->getSeqNumber()
+                << " inQueueTime=" << getTimeMS() - p.queue_ts << " ms";
       }
-      boost::mutex::scoped_lock lock(send_pq_mutex_);
-      RtpSendPacket p = mypq->top();
-      if (p.priority == 1) {
-        const RtpHeader* h = reinterpret_cast<const RtpHeader*>(p.buf);
-        VLOG(3) << "Write ---- p.buf_size=" << p.buf_size;
-        VLOG(3) << " payload=" << (int)(h->getPayloadType())
-                  << " ts=" <<  h->getTimestamp()  
-                  << " seq=" << h->getSeqNumber()
-                  << " h->getMarker()=" << (int)(h->getMarker())
-                  << " headerLength=" << h->getHeaderLength();
-        VLOG(3) << "pq.size=" << mypq->size();
-        p.transport->write((char*)p.buf, p.buf_size);
-        free(p.buf);
-        mypq->pop();
-        transport_delegate_->UpdateSenderBitrate(p.buf_size);
-      } else {
-        //....Send
-        long cur = getTimeMS();
-        const RtpHeader* h = reinterpret_cast<const RtpHeader*>(p.buf);
-        VLOG(3) << "SendBUF******* ---- p.buf_size=" << p.buf_size;
-        VLOG(3) << " payload=" << (int)(h->getPayloadType())
-                  << " ts=" <<  h->getTimestamp()
-                  << " seq=" << h->getSeqNumber();
-        VLOG(3) << " inQueueTime=" << cur - p.queue_ts << " ms";
-
-        p.transport->write((char*)p.buf, p.buf_size);
-        free(p.buf);
-        mypq->pop();
-        transport_delegate_->UpdateSenderBitrate(p.buf_size);
+      if (p.transport != transport && count > 0) {
+        WriteBuffers(transport, buffers, traces, count, batch);
+        count = 0;
+      }
+      transport = p.transport;
+      PacketTracer::EndStage(&p.trace, TRACE_STAGE_SENDER_QUEUE);
+      traces[count] = p.trace;
+      buffers[count++].swap(p.buffer);
+      transport_delegate_->UpdateSenderBitrate(buf_size);
+      sent++;
+    }
+    if (count > 0) {
+      WriteBuffers(transport, buffers, traces, count, batch);
+    }
+    return sent;
+  }
+
+  void RtpSender::WriteBuffers(Transport* transport, PacketBufferPtr* buffers,
+                               PacketTraceContext* traces, int count,
+                               UdpBatchSender* batch) {
+    int begin = 0;
+    for (int i = 0; i < count; ++i) {
+      if (!traces[i].sampled()) {
         continue;
       }
+      if (i > begin) {
+        transport->writeBuffers(buffers + begin, i - begin, batch);
+      }
+      {
+        PacketTraceScope trace_scope(&traces[i]);
+        transport->writeBuffers(buffers + i, 1, batch);
+      }
+      PacketTracer::EndTrace(&traces[i]);
+      begin = i + 1;
+    }
+    if (count > begin) {
+      transport->writeBuffers(buffers + begin, count - begin, batch);
+    }
+    // Give the buffers back to the pool now.
+    for (int i = 0; i < count; ++i) {
+      buffers[i].reset();
+    }
+  }
+
+  int RtpSender::QueuedPacketsApprox() const {
+    int size = 0;
+    for (int i = 0; i < SEND_CLASS_COUNT; ++i) {
+      size += send_queues_[i]->SizeApprox();
+    }
+    return size;
+  }
+
+  int RtpSender::SendPendingPackets(int max_packets, UdpBatchSender* batch) {
+    int total = 0;
+    while (total < max_packets) {
+      int batch_size = std::min(SEND_QUEUE_BATCH_SIZE, max_packets - total);
+      int sent = 0;
+      for (int i = 0; i < SEND_CLASS_COUNT; ++i) {
+        sent = DrainQueue(i, batch_size, batch);
+        if (sent > 0) {
+          // Restart from the highest priority queue after each batch, so the
+          // RTCP and audio packets are not starved by a burst of video.
+          break;
+        }
+      }
+      if (sent == 0) {
+        break;
+      }
+      total += sent;
+    }
+    return total;
+  }
+
+  void RtpSender::ClearQueues() {
+    int cleared = 0;
+    RtpSendPacket p;
+    for (int i = 0; i < SEND_CLASS_COUNT; ++i) {
+      while (send_queues_[i]->TryPop(&p)) {
+        p.buffer.reset();
+        cleared++;
+      }
+    }
+    if (cleared > 0) {
+      LOG(INFO) << "RtpSender::ClearQueues free the queued packets, size=" << cleared;
     }
   }
 } // namespace orbit
@@ -10,10 +10,16 @@
  */
 
 #pragma once
-#include <boost/thread/mutex.hpp>
 #include <boost/scoped_ptr.hpp>
 
+#include <atomic>
+
 #include "transport.h"
+#include "packet_buffer.h"
+#include "packet_trace.h"
+#include "egress_scheduler.h"
+#include "stream_service/orbit/base/mpsc_ring.h"
+
 namespace orbit {
 // Forward declartion
 class TransportDelegate;
@@ -27,57 +33,85 @@ class TransportDelegate;
     DEFAULT_PRIORITY = 10, // VIDEO is also in this priority.
   };
 
+  // The sender keeps one queue per class. The queues are drained strictly
+  // in this order, i.e. a REMB/RTCP packet never waits behind video.
+  enum SendPacketClass {
+    SEND_CLASS_RTCP = 0,    // REMB and the other RTCP feedback.
+    SEND_CLASS_AUDIO,
+    SEND_CLASS_RETRANSMIT,  // NACK retransmissions and RTX.
+    SEND_CLASS_VIDEO,       // Video, FEC and everything else.
+    SEND_CLASS_COUNT
+  };
+
  // A packet to store the outgoing packets.
  struct RtpSendPacket {
    int priority;
    int seqn;
    long queue_ts;
    Transport* transport;
-   unsigned char* buf;
-   int buf_size;
+   PacketBufferPtr buffer;  // Shared with the caller, not copied.
+   // The trace of this copy of the packet, the buffer may be shared.
+   PacketTraceContext trace;
    RtpSendPacket() {
    }
  };
 
- // A functor use to packets' ordering and sorting in sender queue.
-class RtpSendPacketComparator {
-public:
-  bool operator() (RtpSendPacket a, RtpSendPacket b)
-  {
-    if (a.priority > b.priority) {
-      return true;
-    } else {
-      if (a.seqn > b.seqn) {
-        return true;
-      }
-      return false;
-    }
-  }
-};
-
 class RtpSender {
  public:
   RtpSender(TransportDelegate *transport_delegate);
   ~RtpSender();
+
+  // Schedules the sender to send the packets queued before the transport
+  // became ready.
+  void Wakeup();
  private:
-  // The transport_delegate maintains a RTP/RTCP sender in the class
-  void WriteAndSend(Transport* transport, int priority, unsigned char* data, int len);
-  // A thread maintained by this class to send the packets to other endpoint.
-  void SendThreadLoop();
+  // The transport_delegate maintains a RTP/RTCP sender in the class.
+  // Never blocks: if the queue of the packet's class is full the packet is
+  // dropped.
+  void WriteAndSend(Transport* transport, int priority, const PacketBufferPtr& buffer);
+
+  // The following functions are called by the EgressScheduler workers.
+  // Sends at most max_packets packets from all the queues, in the priority
+  // order. Returns the number of packets sent. If batch is not NULL, the
+  // packets may be added into it and are sent when the worker flushes it.
+  int SendPendingPackets(int max_packets, UdpBatchSender* batch);
+  bool HasPendingPackets() const;
+  int QueuedPacketsApprox() const;
+  bool IsTransportReady() const;
+
+  // Sends at most max_packets packets from the queue of send_class.
+  // Returns the number of packets sent.
+  int DrainQueue(int send_class, int max_packets, UdpBatchSender* batch);
+  // Hands the buffers to the transport and releases them. Each sampled
+  // packet is written on its own, so its SRTP and socket stages are its
+  // own.
+  void WriteBuffers(Transport* transport, PacketBufferPtr* buffers,
+                    PacketTraceContext* traces, int count,
+                    UdpBatchSender* batch);
+  // Frees all the packets left in the queues.
+  void ClearQueues();
+
+  static int GetSendPacketClass(int priority, char* data, int len);
 
   // The reference to the tranport_delegate_
   TransportDelegate *transport_delegate_;
-  // mutex to lock the sender queue.
-  boost::mutex send_pq_mutex_;
-  // seqn hash_set - the sender queue ordered by priority and sequence number.
-  std::priority_queue<RtpSendPacket, std::vector<RtpSendPacket>, RtpSendPacketComparator> send_pq_;
+  // The sender queues, one per SendPacketClass. Multiple producers (the
+  // media threads) and a single consumer (the egress worker running this
+  // sender).
+  boost::scoped_ptr<MpscRing<RtpSendPacket> > send_queues_[SEND_CLASS_COUNT];
+  // The number of packets dropped because the sender queue was full.
+  std::atomic<uint64_t> dropped_packets_{0};
 
-  // the thread to 
-  boost::scoped_ptr<boost::thread> sender_thread_;
-  // The flag of the running status of the class/thread.
-  bool running_ = false;
+  // The scheduler shared by all the senders in the process.
+  EgressScheduler* scheduler_;
+  // The following fields are maintained by the EgressScheduler.
+  int worker_index_ = 0;                 // The home worker.
+  std::atomic<bool> scheduled_{false};   // In a run queue or being run.
+  std::atomic<bool> closing_{false};     // Being unregistered.
+  std::atomic<int> run_count_{0};        // The workers holding the sender.
 
   friend class TransportDelegate;
+  friend class EgressScheduler;
 };
 
 }  // namespace orbit
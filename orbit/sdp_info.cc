@@ -731,6 +731,8 @@ namespace orbit {
     std::istringstream iss(sdp);
     int mlineNum = -1;
     std::vector<std::string> tmpFeedbackVector;
+    // <video ssrc, rtx ssrc> of the a=ssrc-group:FID lines.
+    std::vector<std::pair<unsigned int, unsigned int> > tmpFidGroups;
 
     MediaType mtype = OTHER;
     if (media == "audio") {
@@ -922,11 +924,21 @@ namespace orbit {
       }
       if (isSsrcGroup != std::string::npos) {
         if (mtype == VIDEO_TYPE){
-          VLOG(2) << "FID group detected";
           std::vector<std::string> parts = stringutil::splitOneOf(line, " :", 10);
-          if (parts.size()>=4){
-            videoRtxSsrc = strtoul(parts[3].c_str(), NULL, 10);
-            VLOG(2) << "Setting videoRtxSsrc to " << videoRtxSsrc;
+          if (parts.size()>=3 && parts[1] == "SIM") {
+            // a=ssrc-group:SIM <layer 0 ssrc> <layer 1 ssrc> ...
+            VLOG(2) << "SIM group detected";
+            simulcastVideoSsrcs.clear();
+            for (size_t i = 2; i < parts.size(); i++) {
+              simulcastVideoSsrcs.push_back(strtoul(parts[i].c_str(), NULL, 10));
+            }
+            videoSsrc = simulcastVideoSsrcs[0];
+            VLOG(2) << "Setting videoSsrc to the lowest layer " << videoSsrc;
+          } else if (parts.size()>=4){
+            VLOG(2) << "FID group detected";
+            tmpFidGroups.push_back(std::make_pair(
+                strtoul(parts[2].c_str(), NULL, 10),
+                strtoul(parts[3].c_str(), NULL, 10)));
           }
         }
       }
@@ -1039,6 +1051,20 @@ namespace orbit {
       }
     }
 
+    // Map the FID groups after the SIM group, which may come after them.
+    // With simulcast, there is a FID group per layer. Only the lowest layer
+    // is the videoRtxSsrc.
+    for (size_t i = 0; i < tmpFidGroups.size(); i++) {
+      unsigned int ssrc = tmpFidGroups[i].first;
+      unsigned int rtx_ssrc = tmpFidGroups[i].second;
+      if (getSimulcastLayer(ssrc) > 0) {
+        simulcastRtxSsrcs.push_back(rtx_ssrc);
+      } else {
+        videoRtxSsrc = rtx_ssrc;
+        VLOG(2) << "Setting videoRtxSsrc to " << videoRtxSsrc;
+      }
+    }
+
     // Map the RTCP Feedback after we have built the payload vector
     for (unsigned int fbi = 0; fbi < tmpFeedbackVector.size(); fbi++){
       std::string line = tmpFeedbackVector[fbi];
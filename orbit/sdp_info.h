@@ -366,6 +366,32 @@ public:
       return videoRtxSsrc;
     }
 
+    // The simulcast layer (the index in the a=ssrc-group:SIM line, 0 is the
+    // lowest resolution) of the video ssrc, or -1 if the ssrc is not
+    // simulcast.
+    int getSimulcastLayer(unsigned int ssrc) const {
+      for (size_t i = 0; i < simulcastVideoSsrcs.size(); ++i) {
+        if (simulcastVideoSsrcs[i] == ssrc) {
+          return i;
+        }
+      }
+      return -1;
+    }
+
+    std::vector<unsigned int> getSimulcastVideoSsrcs() const {
+      return simulcastVideoSsrcs;
+    }
+
+    // Whether the ssrc is the RTX of a simulcast layer above the lowest one.
+    bool isSimulcastRtxSsrc(unsigned int ssrc) const {
+      for (unsigned int rtx_ssrc : simulcastRtxSsrcs) {
+        if (rtx_ssrc == ssrc) {
+          return true;
+        }
+      }
+      return false;
+    }
+
     // Getter/setter function for private variable: isBundle
     void setIsBundle(bool is_bundle) {
       isBundle = is_bundle;
@@ -493,6 +519,13 @@ private:
     unsigned int videoSsrc;
     unsigned int videoRtxSsrc;
     std::vector<unsigned int> extended_video_ssrc;
+    /**
+     * The video SSRCs of the a=ssrc-group:SIM line, lowest layer first, and
+     * the RTX SSRCs of the layers above the lowest one. videoSsrc and
+     * videoRtxSsrc are the lowest layer.
+     */
+    std::vector<unsigned int> simulcastVideoSsrcs;
+    std::vector<unsigned int> simulcastRtxSsrcs;
 
     /**
     * Is it Bundle
@@ -73,6 +73,56 @@ TEST_F(SdpInfoTest, ChromeHasSSRCButFirefoxDoesNotHave) {
   }
 }
 
+TEST_F(SdpInfoTest, ChromeSimulcastSdp) {
+  {
+    orbit::SdpInfo sdp;
+    std::ifstream ifs(TEST_DIR + "ChromeSimulcast.sdp", std::fstream::in);
+    std::string sdpString = readFile(ifs);
+    sdp.initWithSdp(sdpString, "video");
+    // The lowest layer is the video ssrc.
+    EXPECT_EQ(1640977436, sdp.getVideoSsrc());
+    EXPECT_EQ(806712760, sdp.getVideoRtxSsrc());
+    EXPECT_EQ(3, sdp.getSimulcastVideoSsrcs().size());
+    EXPECT_EQ(0, sdp.getSimulcastLayer(1640977436));
+    EXPECT_EQ(1, sdp.getSimulcastLayer(2904761925));
+    EXPECT_EQ(2, sdp.getSimulcastLayer(3358311872));
+    EXPECT_EQ(-1, sdp.getSimulcastLayer(806712760));
+    EXPECT_TRUE(sdp.isSimulcastRtxSsrc(1177313946));
+    EXPECT_TRUE(sdp.isSimulcastRtxSsrc(2449021073));
+    EXPECT_FALSE(sdp.isSimulcastRtxSsrc(806712760));
+  }
+  {
+    orbit::SdpInfo sdp;
+    std::ifstream ifs(TEST_DIR + "Chrome.sdp", std::fstream::in);
+    std::string sdpString = readFile(ifs);
+    sdp.initWithSdp(sdpString, "video");
+    EXPECT_EQ(806712760, sdp.getVideoRtxSsrc());
+    EXPECT_EQ(0, sdp.getSimulcastVideoSsrcs().size());
+    EXPECT_EQ(-1, sdp.getSimulcastLayer(1640977436));
+  }
+}
+
+TEST_F(SdpInfoTest, SimulcastFidBeforeSim) {
+  orbit::SdpInfo sdp;
+  std::ifstream ifs(TEST_DIR + "ChromeSimulcast.sdp", std::fstream::in);
+  std::string sdpString = readFile(ifs);
+  // Moves the SIM group after the FID groups.
+  const std::string sim = "a=ssrc-group:SIM 1640977436 2904761925 3358311872\n";
+  size_t pos = sdpString.find(sim);
+  ASSERT_NE(std::string::npos, pos);
+  sdpString.erase(pos, sim.size());
+  pos = sdpString.find("a=ssrc-group:FID 3358311872 2449021073\n");
+  ASSERT_NE(std::string::npos, pos);
+  sdpString.insert(sdpString.find("\n", pos) + 1, sim);
+  sdp.initWithSdp(sdpString, "video");
+  EXPECT_EQ(1640977436, sdp.getVideoSsrc());
+  EXPECT_EQ(806712760, sdp.getVideoRtxSsrc());
+  EXPECT_EQ(3, sdp.getSimulcastVideoSsrcs().size());
+  EXPECT_TRUE(sdp.isSimulcastRtxSsrc(1177313946));
+  EXPECT_TRUE(sdp.isSimulcastRtxSsrc(2449021073));
+  EXPECT_FALSE(sdp.isSimulcastRtxSsrc(806712760));
+}
+
 TEST_F(SdpInfoTest, CreateOfferSdp) {
   {
     orbit::SdpInfo sdp;
@@ -44,6 +44,7 @@
 
 // For the http server and handler with implementation
 #include "stream_service/orbit/http_server/statusz_handler.h"
+#include "stream_service/orbit/http_server/tracez_handler.h"
 #include "stream_service/orbit/http_server/varz_handler.h"
 #include "stream_service/orbit/http_server/rpcz_handler.h"
 #include "stream_service/orbit/http_server/pretty_signin_handler.h"
@@ -181,18 +182,24 @@ public:
     server->RegisterHandler("/varz", varz_handler);
     orbit::FlagzHandler* flagz_handler = new orbit::FlagzHandler();
     server->RegisterHandler("/flagz", flagz_handler);
+    orbit::HistogramzHandler* histogramz_handler = new orbit::HistogramzHandler();
+    server->RegisterHandler("/histogramz", histogramz_handler);
     orbit::RpczHandler* rpcz_handler = new orbit::RpczHandler();
     server->RegisterHandler("/rpcz", rpcz_handler);
     orbit::StatuszHandler* statusz_handler = new orbit::StatuszHandler();
     server->RegisterHandler("/statusz", statusz_handler);
+    orbit::TracezHandler* tracez_handler = new orbit::TracezHandler();
+    server->RegisterHandler("/tracez", tracez_handler);
     orbit::ZkStatuszHandler* zk_statusz_handler = new orbit::ZkStatuszHandler();
     server->RegisterHandler("/zkstatus", zk_statusz_handler);
     
     // Secure endpoints if flag is enabled.
     if (FLAGS_use_http_auth) {
       varz_handler->SetAuthMode(true, "/signin", SESSION_KEY, "/varz");
+      histogramz_handler->SetAuthMode(true, "/signin", SESSION_KEY, "/histogramz");
       rpcz_handler->SetAuthMode(true, "/signin", SESSION_KEY, "/rpcz");
       statusz_handler->SetAuthMode(true, "/signin", SESSION_KEY, "/statusz");
+      tracez_handler->SetAuthMode(true, "/signin", SESSION_KEY, "/tracez");
       zk_statusz_handler->SetAuthMode(true, "/signin", SESSION_KEY, "/zkstatus");
     }
 
@@ -18,6 +18,7 @@
 #include "stream_service/orbit/network_status_common.h"
 #include "stream_service/orbit/http_server/rpc_call_stats.h"
 #include "stream_service/orbit/network_status.h"
+#include "stream_service/orbit/packet_trace.h"
 
 #include <google/protobuf/text_format.h>
 #include "glog/logging.h"
@@ -115,6 +116,7 @@ namespace olive {
               orbit::SessionInfoManager* session_info = 
                 Singleton<orbit::SessionInfoManager>::GetInstance();
               session_info->RemoveSession(session_id);
+              orbit::PacketTracer::GetInstance()->RemoveRoom(session_id);
 
               pipeline->CloseAll();
             }
@@ -266,6 +268,7 @@ grpc::Status OrbitStreamServiceImpl::CreateSession(grpc::ServerContext* context,
       Singleton<orbit::SessionInfoManager>::GetInstance();
     session_info->AddSession(session_id);
     // end session info for statuz
+    orbit::PacketTracer::GetInstance()->AddRoom(session_id);
     LOG(INFO)<<"CreatePipelineType = "<<request->type();
 
     switch (request->type()) {
@@ -353,6 +356,7 @@ grpc::Status OrbitStreamServiceImpl::CloseSession(grpc::ServerContext* context,
         Singleton<orbit::SessionInfoManager>::GetInstance();
       session_info->RemoveSession(session_id);
       // end session info for statuz
+      orbit::PacketTracer::GetInstance()->RemoveRoom(session_id);
 
       pipeline->CloseAll();
     }
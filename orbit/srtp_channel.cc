@@ -2,12 +2,16 @@
  * Srtpchannel.cpp
  */
 
+#include <string.h>
 #include <srtp/srtp.h>
 #include <nice/nice.h>
 //#include "stream_service/third_party/libnice/upstream/nice/nice.h"
 
 #include "srtp_channel.h"
 
+// SRTCP adds the E flag and the SRTCP index before the auth tag.
+#define SRTCP_MAX_TRAILER_LEN (SRTP_MAX_TRAILER_LEN + 4)
+
 namespace orbit {
   bool SrtpChannel::initialized = false;
   boost::mutex SrtpChannel::sessionMutex_;
@@ -37,10 +41,18 @@ SrtpChannel::~SrtpChannel() {
   }
 }
 
-bool SrtpChannel::setRtpParams(char* sendingKey, char* receivingKey) {
+SrtpChannel::Profile SrtpChannel::profileFromName(const std::string& name) {
+  if (name == "SRTP_AES128_CM_SHA1_32") {
+    return AES_CM_128_HMAC_SHA1_32;
+  }
+  return AES_CM_128_HMAC_SHA1_80;
+}
+
+bool SrtpChannel::setRtpParams(char* sendingKey, char* receivingKey,
+                               Profile profile) {
     ELOG_DEBUG("Configuring srtp local key %s remote key %s", sendingKey,
             receivingKey);
-  if (configureSrtpSession(&send_session_, sendingKey, SENDING) && configureSrtpSession(&receive_session_, receivingKey, RECEIVING)){
+  if (configureSrtpSession(&send_session_, sendingKey, SENDING, profile) && configureSrtpSession(&receive_session_, receivingKey, RECEIVING, profile)){
     active_ = true;
     return active_;
   }
@@ -118,12 +130,49 @@ int SrtpChannel::unprotectRtcp(char* buffer, int *len) {
     }
 }
 
+int SrtpChannel::protectRtp(const PacketBuffer& buffer, char* out,
+                            int out_size) {
+    int length = buffer.length();
+    if (out == NULL || length + SRTP_MAX_TRAILER_LEN > out_size) {
+      ELOG_WARN("FATAL SrtpChannel::protectRtp : no room to protect, len %d", length);
+      return -1;
+    }
+    memcpy(out, buffer.data(), length);
+    if (protectRtp(out, &length) < 0) {
+      return -1;
+    }
+    return length;
+}
+
+int SrtpChannel::protectRtcp(const PacketBuffer& buffer, char* out,
+                             int out_size) {
+    int length = buffer.length();
+    if (out == NULL || length + SRTCP_MAX_TRAILER_LEN > out_size) {
+      ELOG_WARN("FATAL SrtpChannel::protectRtcp : no room to protect, len %d", length);
+      return -1;
+    }
+    memcpy(out, buffer.data(), length);
+    if (protectRtcp(out, &length) < 0) {
+      return -1;
+    }
+    return length;
+}
+
 bool SrtpChannel::configureSrtpSession(srtp_t *session, const char* key,
-        enum TransmissionType type) {
+        enum TransmissionType type, Profile profile) {
     srtp_policy_t policy;
     memset(&policy, 0, sizeof(policy));
-    crypto_policy_set_aes_cm_128_hmac_sha1_80(&policy.rtp);
-    crypto_policy_set_aes_cm_128_hmac_sha1_80(&policy.rtcp);
+    switch (profile) {
+    case AES_CM_128_HMAC_SHA1_32:
+      // RFC 5764 4.1.2: the SRTCP auth tag stays 80 bits.
+      crypto_policy_set_aes_cm_128_hmac_sha1_32(&policy.rtp);
+      crypto_policy_set_aes_cm_128_hmac_sha1_80(&policy.rtcp);
+      break;
+    default:
+      crypto_policy_set_aes_cm_128_hmac_sha1_80(&policy.rtp);
+      crypto_policy_set_aes_cm_128_hmac_sha1_80(&policy.rtcp);
+      break;
+    }
     if (type == SENDING) {
         policy.ssrc.type = ssrc_any_outbound;
     } else {
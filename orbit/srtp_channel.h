@@ -19,6 +19,7 @@
 #include <boost/thread/mutex.hpp>
 
 #include "rtp/rtp_headers.h"
+#include "packet_buffer.h"
 #include "stream_service/orbit/logger_helper.h"
 
 namespace orbit {
@@ -32,6 +33,19 @@ class SrtpChannel {
 	static boost::mutex sessionMutex_;
 
 public:
+	/**
+	 * The SRTP crypto suites.
+	 */
+	enum Profile {
+		AES_CM_128_HMAC_SHA1_80,
+		AES_CM_128_HMAC_SHA1_32,
+	};
+	/**
+	 * Maps the DTLS-SRTP profile name (e.g. "SRTP_AES128_CM_SHA1_32") to the
+	 * profile, AES_CM_128_HMAC_SHA1_80 if unknown.
+	 */
+	static Profile profileFromName(const std::string& name);
+
 	/**
 	 * The constructor. At this point the class is only initialized but it still needs the Key pair.
 	 */
@@ -65,13 +79,30 @@ public:
 	 * @return 0 or an error code
 	 */
 	int unprotectRtcp(char* buffer, int *len);
+	/**
+	 * Protects the RTP Data of a pooled buffer into out, e.g. the datagram
+	 * of a UdpBatchSender. The buffer itself is not modified: it is shared
+	 * with the NACK history, which retransmits the clear packet.
+	 * @param buffer The buffer to protect.
+	 * @param out Where the protected packet is written.
+	 * @param out_size The size of out, at least the length plus the auth tag.
+	 * @return the protected length, or -1 on error
+	 */
+	int protectRtp(const PacketBuffer& buffer, char* out, int out_size);
+	/**
+	 * Protects the RTCP Data of a pooled buffer into out, see
+	 * protectRtp(const PacketBuffer&, char*, int).
+	 * @return the protected length, or -1 on error
+	 */
+	int protectRtcp(const PacketBuffer& buffer, char* out, int out_size);
 	/**
 	 * Sets a key pair for the RTP channel
 	 * @param sendingKey The key for protecting data
 	 * @param receivingKey The key for unprotecting data
 	 * @return true if everything is ok
 	 */
-	bool setRtpParams(char* sendingKey, char* receivingKey);
+	bool setRtpParams(char* sendingKey, char* receivingKey,
+			Profile profile = AES_CM_128_HMAC_SHA1_80);
 	/**
 	 * Sets a key pair for the RTCP channel
 	 * @param sendingKey The key for protecting data
@@ -86,7 +117,7 @@ private:
 	};
 
 	bool configureSrtpSession(srtp_t *session, const char* key,
-			enum TransmissionType type);
+			enum TransmissionType type, Profile profile);
 
 	bool active_;
 	srtp_t send_session_;
@@ -16,6 +16,8 @@
 #include <cstdio>
 #include <atomic>
 #include "nice_connection.h"
+#include "packet_buffer.h"
+#include "udp_batch_sender.h"
 
 /**
  * States of Transport
@@ -33,7 +35,13 @@ namespace orbit {
   class Transport;
   class TransportListener {
     public:
+      // Copies the packet into a PacketBuffer and hands it to onTransportBuffer,
+      // for the callers which don't read the packets into a PacketBuffer.
       virtual void onTransportData(char* buf, int len, Transport *transport) = 0;
+      // The received packet, unprotected in place in the buffer it was read
+      // into. The buffer is passed on to the plugin without any copy.
+      virtual void onTransportBuffer(const PacketBufferPtr& buffer,
+                                     Transport *transport) = 0;
       virtual void queueData(int comp, const char* data, int len, 
                              Transport *transport, packetType type) = 0;
       virtual void updateState(TransportState state) = 0;
@@ -48,6 +56,8 @@ namespace orbit {
       std::shared_ptr<NiceConnection> nice_;
       MediaType mediaType;
       std::string transport_name;
+      // The room (session id) of the transport, for the packet traces.
+      std::atomic<int> trace_room{0};
       Transport(MediaType med, const std::string &transport_name, bool bundle, 
                 bool rtcp_mux, TransportListener *transportListener, 
                 const IceConfig& iceConfig) :
@@ -80,6 +90,23 @@ namespace orbit {
       }
   
       virtual void write(char* data, int len) = 0;
+      // Same as write(), but the datagram may be added into the batch and
+      // sent when the caller flushes the batch. The default implementation
+      // sends it right away.
+      virtual void writeBatched(char* data, int len, UdpBatchSender* batch) {
+        write(data, len);
+      }
+      // Sends count pooled buffers, each one protected right into its
+      // datagram in the batch (see UdpBatchSender::Reserve()). The buffers
+      // are not modified, they may be shared (e.g. with the NACK history).
+      // The default implementation sends them one by one with
+      // writeBatched().
+      virtual void writeBuffers(PacketBufferPtr* buffers, int count,
+                                UdpBatchSender* batch) {
+        for (int i = 0; i < count; ++i) {
+          writeBatched(buffers[i]->data(), buffers[i]->length(), batch);
+        }
+      }
       virtual void processLocalSdp(SdpInfo *localSdp_) = 0;
       virtual std::shared_ptr<NiceConnection> getNiceConnection() { return nice_; };
       TransportListener* getTransportListener() {
@@ -15,6 +15,7 @@
 #include "network_status.h"
 #include "rtp/rtcp_processor.h"
 #include "rtp/janus_rtcp_processor.h"
+#include "plugin_dispatcher.h"
 
 #include "stream_service/orbit/logger_helper.h"
 #include "transport_plugin.h"
@@ -26,11 +27,13 @@
 #include "stream_service/orbit/debug_server/rtp_capture.h"
 #include "stream_service/orbit/rtp/janus_rtcp_processor.h"
 #include "stream_service/orbit/rtp_sender.h"
+#include "stream_service/orbit/packet_trace.h"
 
 #include "gflags/gflags.h"
 #include "webrtc/modules/include/module_common_types.h"
 
 #include <glib.h>
+#include <unistd.h>
 #include <string>
 
 using namespace std;
@@ -46,7 +49,48 @@ DEFINE_bool(setup_passive_server, true,
             "Right not it is setup:actpass by default.");
 DEFINE_bool(debug_display_rtt, true,
             "If set, we will display RTT every second. For debug.");
+DEFINE_bool(async_plugin_delivery, false,
+            "If set, the incoming packets are handed to the plugins on the "
+            "PluginDispatcher workers through a bounded queue per stream, "
+            "so a slow plugin doesn't stall the receiving thread. Only for "
+            "the bundled streams, the others are still delivered on the "
+            "receiving threads.");
+DEFINE_int32(plugin_queue_size, 512,
+             "The max number of packets queued for a plugin with "
+             "--async_plugin_delivery, the newer packets are dropped.");
+
+// Waits for the PluginRefs taken before the plugin is cleared.
+#define PLUGIN_USERS_WAIT 100 // in us
 namespace orbit {
+thread_local TransportDelegate::PluginRef* TransportDelegate::PluginRef::top_ = NULL;
+
+namespace {
+  // Replaces the RED payload of the packet by its primary block, since the
+  // upper simulcast layers don't go through the FEC receiver. Returns false
+  // if it is a FEC packet, or has redundant blocks.
+  bool UnwrapRedPacket(PacketBuffer* buffer) {
+    char* data = buffer->data();
+    RtpHeader* h = reinterpret_cast<RtpHeader*>(data);
+    if (h->getPayloadType() != RED_90000_PT) {
+      return true;
+    }
+    int header_length = h->getHeaderLength();
+    if (buffer->length() <= header_length) {
+      return false;
+    }
+    RedHeader* red_header =
+      reinterpret_cast<RedHeader*>(&data[header_length]);
+    if (red_header->follow || red_header->payloadtype == ULP_90000_PT) {
+      return false;
+    }
+    h->setPayloadType(red_header->payloadtype);
+    memmove(&data[header_length], &data[header_length + 1],
+            buffer->length() - header_length - 1);
+    buffer->set_length(buffer->length() - 1);
+    return true;
+  }
+}  // annoymous namespace
+
   TransportDelegate::TransportDelegate(bool audio_enabled, bool video_enabled,
                                        bool trickle_enabled, const IceConfig& ice_config,
                                        int session_id, int stream_id)
@@ -100,6 +144,10 @@ namespace orbit {
   void TransportDelegate::Destroy() {
     LOG(INFO) <<"Enter into TransportDelegate::Destroy";
     running_ = false;
+    if (plugin_queue_ != NULL) {
+      // No more delivery, the queue is deleted after the transports.
+      plugin_queue_->Stop();
+    }
     if (rtp_sender_ != NULL) {
       delete rtp_sender_;
       rtp_sender_ = NULL;
@@ -117,6 +165,7 @@ namespace orbit {
       delete audio_transport_;
       audio_transport_ = NULL;
     }
+    plugin_queue_.reset();
     NetworkStatusManager::Destroy(session_id_, stream_id_);
     LOG(INFO) << "Leave TransportDelegate::Destroy().";
   }
@@ -128,7 +177,12 @@ namespace orbit {
     if (!FLAGS_packet_capture_filename.empty()) {
       rtp_capture_ = new RtpCapture(FLAGS_packet_capture_directory + FLAGS_packet_capture_filename);
     }
-
+    if (FLAGS_async_plugin_delivery) {
+      plugin_queue_.reset(new PluginDeliveryQueue(
+          FLAGS_plugin_queue_size,
+          std::bind(&TransportDelegate::DeliverQueuedPacket, this,
+                    std::placeholders::_1)));
+    }
 
     if (FLAGS_only_public_ip) {
       StunServerProber* prober = Singleton<StunServerProber>::get();
@@ -178,12 +232,12 @@ namespace orbit {
     local_sdp_.setOfferSdp(remote_sdp_);
   
     {
-      boost::mutex::scoped_lock lock_plugin(plugin_mutex_);
-      if (plugin_ != NULL) {
-        local_sdp_.initExtendedVideoSsrc(plugin_->GetExtendedVideoSsrcNumber());
-        plugin_->SetDownstreamSsrc(local_sdp_.getVideoSsrc());
-        plugin_->SetUpstreamSsrc(remote_sdp_.getVideoSsrc());
-        plugin_->SetExtendedVideoSsrcs(local_sdp_.getExtendedVideoSsrcs());
+      PluginRef plugin(this);
+      if (plugin.get() != NULL) {
+        local_sdp_.initExtendedVideoSsrc(plugin->GetExtendedVideoSsrcNumber());
+        plugin->SetDownstreamSsrc(local_sdp_.getVideoSsrc());
+        plugin->SetUpstreamSsrc(remote_sdp_.getVideoSsrc());
+        plugin->SetExtendedVideoSsrcs(local_sdp_.getExtendedVideoSsrcs());
       }
     }
     LOG(INFO) << "local videossrc=" << local_sdp_.getVideoSsrc()
@@ -217,6 +271,7 @@ namespace orbit {
                                                  bundle_, remote_sdp_.getIsRtcpMux(),
                                                  video_receiver, ice_config_ ,
                                                  username, password, isServer);
+            video_transport_->trace_room = session_id_;
           }else{ 
             ELOG_DEBUG("UPDATING videoTransport with creds %s, %s", username.c_str(), password.c_str());
             video_transport_->getNiceConnection()->setRemoteCredentials(username, password);
@@ -234,6 +289,7 @@ namespace orbit {
                                                  bundle_, remote_sdp_.getIsRtcpMux(),
                                                 audio_receiver, ice_config_,
                                                 username, password, isServer);
+            audio_transport_->trace_room = session_id_;
           }else{
             ELOG_DEBUG("UPDATING audioTransport with creds %s, %s",
                        username.c_str(), password.c_str());
@@ -332,7 +388,7 @@ namespace orbit {
   }
  
   TransportPlugin* TransportDelegate::getPlugin() {
-    return plugin_;
+    return plugin_.load();
   }
 
   bool TransportDelegate::AddRemoteCandidate(const std::string &mid,
@@ -428,8 +484,9 @@ namespace orbit {
               <<state;
     transport_state_ = state;
 
-    if (plugin_) {
-      plugin_->OnTransportStateChange(state);
+    PluginRef plugin(this);
+    if (plugin.get() != NULL) {
+      plugin->OnTransportStateChange(state);
     }
 
     switch(state) {
@@ -439,8 +496,12 @@ namespace orbit {
     case TRANSPORT_GATHERED:
       break;
     case TRANSPORT_READY:
-      if (plugin_) {
-        plugin_->set_active(true);
+      if (plugin.get() != NULL) {
+        plugin->set_active(true);
+      }
+      // Flush the packets queued before the transport became ready.
+      if (rtp_sender_ != NULL) {
+        rtp_sender_->Wakeup();
       }
       CallConnectReadyListeners();
       break;
@@ -511,8 +572,23 @@ namespace orbit {
 
   void TransportDelegate::onTransportData(char* buf, int len,
                                           Transport *transport) {
-    // update stream incomming packet time
-    NetworkStatusManager::UpdateStreamIncommingTime(session_id_, stream_id_);
+    PacketBufferPtr buffer = PacketBuffer::Create(buf, len);
+    if (buffer == NULL) {
+      LOG(ERROR) << "Drop the incoming packet, too large, len=" << len;
+      return;
+    }
+    onTransportBuffer(buffer, transport);
+  }
+
+  void TransportDelegate::onTransportBuffer(const PacketBufferPtr& buffer,
+                                            Transport *transport) {
+    char* buf = buffer->data();
+    int len = buffer->length();
+    // update stream incomming packet time, network_status_ is resolved once
+    // in the constructor, no registry lookup per packet.
+    if (network_status_ != NULL) {
+      network_status_->UpdateIncomingTime(GetCurrentTime_MS());
+    }
     
     uint32_t recvSSRC;
     // PROCESS RTCP
@@ -521,41 +597,34 @@ namespace orbit {
     if (chead->isRtcp()) {
       // RTP or RTCP Sender Report
       recvSSRC = chead->getSSRC();
-      boost::mutex::scoped_lock lock_plugin(plugin_mutex_);
+      PluginRef plugin(this);
       {
-        if (plugin_ != NULL) {
-          dataPacket packet;
-          packet.comp = 0;
-          memcpy(&(packet.data[0]), buf, len);
-          packet.length = len;
+        if (plugin.get() != NULL) {
+          buffer->comp = 0;
           if (recvSSRC == remote_sdp_.getAudioSsrc()) {
-            packet.type = AUDIO_PACKET;
+            buffer->type = AUDIO_PACKET;
             network_status_->ReceivingRTCPPacket(false);
           } else if (recvSSRC == remote_sdp_.getVideoSsrc()) {
-            packet.type = VIDEO_PACKET;
+            buffer->type = VIDEO_PACKET;
             network_status_->ReceivingRTCPPacket(true);
           } else if (recvSSRC == remote_sdp_.getVideoRtxSsrc()) {
-            packet.type = VIDEO_RTX_PACKET;
+            buffer->type = VIDEO_RTX_PACKET;
           } else {
             // HACK(zhanghao): this fix is for supervise class page, because the sdp
             // of supervise class page has no ssrc, we could not distinguish the stream.
             // So if the stream is RECVONLY, there is no SSRC, But the RTCP packet
             // is valid. So we should not return.
             if (remote_sdp_.GetVideoDirection() == RECVONLY) {
-              packet.type = VIDEO_PACKET;
+              buffer->type = VIDEO_PACKET;
             } else {
               LOG(ERROR) << "recvSSRC=" << recvSSRC << " invalid SSRC...----- RTCP";
               return;
             }
           }
-          rtcp_processor_->RtcpProcessIncomingRtcp(packet.type, buf, len);
-          plugin_->IncomingRtcpPacket(packet);
-          CallRecvRtcpListeners(packet);
-
-          if (rtp_capture_ != NULL) {
-            intptr_t transport_address = reinterpret_cast<intptr_t>(this);
-            rtp_capture_->CapturePacket(transport_address, packet);
-          }
+          rtcp_processor_->RtcpProcessIncomingRtcp(buffer->type, buf, len);
+          DeliverToPlugin(plugin.get(), buffer, true);
+          CallRecvRtcpListeners(*buffer);
+          CaptureBuffer(*buffer);
         }
       }
     } else {
@@ -564,43 +633,55 @@ namespace orbit {
         RtpHeader *head = reinterpret_cast<RtpHeader*> (buf);
         recvSSRC = head->getSSRC();
       }
-      boost::mutex::scoped_lock lock_plugin(plugin_mutex_);
-      if (plugin_ != NULL) {
-        dataPacket packet;
-        packet.comp = 0;
-        memcpy(&(packet.data[0]), buf, len);
-        packet.length = len;
+      PluginRef plugin(this);
+      if (plugin.get() != NULL) {
+        buffer->comp = 0;
         RtpHeader* rtp_header = reinterpret_cast<RtpHeader*> (buf); 
         uint16_t seqnumber = rtp_header->getSeqNumber();
+        int simulcast_layer = 0;
         if (recvSSRC == remote_sdp_.getAudioSsrc()) {
-          packet.type = AUDIO_PACKET;
+          buffer->type = AUDIO_PACKET;
           network_status_->ReceivingPacket(false);
           network_status_->StatisticRecvFractionLost(false, seqnumber);
         } else if (recvSSRC == remote_sdp_.getVideoSsrc()) {
-          packet.type = VIDEO_PACKET;
+          buffer->type = VIDEO_PACKET;
           network_status_->ReceivingPacket(true);
           network_status_->StatisticRecvFractionLost(true, seqnumber);
-        } else if (recvSSRC == remote_sdp_.getVideoRtxSsrc()) {
-          packet.type = VIDEO_RTX_PACKET;
+        } else if (recvSSRC == remote_sdp_.getVideoRtxSsrc() ||
+                   remote_sdp_.isSimulcastRtxSsrc(recvSSRC)) {
+          buffer->type = VIDEO_RTX_PACKET;
+        } else if ((simulcast_layer =
+                    remote_sdp_.getSimulcastLayer(recvSSRC)) > 0) {
+          buffer->type = VIDEO_PACKET;
+          buffer->simulcast_layer = simulcast_layer;
+          network_status_->ReceivingPacket(true);
         } else {
           LOG(ERROR) << "recvSSRC=" << recvSSRC << " invalid SSRC...----- RTP";
         }
-        
-        if (FLAGS_enable_red_fec) {
-          ReceivePacketAsFec(&packet);
+
+        if (simulcast_layer > 0) {
+          // An upper simulcast layer. It only counts for the receiver
+          // bitrate, the RTCP context, the NACKs and the loss statistics
+          // follow the lowest layer.
+          UpdateReceiverBitrate(len);
+          if (plugin->SupportsSimulcast() && UnwrapRedPacket(buffer.get())) {
+            SendPacketToPlugin(buffer);
+          }
+        } else if (FLAGS_enable_red_fec) {
+          ReceivePacketAsFec(buffer);
         } else {            //enable_red_fec == false
-          if (packet.type == VIDEO_PACKET) {
+          if (buffer->type == VIDEO_PACKET) {
             rtcp_processor_->SendVideoNackByCondition(recvSSRC, seqnumber);
           }
-          ProcessPacket(packet.type, buf, len);
-          SendPacketToPlugin(packet);
-          CallRecvRtpListeners(packet);
+          ProcessPacket(buffer->type, buf, len);
+          SendPacketToPlugin(buffer);
+          CallRecvRtpListeners(*buffer);
         }
 
-        if (packet.type == AUDIO_PACKET) {
+        if (buffer->type == AUDIO_PACKET) {
           rtcp_processor_->SendAudioNackByCondition(seqnumber);
         }
-      } // end of (plugin_ != NULL)
+      } // end of (plugin != NULL)
     } // end of else
 
     // The data has available. should update the network status etc.
@@ -611,13 +692,15 @@ namespace orbit {
   bool TransportDelegate::OnRecoveredPacket(const uint8_t* rtp_packet, 
                                             size_t rtp_packet_length) {
     /* Enqueue it */
-    dataPacket packet;
-    packet.comp = 0;
-    packet.length = rtp_packet_length;
-    packet.type = VIDEO_PACKET;
-    memcpy(&(packet.data[0]), rtp_packet, rtp_packet_length);
-    
-    RtpHeader* h = reinterpret_cast<RtpHeader*>(&(packet.data[0]));
+    PacketBufferPtr buffer = PacketBuffer::Create(
+        reinterpret_cast<const char*>(rtp_packet), rtp_packet_length);
+    if (buffer == NULL) {
+      return false;
+    }
+    buffer->comp = 0;
+    buffer->type = VIDEO_PACKET;
+
+    RtpHeader* h = reinterpret_cast<RtpHeader*>(buffer->data());
     uint16_t seqnumber = h->getSeqNumber();
     uint32_t recvSSRC = h->getSSRC();
     VLOG(3) <<" Recovered Video Packet , seq = " << (int)h->getSeqNumber()
@@ -626,9 +709,9 @@ namespace orbit {
 
     rtcp_processor_->SendVideoNackByCondition(recvSSRC, seqnumber);
 
-    ProcessPacket(packet.type, &(packet.data[0]), rtp_packet_length);
-    SendPacketToPlugin(packet);
-    CallRecvRtpListeners(packet);
+    ProcessPacket(buffer->type, buffer->data(), rtp_packet_length);
+    SendPacketToPlugin(buffer);
+    CallRecvRtpListeners(*buffer);
     return true;
   }
 
@@ -653,18 +736,81 @@ namespace orbit {
     }
   }
 
-  void TransportDelegate::SendPacketToPlugin(dataPacket packet) {
-    RtpHeader* rtp_header = reinterpret_cast<RtpHeader*>(&(packet.data[0])); 
-    packet.rtp_timestamp = rtp_header->getTimestamp();
-    packet.arrival_time_ms = GetCurrentTime_MS();
-    packet.remote_ntp_time_ms =
-        rtcp_processor_->EstimateRemoteNTPTimeMS(packet.type, packet.rtp_timestamp);
-    plugin_->IncomingRtpPacket(packet);
+  void TransportDelegate::RelayBuffer(const PacketBufferPtr& buffer) {
+    assert(bundle_);
+    if (video_transport_ != NULL) {
+      queueData(0, buffer->data(), buffer->length(), video_transport_,
+                buffer->type);
+    }
+  }
+
+  void TransportDelegate::RetransmitBuffer(const PacketBufferPtr& buffer) {
+    assert(bundle_);
+    if (video_transport_ != NULL) {
+      WriteAndSend(video_transport_, RETRANSMIT_PRIORITY, buffer);
+    }
+  }
 
-    if (rtp_capture_ != NULL) {
-      intptr_t transport_address = reinterpret_cast<intptr_t>(this);
-      rtp_capture_->CapturePacket(transport_address, packet);
+  void TransportDelegate::SendPacketToPlugin(const PacketBufferPtr& buffer) {
+    RtpHeader* rtp_header = reinterpret_cast<RtpHeader*>(buffer->data());
+    buffer->rtp_timestamp = rtp_header->getTimestamp();
+    buffer->arrival_time_ms = GetCurrentTime_MS();
+    buffer->remote_ntp_time_ms =
+        rtcp_processor_->EstimateRemoteNTPTimeMS(buffer->type, buffer->rtp_timestamp);
+    PluginRef plugin(this);
+    if (plugin.get() != NULL) {
+      DeliverToPlugin(plugin.get(), buffer, false);
+    }
+    CaptureBuffer(*buffer);
+  }
+
+  void TransportDelegate::CaptureBuffer(const PacketBuffer& buffer) {
+    if (rtp_capture_ == NULL) {
+      return;
+    }
+    dataPacket packet;
+    buffer.CopyTo(&packet);
+    intptr_t transport_address = reinterpret_cast<intptr_t>(this);
+    rtp_capture_->CapturePacket(transport_address, packet);
+  }
+
+  void TransportDelegate::DeliverToPlugin(TransportPlugin* plugin,
+                                          const PacketBufferPtr& buffer,
+                                          bool is_rtcp) {
+    PacketTracer::EndStage(TRACE_STAGE_DELEGATE);
+    // The queue has a single producer, which the two receiving threads of
+    // a non-bundled stream would break.
+    if (plugin_queue_ != NULL && bundle_) {
+      PacketTraceContext* trace = PacketTracer::Current();
+      if (trace != NULL) {
+        buffer->trace = *trace;
+      }
+      // Dropped and counted by the queue if the plugin falls behind.
+      plugin_queue_->Push(buffer);
+      return;
+    }
+    if (is_rtcp) {
+      plugin->IncomingRtcpBuffer(buffer);
+    } else {
+      plugin->IncomingRtpBuffer(buffer);
     }
+    PacketTracer::EndStage(TRACE_STAGE_PLUGIN);
+  }
+
+  void TransportDelegate::DeliverQueuedPacket(const PacketBufferPtr& buffer) {
+    PluginRef plugin(this);
+    if (plugin.get() == NULL) {
+      return;
+    }
+    PacketTraceScope trace_scope(&buffer->trace);
+    PacketTracer::EndStage(TRACE_STAGE_PLUGIN_QUEUE);
+    RtcpHeader* chead = reinterpret_cast<RtcpHeader*>(buffer->data());
+    if (chead->isRtcp()) {
+      plugin->IncomingRtcpBuffer(buffer);
+    } else {
+      plugin->IncomingRtpBuffer(buffer);
+    }
+    PacketTracer::EndStage(TRACE_STAGE_PLUGIN);
   }
 
   /*
@@ -674,10 +820,10 @@ namespace orbit {
    * directly. And in this function , we also send the packet into nack
    * processor.
    */
-  void TransportDelegate::ReceivePacketAsFec(dataPacket* packet) {
-    char* buf = packet->data;
-    int len = packet->length;
-    packetType packet_type = packet->type;
+  void TransportDelegate::ReceivePacketAsFec(const PacketBufferPtr& buffer) {
+    char* buf = buffer->data();
+    int len = buffer->length();
+    packetType packet_type = buffer->type;
     RtpHeader* h = reinterpret_cast<RtpHeader*>(buf);
     uint16_t seqnumber = h->getSeqNumber();   
     uint32_t recvSSRC = h->getSSRC();
@@ -713,8 +859,8 @@ namespace orbit {
         // send to plugin directly.
         rtcp_processor_->SendVideoNackByCondition(recvSSRC, seqnumber);
         ProcessPacket(packet_type, buf, len);
-        SendPacketToPlugin(*packet);
-        CallRecvRtpListeners(*packet);
+        SendPacketToPlugin(buffer);
+        CallRecvRtpListeners(*buffer);
       }
       break;
       default:
@@ -724,8 +870,8 @@ namespace orbit {
     break;
     case AUDIO_PACKET: {
       ProcessPacket(packet_type, buf, len);
-      SendPacketToPlugin(*packet);
-      CallRecvRtpListeners(*packet);
+      SendPacketToPlugin(buffer);
+      CallRecvRtpListeners(*buffer);
     }
     break;
     default:
@@ -752,15 +898,7 @@ namespace orbit {
     producer_->AddRtpPacketAndGenerateFec(
         reinterpret_cast<const uint8_t*>(buf), len - 12, 12);
 
-    int red_len = red_packet->length();
-    unsigned char* red_buf = reinterpret_cast<unsigned char*>(malloc(red_len));
-    memcpy(red_buf, red_packet->data(), red_packet->length());
-
-    // Delete the buf
-    free(buf);
-
-    buf = (char*) red_buf;
-    len = red_len;
+    // NOTE: buf is owned by the caller (a pooled PacketBuffer), don't free it.
     uint16_t num_fec_packets = producer_->NumAvailableFecPackets();
     if (num_fec_packets > 0) {
       uint16_t next_fec_sequence_number = GenerateNextFecSequenceNumber(true, NULL);
@@ -768,10 +906,14 @@ namespace orbit {
       fec_packets = producer_->GetFecPackets(kRedPayloadType, kFecPayloadType,
                                              next_fec_sequence_number, 12);
       for (webrtc::RedPacket* fec_packet : fec_packets) {
-        rtcp_processor_->NackPushVideoPacket((char*)fec_packet->data(), fec_packet->length());
         const RtpHeader* rtp = reinterpret_cast<const RtpHeader*>((unsigned char*)fec_packet->data());
         VLOG(3) <<" fec packet's send seqnumber = " << rtp->getSeqNumber();
-        WriteAndSend(transport, DEFAULT_PRIORITY, (unsigned char*)fec_packet->data(), fec_packet->length());
+        PacketBufferPtr fec_buffer = PacketBuffer::Create(
+            reinterpret_cast<const char*>(fec_packet->data()), fec_packet->length());
+        if (fec_buffer != NULL) {
+          rtcp_processor_->NackPushVideoPacket(fec_buffer);
+          WriteAndSend(transport, DEFAULT_PRIORITY, fec_buffer);
+        }
         delete fec_packet;
       }
       fec_send_count_ += num_fec_packets - 1;
@@ -834,9 +976,15 @@ namespace orbit {
   void TransportDelegate::queueData(int comp, const char* data, int len,
                                     Transport *transport, packetType type) {
     // HACK(chengxu): rewrite the following logic.
-    // Rewrite the RTP header.
-    char* buf = reinterpret_cast<char*>(malloc(len));
-    memcpy(buf, data, len);
+    // Rewrite the RTP header. The packet is copied once into a pooled buffer,
+    // which is then handed over to the RtpSender without any further copy.
+    PacketBufferPtr buffer = PacketBuffer::Create(data, len);
+    if (buffer == NULL) {
+      LOG(ERROR) << "queueData: packet is too large, len=" << len;
+      return;
+    }
+    buffer->type = type;
+    char* buf = buffer->data();
 
     // When relay the packet, we should reset the codec
     ResetRelayPacketCodec(buf, type);
@@ -859,8 +1007,14 @@ namespace orbit {
         // construct module , not in here.
         uint32_t packet_type = rtcp->getPacketType();
         if (packet_type != RTCP_Sender_PT) {
-          janus_rtcp_fix_ssrc(NULL, buf, len, 1, VIDEO_SSRC,
-                              remote_sdp_.getVideoSsrc());
+          // The FIR/PLI to an upper simulcast layer is already addressed to
+          // the ssrc of the layer, only the sender ssrc is fixed.
+          uint32_t media_ssrc = remote_sdp_.getVideoSsrc();
+          if (packet_type == RTCP_PS_Feedback_PT &&
+              remote_sdp_.getSimulcastLayer(rtcp->getSourceSSRC()) > 0) {
+            media_ssrc = 0;
+          }
+          janus_rtcp_fix_ssrc(NULL, buf, len, 1, VIDEO_SSRC, media_ssrc);
         }
         network_status_->SendingRTCPPacket(true);
       } else if (type == VIDEO_RTX_PACKET) {
@@ -889,9 +1043,9 @@ namespace orbit {
       }
 
       if (type == REMB_PACKET) {
-        WriteAndSend(transport, REMB_PRIORITY, (unsigned char*)buf, len);
+        WriteAndSend(transport, REMB_PRIORITY, buffer);
       } else {
-        WriteAndSend(transport, RTCP_PRIORITY, (unsigned char*)buf, len);
+        WriteAndSend(transport, RTCP_PRIORITY, buffer);
       }
     } else {
       guint32 timestamp = rtp->getTimestamp();
@@ -915,9 +1069,9 @@ namespace orbit {
           // Disable sending FEC for now
           //SendPacketAsFec(buf, len, transport);
         } // FLAGS_enable_red_fec */
-        rtcp_processor_->NackPushVideoPacket(buf, len);
+        rtcp_processor_->NackPushVideoPacket(buffer);
       } else if (type == AUDIO_PACKET) {
-        rtcp_processor_->NackPushAudioPacket(buf, len);
+        rtcp_processor_->NackPushAudioPacket(buffer);
       }
 
       // specify priority and send packet
@@ -932,15 +1086,14 @@ namespace orbit {
         priority = RETRANSMIT_PRIORITY;
       }
 
-      WriteAndSend(transport, priority, (unsigned char*)buf, len);
+      WriteAndSend(transport, priority, buffer);
     }
-    free(buf);
   }
 
-  void TransportDelegate::WriteAndSend(Transport* transport, int priority, 
-                                       unsigned char* data, int len) {
-    rtp_sender_->WriteAndSend(transport, priority, data, len);
-  } 
+  void TransportDelegate::WriteAndSend(Transport* transport, int priority,
+                                       const PacketBufferPtr& buffer) {
+    rtp_sender_->WriteAndSend(transport, priority, buffer);
+  }
 
   void TransportDelegate::UpdateSessionOrStreamInfo(const string& event_key,
                                                     const string& event_value) {
@@ -999,6 +1152,11 @@ namespace orbit {
     if (ret) {
       bundle_ = remote_sdp_.getIsBundle();
       ELOG_DEBUG("Is bundle? %d", bundle_);
+      if (plugin_queue_ != NULL && !bundle_) {
+        // The audio and the video would be two producers of the queue.
+        LOG(WARNING) << "No async plugin delivery without bundle, stream_id="
+                     << stream_id_ << " is delivered on the receiving threads.";
+      }
       assert(bundle_);
       
       ELOG_DEBUG("Video %d videossrc %u Audio %d audio ssrc %u Bundle %d",
@@ -1032,6 +1190,7 @@ namespace orbit {
     video_transport_ = new DtlsTransport(VIDEO_TYPE, "video",
                                          true, true, this, ice_config_,
                                          "", "", is_server);
+    video_transport_->trace_room = session_id_;
 
     fec_receiver_.reset(new webrtc::FecReceiverImpl(this));
     fec_.reset(new webrtc::ForwardErrorCorrection());
@@ -1053,8 +1212,19 @@ namespace orbit {
   }
 
   void TransportDelegate::Stop() {
-    boost::mutex::scoped_lock lock_plugin(plugin_mutex_);
-    plugin_ = NULL;
+    plugin_.store(NULL);
+    // The plugin may be deleted after Stop() returns, wait for the ingress
+    // path and the plugin queue which are still using it. The PluginRefs of
+    // this thread (Stop() called from a plugin callback) are only released
+    // once it returns, waiting for them would never end.
+    int own_users = PluginRef::HeldByThisThread(this);
+    if (own_users > 0) {
+      LOG(WARNING) << "TransportDelegate::Stop() called from a plugin "
+                   << "callback, stream_id=" << stream_id_;
+    }
+    while (plugin_users_.load(std::memory_order_acquire) > own_users) {
+      usleep(PLUGIN_USERS_WAIT);
+    }
   }
 
   void TransportDelegate::ResetSequenceNumberNotContainFec(char* buf) {
@@ -23,6 +23,7 @@
 #include "sdp_info.h"
 #include "nice_connection.h"
 #include "transport.h"
+#include "packet_buffer.h"
 
 #include <vector>
 #include <functional>
@@ -46,6 +47,7 @@ namespace orbit {
  class dataPacket;
  class NetworkStatus;
  class PacketReplayDriver;         // For replaying the rtp packets.
+ class PluginDeliveryQueue;
 
 class TransportDelegate : public TransportListener,
                           public webrtc::RtpData {
@@ -62,6 +64,8 @@ class TransportDelegate : public TransportListener,
 
   // Overrides interfaces from TransportListener
   virtual void onTransportData(char* buf, int len, Transport* transport) override;
+  virtual void onTransportBuffer(const PacketBufferPtr& buffer,
+                                 Transport* transport) override;
 
   // Send some type of data to remote side.
   // This function is normally used by client side.
@@ -115,6 +119,9 @@ class TransportDelegate : public TransportListener,
   void StartAsClient();
 
   // Stop the transport_delegate, and will not forward/relay any data further.
+  // Waits for the other threads still using the plugin. If called from a
+  // plugin callback, the plugin is still used by the calling thread when
+  // Stop() returns, it must not be deleted before the callback returns.
   void Stop();
   // Returns if the delegate is still running, not stopped.
   bool isRunning();
@@ -125,6 +132,13 @@ class TransportDelegate : public TransportListener,
 
   // Relay the packet to the endpoint.
   void RelayPacket(const dataPacket& packet);
+  // Relays a packet held in a buffer shared with other endpoints (e.g. by a
+  // fan-out). The buffer is not modified, it is copied once into the
+  // egress buffer of this endpoint.
+  void RelayBuffer(const PacketBufferPtr& buffer);
+  // Sends an already sent (and rewritten) RTP packet again, as is. The buffer
+  // is shared, not copied.
+  void RetransmitBuffer(const PacketBufferPtr& buffer);
 
   // WebRtc connection establishment functions:
   // Typically a webrtc endpoint is created with a transport_delegate. The
@@ -133,7 +147,7 @@ class TransportDelegate : public TransportListener,
   //   delegate->AddRemoteCandidate(candidates); // Get the remote candidates and add to delegate.
   // The connection will be established with the Ice and DtlsTransport with a callback above.
   //   callback 'updateState()' will update the state to ICE_CONNECTED, and the callback
-  //   'onTransportData()' will start to transport the media and RTP data.
+  //   'onTransportBuffer()' will start to transport the media and RTP data.
   bool ProcessOffer(const std::string& offer_sdp,
                     std::string* answer_sdp);
   bool AddRemoteCandidate(const std::string &mid,
@@ -287,8 +301,8 @@ class TransportDelegate : public TransportListener,
 
   void SendPacketAsFec(char* buf, int len, Transport *transport);
 
-  void WriteAndSend(Transport* transport, int priority, 
-                    unsigned char* data, int len);
+  void WriteAndSend(Transport* transport, int priority,
+                    const PacketBufferPtr& buffer);
   /*
    * Update the session or stream info to the singleton class to record the
    * the connection status and etc.
@@ -302,7 +316,7 @@ class TransportDelegate : public TransportListener,
    *
    * @param[in] packet the incoming RED packet  
    */ 
-  void ReceivePacketAsFec(dataPacket* packet);
+  void ReceivePacketAsFec(const PacketBufferPtr& buffer);
 
   void CallConnectReadyListeners() const {
     std::lock_guard<std::mutex> lock(connect_ready_listeners_mutex_);
@@ -318,15 +332,27 @@ class TransportDelegate : public TransportListener,
     }
   }
 
-  void CallRecvRtpListeners(const dataPacket &packet) const {
+  // The listeners still take a dataPacket, the buffer is only copied when
+  // there are some.
+  void CallRecvRtpListeners(const PacketBuffer& buffer) const {
     std::lock_guard<std::mutex> lock(recv_rtp_listeners_mutex_);
+    if (recv_rtp_listeners_.empty()) {
+      return;
+    }
+    dataPacket packet;
+    buffer.CopyTo(&packet);
     for (auto listener : recv_rtp_listeners_) {
       listener(packet);
     }
   }
 
-  void CallRecvRtcpListeners(const dataPacket &packet) const {
+  void CallRecvRtcpListeners(const PacketBuffer& buffer) const {
     std::lock_guard<std::mutex> lock(recv_rtcp_listeners_mutex_);
+    if (recv_rtcp_listeners_.empty()) {
+      return;
+    }
+    dataPacket packet;
+    buffer.CopyTo(&packet);
     for (auto listener : recv_rtcp_listeners_) {
       listener(packet);
     }
@@ -336,14 +362,66 @@ class TransportDelegate : public TransportListener,
   long long last_update_ns_time_ = 0;
   void UpdateNetworkStatus();
 
-  void SendPacketToPlugin(dataPacket packet);
+  void SendPacketToPlugin(const PacketBufferPtr& buffer);
+
+  // Hands the incoming buffer to the plugin, through the plugin delivery
+  // queue with --async_plugin_delivery, or right away otherwise. The buffer
+  // is shared with the plugin from then on, it must not be modified.
+  void DeliverToPlugin(TransportPlugin* plugin, const PacketBufferPtr& buffer,
+                       bool is_rtcp);
+  // Passes the buffer to the RTP capture, if any.
+  void CaptureBuffer(const PacketBuffer& buffer);
+  // Called on a PluginDispatcher worker for the queued packets.
+  void DeliverQueuedPacket(const PacketBufferPtr& buffer);
 
   // When sending the packet, we should check the payload of the packet.
   // If this stream has new codec, we should reset the new codec.
   void ResetRelayPacketCodec(char* data, packetType type);
 
-  // mutex to lock the plugins processing module.
-  boost::mutex plugin_mutex_;
+  // Pins the plugin while it is used. The ingress path doesn't lock: Stop()
+  // clears plugin_ and then waits for the PluginRefs taken before that.
+  // The PluginRefs of a thread are chained, so Stop() doesn't wait for
+  // those of its own thread.
+  class PluginRef {
+   public:
+    explicit PluginRef(TransportDelegate* delegate)
+      : delegate_(delegate), prev_(top_) {
+      delegate_->plugin_users_.fetch_add(1);
+      plugin_ = delegate_->plugin_.load();
+      top_ = this;
+    }
+    ~PluginRef() {
+      top_ = prev_;
+      delegate_->plugin_users_.fetch_sub(1, std::memory_order_release);
+    }
+    // The number of PluginRefs of the delegate held by the calling thread.
+    static int HeldByThisThread(const TransportDelegate* delegate) {
+      int count = 0;
+      for (const PluginRef* ref = top_; ref != NULL; ref = ref->prev_) {
+        if (ref->delegate_ == delegate) {
+          count++;
+        }
+      }
+      return count;
+    }
+    TransportPlugin* get() const {
+      return plugin_;
+    }
+    TransportPlugin* operator->() const {
+      return plugin_;
+    }
+
+   private:
+    TransportDelegate* delegate_;
+    TransportPlugin* plugin_;
+    PluginRef* prev_;
+    // The last PluginRef taken by the thread.
+    static thread_local PluginRef* top_;
+  };
+  // The number of the PluginRefs alive.
+  std::atomic<int> plugin_users_{0};
+  // Only with --async_plugin_delivery.
+  boost::scoped_ptr<PluginDeliveryQueue> plugin_queue_;
 
   // session and stream id.
   int session_id_;
@@ -368,7 +446,7 @@ class TransportDelegate : public TransportListener,
   SdpInfo local_sdp_;
 
   // The corresponding plugin where all the traffic goes through and process
-  TransportPlugin* plugin_ = NULL;
+  std::atomic<TransportPlugin*> plugin_{NULL};
   // Dtls transport for video/audio channel.
   Transport* video_transport_ = NULL;
   Transport* audio_transport_ = NULL;
@@ -421,7 +499,7 @@ class TransportDelegate : public TransportListener,
   boost::scoped_ptr<webrtc::ForwardErrorCorrection> fec_;
   boost::scoped_ptr<webrtc::ProducerFec> producer_;          // FEC producer
 
-  RtpSender* rtp_sender_;  // The RTP sender module.
+  RtpSender* rtp_sender_ = NULL;  // The RTP sender module.
 
   RtpCapture* rtp_capture_ = NULL; // The RTP capture module.
 
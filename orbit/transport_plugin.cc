@@ -22,6 +22,16 @@ namespace orbit {
   }
   void TransportPlugin::IncomingRtcpPacket(const dataPacket& packet) {
   }
+  void TransportPlugin::IncomingRtpBuffer(const PacketBufferPtr& buffer) {
+    dataPacket packet;
+    buffer->CopyTo(&packet);
+    IncomingRtpPacket(packet);
+  }
+  void TransportPlugin::IncomingRtcpBuffer(const PacketBufferPtr& buffer) {
+    dataPacket packet;
+    buffer->CopyTo(&packet);
+    IncomingRtcpPacket(packet);
+  }
   void TransportPlugin::RelayRtpPacket(const dataPacket& packet) {
      const RtpHeader* header = reinterpret_cast<const RtpHeader*>(packet.data);
      VLOG(3) << " VideoPacket payload=" << (int)(header->getPayloadType())
@@ -34,6 +44,11 @@ namespace orbit {
     if(gateway_ != NULL)
         gateway_->RelayPacket(packet);
   }
+  void TransportPlugin::RelayRtpBuffer(const PacketBufferPtr& buffer) {
+    boost::mutex::scoped_lock lock_gateway(gateway_mutex_);
+    if(gateway_ != NULL)
+        gateway_->RelayBuffer(buffer);
+  }
   void TransportPlugin::RelayRtcpPacket(const dataPacket& packet) {
     boost::mutex::scoped_lock lock_gateway(gateway_mutex_);
     if(gateway_ != NULL)
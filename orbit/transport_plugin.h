@@ -62,8 +62,18 @@ namespace orbit {
 
     virtual void IncomingRtpPacket(const dataPacket& packet) override;
     virtual void IncomingRtcpPacket(const dataPacket& packet) override;
+    // The received packet, in the buffer it was read into, see
+    // TransportDelegate::DeliverToPlugin. The buffer may be shared, Clone()
+    // it before modifying. By default, copies it into a dataPacket and calls
+    // IncomingRtpPacket()/IncomingRtcpPacket(), override them to avoid that
+    // copy.
+    virtual void IncomingRtpBuffer(const PacketBufferPtr& buffer);
+    virtual void IncomingRtcpBuffer(const PacketBufferPtr& buffer);
     virtual void RelayRtpPacket(const dataPacket& packet) override;
     virtual void RelayRtcpPacket(const dataPacket& packet) override;
+    // Relays a RTP packet shared by several plugins, see
+    // TransportDelegate::RelayBuffer.
+    virtual void RelayRtpBuffer(const PacketBufferPtr& buffer);
     void Stop();
 
     virtual int GetExtendedVideoSsrcNumber() {
@@ -87,6 +97,12 @@ namespace orbit {
     virtual std::vector<unsigned int> GetExtendedVideoSsrcs() {
       return extended_video_ssrcs_;
     }
+    // Whether the plugin takes the upper simulcast layers of the publisher
+    // (dataPacket::simulcast_layer > 0). If not, the TransportDelegate only
+    // delivers the lowest layer.
+    virtual bool SupportsSimulcast() {
+      return false;
+    }
   protected:
     boost::mutex gateway_mutex_;
     TransportDelegate* gateway_;
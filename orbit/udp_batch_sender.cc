@@ -0,0 +1,279 @@
+/*
+ * Copyright 2016 (C) Orange Labs Inc. All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * udp_batch_sender.cc
+ * ---------------------------------------------------------------------------
+ * Implements the batched UDP sender with sendmmsg() and UDP GSO.
+ * ---------------------------------------------------------------------------
+ */
+#include "udp_batch_sender.h"
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+// From linux/udp.h, missing in old glibc headers.
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+// The kernel limit of the segments in one GSO message (UDP_MAX_SEGMENTS).
+#define UDP_GSO_MAX_SEGMENTS 64
+// The max payload of one GSO message.
+#define UDP_GSO_MAX_BYTES 60000
+
+DEFINE_bool(udp_gso, true,
+            "Use UDP GSO (UDP_SEGMENT) to send the batched datagrams if the "
+            "kernel supports it.");
+
+namespace orbit {
+namespace {
+  // Returns true if the kernel supports the UDP_SEGMENT socket option.
+  bool ProbeUdpGso() {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+      return false;
+    }
+    int value = 0;
+    socklen_t len = sizeof(value);
+    bool supported = (getsockopt(fd, SOL_UDP, UDP_SEGMENT, &value, &len) == 0);
+    close(fd);
+    LOG(INFO) << "UDP GSO is " << (supported ? "supported" : "not supported");
+    return supported;
+  }
+
+  bool IsUdpGsoSupported() {
+    static bool supported = ProbeUdpGso();
+    return supported;
+  }
+
+  bool SameAddress(const struct sockaddr_storage& a, socklen_t a_len,
+                   const struct sockaddr_storage& b, socklen_t b_len) {
+    return a_len == b_len && memcmp(&a, &b, a_len) == 0;
+  }
+}  // annoymous namespace
+
+const int UdpBatchSender::kMaxBatchSize;
+const int UdpBatchSender::kMaxDatagramSize;
+
+UdpBatchSender::UdpBatchSender() {
+  buffer_ = new char[kMaxBatchSize * kMaxDatagramSize];
+  use_gso_ = FLAGS_udp_gso && IsUdpGsoSupported();
+}
+
+UdpBatchSender::~UdpBatchSender() {
+  delete[] buffer_;
+}
+
+bool UdpBatchSender::Add(int fd, const struct sockaddr* to, socklen_t to_len,
+                         const char* buf, int len) {
+  if (len <= 0 || len > kMaxDatagramSize) {
+    dropped_datagrams_++;
+    return false;
+  }
+  char* out = Reserve(fd, to, to_len);
+  if (out == NULL) {
+    return false;
+  }
+  memcpy(out, buf, len);
+  return Commit(len);
+}
+
+char* UdpBatchSender::Reserve(int fd, const struct sockaddr* to,
+                              socklen_t to_len) {
+  reserved_ = false;
+  if (to_len > sizeof(struct sockaddr_storage)) {
+    dropped_datagrams_++;
+    return NULL;
+  }
+  if (num_datagrams_ == kMaxBatchSize) {
+    Flush();
+  }
+  Datagram* d = &datagrams_[num_datagrams_];
+  d->fd = fd;
+  memcpy(&d->to, to, to_len);
+  d->to_len = to_len;
+  reserved_ = true;
+  return data(num_datagrams_);
+}
+
+bool UdpBatchSender::Commit(int len) {
+  if (!reserved_ || len <= 0 || len > kMaxDatagramSize) {
+    reserved_ = false;
+    dropped_datagrams_++;
+    return false;
+  }
+  reserved_ = false;
+  Datagram* d = &datagrams_[num_datagrams_];
+  d->len = len;
+  d->sent = false;
+  num_datagrams_++;
+  return true;
+}
+
+int UdpBatchSender::Flush() {
+  uint64_t sent_before = sent_datagrams_;
+  for (int i = 0; i < num_datagrams_; ++i) {
+    if (!datagrams_[i].sent) {
+      FlushSocket(i);
+    }
+  }
+  num_datagrams_ = 0;
+  // The reserved datagram (if any) is not in the batch anymore.
+  reserved_ = false;
+  return sent_datagrams_ - sent_before;
+}
+
+void UdpBatchSender::FlushSocket(int first) {
+  struct iovec iovs[kMaxBatchSize];
+  struct mmsghdr msgs[kMaxBatchSize];
+  // The UDP_SEGMENT cmsg of each message.
+  union {
+    char buf[CMSG_SPACE(sizeof(uint16_t))];
+    struct cmsghdr align;
+  } controls[kMaxBatchSize];
+  int segment_size[kMaxBatchSize];
+  int message_bytes[kMaxBatchSize];
+  int message_head[kMaxBatchSize];  // The first datagram of each message.
+  bool message_closed = true;
+  int num_msgs = 0;
+  int num_iovs = 0;
+
+  int fd = datagrams_[first].fd;
+  for (int i = first; i < num_datagrams_; ++i) {
+    Datagram* d = &datagrams_[i];
+    if (d->sent || d->fd != fd) {
+      continue;
+    }
+    d->sent = true;
+    struct iovec* iov = &iovs[num_iovs++];
+    iov->iov_base = data(i);
+    iov->iov_len = d->len;
+
+    if (use_gso_ && num_msgs > 0 && !message_closed) {
+      // Merge into the last message if it goes to the same destination and
+      // all the segments but the last one have the same size.
+      struct msghdr* last = &msgs[num_msgs - 1].msg_hdr;
+      const Datagram* head = &datagrams_[message_head[num_msgs - 1]];
+      if (d->len <= segment_size[num_msgs - 1] &&
+          last->msg_iovlen < UDP_GSO_MAX_SEGMENTS &&
+          message_bytes[num_msgs - 1] + d->len <= UDP_GSO_MAX_BYTES &&
+          SameAddress(head->to, head->to_len, d->to, d->to_len)) {
+        last->msg_iovlen++;
+        message_bytes[num_msgs - 1] += d->len;
+        if (d->len < segment_size[num_msgs - 1]) {
+          // A shorter segment must be the last one.
+          message_closed = true;
+        }
+        continue;
+      }
+    }
+
+    struct msghdr* msg = &msgs[num_msgs].msg_hdr;
+    memset(msg, 0, sizeof(*msg));
+    msg->msg_name = &d->to;
+    msg->msg_namelen = d->to_len;
+    msg->msg_iov = iov;
+    msg->msg_iovlen = 1;
+    msgs[num_msgs].msg_len = 0;
+    segment_size[num_msgs] = d->len;
+    message_bytes[num_msgs] = d->len;
+    message_head[num_msgs] = i;
+    message_closed = false;
+    num_msgs++;
+  }
+
+  for (int i = 0; i < num_msgs; ++i) {
+    struct msghdr* msg = &msgs[i].msg_hdr;
+    if (msg->msg_iovlen <= 1) {
+      continue;
+    }
+    msg->msg_control = controls[i].buf;
+    msg->msg_controllen = sizeof(controls[i].buf);
+    struct cmsghdr* cm = CMSG_FIRSTHDR(msg);
+    cm->cmsg_level = SOL_UDP;
+    cm->cmsg_type = UDP_SEGMENT;
+    cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    uint16_t gso_size = segment_size[i];
+    memcpy(CMSG_DATA(cm), &gso_size, sizeof(gso_size));
+  }
+
+  int offset = 0;
+  while (offset < num_msgs) {
+    int sent = SendMessages(fd, msgs + offset, num_msgs - offset);
+    if (sent > 0) {
+      // A short count is not an error, the rest is sent by the next call,
+      // which fails with its own errno if msgs[offset] can't be sent.
+      for (int i = offset; i < offset + sent; ++i) {
+        sent_datagrams_ += msgs[i].msg_hdr.msg_iovlen;
+      }
+      offset += sent;
+      continue;
+    }
+    if (sent == 0) {
+      // Never returned for a non-empty vector, don't spin on it anyway.
+      for (int i = offset; i < num_msgs; ++i) {
+        dropped_datagrams_ += msgs[i].msg_hdr.msg_iovlen;
+      }
+      break;
+    }
+    // msgs[offset] failed, errno is the one of this call.
+    int error = errno;
+    struct msghdr* failed = &msgs[offset].msg_hdr;
+    if (failed->msg_iovlen > 1 && (error == EIO || error == EINVAL)) {
+      // The kernel or the NIC doesn't support GSO after all, e.g. EIO is
+      // returned when the NIC can't do the checksum offload.
+      LOG(WARNING) << "UDP GSO send failed, errno=" << error
+                   << ", disable UDP GSO.";
+      use_gso_ = false;
+      SendUnsegmented(fd, *failed);
+      offset++;
+    } else if (error == EAGAIN || error == EWOULDBLOCK || error == ENOBUFS) {
+      // The socket buffer is full, drop the rest as nice_agent_send() does.
+      for (int i = offset; i < num_msgs; ++i) {
+        dropped_datagrams_ += msgs[i].msg_hdr.msg_iovlen;
+      }
+      break;
+    } else {
+      LOG_EVERY_N(WARNING, 100) << "sendmmsg failed, fd=" << fd
+                                << " errno=" << error;
+      dropped_datagrams_ += failed->msg_iovlen;
+      offset++;
+    }
+  }
+}
+
+int UdpBatchSender::SendMessages(int fd, struct mmsghdr* msgs, int count) {
+  int sent;
+  do {
+    syscalls_++;
+    sent = sendmmsg(fd, msgs, count, MSG_DONTWAIT);
+  } while (sent < 0 && errno == EINTR);
+  return sent;
+}
+
+void UdpBatchSender::SendUnsegmented(int fd, const struct msghdr& msg) {
+  for (size_t i = 0; i < msg.msg_iovlen; ++i) {
+    syscalls_++;
+    ssize_t ret = sendto(fd, msg.msg_iov[i].iov_base, msg.msg_iov[i].iov_len,
+                         MSG_DONTWAIT,
+                         static_cast<const struct sockaddr*>(msg.msg_name),
+                         msg.msg_namelen);
+    if (ret < 0) {
+      dropped_datagrams_++;
+    } else {
+      sent_datagrams_++;
+    }
+  }
+}
+
+}  // namespace orbit
@@ -0,0 +1,122 @@
+/*
+ * Copyright 2016 (C) Orange Labs Inc. All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * udp_batch_sender.h
+ * ---------------------------------------------------------------------------
+ * Defines a class to gather the outgoing UDP datagrams and send them with as
+ * few syscalls as possible.
+ * ---------------------------------------------------------------------------
+ * The datagrams are copied into the batch by Add() and sent by Flush(). All
+ * the datagrams of the same socket are sent with one sendmmsg() call. With
+ * UDP GSO (Linux >= 4.18), consecutive datagrams of the same size to the same
+ * destination are further merged into one message with a UDP_SEGMENT cmsg,
+ * and the kernel splits them back into datagrams.
+ *
+ * Example usage (one batch per thread, not thread safe):
+ *   UdpBatchSender batch;
+ *   for (...) {
+ *     batch.Add(fd, addr, addr_len, data, len);
+ *   }
+ *   batch.Flush();
+ *
+ * The sockets must stay open until Flush() returns.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include <vector>
+
+namespace orbit {
+
+class UdpBatchSender {
+ public:
+  // The max number of datagrams in a batch. Add() flushes a full batch.
+  static const int kMaxBatchSize = 64;
+  // The max size of a datagram: a RTP packet plus the SRTP auth tag.
+  static const int kMaxDatagramSize = 1600;
+
+  UdpBatchSender();
+  ~UdpBatchSender();
+
+  UdpBatchSender(const UdpBatchSender&) = delete;
+  UdpBatchSender& operator=(const UdpBatchSender&) = delete;
+
+  // Copies the datagram into the batch. Returns false if the datagram is
+  // too large.
+  bool Add(int fd, const struct sockaddr* to, socklen_t to_len,
+           const char* data, int len);
+  // Reserves the next datagram of the batch, to write it right there
+  // instead of copying it in with Add() (e.g. SRTP protect it into the
+  // batch). Returns the buffer of kMaxDatagramSize bytes, or NULL if the
+  // address is too large. The datagram is only added by Commit(), it is
+  // dropped by the next Reserve() or Add() otherwise.
+  char* Reserve(int fd, const struct sockaddr* to, socklen_t to_len);
+  // Adds the reserved datagram of len bytes. Returns false if there is no
+  // reserved datagram or len is out of range.
+  bool Commit(int len);
+  // Sends all the pending datagrams. Returns the number of datagrams sent.
+  int Flush();
+
+  int pending() const {
+    return num_datagrams_;
+  }
+
+  // Enables or disables UDP GSO. It is enabled by default (--udp_gso) and
+  // turned off automatically if the kernel or the NIC rejects it.
+  void set_use_gso(bool use_gso) {
+    use_gso_ = use_gso;
+  }
+  bool use_gso() const {
+    return use_gso_;
+  }
+
+  // Stats
+  uint64_t sent_datagrams() const {
+    return sent_datagrams_;
+  }
+  uint64_t dropped_datagrams() const {
+    return dropped_datagrams_;
+  }
+  uint64_t syscalls() const {
+    return syscalls_;
+  }
+
+ private:
+  struct Datagram {
+    int fd;
+    struct sockaddr_storage to;
+    socklen_t to_len;
+    int len;
+    bool sent;
+  };
+
+  // Sends the pending datagrams of the socket of datagrams_[first].
+  void FlushSocket(int first);
+  // Sends msgs[0, count) with sendmmsg(). Returns the number of messages
+  // sent, which may be less than count, or -1 (with errno set) if msgs[0]
+  // failed.
+  int SendMessages(int fd, struct mmsghdr* msgs, int count);
+  // Resends the datagrams of a GSO message one by one.
+  void SendUnsegmented(int fd, const struct msghdr& msg);
+
+  char* data(int index) {
+    return buffer_ + index * kMaxDatagramSize;
+  }
+
+  Datagram datagrams_[kMaxBatchSize];
+  int num_datagrams_ = 0;
+  bool reserved_ = false;
+  char* buffer_;  // kMaxBatchSize * kMaxDatagramSize bytes.
+  bool use_gso_;
+
+  uint64_t sent_datagrams_ = 0;
+  uint64_t dropped_datagrams_ = 0;
+  uint64_t syscalls_ = 0;
+};
+
+}  // namespace orbit
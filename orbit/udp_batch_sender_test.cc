@@ -0,0 +1,230 @@
+/*
+ * Copyright 2016 (C) Orange Labs Inc. All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * udp_batch_sender_test.cc
+ * ---------------------------------------------------------------------------
+ * Tests the batched UDP sender against loopback sockets.
+ * ---------------------------------------------------------------------------
+ */
+#include "udp_batch_sender.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace orbit {
+namespace {
+
+class LoopbackSocket {
+ public:
+  LoopbackSocket() {
+    fd_ = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(&addr_, 0, sizeof(addr_));
+    addr_.sin_family = AF_INET;
+    addr_.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr_.sin_port = 0;
+    bind(fd_, reinterpret_cast<struct sockaddr*>(&addr_), sizeof(addr_));
+    socklen_t len = sizeof(addr_);
+    getsockname(fd_, reinterpret_cast<struct sockaddr*>(&addr_), &len);
+    struct timeval tv = {1, 0};
+    setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  }
+  ~LoopbackSocket() {
+    close(fd_);
+  }
+  int fd() const {
+    return fd_;
+  }
+  const struct sockaddr* addr() const {
+    return reinterpret_cast<const struct sockaddr*>(&addr_);
+  }
+  socklen_t addr_len() const {
+    return sizeof(addr_);
+  }
+  // Returns an empty string on timeout.
+  std::string Receive() {
+    char buf[2048];
+    ssize_t len = recv(fd_, buf, sizeof(buf), 0);
+    if (len < 0) {
+      return std::string();
+    }
+    return std::string(buf, len);
+  }
+
+ private:
+  int fd_;
+  struct sockaddr_in addr_;
+};
+
+std::string MakeDatagram(int index, int len) {
+  std::string data(len, static_cast<char>('a' + index % 26));
+  data[0] = static_cast<char>(index);
+  return data;
+}
+
+void SendAndVerify(bool use_gso, const std::vector<int>& sizes) {
+  LoopbackSocket sender;
+  LoopbackSocket receiver;
+  UdpBatchSender batch;
+  batch.set_use_gso(batch.use_gso() && use_gso);
+  std::vector<std::string> expected;
+  for (size_t i = 0; i < sizes.size(); ++i) {
+    expected.push_back(MakeDatagram(i, sizes[i]));
+    EXPECT_TRUE(batch.Add(sender.fd(), receiver.addr(), receiver.addr_len(),
+                          expected.back().data(), expected.back().size()));
+  }
+  EXPECT_EQ((int)sizes.size(), batch.pending());
+  EXPECT_EQ((int)sizes.size(), batch.Flush());
+  EXPECT_EQ(0, batch.pending());
+  EXPECT_EQ(0u, batch.dropped_datagrams());
+  EXPECT_GE(batch.syscalls(), 1u);
+  for (size_t i = 0; i < expected.size(); ++i) {
+    EXPECT_EQ(expected[i], receiver.Receive()) << "datagram " << i;
+  }
+}
+
+}  // annoymous namespace
+
+TEST(UdpBatchSenderTest, SendsInOrderWithoutGso) {
+  SendAndVerify(false, {1200, 1200, 300, 1200, 80, 1400});
+}
+
+TEST(UdpBatchSenderTest, SendsInOrderWithGso) {
+  // Equal sized runs are merged into GSO messages if supported, the receiver
+  // must still see the original datagrams.
+  SendAndVerify(true, {1200, 1200, 1200, 900, 1200, 1200, 100, 100, 100});
+}
+
+TEST(UdpBatchSenderTest, OneSyscallPerSocket) {
+  LoopbackSocket sender;
+  LoopbackSocket receiver;
+  UdpBatchSender batch;
+  std::string data = MakeDatagram(1, 500);
+  for (int i = 0; i < 10; ++i) {
+    batch.Add(sender.fd(), receiver.addr(), receiver.addr_len(),
+              data.data(), i % 2 == 0 ? 500 : 400);
+  }
+  EXPECT_EQ(10, batch.Flush());
+  EXPECT_EQ(1u, batch.syscalls());
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_EQ(i % 2 == 0 ? 500u : 400u, receiver.Receive().size());
+  }
+}
+
+TEST(UdpBatchSenderTest, GroupsBySocket) {
+  LoopbackSocket sender1;
+  LoopbackSocket sender2;
+  LoopbackSocket receiver1;
+  LoopbackSocket receiver2;
+  UdpBatchSender batch;
+  for (int i = 0; i < 6; ++i) {
+    std::string data = MakeDatagram(i, 200 + i);
+    if (i % 2 == 0) {
+      batch.Add(sender1.fd(), receiver1.addr(), receiver1.addr_len(),
+                data.data(), data.size());
+    } else {
+      batch.Add(sender2.fd(), receiver2.addr(), receiver2.addr_len(),
+                data.data(), data.size());
+    }
+  }
+  EXPECT_EQ(6, batch.Flush());
+  EXPECT_EQ(2u, batch.syscalls());
+  for (int i = 0; i < 6; i += 2) {
+    EXPECT_EQ(MakeDatagram(i, 200 + i), receiver1.Receive());
+    EXPECT_EQ(MakeDatagram(i + 1, 201 + i), receiver2.Receive());
+  }
+}
+
+TEST(UdpBatchSenderTest, FlushesWhenFull) {
+  LoopbackSocket sender;
+  LoopbackSocket receiver;
+  UdpBatchSender batch;
+  batch.set_use_gso(false);
+  std::string data = MakeDatagram(0, 100);
+  for (int i = 0; i < UdpBatchSender::kMaxBatchSize + 1; ++i) {
+    batch.Add(sender.fd(), receiver.addr(), receiver.addr_len(),
+              data.data(), data.size());
+  }
+  EXPECT_EQ(1, batch.pending());
+  EXPECT_EQ((uint64_t)UdpBatchSender::kMaxBatchSize, batch.sent_datagrams());
+  EXPECT_EQ(1, batch.Flush());
+}
+
+TEST(UdpBatchSenderTest, RejectsTooLargeDatagram) {
+  LoopbackSocket receiver;
+  UdpBatchSender batch;
+  std::string data(UdpBatchSender::kMaxDatagramSize + 1, 'x');
+  EXPECT_FALSE(batch.Add(receiver.fd(), receiver.addr(), receiver.addr_len(),
+                         data.data(), data.size()));
+  EXPECT_EQ(0, batch.pending());
+  EXPECT_EQ(1u, batch.dropped_datagrams());
+}
+
+TEST(UdpBatchSenderTest, ResumesAfterShortCount) {
+  LoopbackSocket sender;
+  LoopbackSocket receiver;
+  UdpBatchSender batch;
+  batch.set_use_gso(false);
+  // An IPv6 address on the IPv4 socket: sendmmsg() stops short before it,
+  // and fails on it when called again.
+  struct sockaddr_in6 bad;
+  memset(&bad, 0, sizeof(bad));
+  bad.sin6_family = AF_INET6;
+  bad.sin6_addr = in6addr_loopback;
+  bad.sin6_port = htons(9);
+  for (int i = 0; i < 6; ++i) {
+    std::string data = MakeDatagram(i, 100 + i);
+    if (i == 3) {
+      batch.Add(sender.fd(), reinterpret_cast<struct sockaddr*>(&bad),
+                sizeof(bad), data.data(), data.size());
+    } else {
+      batch.Add(sender.fd(), receiver.addr(), receiver.addr_len(),
+                data.data(), data.size());
+    }
+  }
+  // A stale errno must not be taken for the error of the short count.
+  errno = EAGAIN;
+  EXPECT_EQ(5, batch.Flush());
+  EXPECT_EQ(1u, batch.dropped_datagrams());
+  for (int i = 0; i < 6; ++i) {
+    if (i != 3) {
+      EXPECT_EQ(MakeDatagram(i, 100 + i), receiver.Receive()) << "datagram " << i;
+    }
+  }
+}
+
+TEST(UdpBatchSenderTest, WritesReservedDatagramInPlace) {
+  LoopbackSocket sender;
+  LoopbackSocket receiver;
+  UdpBatchSender batch;
+  std::string first = MakeDatagram(0, 300);
+  std::string second = MakeDatagram(1, 200);
+  char* out = batch.Reserve(sender.fd(), receiver.addr(), receiver.addr_len());
+  ASSERT_TRUE(out != NULL);
+  memcpy(out, first.data(), first.size());
+  EXPECT_TRUE(batch.Commit(first.size()));
+  // A reservation which is not committed is dropped.
+  ASSERT_TRUE(batch.Reserve(sender.fd(), receiver.addr(),
+                            receiver.addr_len()) != NULL);
+  out = batch.Reserve(sender.fd(), receiver.addr(), receiver.addr_len());
+  ASSERT_TRUE(out != NULL);
+  memcpy(out, second.data(), second.size());
+  EXPECT_TRUE(batch.Commit(second.size()));
+  EXPECT_FALSE(batch.Commit(100));
+  EXPECT_EQ(2, batch.pending());
+  EXPECT_EQ(2, batch.Flush());
+  EXPECT_EQ(first, receiver.Receive());
+  EXPECT_EQ(second, receiver.Receive());
+}
+
+}  // namespace orbit
@@ -69,7 +69,21 @@ namespace {
     if (packet.type == AUDIO_PACKET) {
       // do nothing
     } else if (packet.type == VIDEO_PACKET) {
-      video_queue_.pushPacket((const char *)&(packet.data[0]), packet.length);
+      auto vd_room = room_.lock();
+      if (vd_room) {
+        ((VideoDispatcherRoom*)vd_room.get())->PublishPacket(stream_id_, packet);
+      }
+    }
+  }
+
+  void VideoDispatcherPlugin::IncomingRtpBuffer(const PacketBufferPtr& buffer) {
+    if (buffer->type != VIDEO_PACKET) {
+      TransportPlugin::IncomingRtpBuffer(buffer);
+      return;
+    }
+    auto vd_room = room_.lock();
+    if (vd_room) {
+      ((VideoDispatcherRoom*)vd_room.get())->PublishBuffer(stream_id_, buffer);
     }
   }
 
@@ -11,7 +11,6 @@
 
 #include "stream_service/orbit/transport_plugin.h"
 #include "stream_service/orbit/modules/media_packet.h"
-#include "stream_service/orbit/rtp/rtp_packet_queue.h"
 #include "stream_service/orbit/rtp/rtp_headers.h"
 
 namespace orbit{
@@ -38,6 +37,9 @@ class VideoDispatcherPlugin : public TransportPlugin {
     // Overrides the interface in TransportPluginInterface
     void IncomingRtpPacket(const dataPacket& packet) override;
     void IncomingRtcpPacket(const dataPacket& packet) override;
+    // Overrides the interface in TransportPlugin, the video is published
+    // without copying it into a dataPacket.
+    void IncomingRtpBuffer(const PacketBufferPtr& buffer) override;
 
     void RelayMediaOutputPacket(const std::shared_ptr<MediaOutputPacket>  packet,
                                 packetType packet_type);
@@ -62,17 +64,14 @@ class VideoDispatcherPlugin : public TransportPlugin {
   private:
     bool Init();
     void Release();
-    RtpPacketQueue* GetVideoQueue() {
-      return &video_queue_;
-    }
-
-    RtpPacketQueue video_queue_;  // inbuf
 
     bool muted_;
     bool prebuffering_;
 
     std::weak_ptr<Room> room_;
     int stream_id_;
+    // The FIR sequence number, while the plugin is the publisher.
+    int fir_seq_ = 0;
     friend class VideoDispatcherRoom;
   };
 }
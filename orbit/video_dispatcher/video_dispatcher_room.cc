@@ -15,28 +15,34 @@
 #include "stream_service/orbit/rtp/janus_rtcp_processor.h"
 #include "stream_service/orbit/live_stream/common_defines.h"
 #include "stream_service/orbit/base/timeutil.h"
+#include "stream_service/orbit/packet_trace.h"
 
 #include "gflags/gflags.h"
 
-#define VIDEO_PREBUFFERING_SIZE 0
+// The packets queued from the publisher to the forward thread.
+#define VIDEO_DISPATCHER_QUEUE_SIZE 1024
+// The max number of packets forwarded with one snapshot of the viewers.
+#define VIDEO_DISPATCHER_FORWARD_BUDGET 64
+// The forward thread wakes up periodically to ask for a key frame.
+#define VIDEO_DISPATCHER_IDLE_WAIT 100 // in ms
+// The RTP timestamp gap inserted when the publisher changes, one frame at
+// 30fps in the 90kHz clock.
+#define VIDEO_DISPATCHER_SWITCH_TS_GAP 3000
 
 namespace orbit {
 using namespace std;
-  VideoDispatcherRoom::VideoDispatcherRoom() {
-    running_ = false;
-    for (int i = 0; i < MAX_DISPATCHER_PARTICIPANT_COUNT; ++i) {
-      fir_seq_[i] = 0;
-    }
-    // publisher
-    current_viewer_ = -1;
-    publisher_stream_id_ = -1;
+  VideoDispatcherRoom::VideoDispatcherRoom()
+    : subscribers_(std::make_shared<Subscribers>()),
+      publisher_ring_(VIDEO_DISPATCHER_QUEUE_SIZE) {
   }
   void VideoDispatcherRoom::Create() {
   }
   void VideoDispatcherRoom::Destroy() {
       running_ = false;
+      notifier_.ForceNotify();
       if (selective_forward_thread_.get() != NULL) {
        selective_forward_thread_->join();
+       selective_forward_thread_.reset();
        VLOG(3) << "Thread terminated on destructor in video dispatcher room";
       }
   }
@@ -50,7 +56,9 @@ using namespace std;
 
   void VideoDispatcherRoom::AddParticipant(TransportPlugin* plugin) {
     VLOG(2) << "AddParticipant===========================================================";
-    Room::AddParticipant(plugin);
+    boost::mutex::scoped_lock lock(room_plugin_mutex_);
+    plugins_.push_back(plugin);
+    UpdateSubscribers();
   }
 
   bool VideoDispatcherRoom::RemoveParticipant(TransportPlugin* plugin) {
@@ -58,16 +66,37 @@ using namespace std;
       boost::mutex::scoped_lock lock(room_plugin_mutex_);
       VideoDispatcherPlugin *vd_plugin = (VideoDispatcherPlugin *)plugin;
       if (vd_plugin->stream_id() == publisher_stream_id_) {
-        current_viewer_ = -1; // reset publiser  
+        publisher_stream_id_ = -1; // reset publiser
       }
       Room::RemoveParticipant(plugin);
-      return true;
+      UpdateSubscribers();
+    }
+    // Waits for the forward thread to leave the old snapshot, the plugin is
+    // deleted once we return.
+    std::lock_guard<std::mutex> sync(forward_mutex_);
+    return true;
+  }
+
+  void VideoDispatcherRoom::UpdateSubscribers() {
+    std::shared_ptr<Subscribers> subscribers = std::make_shared<Subscribers>();
+    for (TransportPlugin* plugin : plugins_) {
+      VideoDispatcherPlugin* p = (VideoDispatcherPlugin*)plugin;
+      if (p->stream_id() == publisher_stream_id_) {
+        subscribers->publisher = p;
+        subscribers->publisher_stream_id = p->stream_id();
+      } else {
+        subscribers->viewers.push_back(p);
+      }
     }
+    std::atomic_store(&subscribers_,
+                      std::shared_ptr<const Subscribers>(subscribers));
   }
- 
+
   void VideoDispatcherRoom::SendFirPacketToViewer() {
-    std::vector<TransportPlugin*> participants = GetParticipants();
-    SwitchPublisher(current_viewer_);
+    boost::mutex::scoped_lock lock(room_plugin_mutex_);
+    if (subscribers_->publisher != NULL) {
+      SendFirPacket(subscribers_->publisher);
+    }
   }
 
   void VideoDispatcherRoom::SetupLiveStream(bool support, bool need_return_video,
@@ -81,19 +110,17 @@ using namespace std;
       live_stream_processor_->Start(live_location);
     }
   }
-  void VideoDispatcherRoom::SendFirPacket(int viewer, const std::vector<TransportPlugin*>& participants ) {
 
-    if (viewer < 0 || viewer > (MAX_DISPATCHER_PARTICIPANT_COUNT - 1)) {
-      LOG(ERROR) << "Invalid viewer index for SendFirPacket. index = " << viewer;
-      return;
-    }
+  void VideoDispatcherRoom::SendFirPacket(VideoDispatcherPlugin* publisher) {
     // Send another FIR/PLI packet to the sender.
     /* Send a FIR to the new RTP forward publisher */
     char buf[20];
     memset(buf, 0, 20);
-    int fir_tmp = fir_seq_[viewer];
-    int len = janus_rtcp_fir((char *)&buf, 20, &fir_tmp);
-    fir_seq_[viewer] = fir_tmp;
+    int len;
+    {
+      std::lock_guard<std::mutex> guard(fir_mutex_);
+      len = janus_rtcp_fir((char *)&buf, 20, &publisher->fir_seq_);
+    }
 
     dataPacket p;
     p.comp = 0;
@@ -101,9 +128,7 @@ using namespace std;
     p.length = len;
     memcpy(&(p.data[0]), buf, len);
 
-    TransportPlugin* tp = participants[viewer];
-    VideoDispatcherPlugin* acp = reinterpret_cast<VideoDispatcherPlugin*>(tp);
-    acp->RelayRtcpPacket(p);
+    publisher->RelayRtcpPacket(p);
     VLOG(2) << "Send RTCP...FIR....";
 
     /* Send a PLI too, just in case... */
@@ -112,133 +137,154 @@ using namespace std;
 
     p.length = len;
     memcpy(&(p.data[0]), buf, len);
-    acp->RelayRtcpPacket(p);
+    publisher->RelayRtcpPacket(p);
     VLOG(2) << "Send RTCP...PLI....===========================================================";
   }
 
+  bool VideoDispatcherRoom::PublishPacket(int stream_id, const dataPacket& packet) {
+    if (stream_id != publisher_stream_id_.load(std::memory_order_relaxed)) {
+      return false;
+    }
+    PacketBufferPtr buffer = PacketBuffer::Create(packet);
+    if (buffer == NULL) {
+      return false;
+    }
+    buffer->comp = 0;
+    buffer->type = VIDEO_PACKET;
+    return PublishBuffer(stream_id, buffer);
+  }
+
+  bool VideoDispatcherRoom::PublishBuffer(int stream_id,
+                                          const PacketBufferPtr& buffer) {
+    if (stream_id != publisher_stream_id_.load(std::memory_order_relaxed)) {
+      return false;
+    }
+    if (buffer->length() <= RTP_HEADER_BASE_SIZE) {
+      return false;
+    }
+    PublishedPacket published;
+    published.buffer = buffer;
+    PacketTraceContext* trace = PacketTracer::Current();
+    if (trace != NULL && trace != &buffer->trace) {
+      buffer->trace = *trace;
+    }
+    published.stream_id = stream_id;
+    if (!publisher_ring_.TryPush(published)) {
+      int64_t dropped = ++dropped_packets_;
+      LOG_EVERY_N(WARNING, 100) << "Video dispatcher queue is full, dropped "
+                                << dropped << " packets so far.";
+      return false;
+    }
+    notifier_.Notify();
+    return true;
+  }
+
   void VideoDispatcherRoom::SelectiveVideoForward() {
     VLOG(2) << "SelectiveVideoForward";
     /* Set thread name */
     prctl(PR_SET_NAME, (unsigned long)"VDR::SelectiveVideoForward");
 
-    /* RTP */
-    int16_t seq = 0;
-    int32_t ts = 0;
-
-    int32_t last_ts = 0;
-    int32_t base_ts = -1;
-    int16_t last_seq = 0;
-    int16_t base_seq = -1;
-
+    ForwardState state;
     long long framekey_timeout = getTimeMS();
-    
-    bool need_sleep = false;
 
     while(running_) {
-
-      if (need_sleep) {
-       usleep(1000);
-       need_sleep = false;
+      notifier_.PrepareWait();
+      if (!publisher_ring_.EmptyApprox()) {
+        notifier_.CancelWait();
+      } else {
+        notifier_.Wait(VIDEO_DISPATCHER_IDLE_WAIT);
       }
 
-      // TODO Need to refactor the code for using lock 
-      boost::mutex::scoped_lock lock(room_plugin_mutex_);
-
-      std::vector<TransportPlugin*> participants = GetParticipants();
-      int count = participants.size();
-      if (count == 0) {
-        VLOG(2) << "No participant...";
-        need_sleep = true;
-        continue;
-      }
+      std::lock_guard<std::mutex> sync(forward_mutex_);
+      std::shared_ptr<const Subscribers> subscribers =
+        std::atomic_load(&subscribers_);
 
-      // check publiser
-      if (current_viewer_ == -1) {
-        VLOG(2) << "publisher not ready...";
-        need_sleep = true;
-        continue;
-      }
-      
-      // force to ask for fir packet each 10 second 
+      // force to ask for fir packet each 10 second
       long long current_time = getTimeMS();
-      if (current_time - framekey_timeout > 10000) {
+      if (subscribers->publisher != NULL &&
+          current_time - framekey_timeout > 10000) {
         framekey_timeout = current_time;
-        SendFirPacket(current_viewer_, participants);
+        SendFirPacket(subscribers->publisher);
       }
 
-      orbit::dataPacket pkt;
-      {
-        // get packet from publisher 
-        TransportPlugin* p = participants[current_viewer_];
-        VideoDispatcherPlugin* acp = reinterpret_cast<VideoDispatcherPlugin*>(p);
-        RtpPacketQueue* inbuf = acp->GetVideoQueue();
-        if (inbuf->getSize() > VIDEO_PREBUFFERING_SIZE) {
-          std::shared_ptr<orbit::dataPacket> rtp_packet = inbuf->popPacket(true);
-          pkt = *(rtp_packet.get());
-        }
-
-        // publish the packet to subscribers
-        if (pkt.length != 0) {
-          /* Update RTP header information */
-          const unsigned char* data_buf = reinterpret_cast<const unsigned char*>(&(pkt.data[0]));
-          const RtpHeader* h = reinterpret_cast<const RtpHeader*>(pkt.data);
-          if (base_seq == -1) {
-            base_seq = h->getSeqNumber();
-          }
-          seq = last_seq + (h->getSeqNumber() - base_seq);
-          if (base_ts == -1) {
-            base_ts = h->getTimestamp();
-          }
-          ts = last_ts + (h->getTimestamp() - base_ts);
-  
-          //ts = h->getTimestamp();
-  
-          VLOG(3) << " VideoPacket payload=" << (int)(h->getPayloadType())
-                  << " ts=" <<  h->getTimestamp()
-                  << " our_ts=" << ts
-                  << " seq=" << h->getSeqNumber()
-                  << " our_seq=" << seq
-                  << " h->getMarker()=" << (int)(h->getMarker())
-                  << " headerLength=" << h->getHeaderLength()
-                  << " pkt.length=" << pkt.length;
-
-          std::shared_ptr<MediaOutputPacket> mixed_pkt = std::make_shared<MediaOutputPacket>();
-          mixed_pkt->timestamp = ts;
-          mixed_pkt->seq_number = seq;
-          mixed_pkt->end_frame = h->getMarker();
-          mixed_pkt->ssrc = -1;
-
-          unsigned char* tmp_buf = (unsigned char*)malloc(pkt.length-12);
-
-          memcpy(tmp_buf, data_buf+12, pkt.length-12);
-          mixed_pkt->encoded_buf = tmp_buf;
-          mixed_pkt->length = pkt.length-12;
-          for (int i = 0; i < count; ++i) {
-            VideoDispatcherPlugin* p = (VideoDispatcherPlugin*)participants[i];
-            if(i == current_viewer_){
-                VLOG(3) << "Publisher id :"<<p->stream_id();
-                continue;
-            }
-            VLOG(3) << "Send video to :"<<p->stream_id();
-            VideoDispatcherPlugin* acp = reinterpret_cast<VideoDispatcherPlugin*>(p);
-            acp->RelayMediaOutputPacket(mixed_pkt, VIDEO_PACKET);
-          }
-          if (use_webcast_  && live_stream_processor_->IsStarted()){
-            live_stream_processor_->RelayRtpVideoPacket(mixed_pkt);
-          }
-        } else {
-          usleep(1000);
-          need_sleep = true;
+      PublishedPacket packet;
+      for (int i = 0; i < VIDEO_DISPATCHER_FORWARD_BUDGET &&
+           publisher_ring_.TryPop(&packet); ++i) {
+        // Queued before the publisher changed.
+        if (packet.stream_id != subscribers->publisher_stream_id) {
           continue;
         }
+        ForwardPacket(*subscribers, &packet, &state);
       }
-    } // while(running_) 
+      packet.buffer.reset();
+    } // while(running_)
   }
-  
-  void VideoDispatcherRoom::SwitchPublisher(int publisher_id) {
-    VLOG(3) << "Change the Viewer....";
-    std::vector<TransportPlugin*> participants = GetParticipants();
-    SendFirPacket(publisher_id, participants);
+
+  void VideoDispatcherRoom::ForwardPacket(const Subscribers& subscribers,
+                                          PublishedPacket* packet,
+                                          ForwardState* state) {
+    // The received buffer may still be read by the receiving thread, e.g.
+    // by the RTP capture. It is only copied then.
+    if (!packet->buffer->unique()) {
+      packet->buffer = packet->buffer->Clone();
+    }
+    PacketBuffer* buffer = packet->buffer.get();
+    PacketTraceContext trace = buffer->trace;
+    PacketTraceScope scope(&trace);
+    PacketTracer::EndStage(TRACE_STAGE_PLUGIN_QUEUE);
+
+    /* Update RTP header information */
+    const RtpHeader* h = reinterpret_cast<const RtpHeader*>(buffer->data());
+    if (packet->stream_id != state->stream_id) {
+      // A new publisher, continue the sequence numbers and timestamps.
+      if (state->stream_id != -1) {
+        state->last_seq = state->seq + 1;
+        state->last_ts = state->ts + VIDEO_DISPATCHER_SWITCH_TS_GAP;
+      }
+      state->base_seq = h->getSeqNumber();
+      state->base_ts = h->getTimestamp();
+      state->stream_id = packet->stream_id;
+    }
+    state->seq = state->last_seq + (uint16_t)(h->getSeqNumber() - state->base_seq);
+    state->ts = state->last_ts + (h->getTimestamp() - state->base_ts);
+
+    VLOG(3) << " VideoPacket payload=" << (int)(h->getPayloadType())
+            << " ts=" <<  h->getTimestamp()
+            << " our_ts=" << state->ts
+            << " seq=" << h->getSeqNumber()
+            << " our_seq=" << state->seq
+            << " h->getMarker()=" << (int)(h->getMarker())
+            << " headerLength=" << h->getHeaderLength()
+            << " pkt.length=" << buffer->length();
+
+    // The header is rewritten in place while the buffer is still private
+    // to this thread, the viewers only read it.
+    RtpHeader rtp_header;
+    rtp_header.setTimestamp(state->ts);
+    rtp_header.setSeqNumber(state->seq);
+    rtp_header.setSSRC(-1);
+    rtp_header.setMarker(h->getMarker());
+    rtp_header.setPayloadType(VP8_90000_PT);
+    memcpy(buffer->data(), &rtp_header, RTP_HEADER_BASE_SIZE);
+
+    for (VideoDispatcherPlugin* viewer : subscribers.viewers) {
+      VLOG(3) << "Send video to :" << viewer->stream_id();
+      viewer->RelayRtpBuffer(packet->buffer);
+    }
+    forwarded_packets_++;
+
+    if (use_webcast_  && live_stream_processor_->IsStarted()){
+      std::shared_ptr<MediaOutputPacket> mixed_pkt = std::make_shared<MediaOutputPacket>();
+      mixed_pkt->timestamp = state->ts;
+      mixed_pkt->seq_number = state->seq;
+      mixed_pkt->end_frame = rtp_header.getMarker();
+      mixed_pkt->ssrc = -1;
+      mixed_pkt->length = buffer->length() - RTP_HEADER_BASE_SIZE;
+      mixed_pkt->encoded_buf = (unsigned char*)malloc(mixed_pkt->length);
+      memcpy(mixed_pkt->encoded_buf, buffer->data() + RTP_HEADER_BASE_SIZE,
+             mixed_pkt->length);
+      live_stream_processor_->RelayRtpVideoPacket(mixed_pkt);
+    }
   }
 
   bool VideoDispatcherRoom::ProcessMessage(int stream_id, int message_type, void *data) {
@@ -246,15 +292,13 @@ using namespace std;
     if (message_type == 2) { // TODO hard code here for set publisher message
       bool success = false;
       {
-        boost::mutex::scoped_lock lock(room_plugin_mutex_);          
-        std::vector<TransportPlugin*> participants = GetParticipants();
-        int count = participants.size();
-        for (int i = 0; i < count; ++i) {
-          VideoDispatcherPlugin* p = (VideoDispatcherPlugin*)participants[i];
+        boost::mutex::scoped_lock lock(room_plugin_mutex_);
+        for (TransportPlugin* plugin : plugins_) {
+          VideoDispatcherPlugin* p = (VideoDispatcherPlugin*)plugin;
           if (stream_id == p->stream_id()) {
             publisher_stream_id_ = stream_id;
-            current_viewer_ = i;
-            SendFirPacket(current_viewer_, participants);
+            UpdateSubscribers();
+            SendFirPacket(p);
             success = true;
           }
         }
@@ -262,28 +306,28 @@ using namespace std;
       if (!success) {
         LOG(ERROR) << "Fail to set publisher since stream_id not found .. ";
       }
-      return success; 
+      return success;
     } else {
-      // other message 
+      // other message
       LOG(ERROR) << "Unknown message to VideoDispatcherRoom";
     }
-    return false; 
+    return false;
   }
 
   void VideoDispatcherRoom::RequestFirPacket(const int stream_id) {
     {
-      boost::mutex::scoped_lock lock(room_plugin_mutex_);          
+      boost::mutex::scoped_lock lock(room_plugin_mutex_);
 
-      if (current_viewer_ != -1 && stream_id != publisher_stream_id_) {
+      VideoDispatcherPlugin* publisher = subscribers_->publisher;
+      if (publisher != NULL && stream_id != publisher_stream_id_) {
         // When requesting a key frame, set the interval limit of 2 seconds.
         long long current_time = getTimeMS();
         if (current_time < last_fir_time_ + 2000) {
           return;
         }
-        last_fir_time_ = current_time;  
+        last_fir_time_ = current_time;
 
-        std::vector<TransportPlugin*> participants = GetParticipants();
-        SendFirPacket(current_viewer_, participants);
+        SendFirPacket(publisher);
      }
 
     }
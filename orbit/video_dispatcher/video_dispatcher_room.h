@@ -3,19 +3,37 @@
  *
  *  Created on: Mar 23, 2016
  *      Author: vellee
+ *
+ * The room forwards the video of one publisher to all the other
+ * participants (the viewers):
+ *  - The publisher's ingress pushes each packet into a MPSC ring and wakes
+ *    up the forward thread, which never polls.
+ *  - The viewers are read from an immutable snapshot, which is replaced
+ *    (copy-on-write) when a participant joins or leaves or the publisher
+ *    changes, so the forward thread doesn't take room_plugin_mutex_.
+ *  - The RTP header is rewritten once per packet, and the same buffer is
+ *    relayed to all the viewers.
  */
 
 #ifndef VIDEO_DISPATCHER_VIDEO_DISPATCHER_ROOM_H_
 #define VIDEO_DISPATCHER_VIDEO_DISPATCHER_ROOM_H_
 
 #include "stream_service/orbit/transport_plugin.h"
+#include "stream_service/orbit/packet_buffer.h"
+#include "stream_service/orbit/base/event_notifier.h"
+#include "stream_service/orbit/base/mpsc_ring.h"
 #include "stream_service/orbit/live_stream/live_stream_processor.h"
 #include "stream_service/orbit/live_stream/live_stream_processor_impl.h"
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <vector>
 
-#define MAX_DISPATCHER_PARTICIPANT_COUNT 100
-
 namespace orbit {
+  class VideoDispatcherPlugin;
+
   class VideoDispatcherRoom : public Room {
    public:
      VideoDispatcherRoom();
@@ -32,23 +50,74 @@ namespace orbit {
      bool RemoveParticipant(TransportPlugin* plugin) override;
      bool ProcessMessage(int stream_id, int message_type, void *data);
 
-     // custom 
-     void SwitchPublisher(int publisher_id);
+     // custom
      void SendFirPacketToViewer();
      void RequestFirPacket(const int stream_id);
 
+     // Queues the video packet of the stream for the viewers, if the stream
+     // is the publisher. Never blocks, returns false if the packet is not
+     // forwarded.
+     bool PublishPacket(int stream_id, const dataPacket& packet);
+     // Same as PublishPacket(), the buffer is shared, not copied.
+     bool PublishBuffer(int stream_id, const PacketBufferPtr& buffer);
+
+     int64_t forwarded_packets() const {
+       return forwarded_packets_;
+     }
+     int64_t dropped_packets() const {
+       return dropped_packets_;
+     }
+
    private:
-     bool running_;
+     // The participants as seen by the forward thread. Never modified once
+     // published.
+     struct Subscribers {
+       VideoDispatcherPlugin* publisher = NULL;
+       int publisher_stream_id = -1;
+       std::vector<VideoDispatcherPlugin*> viewers;
+     };
+
+     struct PublishedPacket {
+       PacketBufferPtr buffer;
+       int stream_id = -1;
+     };
+
+     // The RTP sequence numbers and timestamps sent to the viewers, which
+     // continue across the publisher switches.
+     struct ForwardState {
+       int stream_id = -1;
+       uint16_t base_seq = 0;
+       uint32_t base_ts = 0;
+       uint16_t last_seq = 0;
+       uint32_t last_ts = 0;
+       uint16_t seq = 0;
+       uint32_t ts = 0;
+     };
 
-     int publisher_stream_id_;
-     int current_viewer_;
+     std::atomic<bool> running_{false};
 
-     int32_t fir_seq_[MAX_DISPATCHER_PARTICIPANT_COUNT];
+     std::atomic<int> publisher_stream_id_{-1};
+
+     std::mutex fir_mutex_;  // protects fir_seq_ of the plugins.
      long long last_fir_time_{0};
-     
+
      // The thread to do the SFU stuff.
      void SelectiveVideoForward();
-     void SendFirPacket(int viewer, const std::vector<TransportPlugin*>& participants );
+     void ForwardPacket(const Subscribers& subscribers,
+                        PublishedPacket* packet, ForwardState* state);
+     void SendFirPacket(VideoDispatcherPlugin* publisher);
+     // Publishes a new snapshot of plugins_, under room_plugin_mutex_.
+     void UpdateSubscribers();
+
+     std::shared_ptr<const Subscribers> subscribers_;
+     MpscRing<PublishedPacket> publisher_ring_;
+     EventNotifier notifier_;
+     // Held by the forward thread while it uses a snapshot. Taken by
+     // RemoveParticipant() to wait until the removed plugin is not used
+     // anymore.
+     std::mutex forward_mutex_;
+     std::atomic<int64_t> forwarded_packets_{0};
+     std::atomic<int64_t> dropped_packets_{0};
 
      // Thread to mix the packets from different participants.
      bool use_webcast_ = false;
@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2016 Orangelab Inc. All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * i420_compositor.cc
+ * ---------------------------------------------------------------------------
+ * Implements the I420Compositor.
+ * ---------------------------------------------------------------------------
+ */
+
+#include "i420_compositor.h"
+#include "i420_scale.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "glog/logging.h"
+
+// The black background, the same as the "background" of the compositor
+// element the mixer used.
+#define COMPOSITOR_BACKGROUND_Y  16
+#define COMPOSITOR_BACKGROUND_UV 128
+
+namespace orbit {
+namespace {
+
+inline int RoundUp4(int value) {
+  return (value + 3) & ~3;
+}
+
+void CopyPlane(const uint8_t* src, int src_stride, uint8_t* dst,
+               int dst_stride, int width, int height) {
+  for (int y = 0; y < height; ++y) {
+    memcpy(dst + y * dst_stride, src + y * src_stride, width);
+  }
+}
+
+}  // annoymous namespace
+
+void I420Buffer::Resize(int width, int height) {
+  if (width == width_ && height == height_) {
+    return;
+  }
+  width_ = width;
+  height_ = height;
+  stride_y_ = RoundUp4(width);
+  stride_uv_ = RoundUp4(chroma_width());
+  offset_u_ = stride_y_ * chroma_height() * 2;
+  offset_v_ = offset_u_ + stride_uv_ * chroma_height();
+  data_.assign(offset_v_ + stride_uv_ * chroma_height(), 0);
+}
+
+I420Frame I420Buffer::frame() const {
+  I420Frame frame;
+  frame.y = data_.data();
+  frame.u = data_.data() + offset_u_;
+  frame.v = data_.data() + offset_v_;
+  frame.stride_y = stride_y_;
+  frame.stride_u = stride_uv_;
+  frame.stride_v = stride_uv_;
+  frame.width = width_;
+  frame.height = height_;
+  return frame;
+}
+
+I420Compositor::I420Compositor() {
+}
+
+void I420Compositor::SetCanvasSize(int width, int height) {
+  boost::mutex::scoped_lock lock(mutex_);
+  if (width == canvas_width_ && height == canvas_height_) {
+    return;
+  }
+  canvas_width_ = width;
+  canvas_height_ = height;
+  redraw_all_ = true;
+}
+
+void I420Compositor::SetTile(int stream_id, int x, int y, int width,
+                             int height) {
+  boost::mutex::scoped_lock lock(mutex_);
+  std::shared_ptr<Tile>& tile = tiles_[stream_id];
+  if (!tile) {
+    tile.reset(new Tile());
+  }
+  boost::mutex::scoped_lock tile_lock(tile->mutex);
+  if (tile->buffer.width() != width || tile->buffer.height() != height) {
+    tile->buffer.Resize(width, height);
+    tile->has_frame = false;
+  }
+  tile->x = x;
+  tile->y = y;
+  redraw_all_ = true;
+}
+
+void I420Compositor::RemoveTile(int stream_id) {
+  boost::mutex::scoped_lock lock(mutex_);
+  if (tiles_.erase(stream_id) > 0) {
+    redraw_all_ = true;
+  }
+}
+
+bool I420Compositor::UpdateFrame(int stream_id, const I420Frame& frame) {
+  std::shared_ptr<Tile> tile;
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    auto iter = tiles_.find(stream_id);
+    if (iter == tiles_.end()) {
+      return false;
+    }
+    tile = iter->second;
+  }
+  // Scaled without holding the compositor lock, so the participants don't
+  // wait for each other.
+  boost::mutex::scoped_lock tile_lock(tile->mutex);
+  I420Buffer& buffer = tile->buffer;
+  ScalePlane(frame.y, frame.stride_y, frame.width, frame.height,
+             buffer.y(), buffer.stride_y(), buffer.width(), buffer.height());
+  ScalePlane(frame.u, frame.stride_u, (frame.width + 1) / 2,
+             (frame.height + 1) / 2, buffer.u(), buffer.stride_uv(),
+             buffer.chroma_width(), buffer.chroma_height());
+  ScalePlane(frame.v, frame.stride_v, (frame.width + 1) / 2,
+             (frame.height + 1) / 2, buffer.v(), buffer.stride_uv(),
+             buffer.chroma_width(), buffer.chroma_height());
+  tile->has_frame = true;
+  tile->dirty = true;
+  return true;
+}
+
+int I420Compositor::Compose() {
+  boost::mutex::scoped_lock lock(mutex_);
+  bool redraw_all = redraw_all_;
+  redraw_all_ = false;
+  if (redraw_all) {
+    canvas_.Resize(canvas_width_, canvas_height_);
+    FillPlane(canvas_.y(), canvas_.stride_y(), canvas_.width(),
+              canvas_.height(), COMPOSITOR_BACKGROUND_Y);
+    FillPlane(canvas_.u(), canvas_.stride_uv(), canvas_.chroma_width(),
+              canvas_.chroma_height(), COMPOSITOR_BACKGROUND_UV);
+    FillPlane(canvas_.v(), canvas_.stride_uv(), canvas_.chroma_width(),
+              canvas_.chroma_height(), COMPOSITOR_BACKGROUND_UV);
+  }
+  int drawn = 0;
+  for (auto& iter : tiles_) {
+    Tile& tile = *iter.second;
+    boost::mutex::scoped_lock tile_lock(tile.mutex);
+    if (!tile.has_frame || !(tile.dirty || redraw_all)) {
+      continue;
+    }
+    if (DrawTile(tile)) {
+      ++drawn;
+    }
+    tile.dirty = false;
+  }
+  return drawn;
+}
+
+bool I420Compositor::DrawTile(const Tile& tile) {
+  const I420Buffer& buffer = tile.buffer;
+  // The part of the tile in the canvas.
+  int left = std::max(tile.x, 0);
+  int top = std::max(tile.y, 0);
+  int right = std::min(tile.x + buffer.width(), canvas_.width());
+  int bottom = std::min(tile.y + buffer.height(), canvas_.height());
+  if (right <= left || bottom <= top) {
+    VLOG(3) << "The tile at (" << tile.x << ", " << tile.y
+            << ") is out of the canvas";
+    return false;
+  }
+  I420Frame frame = buffer.frame();
+  CopyPlane(frame.y + (top - tile.y) * frame.stride_y + (left - tile.x),
+            frame.stride_y, canvas_.y() + top * canvas_.stride_y() + left,
+            canvas_.stride_y(), right - left, bottom - top);
+
+  // The luma is at the exact position, the chroma of an odd position is
+  // rounded down to the chroma sample covering it.
+  int chroma_left = left / 2;
+  int chroma_top = top / 2;
+  int src_x = chroma_left - (tile.x >> 1);
+  int src_y = chroma_top - (tile.y >> 1);
+  int chroma_width = std::min(std::min((right + 1) / 2, canvas_.chroma_width()) -
+                              chroma_left, buffer.chroma_width() - src_x);
+  int chroma_height = std::min(std::min((bottom + 1) / 2, canvas_.chroma_height()) -
+                               chroma_top, buffer.chroma_height() - src_y);
+  CopyPlane(frame.u + src_y * frame.stride_u + src_x, frame.stride_u,
+            canvas_.u() + chroma_top * canvas_.stride_uv() + chroma_left,
+            canvas_.stride_uv(), chroma_width, chroma_height);
+  CopyPlane(frame.v + src_y * frame.stride_v + src_x, frame.stride_v,
+            canvas_.v() + chroma_top * canvas_.stride_uv() + chroma_left,
+            canvas_.stride_uv(), chroma_width, chroma_height);
+  return true;
+}
+
+}  // namespace orbit
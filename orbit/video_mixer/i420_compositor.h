@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2016 Orangelab Inc. All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * i420_compositor.h
+ * ---------------------------------------------------------------------------
+ * Defines an in-process compositor of I420 frames for the video mixer, in
+ * place of the GStreamer compositor element.
+ * ---------------------------------------------------------------------------
+ * Each participant has a tile in the canvas. When a decoded frame of the
+ * participant arrives, it's scaled into the private buffer of its tile, on
+ * the thread of the participant. Compose() then copies the tiles changed
+ * since the last call into the preallocated canvas, the tiles whose frame
+ * hasn't changed are not touched. The tiles don't overlap (grid layouts), so
+ * there is no blending.
+ *
+ *   I420Compositor compositor;
+ *   compositor.SetCanvasSize(370, 370);
+ *   compositor.SetTile(stream_id, 0, 0, 180, 180);
+ *   compositor.UpdateFrame(stream_id, frame);   // On the decoding thread.
+ *   compositor.Compose();                       // On the encoding thread.
+ *   encode(compositor.canvas().data(), compositor.canvas().size());
+ *
+ * UpdateFrame() is thread safe. SetCanvasSize(), SetTile() and RemoveTile()
+ * may be called from any thread, Compose() and canvas() from a single one.
+ */
+
+#ifndef VIDEO_MIXER_I420_COMPOSITOR_H_
+#define VIDEO_MIXER_I420_COMPOSITOR_H_
+
+#include <stdint.h>
+
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <boost/thread/mutex.hpp>
+
+namespace orbit {
+
+// A view of an I420 frame, the planes are not owned.
+struct I420Frame {
+  const uint8_t* y = NULL;
+  const uint8_t* u = NULL;
+  const uint8_t* v = NULL;
+  int stride_y = 0;
+  int stride_u = 0;
+  int stride_v = 0;
+  int width = 0;
+  int height = 0;
+};
+
+// An I420 frame in one contiguous buffer, in the default layout of GStreamer
+// (the strides rounded up to 4), so it's pushed to a GStreamer element as is.
+class I420Buffer {
+ public:
+  I420Buffer() {}
+
+  void Resize(int width, int height);
+
+  int width() const {
+    return width_;
+  }
+  int height() const {
+    return height_;
+  }
+  int chroma_width() const {
+    return (width_ + 1) / 2;
+  }
+  int chroma_height() const {
+    return (height_ + 1) / 2;
+  }
+  int stride_y() const {
+    return stride_y_;
+  }
+  int stride_uv() const {
+    return stride_uv_;
+  }
+  uint8_t* y() {
+    return data_.data();
+  }
+  uint8_t* u() {
+    return data_.data() + offset_u_;
+  }
+  uint8_t* v() {
+    return data_.data() + offset_v_;
+  }
+  const uint8_t* data() const {
+    return data_.data();
+  }
+  int size() const {
+    return data_.size();
+  }
+  I420Frame frame() const;
+
+ private:
+  int width_ = 0;
+  int height_ = 0;
+  int stride_y_ = 0;
+  int stride_uv_ = 0;
+  int offset_u_ = 0;
+  int offset_v_ = 0;
+  std::vector<uint8_t> data_;
+};
+
+class I420Compositor {
+ public:
+  I420Compositor();
+  ~I420Compositor() {}
+
+  // Resizes the canvas, the whole canvas is drawn again by the next
+  // Compose().
+  void SetCanvasSize(int width, int height);
+  // Places the tile of the stream. If only the position changes, the last
+  // frame is kept, otherwise the tile stays blank until the next frame.
+  void SetTile(int stream_id, int x, int y, int width, int height);
+  void RemoveTile(int stream_id);
+
+  // Scales the frame of the stream into its tile. Returns false if the
+  // stream has no tile.
+  bool UpdateFrame(int stream_id, const I420Frame& frame);
+
+  // Draws the changed tiles into the canvas, returns the number of tiles
+  // drawn.
+  int Compose();
+  const I420Buffer& canvas() const {
+    return canvas_;
+  }
+
+ private:
+  struct Tile {
+    boost::mutex mutex;  // protects the fields below.
+    int x = 0;
+    int y = 0;
+    I420Buffer buffer;
+    bool has_frame = false;
+    bool dirty = false;
+  };
+
+  // Copies the tile into the canvas, clipped to the canvas. Returns false if
+  // the tile is out of the canvas.
+  bool DrawTile(const Tile& tile);
+
+  boost::mutex mutex_;  // protects the fields below.
+  std::map<int, std::shared_ptr<Tile> > tiles_;
+  int canvas_width_ = 0;
+  int canvas_height_ = 0;
+  // The layout or the canvas has changed, everything is drawn again.
+  bool redraw_all_ = true;
+
+  // Only accessed by Compose().
+  I420Buffer canvas_;
+};
+
+}  // namespace orbit
+
+#endif  // VIDEO_MIXER_I420_COMPOSITOR_H_
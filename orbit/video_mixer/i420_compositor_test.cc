@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2016 Orangelab Inc. All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * i420_compositor_test.cc
+ */
+
+#include "i420_compositor.h"
+
+#include <algorithm>
+
+#include "gtest/gtest.h"
+#include "glog/logging.h"
+
+namespace orbit {
+namespace {
+
+const int kTileSize = 180;
+const int kCanvasSize = 370;
+
+class I420CompositorTest : public testing::Test {
+ protected:
+  virtual void SetUp() override {
+    compositor_.SetCanvasSize(kCanvasSize, kCanvasSize);
+    compositor_.SetTile(1, 0, 0, kTileSize, kTileSize);
+    compositor_.SetTile(2, 190, 190, kTileSize, kTileSize);
+  }
+
+  virtual void TearDown() override {
+  }
+
+  // A 640x480 frame of one color.
+  I420Frame MakeFrame(uint8_t y, uint8_t u, uint8_t v) {
+    source_.Resize(640, 480);
+    std::fill(source_.y(), source_.u(), y);
+    std::fill(source_.u(), source_.v(), u);
+    std::fill(source_.v(), source_.y() + source_.size(), v);
+    return source_.frame();
+  }
+
+  // The pixel of the canvas, as Y, U and V.
+  void ExpectPixel(int x, int y, uint8_t py, uint8_t pu, uint8_t pv) {
+    I420Frame canvas = compositor_.canvas().frame();
+    EXPECT_EQ(py, canvas.y[y * canvas.stride_y + x]) << x << "," << y;
+    EXPECT_EQ(pu, canvas.u[y / 2 * canvas.stride_u + x / 2]) << x << "," << y;
+    EXPECT_EQ(pv, canvas.v[y / 2 * canvas.stride_v + x / 2]) << x << "," << y;
+  }
+
+  I420Compositor compositor_;
+  I420Buffer source_;
+};
+
+TEST_F(I420CompositorTest, CanvasLayout) {
+  compositor_.Compose();
+  const I420Buffer& canvas = compositor_.canvas();
+  EXPECT_EQ(kCanvasSize, canvas.width());
+  // Rounded up to 4, as GStreamer does.
+  EXPECT_EQ(372, canvas.stride_y());
+  EXPECT_EQ(188, canvas.stride_uv());
+  EXPECT_EQ(372 * 370 + 188 * 185 * 2, canvas.size());
+  // Black without any frame.
+  ExpectPixel(0, 0, 16, 128, 128);
+  ExpectPixel(369, 369, 16, 128, 128);
+}
+
+TEST_F(I420CompositorTest, PlacesTheTiles) {
+  EXPECT_TRUE(compositor_.UpdateFrame(1, MakeFrame(200, 50, 60)));
+  EXPECT_TRUE(compositor_.UpdateFrame(2, MakeFrame(100, 70, 80)));
+  EXPECT_FALSE(compositor_.UpdateFrame(3, MakeFrame(100, 70, 80)));
+  EXPECT_EQ(2, compositor_.Compose());
+  ExpectPixel(0, 0, 200, 50, 60);
+  ExpectPixel(179, 179, 200, 50, 60);
+  ExpectPixel(185, 185, 16, 128, 128);
+  ExpectPixel(190, 190, 100, 70, 80);
+  ExpectPixel(369, 369, 100, 70, 80);
+}
+
+TEST_F(I420CompositorTest, SkipsUnchangedTiles) {
+  compositor_.UpdateFrame(1, MakeFrame(200, 50, 60));
+  compositor_.UpdateFrame(2, MakeFrame(100, 70, 80));
+  EXPECT_EQ(2, compositor_.Compose());
+  EXPECT_EQ(0, compositor_.Compose());
+  compositor_.UpdateFrame(2, MakeFrame(110, 70, 80));
+  EXPECT_EQ(1, compositor_.Compose());
+  ExpectPixel(0, 0, 200, 50, 60);
+  ExpectPixel(190, 190, 110, 70, 80);
+}
+
+TEST_F(I420CompositorTest, LayoutChangeRedraws) {
+  compositor_.UpdateFrame(1, MakeFrame(200, 50, 60));
+  compositor_.UpdateFrame(2, MakeFrame(100, 70, 80));
+  compositor_.Compose();
+
+  // Moved, the last frame is kept and the old place is cleared.
+  compositor_.SetTile(2, 190, 0, kTileSize, kTileSize);
+  EXPECT_EQ(2, compositor_.Compose());
+  ExpectPixel(190, 0, 100, 70, 80);
+  ExpectPixel(190, 190, 16, 128, 128);
+
+  compositor_.RemoveTile(1);
+  EXPECT_EQ(1, compositor_.Compose());
+  ExpectPixel(0, 0, 16, 128, 128);
+
+  // Resized, blank until the next frame.
+  compositor_.SetTile(2, 190, 0, 90, 90);
+  EXPECT_EQ(0, compositor_.Compose());
+  ExpectPixel(190, 0, 16, 128, 128);
+}
+
+TEST_F(I420CompositorTest, TileIsClipped) {
+  compositor_.SetCanvasSize(kTileSize, kTileSize);
+  compositor_.UpdateFrame(2, MakeFrame(100, 70, 80));
+  compositor_.SetTile(1, 100, 100, kTileSize, kTileSize);
+  compositor_.UpdateFrame(1, MakeFrame(200, 50, 60));
+  // The tile 2 is out of the canvas, not drawn.
+  EXPECT_EQ(1, compositor_.Compose());
+  ExpectPixel(99, 99, 16, 128, 128);
+  ExpectPixel(179, 179, 200, 50, 60);
+
+  compositor_.SetTile(1, -100, -100, kTileSize, kTileSize);
+  EXPECT_EQ(1, compositor_.Compose());
+  ExpectPixel(0, 0, 200, 50, 60);
+  ExpectPixel(79, 79, 200, 50, 60);
+  ExpectPixel(80, 80, 16, 128, 128);
+}
+
+TEST_F(I420CompositorTest, OddPositionIsExact) {
+  // As the centered last row of VideoMixerPositionManager.
+  compositor_.SetTile(1, 5, 7, 90, 90);
+  compositor_.UpdateFrame(1, MakeFrame(200, 50, 60));
+  EXPECT_EQ(1, compositor_.Compose());
+  I420Frame canvas = compositor_.canvas().frame();
+  EXPECT_EQ(16, canvas.y[7 * canvas.stride_y + 4]);
+  EXPECT_EQ(16, canvas.y[6 * canvas.stride_y + 5]);
+  EXPECT_EQ(200, canvas.y[7 * canvas.stride_y + 5]);
+  EXPECT_EQ(200, canvas.y[96 * canvas.stride_y + 94]);
+  EXPECT_EQ(16, canvas.y[96 * canvas.stride_y + 95]);
+  EXPECT_EQ(16, canvas.y[97 * canvas.stride_y + 94]);
+  // The chroma sample covering the first pixel.
+  ExpectPixel(5, 7, 200, 50, 60);
+}
+
+}  // annoymous namespace
+}  // namespace orbit
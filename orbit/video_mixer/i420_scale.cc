@@ -0,0 +1,333 @@
+/*
+ * Copyright (C) 2016 Orangelab Inc. All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * i420_scale.cc
+ * ---------------------------------------------------------------------------
+ * Implements the scalar and SSE2 plane scaling kernels.
+ * ---------------------------------------------------------------------------
+ */
+
+#include "i420_scale.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define I420_SCALE_X86 1
+#include <emmintrin.h>
+#endif
+
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "glog/logging.h"
+
+namespace orbit {
+namespace {
+
+// out[i] = (row0[i] * (256 - fraction) + row1[i] * fraction + 128) >> 8
+void BlendRowScalar(const uint8_t* row0, const uint8_t* row1, uint8_t* out,
+                    int width, int fraction) {
+  int f0 = 256 - fraction;
+  for (int i = 0; i < width; ++i) {
+    out[i] = (row0[i] * f0 + row1[i] * fraction + 128) >> 8;
+  }
+}
+
+// out[x] is the rounded average of the 2x2 pixels at (2x, 2x + 1) of the
+// two rows.
+void Down2BoxRowScalar(const uint8_t* row0, const uint8_t* row1, uint8_t* out,
+                       int dst_width) {
+  for (int x = 0; x < dst_width; ++x) {
+    out[x] = (row0[2 * x] + row0[2 * x + 1] +
+              row1[2 * x] + row1[2 * x + 1] + 2) >> 2;
+  }
+}
+
+void AccumulateRowScalar(const uint8_t* src, uint16_t* sum, int width) {
+  for (int i = 0; i < width; ++i) {
+    sum[i] += src[i];
+  }
+}
+
+#ifdef I420_SCALE_X86
+// SSE2 is always available on x86_64, 16 pixels per iteration. The products
+// are at most 255 * 256, so the uint16 math doesn't overflow.
+void BlendRowSse2(const uint8_t* row0, const uint8_t* row1, uint8_t* out,
+                  int width, int fraction) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i f0 = _mm_set1_epi16(256 - fraction);
+  const __m128i f1 = _mm_set1_epi16(fraction);
+  const __m128i round = _mm_set1_epi16(128);
+  int i = 0;
+  for (; i + 16 <= width; i += 16) {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + i));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + i));
+    __m128i lo = _mm_add_epi16(
+        _mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), f0),
+        _mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), f1));
+    __m128i hi = _mm_add_epi16(
+        _mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), f0),
+        _mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), f1));
+    lo = _mm_srli_epi16(_mm_add_epi16(lo, round), 8);
+    hi = _mm_srli_epi16(_mm_add_epi16(hi, round), 8);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i),
+                     _mm_packus_epi16(lo, hi));
+  }
+  BlendRowScalar(row0 + i, row1 + i, out + i, width - i, fraction);
+}
+
+// Adds the even and the odd bytes of 16 pixels as 8 uint16.
+inline __m128i SumPairs(__m128i x) {
+  const __m128i mask = _mm_set1_epi16(0x00FF);
+  return _mm_add_epi16(_mm_and_si128(x, mask), _mm_srli_epi16(x, 8));
+}
+
+void Down2BoxRowSse2(const uint8_t* row0, const uint8_t* row1, uint8_t* out,
+                     int dst_width) {
+  const __m128i two = _mm_set1_epi16(2);
+  int x = 0;
+  for (; x + 16 <= dst_width; x += 16) {
+    const __m128i* a = reinterpret_cast<const __m128i*>(row0 + 2 * x);
+    const __m128i* b = reinterpret_cast<const __m128i*>(row1 + 2 * x);
+    __m128i lo = _mm_add_epi16(SumPairs(_mm_loadu_si128(a)),
+                               SumPairs(_mm_loadu_si128(b)));
+    __m128i hi = _mm_add_epi16(SumPairs(_mm_loadu_si128(a + 1)),
+                               SumPairs(_mm_loadu_si128(b + 1)));
+    lo = _mm_srli_epi16(_mm_add_epi16(lo, two), 2);
+    hi = _mm_srli_epi16(_mm_add_epi16(hi, two), 2);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x),
+                     _mm_packus_epi16(lo, hi));
+  }
+  Down2BoxRowScalar(row0 + 2 * x, row1 + 2 * x, out + x, dst_width - x);
+}
+
+void AccumulateRowSse2(const uint8_t* src, uint16_t* sum, int width) {
+  const __m128i zero = _mm_setzero_si128();
+  int i = 0;
+  for (; i + 16 <= width; i += 16) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    __m128i* s = reinterpret_cast<__m128i*>(sum + i);
+    _mm_storeu_si128(s, _mm_add_epi16(_mm_loadu_si128(s),
+                                      _mm_unpacklo_epi8(x, zero)));
+    _mm_storeu_si128(s + 1, _mm_add_epi16(_mm_loadu_si128(s + 1),
+                                          _mm_unpackhi_epi8(x, zero)));
+  }
+  AccumulateRowScalar(src + i, sum + i, width - i);
+}
+#endif  // I420_SCALE_X86
+
+typedef void (*BlendRowFunc)(const uint8_t*, const uint8_t*, uint8_t*, int,
+                             int);
+typedef void (*Down2BoxRowFunc)(const uint8_t*, const uint8_t*, uint8_t*,
+                                int);
+typedef void (*AccumulateRowFunc)(const uint8_t*, uint16_t*, int);
+
+struct KernelTable {
+  I420ScaleKernel kernel;
+  BlendRowFunc blend_row;
+  Down2BoxRowFunc down2_box_row;
+  AccumulateRowFunc accumulate_row;
+};
+
+KernelTable MakeKernelTable(I420ScaleKernel kernel) {
+  KernelTable table;
+  table.kernel = kernel;
+  switch (kernel) {
+#ifdef I420_SCALE_X86
+    case I420_SCALE_KERNEL_SSE2:
+      table.blend_row = BlendRowSse2;
+      table.down2_box_row = Down2BoxRowSse2;
+      table.accumulate_row = AccumulateRowSse2;
+      break;
+#endif
+    default:
+      table.kernel = I420_SCALE_KERNEL_SCALAR;
+      table.blend_row = BlendRowScalar;
+      table.down2_box_row = Down2BoxRowScalar;
+      table.accumulate_row = AccumulateRowScalar;
+      break;
+  }
+  return table;
+}
+
+I420ScaleKernel DetectBestKernel() {
+  I420ScaleKernel kernel = I420_SCALE_KERNEL_SCALAR;
+  if (IsI420ScaleKernelSupported(I420_SCALE_KERNEL_SSE2)) {
+    kernel = I420_SCALE_KERNEL_SSE2;
+  }
+  LOG(INFO) << "I420 scale kernel: " << I420ScaleKernelName(kernel);
+  return kernel;
+}
+
+KernelTable* GetKernelTable() {
+  static KernelTable table = MakeKernelTable(DetectBestKernel());
+  return &table;
+}
+
+// The source position of the first destination pixel and the step, in 16.16
+// fixed point, so that the pixel centers are aligned.
+void BilinearStep(int src_size, int dst_size, int* start, int* step) {
+  *step = (static_cast<int64_t>(src_size) << 16) / dst_size;
+  *start = *step / 2 - 32768;
+}
+
+void FilterColumns(const uint8_t* src, int src_width, uint8_t* dst,
+                   int dst_width) {
+  int x, dx;
+  BilinearStep(src_width, dst_width, &x, &dx);
+  for (int i = 0; i < dst_width; ++i, x += dx) {
+    int xi = 0;
+    int fraction = 0;
+    if (x > 0) {
+      xi = x >> 16;
+      fraction = (x >> 8) & 0xFF;
+    }
+    int next = std::min(xi + 1, src_width - 1);
+    dst[i] = (src[xi] * (256 - fraction) + src[next] * fraction + 128) >> 8;
+  }
+}
+
+void ScalePlaneBilinear(const KernelTable* table,
+                        const uint8_t* src, int src_stride,
+                        int src_width, int src_height,
+                        uint8_t* dst, int dst_stride,
+                        int dst_width, int dst_height) {
+  std::vector<uint8_t> row(src_width);
+  int y, dy;
+  BilinearStep(src_height, dst_height, &y, &dy);
+  for (int i = 0; i < dst_height; ++i, y += dy) {
+    int yi = 0;
+    int fraction = 0;
+    if (y > 0) {
+      yi = y >> 16;
+      fraction = (y >> 8) & 0xFF;
+    }
+    const uint8_t* row0 = src + yi * src_stride;
+    const uint8_t* row1 = src + std::min(yi + 1, src_height - 1) * src_stride;
+    uint8_t* out = dst + i * dst_stride;
+    // Blends straight into the destination if the width doesn't change.
+    uint8_t* blended = src_width == dst_width ? out : row.data();
+    if (fraction == 0) {
+      memcpy(blended, row0, src_width);
+    } else {
+      table->blend_row(row0, row1, blended, src_width, fraction);
+    }
+    if (src_width != dst_width) {
+      FilterColumns(blended, src_width, out, dst_width);
+    }
+  }
+}
+
+void ScalePlaneBox(const KernelTable* table,
+                   const uint8_t* src, int src_stride,
+                   int src_width, int src_height,
+                   uint8_t* dst, int dst_stride,
+                   int dst_width, int dst_height) {
+  // The source columns of each destination pixel.
+  std::vector<int> columns(dst_width + 1);
+  for (int j = 0; j <= dst_width; ++j) {
+    columns[j] = j * src_width / dst_width;
+  }
+  // 16.16 reciprocals of the box areas, instead of a division per pixel.
+  int max_area = (src_width / dst_width + 1) * (src_height / dst_height + 1);
+  std::vector<uint32_t> reciprocals(max_area + 1);
+  for (int area = 1; area <= max_area; ++area) {
+    reciprocals[area] = (65536 + area / 2) / area;
+  }
+  std::vector<uint16_t> sum(src_width);
+  for (int i = 0; i < dst_height; ++i) {
+    int y0 = i * src_height / dst_height;
+    int y1 = (i + 1) * src_height / dst_height;
+    std::fill(sum.begin(), sum.end(), 0);
+    for (int y = y0; y < y1; ++y) {
+      table->accumulate_row(src + y * src_stride, sum.data(), src_width);
+    }
+    int rows = y1 - y0;
+    uint8_t* out = dst + i * dst_stride;
+    for (int j = 0; j < dst_width; ++j) {
+      uint32_t total = 0;
+      for (int x = columns[j]; x < columns[j + 1]; ++x) {
+        total += sum[x];
+      }
+      uint32_t reciprocal = reciprocals[(columns[j + 1] - columns[j]) * rows];
+      out[j] = (total * reciprocal + 32768) >> 16;
+    }
+  }
+}
+
+}  // annoymous namespace
+
+void ScalePlane(const uint8_t* src, int src_stride,
+                int src_width, int src_height,
+                uint8_t* dst, int dst_stride,
+                int dst_width, int dst_height) {
+  if (src_width <= 0 || src_height <= 0 || dst_width <= 0 || dst_height <= 0) {
+    return;
+  }
+  const KernelTable* table = GetKernelTable();
+  if (src_width == dst_width && src_height == dst_height) {
+    for (int y = 0; y < dst_height; ++y) {
+      memcpy(dst + y * dst_stride, src + y * src_stride, dst_width);
+    }
+  } else if (src_width == dst_width * 2 && src_height == dst_height * 2) {
+    for (int y = 0; y < dst_height; ++y) {
+      const uint8_t* row0 = src + 2 * y * src_stride;
+      table->down2_box_row(row0, row0 + src_stride, dst + y * dst_stride,
+                           dst_width);
+    }
+  } else if (src_width >= dst_width * 2 && src_height >= dst_height * 2 &&
+             // The rows are summed in uint16.
+             src_height <= dst_height * 256) {
+    ScalePlaneBox(table, src, src_stride, src_width, src_height,
+                  dst, dst_stride, dst_width, dst_height);
+  } else {
+    ScalePlaneBilinear(table, src, src_stride, src_width, src_height,
+                       dst, dst_stride, dst_width, dst_height);
+  }
+}
+
+void FillPlane(uint8_t* dst, int dst_stride, int width, int height,
+               uint8_t value) {
+  for (int y = 0; y < height; ++y) {
+    memset(dst + y * dst_stride, value, width);
+  }
+}
+
+I420ScaleKernel GetI420ScaleKernel() {
+  return GetKernelTable()->kernel;
+}
+
+bool SetI420ScaleKernel(I420ScaleKernel kernel) {
+  if (!IsI420ScaleKernelSupported(kernel)) {
+    return false;
+  }
+  *GetKernelTable() = MakeKernelTable(kernel);
+  return true;
+}
+
+bool IsI420ScaleKernelSupported(I420ScaleKernel kernel) {
+  switch (kernel) {
+    case I420_SCALE_KERNEL_SCALAR:
+      return true;
+#ifdef I420_SCALE_X86
+    case I420_SCALE_KERNEL_SSE2:
+      return __builtin_cpu_supports("sse2");
+#endif
+    default:
+      return false;
+  }
+}
+
+const char* I420ScaleKernelName(I420ScaleKernel kernel) {
+  switch (kernel) {
+    case I420_SCALE_KERNEL_SCALAR:
+      return "scalar";
+    case I420_SCALE_KERNEL_SSE2:
+      return "sse2";
+    default:
+      return "unknown";
+  }
+}
+
+}  // namespace orbit
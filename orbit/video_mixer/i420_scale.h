@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2016 Orangelab Inc. All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * i420_scale.h
+ * ---------------------------------------------------------------------------
+ * Defines the plane scaling kernels used by the I420Compositor.
+ * ---------------------------------------------------------------------------
+ * A plane is scaled with:
+ *   - a row copy, if the size doesn't change;
+ *   - a 2x2 box filter, if it's exactly halved;
+ *   - a box filter (the average of the covered source pixels), if it's
+ *     shrunk more than 2x, as the bilinear filter would alias;
+ *   - a bilinear filter (center aligned, 8 bits fraction) otherwise.
+ *
+ * The row kernels (vertical blend, 2x2 box, row accumulation) are vectorized
+ * with SSE2, selected at runtime by the CPU features, with a scalar fallback.
+ * The horizontal part of the bilinear and box filters is scalar in all the
+ * kernels. All the kernels give bit-exact results.
+ */
+
+#ifndef VIDEO_MIXER_I420_SCALE_H_
+#define VIDEO_MIXER_I420_SCALE_H_
+
+#include <stdint.h>
+
+namespace orbit {
+
+enum I420ScaleKernel {
+  I420_SCALE_KERNEL_SCALAR = 0,
+  I420_SCALE_KERNEL_SSE2,
+};
+
+// Scales the src plane into the dst plane.
+void ScalePlane(const uint8_t* src, int src_stride,
+                int src_width, int src_height,
+                uint8_t* dst, int dst_stride,
+                int dst_width, int dst_height);
+
+// Sets the width x height pixels of the plane to value.
+void FillPlane(uint8_t* dst, int dst_stride, int width, int height,
+               uint8_t value);
+
+// Returns the kernel in use, the best one supported by the CPU by default.
+I420ScaleKernel GetI420ScaleKernel();
+// Forces the kernel, e.g. in the tests and benchmarks. Returns false if the
+// CPU does not support it.
+bool SetI420ScaleKernel(I420ScaleKernel kernel);
+bool IsI420ScaleKernelSupported(I420ScaleKernel kernel);
+const char* I420ScaleKernelName(I420ScaleKernel kernel);
+
+}  // namespace orbit
+
+#endif  // VIDEO_MIXER_I420_SCALE_H_
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2016 Orangelab Inc. All Rights Reserved.
+ * Author: cheng@orangelab.cn (Cheng Xu)
+ *
+ * i420_scale_test.cc
+ * ---------------------------------------------------------------------------
+ * Checks the plane scaling filters and that the kernels are bit exact.
+ * ---------------------------------------------------------------------------
+ */
+
+#include "i420_scale.h"
+
+#include <stdlib.h>
+
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "glog/logging.h"
+
+namespace orbit {
+namespace {
+
+typedef std::vector<uint8_t> Plane;
+
+Plane MakePlane(int width, int height, unsigned int seed) {
+  srand(seed);
+  Plane plane(width * height);
+  for (auto& pixel : plane) {
+    pixel = rand() % 256;
+  }
+  return plane;
+}
+
+Plane Scale(const Plane& src, int src_width, int src_height,
+            int dst_width, int dst_height) {
+  Plane dst(dst_width * dst_height);
+  ScalePlane(src.data(), src_width, src_width, src_height,
+             dst.data(), dst_width, dst_width, dst_height);
+  return dst;
+}
+
+class I420ScaleTest : public testing::Test {
+ protected:
+  virtual void SetUp() override {
+    kernel_ = GetI420ScaleKernel();
+  }
+
+  virtual void TearDown() override {
+    SetI420ScaleKernel(kernel_);
+  }
+
+  I420ScaleKernel kernel_;
+};
+
+TEST_F(I420ScaleTest, SameSizeIsCopied) {
+  Plane src = MakePlane(37, 11, 1);
+  EXPECT_EQ(src, Scale(src, 37, 11, 37, 11));
+}
+
+TEST_F(I420ScaleTest, HalvedWithBox) {
+  // Wide enough for the SSE2 loop and its scalar tail.
+  const int kWidth = 2 * 37;
+  Plane src = MakePlane(kWidth, 4, 2);
+  Plane dst = Scale(src, kWidth, 4, kWidth / 2, 2);
+  for (int y = 0; y < 2; ++y) {
+    for (int x = 0; x < kWidth / 2; ++x) {
+      const uint8_t* p = &src[2 * y * kWidth + 2 * x];
+      int expected = (p[0] + p[1] + p[kWidth] + p[kWidth + 1] + 2) / 4;
+      EXPECT_EQ(expected, dst[y * kWidth / 2 + x]) << x << "," << y;
+    }
+  }
+}
+
+TEST_F(I420ScaleTest, ConstantPlaneStaysConstant) {
+  Plane src(640 * 480, 77);
+  const int kSizes[][2] = {{180, 180}, {320, 240}, {500, 400}, {1280, 720}};
+  for (auto& size : kSizes) {
+    Plane dst = Scale(src, 640, 480, size[0], size[1]);
+    EXPECT_EQ(Plane(size[0] * size[1], 77), dst) << size[0] << "x" << size[1];
+  }
+}
+
+TEST_F(I420ScaleTest, BilinearKeepsGradient) {
+  // A horizontal ramp stays a non-decreasing ramp with the same ends.
+  const int kWidth = 64;
+  Plane src(kWidth * 2);
+  for (int y = 0; y < 2; ++y) {
+    for (int x = 0; x < kWidth; ++x) {
+      src[y * kWidth + x] = x * 4;
+    }
+  }
+  Plane dst = Scale(src, kWidth, 2, 100, 3);
+  EXPECT_EQ(0, dst[0]);
+  EXPECT_EQ(252, dst[99]);
+  for (int x = 1; x < 100; ++x) {
+    EXPECT_LE(dst[x - 1], dst[x]);
+    EXPECT_EQ(dst[x], dst[2 * 100 + x]);
+  }
+}
+
+TEST_F(I420ScaleTest, KernelsAreBitExact) {
+  if (!SetI420ScaleKernel(I420_SCALE_KERNEL_SSE2)) {
+    LOG(INFO) << "SSE2 is not supported, skip.";
+    return;
+  }
+  const int kSizes[][4] = {
+    {640, 480, 180, 180},  // box
+    {640, 480, 320, 240},  // halved
+    {320, 240, 180, 180},  // bilinear down
+    {90, 90, 180, 180},    // bilinear up
+    {641, 479, 173, 97},
+  };
+  for (auto& size : kSizes) {
+    Plane src = MakePlane(size[0], size[1], size[2]);
+    SetI420ScaleKernel(I420_SCALE_KERNEL_SSE2);
+    Plane sse2 = Scale(src, size[0], size[1], size[2], size[3]);
+    SetI420ScaleKernel(I420_SCALE_KERNEL_SCALAR);
+    Plane scalar = Scale(src, size[0], size[1], size[2], size[3]);
+    EXPECT_EQ(scalar, sse2) << size[0] << "x" << size[1] << " to "
+                            << size[2] << "x" << size[3];
+  }
+}
+
+}  // annoymous namespace
+}  // namespace orbit
@@ -21,6 +21,7 @@
 // For gstraemer and related.
 #include <gst/app/gstappsrc.h>
 #include <gst/app/gstappsink.h>
+#include <gst/video/video.h>
 #include <glib-2.0/glib.h>
 
 
@@ -49,6 +50,7 @@
 DECLARE_int32(video_width);
 DECLARE_int32(video_height);
 DECLARE_bool(save_dot_file);
+DECLARE_bool(video_mixer_native_compositor);
 
 namespace orbit {
 using namespace std;
@@ -188,6 +190,10 @@ using namespace std;
       }
     }
     
+    static GstFlowReturn on_decoded_sample(GstAppSink* app_sink, gpointer user_data) {
+      return reinterpret_cast<VideoMixerPluginImpl*>(user_data)->OnDecodedSample();
+    }
+
     static int remove_element(gpointer user_data){
       VideoMixerPluginImpl* plugin = (VideoMixerPluginImpl*)user_data;
       plugin->RemoveElements();
@@ -268,19 +274,33 @@ using namespace std;
                            NULL);
           gst_element_link_many(app_src_, jitter_buffer_, rtp_vp8_depay_, vp8_dec_,video_rate_,queue_, NULL);
 
-          sink_pad_ = RequestElementPad(video_mixer, "sink_%u");
-          g_assert(sink_pad_);
-          if(limit_video_size()){
-            g_object_set(G_OBJECT(sink_pad_), "xpos", x_, "ypos", y_, "width", FLAGS_video_width, "height",FLAGS_video_height, NULL);
+          if (FLAGS_video_mixer_native_compositor) {
+            // Only the latest frame is composed.
+            frame_sink_ = gst_element_factory_make("appsink", NULL);
+            GstCaps* frame_caps = gst_caps_new_simple("video/x-raw", "format", G_TYPE_STRING, "I420", NULL);
+            g_object_set(G_OBJECT(frame_sink_), "caps", frame_caps, "sync", false, "async", false,
+                         "max-buffers", 1, "drop", true, NULL);
+            gst_caps_unref(frame_caps);
+            GstAppSinkCallbacks frame_sink_callbacks = {};
+            frame_sink_callbacks.new_sample = on_decoded_sample;
+            gst_app_sink_set_callbacks(GST_APP_SINK(frame_sink_), &frame_sink_callbacks, this, NULL);
+            gst_bin_add(GST_BIN(pipeline), frame_sink_);
+            gst_element_link(queue_, frame_sink_);
           } else {
-            g_object_set(G_OBJECT(sink_pad_), "xpos", x_, "ypos", y_, NULL);
+            sink_pad_ = RequestElementPad(video_mixer, "sink_%u");
+            g_assert(sink_pad_);
+            if(limit_video_size()){
+              g_object_set(G_OBJECT(sink_pad_), "xpos", x_, "ypos", y_, "width", FLAGS_video_width, "height",FLAGS_video_height, NULL);
+            } else {
+              g_object_set(G_OBJECT(sink_pad_), "xpos", x_, "ypos", y_, NULL);
+            }
+            //    g_object_set(G_OBJECT(sink_pad_), "xpos", position_->x(), "ypos", position_->y(), NULL);
+            GstPad* queue_src_pad = gst_element_get_static_pad(queue_, "src");
+            GstPadLinkReturn linkResult = gst_pad_link_full(queue_src_pad, sink_pad_, GST_PAD_LINK_CHECK_DEFAULT);
+
+            VLOG(VLOG_LEVEL)<<"-----------------------LinkResult-------------------"<<linkResult;
+            gst_object_unref(queue_src_pad);
           }
-          //    g_object_set(G_OBJECT(sink_pad_), "xpos", position_->x(), "ypos", position_->y(), NULL);
-          GstPad* queue_src_pad = gst_element_get_static_pad(queue_, "src");
-          GstPadLinkReturn linkResult = gst_pad_link_full(queue_src_pad, sink_pad_, GST_PAD_LINK_CHECK_DEFAULT);
-
-          VLOG(VLOG_LEVEL)<<"-----------------------LinkResult-------------------"<<linkResult;
-          gst_object_unref(queue_src_pad);
 
           //g_signal_connect (app_src_, "enough-data", G_CALLBACK(enough_data), this);
           gst_element_sync_state_with_parent(app_src_);
@@ -319,7 +339,9 @@ using namespace std;
   void VideoMixerPluginImpl::UnlinkElements() {
     VideoMixerPlugin::Stop();
     VLOG(VLOG_LEVEL)<<"-----------------------UnlinkElements-------------------";
-    gst_pad_add_probe (sink_pad_, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, event_probe_cb, this, NULL);
+    if (sink_pad_ != NULL) {
+      gst_pad_add_probe (sink_pad_, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, event_probe_cb, this, NULL);
+    }
     gst_app_src_end_of_stream((GstAppSrc*)app_src_);
     RemoveElements();
   }
@@ -341,10 +363,49 @@ using namespace std;
     }
   }
 
+  GstFlowReturn VideoMixerPluginImpl::OnDecodedSample() {
+    GstSample* sample = gst_app_sink_pull_sample(GST_APP_SINK(frame_sink_));
+    if (sample == NULL) {
+      return GST_FLOW_EOS;
+    }
+    GstBuffer* buffer = gst_sample_get_buffer(sample);
+    GstVideoInfo info;
+    GstVideoFrame frame;
+    if (is_stoped() || buffer == NULL ||
+        !gst_video_info_from_caps(&info, gst_sample_get_caps(sample)) ||
+        !gst_video_frame_map(&frame, &info, buffer, GST_MAP_READ)) {
+      gst_sample_unref(sample);
+      return GST_FLOW_OK;
+    }
+    I420Frame i420_frame;
+    i420_frame.y = static_cast<const uint8_t*>(GST_VIDEO_FRAME_PLANE_DATA(&frame, 0));
+    i420_frame.u = static_cast<const uint8_t*>(GST_VIDEO_FRAME_PLANE_DATA(&frame, 1));
+    i420_frame.v = static_cast<const uint8_t*>(GST_VIDEO_FRAME_PLANE_DATA(&frame, 2));
+    i420_frame.stride_y = GST_VIDEO_FRAME_PLANE_STRIDE(&frame, 0);
+    i420_frame.stride_u = GST_VIDEO_FRAME_PLANE_STRIDE(&frame, 1);
+    i420_frame.stride_v = GST_VIDEO_FRAME_PLANE_STRIDE(&frame, 2);
+    i420_frame.width = GST_VIDEO_FRAME_WIDTH(&frame);
+    i420_frame.height = GST_VIDEO_FRAME_HEIGHT(&frame);
+    auto mixer_room = room_.lock();
+    if (mixer_room) {
+      ((VideoMixerRoom*)mixer_room.get())->OnDecodedFrame(stream_id(), i420_frame);
+    }
+    gst_video_frame_unmap(&frame);
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+  }
+
   void VideoMixerPluginImpl::UpdateVideoPosition(int x, int y,bool imediately) {
     VLOG(VLOG_LEVEL)<<"-----------------------UpdateVideoPosition-------------------";
     x_ = x;
     y_ = y;
+    if (FLAGS_video_mixer_native_compositor) {
+      auto mixer_room = room_.lock();
+      if (mixer_room) {
+        ((VideoMixerRoom*)mixer_room.get())->SetTile(stream_id(), x, y);
+      }
+      return;
+    }
     if(app_src_ != NULL && sink_pad_ != NULL){
       g_object_set(G_OBJECT(sink_pad_), "xpos", x, "ypos", y, NULL);
     } else {
@@ -386,8 +447,13 @@ using namespace std;
     
     gst_element_set_state (queue_, GST_STATE_NULL);
     gst_bin_remove (bin, queue_);
-    GstElement* video_mixer = room->GetVideoMixer();
-    gst_element_remove_pad(video_mixer, sink_pad_);
+    if (frame_sink_ != NULL) {
+      gst_element_set_state (frame_sink_, GST_STATE_NULL);
+      gst_bin_remove (bin, frame_sink_);
+    } else {
+      GstElement* video_mixer = room->GetVideoMixer();
+      gst_element_remove_pad(video_mixer, sink_pad_);
+    }
     //  gst_object_unref(sink_pad_);
     room->OnPluginRemoved(stream_id());
 
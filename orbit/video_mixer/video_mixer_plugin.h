@@ -108,6 +108,9 @@ class VideoMixerPluginImpl :public VideoMixerPlugin {
     return app_src_;
   }
   std::shared_ptr<dataPacket> PopVideoPacket();
+  // Called on the streaming thread of the frame_sink_ for each decoded
+  // frame, with the native compositor.
+  GstFlowReturn OnDecodedSample();
  private:
   GstElement *app_src_ = NULL;
   GstElement *rtp_vp8_depay_ = NULL;
@@ -115,6 +118,9 @@ class VideoMixerPluginImpl :public VideoMixerPlugin {
   GstElement *jitter_buffer_ = NULL;
   GstElement *queue_ = NULL;
   GstElement *video_rate_ = NULL;
+  // Takes the decoded frames instead of the video mixer pad, with the native
+  // compositor.
+  GstElement *frame_sink_ = NULL;
 
   GstPad *sink_pad_ = NULL;
 
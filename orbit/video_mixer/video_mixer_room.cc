@@ -7,7 +7,7 @@
 #include <gst/app/gstappsrc.h>
 #include <gst/app/gstappsink.h>
 #include <glib-2.0/glib.h>
-#include <sys/prctl.h>
+#include <unistd.h>
 
 #include "stream_service/orbit/video_mixer/video_mixer_plugin.h"
 #include "stream_service/orbit/video_mixer/video_mixer_room.h"
@@ -19,6 +19,7 @@
 #include "stream_service/orbit/audio_processing/audio_energy.h"
 #include "stream_service/orbit/rtp/rtp_packet_queue.h"
 #include "stream_service/orbit/rtp/rtp_headers.h"
+#include "stream_service/orbit/base/timeutil.h"
 
 #include "glog/logging.h"
 #include "gflags/gflags.h"
@@ -30,6 +31,11 @@ DEFINE_int32(mtu, 1100,
              "If set, it will change mixer rtp packet size.");
 DEFINE_bool(video_mixer_use_record_stream, false,
             "If set, it will have the recording stream function to enable.");
+DEFINE_bool(video_mixer_native_compositor, false,
+            "If set, the decoded frames are composed by the I420Compositor "
+            "instead of the compositor element.");
+DEFINE_int32(video_mixer_fps, 15,
+             "The frame rate of the mixed video with the native compositor.");
 DECLARE_bool(save_dot_file);
 
 namespace orbit {
@@ -72,11 +78,17 @@ namespace {
     }
     return flag_mtu;
   }
+
+  static GstFlowReturn on_new_sample(GstAppSink* app_sink, gpointer room) {
+    return reinterpret_cast<VideoMixerRoom*>(room)->OnNewSample();
+  }
 }  // Annoymous namespace
 
   void VideoMixerRoom::Start() {
     running_ = true;
-    pull_sink_thread_.reset(new boost::thread(boost::bind(&VideoMixerRoom::PullAppSinkData, this)));
+    if (compositor_) {
+      compose_thread_.reset(new boost::thread(boost::bind(&VideoMixerRoom::ComposeLoop, this)));
+    }
 
     if (FLAGS_video_mixer_use_record_stream) {
       SetupRecordStream();
@@ -138,22 +150,29 @@ namespace {
     gst_pipeline_use_clock(GST_PIPELINE(pipeline_), clock);
 
     app_sink_ = gst_element_factory_make("appsink","app_sink");
-    caps_filter_ = gst_element_factory_make("capsfilter","Caps");
-    g_object_set (app_sink_, "emit-signals", TRUE, NULL);
     gst_app_sink_set_max_buffers((GstAppSink*)app_sink_, 1);
-    gst_app_sink_set_emit_signals((GstAppSink*)app_sink_, true);
     g_object_set(GST_OBJECT(app_sink_),"drop",false,"async",false,"sync",false, "blocksize",1400,NULL);
 
-//    g_signal_connect( G_OBJECT(_sink), "new-buffer", G_CALLBACK(onNewBuffer), this);
-
-//    GstAppSinkCallbacks* appsink_callbacks = (GstAppSinkCallbacks*)malloc(sizeof(GstAppSinkCallbacks));
-//    appsink_callbacks->eos = NULL;
-//    appsink_callbacks->new_preroll = on_new_sample;
-//    appsink_callbacks->new_sample = on_new_sample;
-//    gst_app_sink_set_callbacks(GST_APP_SINK(app_sink_), appsink_callbacks, this, NULL);
-
-    video_mixer_ = gst_element_factory_make("compositor","video_mixer");
-    g_object_set(GST_OBJECT(video_mixer_), "background" , 1, "latency", 1000,"start-time-selection",0,NULL);
+    // The packets are relayed on the streaming thread of the appsink, with
+    // the callbacks set the appsink doesn't emit the signals.
+    GstAppSinkCallbacks appsink_callbacks = {};
+    appsink_callbacks.new_sample = on_new_sample;
+    gst_app_sink_set_callbacks(GST_APP_SINK(app_sink_), &appsink_callbacks, this, NULL);
+
+    if (FLAGS_video_mixer_native_compositor) {
+      compositor_.reset(new I420Compositor());
+      // The caps are set by ComposeLoop() with the size of the canvas.
+      video_src_ = gst_element_factory_make("appsrc", "mixed_video_src");
+      g_object_set(G_OBJECT(video_src_),
+                   "stream-type", 0,
+                   "format", GST_FORMAT_TIME,
+                   "do-timestamp", true,
+                   "is-live", true, NULL);
+    } else {
+      video_mixer_ = gst_element_factory_make("compositor","video_mixer");
+      g_object_set(GST_OBJECT(video_mixer_), "background" , 1, "latency", 1000,"start-time-selection",0,NULL);
+      caps_filter_ = gst_element_factory_make("capsfilter","Caps");
+    }
     tee_ = gst_element_factory_make("tee","tee");
     vp8enc_ = gst_element_factory_make("vp8enc","vp8enc");
 
@@ -175,11 +194,13 @@ namespace {
         NULL);
     rtp_pay_ = gst_element_factory_make("rtpvp8pay","vp8_pay");
     g_object_set(GST_OBJECT(rtp_pay_), "ssrc" , 55543, "pt", 100, "mtu", GetMtu(), NULL);
-    gst_bin_add_many(GST_BIN(pipeline_),video_mixer_, caps_filter_,tee_, vp8enc_, rtp_pay_, app_sink_, NULL);
-    gst_element_link_many(video_mixer_, caps_filter_, tee_,vp8enc_ ,rtp_pay_, app_sink_,NULL);
-    VLOG(VLOG_LEVEL)<<"VideoMixer :: Start app sink thread";
-
-    VLOG(VLOG_LEVEL)<<"VideoMixer :: Start app sink thread succeed";
+    if (compositor_) {
+      gst_bin_add_many(GST_BIN(pipeline_), video_src_, tee_, vp8enc_, rtp_pay_, app_sink_, NULL);
+      gst_element_link_many(video_src_, tee_, vp8enc_, rtp_pay_, app_sink_, NULL);
+    } else {
+      gst_bin_add_many(GST_BIN(pipeline_),video_mixer_, caps_filter_,tee_, vp8enc_, rtp_pay_, app_sink_, NULL);
+      gst_element_link_many(video_mixer_, caps_filter_, tee_,vp8enc_ ,rtp_pay_, app_sink_,NULL);
+    }
     GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline_));
     gst_bus_add_signal_watch(bus);
     g_signal_connect(bus, "message", G_CALLBACK (video_mixer_bus_message), this);
@@ -192,12 +213,69 @@ namespace {
   }
 
   void VideoMixerRoom::SyncElements() {
-    gst_element_sync_state_with_parent(video_mixer_);
+    if (compositor_) {
+      gst_element_sync_state_with_parent(video_src_);
+    } else {
+      gst_element_sync_state_with_parent(video_mixer_);
+      gst_element_sync_state_with_parent(caps_filter_);
+    }
     gst_element_sync_state_with_parent(tee_);
     gst_element_sync_state_with_parent(vp8enc_);
     gst_element_sync_state_with_parent(rtp_pay_);
     gst_element_sync_state_with_parent(app_sink_);
-    gst_element_sync_state_with_parent(caps_filter_);
+  }
+
+  void VideoMixerRoom::SetTile(int stream_id, int x, int y) {
+    if (compositor_) {
+      compositor_->SetTile(stream_id, x, y, FLAGS_video_width, FLAGS_video_height);
+    }
+  }
+
+  void VideoMixerRoom::OnDecodedFrame(int stream_id, const I420Frame& frame) {
+    if (compositor_ && running_) {
+      compositor_->UpdateFrame(stream_id, frame);
+    }
+  }
+
+  void VideoMixerRoom::ComposeLoop() {
+    int width = 0;
+    int height = 0;
+    const long long interval_us = 1000000 / FLAGS_video_mixer_fps;
+    long long next_us = GetCurrentTime_US();
+    while (running_) {
+      next_us += interval_us;
+      long long now_us = GetCurrentTime_US();
+      if (next_us > now_us) {
+        usleep(next_us - now_us);
+      } else {
+        // Too late, don't try to catch up.
+        next_us = now_us;
+      }
+      compositor_->Compose();
+      const I420Buffer& canvas = compositor_->canvas();
+      if (canvas.size() == 0) {
+        continue;
+      }
+      if (canvas.width() != width || canvas.height() != height) {
+        width = canvas.width();
+        height = canvas.height();
+        GstCaps* caps = gst_caps_new_simple("video/x-raw",
+            "format", G_TYPE_STRING, "I420",
+            "width", G_TYPE_INT, width,
+            "height", G_TYPE_INT, height,
+            "framerate", GST_TYPE_FRACTION, FLAGS_video_mixer_fps, 1, NULL);
+        g_object_set(G_OBJECT(video_src_), "caps", caps, NULL);
+        gst_caps_unref(caps);
+      }
+      // The canvas is drawn again on the next tick, so the encoder gets a
+      // copy.
+      GstBuffer* buffer = gst_buffer_new_allocate(NULL, canvas.size(), NULL);
+      gst_buffer_fill(buffer, 0, canvas.data(), canvas.size());
+      GstFlowReturn ret = gst_app_src_push_buffer(GST_APP_SRC(video_src_), buffer);
+      if (ret != GST_FLOW_OK) {
+        VLOG(3) << "Push the mixed video frame failed: " << ret;
+      }
+    }
   }
 
   void VideoMixerRoom::AddParticipant(TransportPlugin* plugin) {
@@ -206,11 +284,7 @@ namespace {
     Room::AddParticipant(plugin);
     position_manager_->AddStream((VideoMixerPluginImpl*)plugin);
     Rect rect = position_manager_->GetOutVideoSize();
-    VLOG(2)<<"SetCaps: width = "<<rect.width<<" height="<<rect.height;
-    GstCaps *caps = gst_caps_new_simple("video/x-raw", "media", G_TYPE_STRING, "video", "width",G_TYPE_INT,rect.width,
-                                        "height", G_TYPE_INT, rect.height, NULL);
-    g_object_set(G_OBJECT(caps_filter_), "caps", caps, NULL);
-    gst_caps_unref(caps);
+    SetOutVideoSize(rect);
     position_manager_->UpdateVideoPosition();
     if(FLAGS_save_dot_file) {
     GST_DEBUG_BIN_TO_DOT_FILE_WITH_TS (GST_BIN (pipeline_), GST_DEBUG_GRAPH_SHOW_VERBOSE, "addparticipent");
@@ -230,6 +304,9 @@ namespace {
       boost::mutex::scoped_lock lock(room_plugin_mutex_);
       Room::RemoveParticipant(plugin);
     }
+    if (compositor_) {
+      compositor_->RemoveTile(mixer_plugin->stream_id());
+    }
     position_manager_->RemoveStream((VideoMixerPluginImpl*)plugin);
     mixer_plugin->UnlinkElements();
     if(FLAGS_save_dot_file) {
@@ -237,92 +314,65 @@ namespace {
     }
     return true;
   }
-  void VideoMixerRoom::PullAppSinkData() {
-    /* Set thread name */
-    prctl(PR_SET_NAME, (unsigned long)"PullAppSinkData");
-
-    GstSample *sample;
-    GstBuffer*buffer;
+  GstFlowReturn VideoMixerRoom::OnNewSample() {
+    GstSample* sample = gst_app_sink_pull_sample(GST_APP_SINK(app_sink_));
+    if (sample == NULL) {
+      return GST_FLOW_EOS;
+    }
+    if (!running_) {
+      VLOG(2)<<"Receive sample after the room is destroyed";
+      gst_sample_unref(sample);
+      return GST_FLOW_EOS;
+    }
+    GstBuffer* buffer = gst_sample_get_buffer(sample);
     GstMapInfo info;
-    guint size;
-    uint32_t time_offset;
-    uint32_t seq_offset;
-//    while(!gst_app_sink_is_eos(GST_APP_SINK(app_sink_))){
-    while(running_){
-      g_signal_emit_by_name (app_sink_, "pull-sample", &sample, NULL);
-      if(!running_){
-        VLOG(2)<<"Receive eos from running";
-        return;
-      }
-      if (sample) {
-        buffer = gst_sample_get_buffer (sample);
-        if (buffer == NULL) {
-          gst_sample_unref (sample);
-          LOG(ERROR) << "No buffer got from sample : GST_FLOW_ERROR";
-          usleep(2000);
-          continue;
-        }
-        if (!gst_buffer_map (buffer, &info, GST_MAP_READ)) {
-          gst_sample_unref (sample);
-          LOG(ERROR) << "Can not read buffer : GST_FLOW_ERROR";
-          usleep(2000);
-          continue;
-        }
-        size = info.size;
-        int i = 0;
-        for (auto _p : plugins_) {
-          g_object_get(G_OBJECT(rtp_pay_),"seqnum",&seq_offset,"timestamp",&time_offset,NULL);
-          VideoMixerPluginImpl* plugin = reinterpret_cast<VideoMixerPluginImpl*>(_p);
-          VLOG(2)<<"\n-------------- length is "<<size
-              <<" TimeStamp is "<<time_offset
-              <<" SeqOffset is "<<seq_offset;
-          dataPacket p;
-          p.comp = 0;
-          p.type = VIDEO_PACKET;
-          memcpy(&(p.data[0]), info.data, size);
-          p.length = size;
-          plugin->RelayRtpPacket(p);
-
-          if(i==0 && stream_recorder_element_) {
-            const RtpHeader* h = reinterpret_cast<const RtpHeader*>(info.data);
-            std::shared_ptr<MediaOutputPacket> webcast_pkt = std::make_shared<MediaOutputPacket>();
-            webcast_pkt->timestamp = h->getTimestamp();
-            webcast_pkt->seq_number = h->getSeqNumber();
-            webcast_pkt->end_frame = h->getMarker();
-            webcast_pkt->ssrc = h->getSSRC();
-            unsigned char* tmp_buf = (unsigned char*)malloc(size-12);
-
-            const unsigned char* data_buf = reinterpret_cast<const unsigned char*>(&(info.data[0]));
-
-            memcpy(tmp_buf, data_buf+12, size-12);
-            webcast_pkt->encoded_buf = tmp_buf;
-            webcast_pkt->length = size-12;
-            stream_recorder_element_->RelayMediaOutputPacket(webcast_pkt, VIDEO_PACKET);
-          }
-          i++;
-        }
-        gst_buffer_unmap (buffer, &info);
-        gst_sample_unref (sample);
-      } else {
-        usleep(2000);
-        continue;
+    if (buffer == NULL || !gst_buffer_map(buffer, &info, GST_MAP_READ)) {
+      gst_sample_unref(sample);
+      LOG(ERROR) << "Can not read buffer from sample";
+      return GST_FLOW_OK;
+    }
+    // The only copy of the packet, which is shared by all the plugins and
+    // the recorder.
+    PacketBufferPtr packet =
+        PacketBuffer::Create(reinterpret_cast<const char*>(info.data), info.size);
+    gst_buffer_unmap(buffer, &info);
+    gst_sample_unref(sample);
+    if (packet == NULL) {
+      LOG(ERROR) << "Mixed video packet is too large, size=" << info.size;
+      return GST_FLOW_OK;
+    }
+    packet->type = VIDEO_PACKET;
+    if (VLOG_IS_ON(3)) {
+      const RtpHeader* h = reinterpret_cast<const RtpHeader*>(packet->data());
+      VLOG(3) << "Mixed video packet length=" << packet->length()
+              << " seq=" << h->getSeqNumber()
+              << " timestamp=" << h->getTimestamp();
+    }
+
+    {
+      boost::mutex::scoped_lock lock(room_plugin_mutex_);
+      for (auto plugin : plugins_) {
+        plugin->RelayRtpBuffer(packet);
       }
     }
-    VLOG(VLOG_LEVEL)<<"Found it stoped!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!";
+    if (stream_recorder_element_) {
+      stream_recorder_element_->PushVideoBuffer(packet);
+    }
+    return GST_FLOW_OK;
   }
 
   void VideoMixerRoom::Destroy() {
     LOG(INFO)<<"Destroy room "<<running_;
     running_ = false;
     LOG(INFO)<<"Destroy room ";
+    if (compose_thread_.get() != NULL) {
+      compose_thread_->join();
+    }
+    // EOS is serialized with the data flow, once it's sent the callback in
+    // progress (if any) is done, and the later ones drop the samples.
     GstPad* sinkpad = gst_element_get_static_pad (app_sink_, "sink");
     gst_pad_send_event (sinkpad, gst_event_new_eos ());
     gst_object_unref(sinkpad);
-    if (pull_sink_thread_.get()!=NULL) {
-      VLOG(3) << "Joining Pull_sink thread";
-      pull_sink_thread_->join();
-      VLOG(3) << "Thread terminated on destructor";
-    }
     if(position_manager_ != NULL){
       delete position_manager_;
     }
@@ -351,12 +401,20 @@ namespace {
       return;
     }
     Rect rect = position_manager_->GetOutVideoSize();
+    SetOutVideoSize(rect);
+    position_manager_->UpdateVideoPosition();
+  }
+
+  void VideoMixerRoom::SetOutVideoSize(const Rect& rect) {
     VLOG(2)<<"SetCaps: width = "<<rect.width<<" height="<<rect.height;
+    if (compositor_) {
+      compositor_->SetCanvasSize(rect.width, rect.height);
+      return;
+    }
     GstCaps *caps = gst_caps_new_simple("video/x-raw", "media", G_TYPE_STRING, "video", "width",G_TYPE_INT,rect.width,
                                         "height", G_TYPE_INT, rect.height, NULL);
     g_object_set(G_OBJECT(caps_filter_), "caps", caps, NULL);
     gst_caps_unref(caps);
-    position_manager_->UpdateVideoPosition();
   }
 
   void VideoMixerRoom::IncomingRtpPacket(const int stream_id, const dataPacket& packet) {
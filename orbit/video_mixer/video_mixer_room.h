@@ -8,6 +8,10 @@
  *|----------------------------------------------------------|------------------------------|
  *                         VideoMixerPlugin                          VideoMixerRoom
  ***************************************************************************************
+ * With --video_mixer_native_compositor, the decoded frames go to an AppSink
+ * instead of the VideoMixer, and are composed by the I420Compositor:
+ * ...-->Vp8Dec-->AppSink ==> I420Compositor ==> AppSrc-->Tee-->Vp8Enc-->...
+ ***************************************************************************************
  *  Created on: Mar 4, 2016
  *      Author: vellee
  */
@@ -16,9 +20,11 @@
 #define VIDEO_MIXER_INCLUDE_VIDEO_MIXER_ROOM_H_
 
 #include "stream_service/orbit/transport_plugin.h"
+#include "stream_service/orbit/packet_buffer.h"
 #include "stream_service/orbit/rtp/rtp_packet_queue.h"
 #include "stream_service/orbit/rtp/rtp_headers.h"
 #include "stream_service/orbit/modules/media_packet.h"
+#include <atomic>
 #include <vector>
 
 // Live stream and recorder element
@@ -27,6 +33,7 @@
 
 #include "video_mixer_plugin.h"
 #include "video_mixer_room.h"
+#include "i420_compositor.h"
 #include "video_mixer_position.h"
 #include "video_mixer_position_manager.h"
 #include "stream_service/orbit/video_mixer/position_update_listener.h"
@@ -51,7 +58,13 @@ class VideoMixerRoom : public Room,
 
     void Create() override { };
     void SyncElements();
-    void PullAppSinkData();
+    // Called on the streaming thread of the appsink for each RTP packet of
+    // the mixed video, relays it to all the plugins and the recorder.
+    GstFlowReturn OnNewSample();
+    // Pushes the composed canvas to the encoder at the frame rate.
+    void ComposeLoop();
+    // Sets the size of the mixed video.
+    void SetOutVideoSize(const Rect& rect);
     int GetVideoCount(){ return plugins_.size(); };
     void Destroy() override;
     void Start() override;
@@ -65,6 +78,10 @@ class VideoMixerRoom : public Room,
     GstElement* GetAppSink(){ return app_sink_; }
     GstElement* GetMixerPipeline(){ return pipeline_; }
     GstElement* GetVideoMixer(){ return video_mixer_; }
+    // For the native compositor: places the tile of the stream, and composes
+    // its decoded frame, called on the streaming thread of the stream.
+    void SetTile(int stream_id, int x, int y);
+    void OnDecodedFrame(int stream_id, const I420Frame& frame);
     void OnPacketLoss(int stream_id, int percent);
     bool MuteStream(const int stream_id,const bool mute);
     void OnAudioMixed(const char* outBuffer, int size);
@@ -85,7 +102,11 @@ class VideoMixerRoom : public Room,
     GstElement* voaacenc = NULL;
     GstElement* vp8enc_ = NULL;
     GstElement* rtp_pay_ = NULL;
-    boost::scoped_ptr<boost::thread> pull_sink_thread_;
+    // Used instead of the video_mixer_ and caps_filter_ with the native
+    // compositor.
+    std::unique_ptr<I420Compositor> compositor_;
+    GstElement* video_src_ = NULL;
+    boost::scoped_ptr<boost::thread> compose_thread_;
     GstElement* tee_ = NULL;
 
     //Live stream element
@@ -95,7 +116,7 @@ class VideoMixerRoom : public Room,
     VideoMixerPositionManager *position_manager_ = NULL;
     std::unique_ptr<AbstractAudioMixerElement> audio_mixer_element_ = NULL;
 
-    bool running_;
+    std::atomic<bool> running_;
     int sampling_rate_;
 
   };